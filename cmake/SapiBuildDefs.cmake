@@ -67,6 +67,8 @@ endmacro()
 # NOEMBED Whether the SAPI library should be embedded inside host code, so the
 #   SAPI Sandbox can be initialized with the
 #   ::sapi::Sandbox::Sandbox(FileToc*) constructor.
+# DIRECT_CALLS Whether to also generate a dispatch table for the sandboxee, so
+#   that calls do not go through libffi.
 # LIBRARY The library target to sandbox and expose to the host code (required).
 # LIBRARY_NAME The name of the class which will proxy the library functions
 #   from the functions list (required). You will call functions from the
@@ -79,7 +81,7 @@ endmacro()
 # HEADER If set, does not generate an interface header, but uses the one
 #   specified.
 function(add_sapi_library)
-  set(_sapi_opts NOEMBED)
+  set(_sapi_opts NOEMBED DIRECT_CALLS)
   set(_sapi_one_value HEADER LIBRARY LIBRARY_NAME NAMESPACE)
   set(_sapi_multi_value SOURCES FUNCTIONS INPUTS)
   cmake_parse_arguments(_sapi
@@ -90,6 +92,10 @@ function(add_sapi_library)
   set(_sapi_NAME "${ARGV0}")
 
   set(_sapi_gen_header "${_sapi_NAME}.sapi.h")
+  if(_sapi_DIRECT_CALLS)
+    set(_sapi_gen_dispatch "${_sapi_NAME}.dispatch.cc")
+    set(_sapi_dispatch_arg "--sapi_dispatch_out=${_sapi_gen_dispatch}")
+  endif()
   foreach(func IN LISTS _sapi_FUNCTIONS)
     list(APPEND _sapi_exported_funcs "-Wl,--export-dynamic-symbol,${func}")
   endforeach()
@@ -103,12 +109,16 @@ function(add_sapi_library)
   set(_sapi_force_cxx_linkage
     "${CMAKE_CURRENT_BINARY_DIR}/${_sapi_bin}_force_cxx_linkage.cc")
   file(WRITE "${_sapi_force_cxx_linkage}" "")
-  add_executable("${_sapi_bin}" "${_sapi_force_cxx_linkage}")
+  add_executable("${_sapi_bin}"
+    "${_sapi_force_cxx_linkage}"
+    ${_sapi_gen_dispatch}
+  )
   # TODO(cblichmann): Use target_link_options on CMake >= 3.13
   target_link_libraries("${_sapi_bin}" PRIVATE
     -fuse-ld=gold
     "${_sapi_LIBRARY}"
     sapi::client
+    sapi::direct_call
     ${CMAKE_DL_LIBS}
     -Wl,-E
     ${_sapi_exported_funcs}
@@ -134,10 +144,11 @@ function(add_sapi_library)
   endif()
   if(SAPI_ENABLE_GENERATOR)
     add_custom_command(
-      OUTPUT "${_sapi_gen_header}"
+      OUTPUT "${_sapi_gen_header}" ${_sapi_gen_dispatch}
       COMMAND sapi_generator_tool
               "--sapi_name=${_sapi_LIBRARY_NAME}"
               "--sapi_out=${_sapi_gen_header}"
+              ${_sapi_dispatch_arg}
               "--sapi_embed_dir=${_sapi_embed_dir}"
               "--sapi_embed_name=${_sapi_embed_name}"
               "--sapi_functions=${_sapi_funcs}"
@@ -151,7 +162,7 @@ function(add_sapi_library)
     set(_sapi_isystem "${_sapi_NAME}.isystem")
     list(JOIN _sapi_full_inputs "," _sapi_full_inputs)
     add_custom_command(
-      OUTPUT "${_sapi_gen_header}" "${_sapi_isystem}"
+      OUTPUT "${_sapi_gen_header}" "${_sapi_isystem}" ${_sapi_gen_dispatch}
       COMMAND sh -c
               "${CMAKE_CXX_COMPILER} -E -x c++ -v /dev/null 2>&1 | \
                awk '/> search starts here:/{f=1;next}/^End of search/{f=0}f{print $1}' \
@@ -160,6 +171,7 @@ function(add_sapi_library)
               "${SAPI_SOURCE_DIR}/sandboxed_api/tools/generator2/sapi_generator.py"
               "--sapi_name=${_sapi_LIBRARY_NAME}"
               "--sapi_out=${_sapi_gen_header}"
+              ${_sapi_dispatch_arg}
               "--sapi_embed_dir=${_sapi_embed_dir}"
               "--sapi_embed_name=${_sapi_embed_name}"
               "--sapi_functions=${_sapi_funcs}"
@@ -45,6 +45,10 @@ def sapi_interface_impl(ctx):
     args = []
     append_arg(args, "--sapi_name", ctx.attr.lib_name)
     append_arg(args, "--sapi_out", ctx.outputs.out.path)
+    outputs = [ctx.outputs.out]
+    if ctx.outputs.dispatch_out:
+        append_arg(args, "--sapi_dispatch_out", ctx.outputs.dispatch_out.path)
+        outputs.append(ctx.outputs.dispatch_out)
     append_arg(args, "--sapi_embed_dir", ctx.attr.embed_dir)
     append_arg(args, "--sapi_embed_name", ctx.attr.embed_name)
     append_arg(args, "--sapi_functions", ",".join(ctx.attr.functions))
@@ -109,7 +113,7 @@ def sapi_interface_impl(ctx):
                     "").format(ctx.outputs.out.short_path, len(input_files_paths))
     ctx.actions.run(
         inputs = input_files,
-        outputs = [ctx.outputs.out],
+        outputs = outputs,
         arguments = args,
         progress_message = progress_msg,
         executable = ctx.executable._sapi_generator,
@@ -120,6 +124,7 @@ sapi_interface = rule(
     implementation = sapi_interface_impl,
     attrs = {
         "out": attr.output(mandatory = True),
+        "dispatch_out": attr.output(),
         "embed_dir": attr.string(),
         "embed_name": attr.string(),
         "functions": attr.string_list(allow_empty = True, default = []),
@@ -147,6 +152,7 @@ def sapi_library(
         namespace = "",
         embed = True,
         add_default_deps = True,
+        direct_calls = False,
         srcs = [],
         hdrs = [],
         functions = [],
@@ -155,7 +161,11 @@ def sapi_library(
         deps = [],
         tags = [],
         visibility = None):
-    """Provides the implementation of a Sandboxed API library."""
+    """Provides the implementation of a Sandboxed API library.
+
+    If direct_calls is set, the generator also emits a dispatch table that is
+    linked into the sandboxee, so that calls do not go through libffi.
+    """
 
     rprefix = "@com_google_sandboxed_api"
     common = {
@@ -165,6 +175,7 @@ def sapi_library(
         common["visibility"] = visibility
 
     generated_header = name + ".sapi.h"
+    generated_dispatch = name + ".dispatch.cc" if direct_calls else None
 
     # Reference (pull into the archive) required functions only. If the functions'
     # array is empty, pull in the whole archive (may not compile with MSAN).
@@ -203,6 +214,7 @@ def sapi_library(
 
     native.cc_binary(
         name = name + ".bin",
+        srcs = [generated_dispatch] if direct_calls else [],
         linkopts = [
             "-ldl",  # For dlopen(), dlsym()
             # The sandboxing client must have access to all symbols used in
@@ -213,7 +225,7 @@ def sapi_library(
         deps = [
             ":" + name + ".lib",
             rprefix + "//sandboxed_api:client",
-        ],
+        ] + ([rprefix + "//sandboxed_api:direct_call"] if direct_calls else []),
         **common
     )
 
@@ -244,6 +256,7 @@ def sapi_library(
         functions = functions,
         input_files = input_files,
         out = generated_header,
+        dispatch_out = generated_dispatch,
         embed_name = embed_name,
         embed_dir = embed_dir,
         namespace = namespace,
@@ -15,6 +15,7 @@
 #ifndef SANDBOXED_API_CALL_H_
 #define SANDBOXED_API_CALL_H_
 
+#include <cstddef>
 #include <cstdint>
 
 #include "sandboxed_api/var_type.h"
@@ -27,6 +28,11 @@ struct ReallocRequest {
   size_t size;
 };
 
+struct UnmapRequest {
+  uintptr_t addr;
+  size_t size;
+};
+
 // Types of TAGs used with Comms channel.
 // Call:
 constexpr uint32_t kMsgCall = 0x101;
@@ -39,6 +45,13 @@ constexpr uint32_t kMsgRecvFd = 0x107;
 constexpr uint32_t kMsgClose = 0x108;
 constexpr uint32_t kMsgReallocate = 0x109;
 constexpr uint32_t kMsgStrlen = 0x10A;
+constexpr uint32_t kMsgShmEnable = 0x10B;
+constexpr uint32_t kMsgSnapshotReset = 0x10C;
+constexpr uint32_t kMsgSnapshotFork = 0x10D;
+constexpr uint32_t kMsgMapFd = 0x10E;
+constexpr uint32_t kMsgUnmap = 0x10F;
+constexpr uint32_t kMsgCallBatch = 0x110;
+constexpr uint32_t kMsgResolve = 0x111;
 // Return:
 constexpr uint32_t kMsgReturn = 0x201;
 
@@ -51,8 +64,9 @@ struct FuncCall {
     kArgsMax = 12,
   };
 
-  // Function to be called.
-  char func[kFuncNameMax];
+  // Index of the function to be called, as returned for kMsgResolve, or -1 to
+  // look it up by name.
+  int32_t func_index;
   // Return type.
   v::Type ret_type;
   // Size of the return value (in bytes).
@@ -74,6 +88,31 @@ struct FuncCall {
   v::Type aux_type[kArgsMax];
   // Size of the auxiliary data (e.g. a structure the pointer points to).
   size_t aux_size[kArgsMax];
+  // Function to be called. Not sent for calls addressed by index, see
+  // kIndexedFuncCallSize.
+  char func[kFuncNameMax];
+};
+
+// Size of a kMsgCall message for a call addressed by index, which is sent
+// without the function name.
+constexpr size_t kIndexedFuncCallSize = offsetof(FuncCall, func);
+
+// Reply to kMsgResolve, one for each function name of the request.
+struct ResolvedFunc {
+  // Index to use in FuncCall::func_index, or -1 if the function was not
+  // found.
+  int32_t index;
+  // Address of the function.
+  uintptr_t addr;
+};
+
+// One call of a kMsgCallBatch message, which consists of an array of these.
+struct BatchedFuncCall {
+  FuncCall call;
+  // For every argument, the index of an earlier call of the batch whose
+  // (integer or pointer) return value is passed instead of call.args[i], or
+  // -1 to pass call.args[i].
+  int32_t arg_from_call[FuncCall::kArgsMax];
 };
 
 struct FuncRet {
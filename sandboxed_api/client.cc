@@ -15,11 +15,17 @@
 #include "sandboxed_api/sandbox2/client.h"
 
 #include <dlfcn.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <atomic>
 #include <cstring>
 #include <iterator>
 #include <list>
+#include <new>
+#include <string>
 #include <vector>
 
 #include <glog/logging.h>
@@ -28,10 +34,13 @@
 #include "sandboxed_api/util/flag.h"
 #include "absl/strings/str_cat.h"
 #include "sandboxed_api/call.h"
+#include "sandboxed_api/direct_call.h"
 #include "sandboxed_api/lenval_core.h"
 #include "sandboxed_api/proto_arg.pb.h"
 #include "sandboxed_api/sandbox2/comms.h"
 #include "sandboxed_api/sandbox2/forkingclient.h"
+#include "sandboxed_api/sandbox2/util.h"
+#include "sandboxed_api/shm_ring.h"
 #include "sandboxed_api/vars.h"
 
 #ifdef MEMORY_SANITIZER
@@ -41,6 +50,12 @@
 #include <ffi.h>
 #include <ffitarget.h>
 
+ABSL_FLAG(bool, sapi_shm_transport, false,
+          "Prepare the shared-memory call ring before enabling sandboxing");
+ABSL_FLAG(bool, sapi_snapshot_template, false,
+          "Keep the initial process as a template and serve requests from "
+          "forked copies of it");
+
 namespace sapi {
 namespace {
 
@@ -121,19 +136,19 @@ class FunctionCallPreparer {
       LenValStruct* lvs = idx_proto.first;
       // There is no way to figure out whether the protobuf structure has
       // changed or not, so we always serialize the protobuf again and replace
-      // the LenValStruct content.
-      std::vector<uint8_t> serialized = SerializeProto(*proto).value();
-      // Reallocate the LV memory to match its length.
-      if (lvs->size != serialized.size()) {
-        void* newdata = realloc(lvs->data, serialized.size());
+      // the LenValStruct content. The protobuf is serialized directly into the
+      // LV memory, after reallocating it to match the new length.
+      const size_t size = GetSerializedProtoSize(*proto).value();
+      if (lvs->size != size) {
+        void* newdata = realloc(lvs->data, size);
         if (!newdata) {
-          LOG(FATAL) << "Failed to reallocate protobuf buffer (size="
-                     << serialized.size() << ")";
+          LOG(FATAL) << "Failed to reallocate protobuf buffer (size=" << size
+                     << ")";
         }
-        lvs->size = serialized.size();
+        lvs->size = size;
         lvs->data = newdata;
       }
-      memcpy(lvs->data, serialized.data(), serialized.size());
+      SerializeProtoToArray(*proto, static_cast<uint8_t*>(lvs->data));
 
       delete proto;
     }
@@ -146,22 +161,24 @@ class FunctionCallPreparer {
  private:
   // Deserializes the protobuf argument.
   google::protobuf::Message** GetDeserializedProto(LenValStruct* src) {
-    ProtoArg proto_arg;
-    if (!proto_arg.ParseFromArray(src->data, src->size)) {
+    // Parse the message in place, without copying it out of the envelope.
+    absl::string_view full_name;
+    absl::string_view protobuf_data;
+    if (!ParseProtoArg(src->data, src->size, &full_name, &protobuf_data).ok()) {
       LOG(FATAL) << "Unable to parse ProtoArg.";
     }
     const google::protobuf::Descriptor* desc =
         google::protobuf::DescriptorPool::generated_pool()->FindMessageTypeByName(
-            proto_arg.full_name());
+            std::string(full_name));
     LOG_IF(FATAL, desc == nullptr) << "Unable to find the descriptor for '"
-                                   << proto_arg.full_name() << "'" << desc;
+                                   << full_name << "'" << desc;
     google::protobuf::Message* deserialized_proto =
         google::protobuf::MessageFactory::generated_factory()->GetPrototype(desc)->New();
     LOG_IF(FATAL, deserialized_proto == nullptr)
-        << "Unable to create deserialized proto for " << proto_arg.full_name();
-    if (!deserialized_proto->ParseFromString(proto_arg.protobuf_data())) {
-      LOG(FATAL) << "Unable to deserialized proto for "
-                 << proto_arg.full_name();
+        << "Unable to create deserialized proto for " << full_name;
+    if (!deserialized_proto->ParseFromArray(protobuf_data.data(),
+                                            protobuf_data.size())) {
+      LOG(FATAL) << "Unable to deserialized proto for " << full_name;
     }
     protos_to_be_destroyed_.push_back({src, deserialized_proto});
     return &protos_to_be_destroyed_.back().second;
@@ -188,28 +205,76 @@ enum class Error : uintptr_t {
   kCall,
 };
 
+// A function of the sandboxed library.
+struct ResolvedFunction {
+  void* fn = nullptr;
+  // Entry of the generated dispatch table, if there is one.
+  const DirectCallTarget* direct = nullptr;
+};
+
+// Functions resolved by kMsgResolve, which calls address by their index.
+std::vector<ResolvedFunction>* resolved_functions =
+    new std::vector<ResolvedFunction>();
+
+// Looks up a function of the sandboxed library by name.
+Error ResolveFunction(const char* name, ResolvedFunction* resolved) {
+  resolved->direct = FindDirectCall(name);
+  if (resolved->direct != nullptr) {
+    resolved->fn = resolved->direct->fn;
+    return Error::kUnset;
+  }
+
+  void* handle = dlopen(nullptr, RTLD_NOW);
+  if (handle == nullptr) {
+    LOG(ERROR) << "dlopen(nullptr, RTLD_NOW)";
+    return Error::kDlOpen;
+  }
+  resolved->fn = dlsym(handle, name);
+  if (resolved->fn == nullptr) {
+    LOG(ERROR) << "Function '" << name << "' not found";
+    return Error::kDlSym;
+  }
+  return Error::kUnset;
+}
+
 // Handles requests to make function calls.
 void HandleCallMsg(const FuncCall& call, FuncRet* ret) {
   VLOG(1) << "HandleMsgCall, func: '" << call.func
-          << "', # of args: " << call.argc;
+          << "', index: " << call.func_index << ", # of args: " << call.argc;
 
   ret->ret_type = call.ret_type;
 
-  void* handle = dlopen(nullptr, RTLD_NOW);
-  if (handle == nullptr) {
-    LOG(ERROR) << "dlopen(nullptr, RTLD_NOW)";
+  ResolvedFunction resolved;
+  if (call.func_index >= 0) {
+    if (static_cast<size_t>(call.func_index) >= resolved_functions->size()) {
+      LOG(ERROR) << "Function index " << call.func_index << " out of range";
+      ret->success = false;
+      ret->int_val = static_cast<uintptr_t>(Error::kDlSym);
+      return;
+    }
+    resolved = (*resolved_functions)[call.func_index];
+  } else if (Error error = ResolveFunction(call.func, &resolved);
+             error != Error::kUnset) {
     ret->success = false;
-    ret->int_val = static_cast<uintptr_t>(Error::kDlOpen);
+    ret->int_val = static_cast<uintptr_t>(error);
     return;
   }
 
-  auto f = dlsym(handle, call.func);
-  if (f == nullptr) {
-    LOG(ERROR) << "Function '" << call.func << "' not found";
-    ret->success = false;
-    ret->int_val = static_cast<uintptr_t>(Error::kDlSym);
+  // Use the generated dispatch table if there is one, which avoids preparing a
+  // libffi call interface every time.
+  const DirectCallTarget* direct = resolved.direct;
+  if (direct != nullptr && direct->argc == call.argc) {
+    FunctionCallPreparer arg_prep(call);
+    if (ret->ret_type == v::Type::kFloat) {
+      direct->thunk(direct->fn, arg_prep.arg_values(), &ret->float_val);
+    } else {
+      ret->int_val = 0;
+      direct->thunk(direct->fn, arg_prep.arg_values(), &ret->int_val);
+    }
+    ret->success = true;
     return;
   }
+
   FunctionCallPreparer arg_prep(call);
   ffi_cif cif;
   if (ffi_prep_cif(&cif, FFI_DEFAULT_ABI, call.argc, arg_prep.ret_type(),
@@ -220,14 +285,52 @@ void HandleCallMsg(const FuncCall& call, FuncRet* ret) {
   }
 
   if (ret->ret_type == v::Type::kFloat) {
-    ffi_call(&cif, FFI_FN(f), &ret->float_val, arg_prep.arg_values());
+    ffi_call(&cif, FFI_FN(resolved.fn), &ret->float_val,
+             arg_prep.arg_values());
   } else {
-    ffi_call(&cif, FFI_FN(f), &ret->int_val, arg_prep.arg_values());
+    ffi_call(&cif, FFI_FN(resolved.fn), &ret->int_val, arg_prep.arg_values());
   }
 
   ret->success = true;
 }
 
+// Handles requests to make a sequence of function calls. Stops at the first
+// failing call, and replies with the results of all calls made, in a single
+// message.
+void HandleCallBatchMsg(sandbox2::Comms* comms,
+                        const std::vector<uint8_t>& bytes) {
+  CHECK_EQ(bytes.size() % sizeof(BatchedFuncCall), 0);
+  const size_t count = bytes.size() / sizeof(BatchedFuncCall);
+  VLOG(1) << "HandleCallBatchMsg, # of calls: " << count;
+
+  std::vector<FuncRet> rets;
+  rets.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    BatchedFuncCall batched;
+    memcpy(&batched, bytes.data() + i * sizeof(BatchedFuncCall),
+           sizeof(BatchedFuncCall));
+    for (size_t arg = 0; arg < FuncCall::kArgsMax; ++arg) {
+      const int32_t from = batched.arg_from_call[arg];
+      if (from >= 0) {
+        CHECK_LT(from, i);
+        batched.call.args[arg].arg_int = rets[from].int_val;
+      }
+    }
+
+    FuncRet ret{};
+    ret.ret_type = v::Type::kVoid;
+    ret.int_val = static_cast<uintptr_t>(Error::kUnset);
+    ret.success = false;
+    HandleCallMsg(batched.call, &ret);
+    rets.push_back(ret);
+    if (!ret.success) {
+      break;
+    }
+  }
+  CHECK(comms->SendTLV(comms::kMsgReturn, rets.size() * sizeof(FuncRet),
+                       reinterpret_cast<uint8_t*>(rets.data())));
+}
+
 // Handles requests to allocate memory inside the sandboxee.
 void HandleAllocMsg(const size_t size, FuncRet* ret) {
   VLOG(1) << "HandleAllocMsg: size=" << size;
@@ -293,6 +396,33 @@ void HandleSymbolMsg(const char* symname, FuncRet* ret) {
   ret->success = true;
 }
 
+// Handles requests to look up functions, so that they can be called by index.
+// The request holds a sequence of null-terminated function names. Replies on
+// its own, with one ResolvedFunc per name.
+void HandleResolveMsg(sandbox2::Comms* comms,
+                      const std::vector<uint8_t>& bytes) {
+  CHECK(bytes.empty() || bytes.back() == '\0');
+  std::vector<ResolvedFunc> funcs;
+  for (size_t pos = 0; pos < bytes.size();) {
+    const char* name = reinterpret_cast<const char*>(bytes.data() + pos);
+    pos += strlen(name) + 1;
+
+    ResolvedFunc& func = funcs.emplace_back();
+    func.index = -1;
+    func.addr = 0;
+    ResolvedFunction resolved;
+    if (ResolveFunction(name, &resolved) == Error::kUnset) {
+      func.index = resolved_functions->size();
+      func.addr = reinterpret_cast<uintptr_t>(resolved.fn);
+      resolved_functions->push_back(resolved);
+    }
+    VLOG(1) << "HandleResolveMsg, func: '" << name
+            << "', index: " << func.index;
+  }
+  CHECK(comms->SendTLV(comms::kMsgReturn, funcs.size() * sizeof(ResolvedFunc),
+                       reinterpret_cast<uint8_t*>(funcs.data())));
+}
+
 // Handles requests to receive a file descriptor from sandboxer.
 void HandleSendFd(sandbox2::Comms* comms, FuncRet* ret) {
   ret->ret_type = v::Type::kInt;
@@ -328,12 +458,194 @@ void HandleCloseFd(sandbox2::Comms* comms, int fd_to_close, FuncRet* ret) {
   ret->success = true;
 }
 
+// Handles requests to map a file descriptor of the sandboxer, shared with it
+// (see v::SharedArray).
+void HandleMapFd(sandbox2::Comms* comms, size_t size, FuncRet* ret) {
+  ret->ret_type = v::Type::kPointer;
+  int fd = -1;
+  if (comms->RecvFD(&fd) == false) {
+    ret->success = false;
+    return;
+  }
+
+  void* addr =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, /*offset=*/0);
+  // The mapping keeps the memory alive.
+  close(fd);
+  if (addr == MAP_FAILED) {
+    PLOG(ERROR) << "HandleMapFd: mmap(size=" << size << ")";
+    ret->success = false;
+    return;
+  }
+  ret->int_val = reinterpret_cast<uintptr_t>(addr);
+  ret->success = true;
+}
+
+// Handles requests to unmap memory previously mapped by HandleMapFd().
+void HandleUnmap(uintptr_t addr, size_t size, FuncRet* ret) {
+  VLOG(1) << "HandleUnmap: munmap(0x" << absl::StrCat(absl::Hex(addr)) << ", "
+          << size << ")";
+  ret->ret_type = v::Type::kVoid;
+  ret->success = munmap(reinterpret_cast<void*>(addr), size) == 0;
+}
+
 void HandleStrlen(sandbox2::Comms* comms, const char* ptr, FuncRet* ret) {
   ret->ret_type = v::Type::kInt;
   ret->int_val = strlen(ptr);
   ret->success = true;
 }
 
+// Shared-memory call ring, mapped by PrepareShmRing() and used by the request
+// loop once the host has sent kMsgShmEnable.
+ShmRing* shm_ring = nullptr;
+bool shm_ring_enabled = false;
+
+// Creates and maps the memfd backing the shared-memory call ring. Must be
+// called before sandboxing is enabled. The memfd is kept open on
+// ShmRing::kSandboxeeFd until the host has retrieved it.
+void PrepareShmRing() {
+  int fd;
+  CHECK(sandbox2::util::CreateMemFd(&fd, "sapi_shm_ring"));
+  PCHECK(ftruncate(fd, sizeof(ShmRing)) == 0);
+  void* addr = mmap(nullptr, sizeof(ShmRing), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  PCHECK(addr != MAP_FAILED);
+  PCHECK(dup2(fd, ShmRing::kSandboxeeFd) != -1);
+  close(fd);
+  shm_ring = reinterpret_cast<ShmRing*>(addr);
+  shm_ring->magic = ShmRing::kMagic;
+}
+
+// Handles requests to switch function calls to the shared-memory ring.
+void HandleShmEnable(FuncRet* ret) {
+  ret->ret_type = v::Type::kVoid;
+  if (shm_ring == nullptr) {
+    LOG(ERROR) << "Shared memory ring not prepared (--sapi_shm_transport)";
+    ret->success = false;
+    return;
+  }
+  // The host has its own mapping now.
+  close(ShmRing::kSandboxeeFd);
+  shm_ring_enabled = true;
+  ret->success = true;
+}
+
+// Exit code of a snapshot worker which exited because of kMsgSnapshotReset.
+constexpr int kSnapshotResetExitCode = 0x5a;
+
+// Set by a snapshot worker while it serves a request, so that the template
+// knows whether the host awaits a reply when the worker dies. Mapped by
+// PrepareSnapshotTemplate() and shared between the template and its workers.
+std::atomic<bool>* snapshot_request_pending = nullptr;
+
+// Maps the flag shared with the snapshot workers. Must be called before
+// sandboxing is enabled.
+void PrepareSnapshotTemplate() {
+  void* addr = mmap(nullptr, sizeof(*snapshot_request_pending),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  PCHECK(addr != MAP_FAILED);
+  snapshot_request_pending = new (addr) std::atomic<bool>(false);
+}
+
+void SetSnapshotRequestPending(bool pending) {
+  if (snapshot_request_pending != nullptr) {
+    snapshot_request_pending->store(pending, std::memory_order_relaxed);
+  }
+}
+
+// Handles requests to discard the current snapshot worker. The reply tells the
+// host that the next request will be read by the template.
+void HandleSnapshotReset(sandbox2::Comms* comms, FuncRet* ret) {
+  ret->ret_type = v::Type::kVoid;
+  ret->success = true;
+  CHECK(comms->SendTLV(comms::kMsgReturn, sizeof(*ret),
+                       reinterpret_cast<uint8_t*>(ret)));
+  syscall(__NR_exit_group, kSnapshotResetExitCode);
+}
+
+// Waits for the snapshot worker 'pid' to exit. If it crashed while serving a
+// request, answers the request on its behalf.
+void WaitForSnapshotWorker(sandbox2::Comms* comms, pid_t pid) {
+  int status;
+  PCHECK(TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) == pid);
+  // Also reset for the next worker, as kMsgSnapshotReset exits mid-request.
+  const bool request_pending =
+      snapshot_request_pending->exchange(false, std::memory_order_relaxed);
+  if (WIFEXITED(status)) {
+    if (WEXITSTATUS(status) == kSnapshotResetExitCode) {
+      return;
+    }
+    // Regular exit (kMsgExit, or exit() called by the library).
+    syscall(__NR_exit_group, WEXITSTATUS(status));
+  }
+  LOG(WARNING) << "Snapshot worker " << pid << " died with signal "
+               << WTERMSIG(status);
+  // A worker which died between requests leaves the host with nothing to wait
+  // for, its next request is answered by the template.
+  if (!request_pending) {
+    return;
+  }
+  FuncRet ret{};
+  ret.ret_type = v::Type::kVoid;
+  ret.int_val = static_cast<uintptr_t>(Error::kUnset);
+  ret.success = false;
+  CHECK(comms->SendTLV(comms::kMsgReturn, sizeof(ret),
+                       reinterpret_cast<uint8_t*>(&ret)));
+}
+
+// Keeps this process in its initial state and serves requests from forked
+// copies of it (sharing the namespaces, the seccomp policy and the Comms
+// channel), so that resetting the sandboxee only takes a fork(). Only returns
+// in a newly forked worker.
+void ServeAsSnapshotTemplate(sandbox2::Comms* comms) {
+  while (true) {
+    uint32_t tag;
+    std::vector<uint8_t> bytes;
+    CHECK(comms->RecvTLV(&tag, &bytes));
+
+    FuncRet ret{};
+    ret.ret_type = v::Type::kVoid;
+    ret.int_val = static_cast<uintptr_t>(Error::kUnset);
+    ret.success = false;
+
+    switch (tag) {
+      case comms::kMsgSnapshotFork: {
+        VLOG(1) << "Received Client::kMsgSnapshotFork message";
+        pid_t pid = fork();
+        PCHECK(pid != -1);
+        if (pid == 0) {
+          // The worker announces itself, the host needs its PID.
+          CHECK(comms->SendSenderCreds());
+          return;
+        }
+        WaitForSnapshotWorker(comms, pid);
+        continue;
+      }
+      case comms::kMsgSnapshotReset:
+        VLOG(1) << "Received Client::kMsgSnapshotReset message";
+        // The worker is already gone.
+        ret.success = true;
+        break;
+      case comms::kMsgExit:
+        VLOG(1) << "Received Client::kMsgExit message";
+        syscall(__NR_exit_group, 0UL);
+        break;
+      case comms::kMsgSendFd: {
+        int fd;
+        if (comms->RecvFD(&fd)) {
+          close(fd);
+        }
+        break;
+      }
+      default:
+        LOG(ERROR) << "No snapshot worker to serve tag: " << tag;
+        break;
+    }
+    CHECK(comms->SendTLV(comms::kMsgReturn, sizeof(ret),
+                         reinterpret_cast<uint8_t*>(&ret)));
+  }
+}
+
 template <typename T>
 static T BytesAs(const std::vector<uint8_t>& bytes) {
   static_assert(std::is_trivial<T>(),
@@ -344,11 +656,24 @@ static T BytesAs(const std::vector<uint8_t>& bytes) {
   return rv;
 }
 
+// Calls addressed by index are sent without the function name.
+FuncCall BytesAsFuncCall(const std::vector<uint8_t>& bytes) {
+  if (bytes.size() != kIndexedFuncCallSize) {
+    return BytesAs<FuncCall>(bytes);
+  }
+  FuncCall call;
+  memcpy(&call, bytes.data(), kIndexedFuncCallSize);
+  CHECK_GE(call.func_index, 0);
+  call.func[0] = '\0';
+  return call;
+}
+
 void ServeRequest(sandbox2::Comms* comms) {
   uint32_t tag;
   std::vector<uint8_t> bytes;
 
   CHECK(comms->RecvTLV(&tag, &bytes));
+  SetSnapshotRequestPending(true);
 
   FuncRet ret{};
   ret.ret_type = v::Type::kVoid;
@@ -358,8 +683,20 @@ void ServeRequest(sandbox2::Comms* comms) {
   switch (tag) {
     case comms::kMsgCall:
       VLOG(1) << "Client::kMsgCall";
-      HandleCallMsg(BytesAs<FuncCall>(bytes), &ret);
+      HandleCallMsg(BytesAsFuncCall(bytes), &ret);
       break;
+    case comms::kMsgCallBatch:
+      VLOG(1) << "Client::kMsgCallBatch";
+      // Replies on its own.
+      HandleCallBatchMsg(comms, bytes);
+      SetSnapshotRequestPending(false);
+      return;
+    case comms::kMsgResolve:
+      VLOG(1) << "Client::kMsgResolve";
+      // Replies on its own.
+      HandleResolveMsg(comms, bytes);
+      SetSnapshotRequestPending(false);
+      return;
     case comms::kMsgAllocate:
       VLOG(1) << "Client::kMsgAllocate";
       HandleAllocMsg(BytesAs<size_t>(bytes), &ret);
@@ -402,7 +739,25 @@ void ServeRequest(sandbox2::Comms* comms) {
       VLOG(1) << "Received Client::kMsgStrlen message";
       HandleStrlen(comms, BytesAs<const char*>(bytes), &ret);
       break;
+    case comms::kMsgMapFd:
+      VLOG(1) << "Received Client::kMsgMapFd message";
+      HandleMapFd(comms, BytesAs<size_t>(bytes), &ret);
       break;
+    case comms::kMsgUnmap:
+      VLOG(1) << "Received Client::kMsgUnmap message";
+      {
+        auto req = BytesAs<comms::UnmapRequest>(bytes);
+        HandleUnmap(req.addr, req.size, &ret);
+      }
+      break;
+    case comms::kMsgShmEnable:
+      VLOG(1) << "Received Client::kMsgShmEnable message";
+      HandleShmEnable(&ret);
+      break;
+    case comms::kMsgSnapshotReset:
+      VLOG(1) << "Received Client::kMsgSnapshotReset message";
+      HandleSnapshotReset(comms, &ret);
+      break;  // Not reached
     default:
       LOG(FATAL) << "Received unknown tag: " << tag;
       break;  // Not reached
@@ -419,6 +774,60 @@ void ServeRequest(sandbox2::Comms* comms) {
 
   CHECK(comms->SendTLV(comms::kMsgReturn, sizeof(ret),
                        reinterpret_cast<uint8_t*>(&ret)));
+  SetSnapshotRequestPending(false);
+}
+
+// Serves a single request published on the shared-memory ring. Requests other
+// than function calls are only announced there and read from the Comms
+// channel.
+void ServeShmRequest(sandbox2::Comms* comms, uint32_t* seq) {
+  auto published = [seq] {
+    return shm_ring->req_seq.load(std::memory_order_acquire) != *seq;
+  };
+  for (int i = 0; !published() && i < shm_ring_internal::kSpinIterations;
+       ++i) {
+    shm_ring_internal::CpuRelax();
+  }
+  while (!published()) {
+    shm_ring->sandboxee_waiting.store(1, std::memory_order_seq_cst);
+    if (!published()) {
+      shm_ring_internal::FutexWait(&shm_ring->req_seq, *seq, nullptr);
+    }
+    shm_ring->sandboxee_waiting.store(0, std::memory_order_relaxed);
+  }
+
+  ShmRing::Slot& slot = shm_ring->slot(*seq);
+  ++*seq;
+  if (slot.tag != comms::kMsgCall) {
+    // The host waits for the reply on the Comms channel.
+    shm_ring->ret_seq.store(*seq, std::memory_order_release);
+    ServeRequest(comms);
+    return;
+  }
+
+  VLOG(1) << "Client::kMsgCall (shared memory)";
+  FuncRet ret{};
+  ret.ret_type = v::Type::kVoid;
+  ret.int_val = static_cast<uintptr_t>(Error::kUnset);
+  ret.success = false;
+  HandleCallMsg(slot.call, &ret);
+  slot.ret = ret;
+
+  shm_ring->ret_seq.store(*seq, std::memory_order_seq_cst);
+  if (shm_ring->host_waiting.load(std::memory_order_seq_cst)) {
+    shm_ring_internal::FutexWake(&shm_ring->ret_seq);
+  }
+}
+
+void ServeRequests(sandbox2::Comms* comms) {
+  uint32_t seq = 0;
+  while (true) {
+    if (shm_ring_enabled) {
+      ServeShmRequest(comms, &seq);
+    } else {
+      ServeRequest(comms);
+    }
+  }
 }
 
 }  // namespace client
@@ -449,11 +858,19 @@ extern "C" ABSL_ATTRIBUTE_WEAK int main(int argc, char** argv) {
   }
 
   // Child thread.
+  if (absl::GetFlag(FLAGS_sapi_shm_transport)) {
+    sapi::client::PrepareShmRing();
+  }
+  if (absl::GetFlag(FLAGS_sapi_snapshot_template)) {
+    sapi::client::PrepareSnapshotTemplate();
+  }
   s2client.SandboxMeHere();
 
-  // Run SAPI stub.
-  while (true) {
-    sapi::client::ServeRequest(&comms);
+  if (absl::GetFlag(FLAGS_sapi_snapshot_template)) {
+    sapi::client::ServeAsSnapshotTemplate(&comms);
   }
+
+  // Run SAPI stub.
+  sapi::client::ServeRequests(&comms);
   LOG(FATAL) << "Unreachable";
 }
@@ -0,0 +1,63 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Implementation of the direct-call dispatch table registry.
+
+#include "sandboxed_api/direct_call.h"
+
+#include <dlfcn.h>
+
+#include <string>
+
+#include <glog/logging.h>
+#include "absl/container/flat_hash_map.h"
+
+namespace sapi {
+namespace {
+
+struct Entry {
+  DirectCallTarget target;
+  bool resolved;
+};
+
+absl::flat_hash_map<std::string, Entry>* GetDirectCalls() {
+  static auto* calls = new absl::flat_hash_map<std::string, Entry>();
+  return calls;
+}
+
+}  // namespace
+
+void RegisterDirectCalls(absl::Span<const DirectCall> calls) {
+  for (const DirectCall& call : calls) {
+    GetDirectCalls()->insert_or_assign(
+        call.name, Entry{{nullptr, call.argc, call.thunk}, false});
+  }
+}
+
+const DirectCallTarget* FindDirectCall(absl::string_view name) {
+  auto* calls = GetDirectCalls();
+  auto it = calls->find(name);
+  if (it == calls->end()) {
+    return nullptr;
+  }
+  Entry& entry = it->second;
+  if (!entry.resolved) {
+    entry.target.fn = dlsym(RTLD_DEFAULT, it->first.c_str());
+    entry.resolved = true;
+    VLOG(1) << "Resolved direct call '" << name << "': " << entry.target.fn;
+  }
+  return entry.target.fn != nullptr ? &entry.target : nullptr;
+}
+
+}  // namespace sapi
@@ -0,0 +1,140 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Typed call thunks for the functions of a sandboxed library. The header
+// generators can emit a table of them (see the direct_calls option of
+// sapi_library()), which the sandboxee then uses instead of libffi.
+
+#ifndef SANDBOXED_API_DIRECT_CALL_H_
+#define SANDBOXED_API_DIRECT_CALL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "sandboxed_api/call.h"
+
+namespace sapi {
+
+// Calls 'fn' with the arguments pointed to by 'args', and stores the return
+// value in 'ret'. Mirrors the interface of ffi_call(), with the signature of
+// the function fixed at compile time.
+using DirectCallThunk = void (*)(void* fn, void** args, void* ret);
+
+// An entry of the dispatch table of a sandboxed library.
+struct DirectCall {
+  const char* name;
+  size_t argc;
+  DirectCallThunk thunk;
+};
+
+namespace internal {
+
+template <typename T>
+constexpr bool IsDirectCallType() {
+  return std::is_arithmetic<T>::value || std::is_pointer<T>::value;
+}
+
+template <typename T>
+T LoadDirectCallArg(const void* arg) {
+  T value;
+  std::memcpy(&value, arg, sizeof(T));
+  return value;
+}
+
+// Integers are widened to the full register, as libffi does, so that they can
+// be passed on as arguments of later calls of a batch.
+template <typename T>
+void StoreDirectCallRet(T value, void* ret) {
+  if constexpr (std::is_integral<T>::value &&
+                sizeof(T) <= sizeof(uintptr_t)) {
+    const uintptr_t widened = static_cast<uintptr_t>(value);
+    std::memcpy(ret, &widened, sizeof(widened));
+  } else {
+    std::memcpy(ret, &value, sizeof(T));
+  }
+}
+
+template <typename Sig>
+struct DirectCallInvoker;
+
+template <typename R, typename... Args>
+struct DirectCallInvoker<R(Args...)> {
+  static_assert(std::is_void<R>::value || IsDirectCallType<R>(),
+                "Only arithmetic and pointer types can be returned directly");
+  static_assert((IsDirectCallType<Args>() && ...),
+                "Only arithmetic and pointer types can be passed directly");
+  static_assert(sizeof...(Args) <= FuncCall::kArgsMax,
+                "Too many arguments for a sandboxed call");
+
+  static constexpr size_t kArgc = sizeof...(Args);
+
+  static void Invoke(void* fn, void** args, void* ret) {
+    Invoke(fn, args, ret, std::index_sequence_for<Args...>());
+  }
+
+  template <size_t... I>
+  static void Invoke(void* fn, void** args, void* ret,
+                     std::index_sequence<I...>) {
+    static_cast<void>(args);  // Unused for functions without arguments
+    auto* f = reinterpret_cast<R (*)(Args...)>(fn);
+    if constexpr (std::is_void<R>::value) {
+      f(LoadDirectCallArg<Args>(args[I])...);
+    } else {
+      StoreDirectCallRet(f(LoadDirectCallArg<Args>(args[I])...), ret);
+    }
+  }
+};
+
+}  // namespace internal
+
+// Returns the dispatch table entry for the function 'name' of type 'Sig'. The
+// generators spell pointers as void* and enums as their underlying type, so
+// that the table compiles without the headers of the library.
+template <typename Sig>
+constexpr DirectCall MakeDirectCall(const char* name) {
+  return {name, internal::DirectCallInvoker<Sig>::kArgc,
+          &internal::DirectCallInvoker<Sig>::Invoke};
+}
+
+// Registers the dispatch table of a sandboxed library. Generated tables are
+// registered by a static DirectCallRegistration.
+void RegisterDirectCalls(absl::Span<const DirectCall> calls);
+
+class DirectCallRegistration {
+ public:
+  explicit DirectCallRegistration(absl::Span<const DirectCall> calls) {
+    RegisterDirectCalls(calls);
+  }
+};
+
+// A registered function, with its address resolved.
+struct DirectCallTarget {
+  void* fn;
+  size_t argc;
+  DirectCallThunk thunk;
+};
+
+// Returns the registered function called 'name', or nullptr if there is none
+// or its symbol cannot be found. Symbols are only looked up on the first call.
+// Not thread-safe, the sandboxee serves requests from a single thread.
+const DirectCallTarget* FindDirectCall(absl::string_view name);
+
+}  // namespace sapi
+
+#endif  // SANDBOXED_API_DIRECT_CALL_H_
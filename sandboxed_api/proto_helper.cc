@@ -0,0 +1,108 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Implementation of the ProtoArg envelope handling.
+
+#include "sandboxed_api/proto_helper.h"
+
+#include <climits>
+
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wire_format_lite.h"
+
+namespace sapi {
+namespace {
+
+using ::google::protobuf::io::CodedInputStream;
+using ::google::protobuf::io::CodedOutputStream;
+using ::google::protobuf::internal::WireFormatLite;
+
+constexpr uint32_t kFullNameTag =
+    WireFormatLite::MakeTag(ProtoArg::kFullNameFieldNumber,
+                            WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+constexpr uint32_t kProtobufDataTag =
+    WireFormatLite::MakeTag(ProtoArg::kProtobufDataFieldNumber,
+                            WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+
+}  // namespace
+
+absl::StatusOr<size_t> GetSerializedProtoSize(
+    const google::protobuf::Message& proto) {
+  const size_t message_size = proto.ByteSizeLong();
+  if (message_size > INT_MAX) {
+    return absl::InvalidArgumentError("Protobuf too large to serialize");
+  }
+  const size_t name_size = proto.GetDescriptor()->full_name().size();
+  return CodedOutputStream::VarintSize32(kFullNameTag) +
+         WireFormatLite::LengthDelimitedSize(name_size) +
+         CodedOutputStream::VarintSize32(kProtobufDataTag) +
+         WireFormatLite::LengthDelimitedSize(message_size);
+}
+
+void SerializeProtoToArray(const google::protobuf::Message& proto,
+                           uint8_t* data) {
+  // Same layout as ProtoArg::SerializeToArray(), with the message serialized
+  // in place of the protobuf_data field.
+  const absl::string_view full_name = proto.GetDescriptor()->full_name();
+  data = CodedOutputStream::WriteTagToArray(kFullNameTag, data);
+  data = CodedOutputStream::WriteVarint32ToArray(full_name.size(), data);
+  data = CodedOutputStream::WriteRawToArray(full_name.data(), full_name.size(),
+                                            data);
+  data = CodedOutputStream::WriteTagToArray(kProtobufDataTag, data);
+  data = CodedOutputStream::WriteVarint32ToArray(proto.GetCachedSize(), data);
+  proto.SerializeWithCachedSizesToArray(data);
+}
+
+absl::Status ParseProtoArg(const void* data, size_t len,
+                           absl::string_view* full_name,
+                           absl::string_view* protobuf_data) {
+  const absl::Status parse_error =
+      absl::InternalError("Unable to parse proto from array");
+  if (len > INT_MAX) {
+    return parse_error;
+  }
+  const char* bytes = static_cast<const char*>(data);
+  CodedInputStream input(reinterpret_cast<const uint8_t*>(bytes), len);
+  bool has_full_name = false;
+  bool has_protobuf_data = false;
+  while (uint32_t tag = input.ReadTag()) {
+    if (tag != kFullNameTag && tag != kProtobufDataTag) {
+      if (!WireFormatLite::SkipField(&input, tag)) {
+        return parse_error;
+      }
+      continue;
+    }
+    uint32_t size;
+    if (!input.ReadVarint32(&size) ||
+        size > len - input.CurrentPosition()) {
+      return parse_error;
+    }
+    absl::string_view value(bytes + input.CurrentPosition(), size);
+    input.Skip(size);
+    if (tag == kFullNameTag) {
+      *full_name = value;
+      has_full_name = true;
+    } else {
+      *protobuf_data = value;
+      has_protobuf_data = true;
+    }
+  }
+  if (input.CurrentPosition() != static_cast<int>(len) || !has_full_name ||
+      !has_protobuf_data) {
+    return parse_error;
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace sapi
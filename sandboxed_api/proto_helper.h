@@ -18,30 +18,46 @@
 #define SANDBOXED_API_PROTO_HELPER_H_
 
 #include <cinttypes>
+#include <cstdint>
 #include <type_traits>
 #include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
 #include "sandboxed_api/proto_arg.pb.h"
+#include "sandboxed_api/util/status_macros.h"
 
 namespace sapi {
 
+// Protobufs are passed to the sandboxee wrapped in a ProtoArg envelope, so
+// that the sandboxee knows the name of the protobuf structure when
+// deserializing it. The functions below write and read the envelope around the
+// message data, instead of copying the serialized message into a ProtoArg.
+
+// Returns the size of 'proto' wrapped in a ProtoArg envelope. Caches the size
+// of the message for SerializeProtoToArray().
+absl::StatusOr<size_t> GetSerializedProtoSize(
+    const google::protobuf::Message& proto);
+
+// Writes 'proto' wrapped in a ProtoArg envelope to 'data', which must hold
+// GetSerializedProtoSize() bytes. The message must not be modified in between.
+void SerializeProtoToArray(const google::protobuf::Message& proto,
+                           uint8_t* data);
+
+// Finds the name and the serialized data of the message in a ProtoArg
+// envelope. Both point into 'data'.
+absl::Status ParseProtoArg(const void* data, size_t len,
+                           absl::string_view* full_name,
+                           absl::string_view* protobuf_data);
+
 template <typename T>
 absl::StatusOr<std::vector<uint8_t>> SerializeProto(const T& proto) {
   static_assert(std::is_base_of<google::protobuf::Message, T>::value,
                 "Template argument must be a proto message");
-  // Wrap protobuf in a envelope so that we know the name of the protobuf
-  // structure when deserializing in the sandboxee.
-  ProtoArg proto_arg;
-  proto_arg.set_protobuf_data(proto.SerializeAsString());
-  proto_arg.set_full_name(proto.GetDescriptor()->full_name());
-
-  std::vector<uint8_t> serialized_proto(proto_arg.ByteSizeLong());
-  if (!proto_arg.SerializeToArray(serialized_proto.data(),
-                                  serialized_proto.size())) {
-    return absl::InternalError("Unable to serialize proto to array");
-  }
+  SAPI_ASSIGN_OR_RETURN(size_t size, GetSerializedProtoSize(proto));
+  std::vector<uint8_t> serialized_proto(size);
+  SerializeProtoToArray(proto, serialized_proto.data());
   return serialized_proto;
 }
 
@@ -49,12 +65,9 @@ template <typename T>
 absl::StatusOr<T> DeserializeProto(const char* data, size_t len) {
   static_assert(std::is_base_of<google::protobuf::Message, T>::value,
                 "Template argument must be a proto message");
-  ProtoArg envelope;
-  if (!envelope.ParseFromArray(data, len)) {
-    return absl::InternalError("Unable to parse proto from array");
-  }
-
-  auto pb_data = envelope.protobuf_data();
+  absl::string_view full_name;
+  absl::string_view pb_data;
+  SAPI_RETURN_IF_ERROR(ParseProtoArg(data, len, &full_name, &pb_data));
   T result;
   if (!result.ParseFromArray(pb_data.data(), pb_data.size())) {
     return absl::InternalError("Unable to parse proto from envelope data");
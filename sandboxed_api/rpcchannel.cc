@@ -14,20 +14,41 @@
 
 #include "sandboxed_api/rpcchannel.h"
 
+#include <poll.h>
+
+#include <atomic>
+#include <cstring>
+
 #include <glog/logging.h>
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
 #include "sandboxed_api/call.h"
 #include "sandboxed_api/sandbox2/comms.h"
+#include "sandboxed_api/shm_ring.h"
 #include "sandboxed_api/util/status_macros.h"
 
 namespace sapi {
+namespace {
+
+// Calls addressed by index are sent without the function name.
+size_t GetFuncCallSize(const FuncCall& call) {
+  return call.func_index >= 0 ? kIndexedFuncCallSize : sizeof(call);
+}
+
+}  // namespace
 
 absl::Status RPCChannel::Call(const FuncCall& call, uint32_t tag, FuncRet* ret,
                               v::Type exp_type) {
   absl::MutexLock lock(&mutex_);
-  if (!comms_->SendTLV(tag, sizeof(call), &call)) {
+  if (ring_ != nullptr && tag == comms::kMsgCall) {
+    DrainPendingCalls();
+    SAPI_ASSIGN_OR_RETURN(*ret, CallShm(call, exp_type));
+    return absl::OkStatus();
+  }
+  const size_t size =
+      tag == comms::kMsgCall ? GetFuncCallSize(call) : sizeof(call);
+  if (!SendRequest(tag, size, &call)) {
     return absl::UnavailableError("Sending TLV value failed");
   }
   SAPI_ASSIGN_OR_RETURN(auto fret, Return(exp_type));
@@ -35,7 +56,221 @@ absl::Status RPCChannel::Call(const FuncCall& call, uint32_t tag, FuncRet* ret,
   return absl::OkStatus();
 }
 
+absl::StatusOr<uint64_t> RPCChannel::CallAsync(const FuncCall& call,
+                                               v::Type exp_type) {
+  absl::MutexLock lock(&mutex_);
+  // Bounds the number of requests in flight: the ring has a fixed number of
+  // slots, and with the Comms channel, the sandboxee would eventually block on
+  // sending results which are not being read.
+  if (pending_.size() >= kMaxPendingCalls) {
+    CollectOldestPendingCall();
+  }
+  // Identifiers are unique across all channels, so that handles for calls to a
+  // restarted sandboxee cannot be mistaken for new ones.
+  static std::atomic<uint64_t> next_call_id = 0;
+  PendingCall pending = {
+      .id = next_call_id.fetch_add(1, std::memory_order_relaxed),
+      .exp_type = exp_type,
+  };
+  if (ring_ != nullptr) {
+    pending.seq = PublishCall(call);
+  } else if (!comms_->SendTLV(comms::kMsgCall, GetFuncCallSize(call),
+                              &call)) {
+    return absl::UnavailableError("Sending TLV value failed");
+  }
+  pending_.push_back(pending);
+  return pending.id;
+}
+
+absl::StatusOr<FuncRet> RPCChannel::AwaitCall(uint64_t call_id) {
+  absl::MutexLock lock(&mutex_);
+  auto it = completed_.find(call_id);
+  while (it == completed_.end()) {
+    if (pending_.empty() || call_id < pending_.front().id ||
+        call_id > pending_.back().id) {
+      return absl::NotFoundError(absl::StrCat("Unknown call: ", call_id));
+    }
+    CollectOldestPendingCall();
+    it = completed_.find(call_id);
+  }
+  absl::StatusOr<FuncRet> ret = std::move(it->second);
+  completed_.erase(it);
+  return ret;
+}
+
+bool RPCChannel::IsCallDone(uint64_t call_id) {
+  absl::MutexLock lock(&mutex_);
+  while (!pending_.empty() && pending_.front().id <= call_id) {
+    if (ring_ != nullptr) {
+      if (!IsShmRequestDone(pending_.front().seq)) {
+        break;
+      }
+    } else {
+      pollfd pfd = {
+          .fd = comms_->GetConnectionFD(),
+          .events = POLLIN,
+      };
+      // Readable also covers a closed connection, in which case the call
+      // will be completed with an error.
+      if (poll(&pfd, 1, 0) != 1) {
+        break;
+      }
+    }
+    CollectOldestPendingCall();
+  }
+  return completed_.contains(call_id) || pending_.empty() ||
+         pending_.front().id > call_id;
+}
+
+void RPCChannel::CollectOldestPendingCall() {
+  const PendingCall pending = pending_.front();
+  pending_.pop_front();
+  absl::StatusOr<FuncRet> ret;
+  if (ring_ != nullptr) {
+    absl::Status status = WaitForShmRequest(pending.seq);
+    if (status.ok()) {
+      ret = ring_->slot(pending.seq).ret;
+    } else {
+      ret = status;
+    }
+  } else {
+    ret = RecvReturn();
+  }
+  if (ret.ok()) {
+    absl::Status status = ValidateReturn(*ret, pending.exp_type);
+    if (!status.ok()) {
+      ret = status;
+    }
+  }
+  completed_.emplace(pending.id, std::move(ret));
+}
+
+void RPCChannel::DrainPendingCalls() {
+  while (!pending_.empty()) {
+    CollectOldestPendingCall();
+  }
+}
+
+absl::Status RPCChannel::EnableShmTransport(
+    std::unique_ptr<sandbox2::Buffer> buffer) {
+  absl::MutexLock lock(&mutex_);
+  if (ring_ != nullptr) {
+    return absl::FailedPreconditionError("Shared memory ring already enabled");
+  }
+  if (buffer->size() < sizeof(ShmRing)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Shared memory ring too small: ", buffer->size(), " < ",
+                     sizeof(ShmRing)));
+  }
+  auto* ring = reinterpret_cast<ShmRing*>(buffer->data());
+  if (ring->magic != ShmRing::kMagic) {
+    return absl::FailedPreconditionError("Shared memory ring not initialized");
+  }
+  DrainPendingCalls();
+  if (!comms_->SendTLV(comms::kMsgShmEnable, 0, nullptr)) {
+    return absl::UnavailableError("Sending TLV value failed");
+  }
+  SAPI_RETURN_IF_ERROR(Return(v::Type::kVoid).status());
+
+  ring_ = ring;
+  next_seq_ = ring_->req_seq.load(std::memory_order_relaxed);
+  shm_buffer_ = std::move(buffer);
+  return absl::OkStatus();
+}
+
+bool RPCChannel::SendRequest(uint32_t tag, size_t length, const void* value) {
+  // Results of the outstanding asynchronous calls arrive first.
+  DrainPendingCalls();
+  if (ring_ != nullptr) {
+    // Tell the sandboxee to read the next request from the Comms channel.
+    ring_->slot(next_seq_).tag = tag;
+    Publish();
+  }
+  return comms_->SendTLV(tag, length, value);
+}
+
+void RPCChannel::Publish() {
+  ring_->req_seq.store(++next_seq_, std::memory_order_seq_cst);
+  if (ring_->sandboxee_waiting.load(std::memory_order_seq_cst)) {
+    shm_ring_internal::FutexWake(&ring_->req_seq);
+  }
+}
+
+uint32_t RPCChannel::PublishCall(const FuncCall& call) {
+  const uint32_t seq = next_seq_;
+  ShmRing::Slot& slot = ring_->slot(seq);
+  slot.tag = comms::kMsgCall;
+  slot.call = call;
+  Publish();
+  return seq;
+}
+
+bool RPCChannel::IsShmRequestDone(uint32_t seq) const {
+  // The request is done, once the sandboxee has completed at least seq + 1
+  // requests. Unsigned arithmetic takes care of wrap-arounds.
+  return static_cast<int32_t>(ring_->ret_seq.load(std::memory_order_acquire) -
+                              seq) > 0;
+}
+
+absl::Status RPCChannel::WaitForShmRequest(uint32_t seq) {
+  for (int i = 0;
+       !IsShmRequestDone(seq) && i < shm_ring_internal::kSpinIterations; ++i) {
+    shm_ring_internal::CpuRelax();
+  }
+  // Check regularly whether the sandboxee is still alive, the futex will
+  // never be woken up if it crashed.
+  constexpr timespec kLivenessCheckPeriod = {0, 10 * 1000 * 1000};  // 10ms
+  while (!IsShmRequestDone(seq)) {
+    uint32_t cur = ring_->ret_seq.load(std::memory_order_seq_cst);
+    ring_->host_waiting.store(1, std::memory_order_seq_cst);
+    if (!IsShmRequestDone(seq)) {
+      shm_ring_internal::FutexWait(&ring_->ret_seq, cur, &kLivenessCheckPeriod);
+    }
+    ring_->host_waiting.store(0, std::memory_order_relaxed);
+    if (IsShmRequestDone(seq)) {
+      break;
+    }
+    pollfd pfd = {
+        .fd = comms_->GetConnectionFD(),
+        .events = POLLRDHUP,
+    };
+    if (poll(&pfd, 1, 0) == -1 ||
+        (pfd.revents & (POLLHUP | POLLRDHUP | POLLERR | POLLNVAL)) != 0) {
+      return absl::UnavailableError("Sandboxee went away during the call");
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<FuncRet> RPCChannel::CallShm(const FuncCall& call,
+                                            v::Type exp_type) {
+  const uint32_t seq = PublishCall(call);
+  SAPI_RETURN_IF_ERROR(WaitForShmRequest(seq));
+  FuncRet ret = ring_->slot(seq).ret;
+  SAPI_RETURN_IF_ERROR(ValidateReturn(ret, exp_type));
+  return ret;
+}
+
+absl::Status RPCChannel::ValidateReturn(const FuncRet& ret, v::Type exp_type) {
+  if (ret.ret_type != exp_type) {
+    LOG(ERROR) << "FuncRet->type != exp_type (" << ret.ret_type
+               << " != " << exp_type << ")";
+    return absl::UnavailableError("Received TLV has incorrect return type");
+  }
+  if (!ret.success) {
+    LOG(ERROR) << "FuncRet->success == false";
+    return absl::UnavailableError("Function call failed");
+  }
+  return absl::OkStatus();
+}
+
 absl::StatusOr<FuncRet> RPCChannel::Return(v::Type exp_type) {
+  SAPI_ASSIGN_OR_RETURN(FuncRet ret, RecvReturn());
+  SAPI_RETURN_IF_ERROR(ValidateReturn(ret, exp_type));
+  return ret;
+}
+
+absl::StatusOr<FuncRet> RPCChannel::RecvReturn() {
   uint32_t tag;
   size_t len;
   FuncRet ret;
@@ -52,21 +287,87 @@ absl::StatusOr<FuncRet> RPCChannel::Return(v::Type exp_type) {
                << " != " << sizeof(FuncRet) << ")";
     return absl::UnavailableError("Received TLV has incorrect length");
   }
-  if (ret.ret_type != exp_type) {
-    LOG(ERROR) << "FuncRet->type != exp_type (" << ret.ret_type
-               << " != " << exp_type << ")";
-    return absl::UnavailableError("Received TLV has incorrect return type");
+  return ret;
+}
+
+absl::Status RPCChannel::CallBatch(absl::Span<const BatchedFuncCall> calls,
+                                   std::vector<FuncRet>* rets) {
+  absl::MutexLock lock(&mutex_);
+  rets->clear();
+  if (!SendRequest(comms::kMsgCallBatch,
+                   calls.size() * sizeof(BatchedFuncCall), calls.data())) {
+    return absl::UnavailableError("Sending TLV value failed");
   }
-  if (!ret.success) {
-    LOG(ERROR) << "FuncRet->success == false";
-    return absl::UnavailableError("Function call failed");
+
+  uint32_t tag;
+  std::vector<uint8_t> bytes;
+  if (!comms_->RecvTLV(&tag, &bytes)) {
+    return absl::UnavailableError("Receiving TLV value failed");
   }
-  return ret;
+  if (tag != comms::kMsgReturn) {
+    LOG(ERROR) << "tag != comms::kMsgReturn (" << absl::StrCat(absl::Hex(tag))
+               << " != " << absl::StrCat(absl::Hex(comms::kMsgReturn)) << ")";
+    return absl::UnavailableError("Received TLV has incorrect tag");
+  }
+  const size_t count = bytes.size() / sizeof(FuncRet);
+  if (bytes.size() % sizeof(FuncRet) != 0 || count > calls.size()) {
+    LOG(ERROR) << "Received " << bytes.size() << " bytes for " << calls.size()
+               << " calls";
+    return absl::UnavailableError("Received TLV has incorrect length");
+  }
+
+  for (size_t i = 0; i < count; ++i) {
+    FuncRet ret;
+    memcpy(&ret, bytes.data() + i * sizeof(FuncRet), sizeof(FuncRet));
+    if (absl::Status status = ValidateReturn(ret, calls[i].call.ret_type);
+        !status.ok()) {
+      return absl::UnavailableError(
+          absl::StrCat("Call ", i, " ('", calls[i].call.func,
+                       "') of the batch failed: ", status.message()));
+    }
+    rets->push_back(ret);
+  }
+  if (count != calls.size()) {
+    return absl::UnavailableError("Sandboxee did not make all calls");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status RPCChannel::Resolve(absl::Span<const std::string> names,
+                                 std::vector<ResolvedFunc>* funcs) {
+  absl::MutexLock lock(&mutex_);
+  funcs->clear();
+  std::string request;
+  for (const std::string& name : names) {
+    request.append(name.c_str(), name.size() + 1);
+  }
+  if (!SendRequest(comms::kMsgResolve, request.size(), request.data())) {
+    return absl::UnavailableError("Sending TLV value failed");
+  }
+
+  uint32_t tag;
+  std::vector<uint8_t> bytes;
+  if (!comms_->RecvTLV(&tag, &bytes)) {
+    return absl::UnavailableError("Receiving TLV value failed");
+  }
+  if (tag != comms::kMsgReturn) {
+    LOG(ERROR) << "tag != comms::kMsgReturn (" << absl::StrCat(absl::Hex(tag))
+               << " != " << absl::StrCat(absl::Hex(comms::kMsgReturn)) << ")";
+    return absl::UnavailableError("Received TLV has incorrect tag");
+  }
+  if (bytes.size() != names.size() * sizeof(ResolvedFunc)) {
+    LOG(ERROR) << "Received " << bytes.size() << " bytes for " << names.size()
+               << " functions";
+    return absl::UnavailableError("Received TLV has incorrect length");
+  }
+  funcs->resize(names.size());
+  memcpy(funcs->data(), bytes.data(), bytes.size());
+  return absl::OkStatus();
 }
 
 absl::Status RPCChannel::Allocate(size_t size, void** addr) {
   absl::MutexLock lock(&mutex_);
-  if (!comms_->SendTLV(comms::kMsgAllocate, sizeof(size), &size)) {
+  if (!SendRequest(comms::kMsgAllocate, sizeof(size), &size)) {
     return absl::UnavailableError("Sending TLV value failed");
   }
 
@@ -83,7 +384,7 @@ absl::Status RPCChannel::Reallocate(void* old_addr, size_t size,
       .size = size,
   };
 
-  if (!comms_->SendTLV(comms::kMsgReallocate, sizeof(comms::ReallocRequest),
+  if (!SendRequest(comms::kMsgReallocate, sizeof(comms::ReallocRequest),
                        &req)) {
     return absl::UnavailableError("Sending TLV value failed");
   }
@@ -102,7 +403,7 @@ absl::Status RPCChannel::Reallocate(void* old_addr, size_t size,
 absl::Status RPCChannel::Free(void* addr) {
   absl::MutexLock lock(&mutex_);
   uintptr_t remote = reinterpret_cast<uintptr_t>(addr);
-  if (!comms_->SendTLV(comms::kMsgFree, sizeof(remote), &remote)) {
+  if (!SendRequest(comms::kMsgFree, sizeof(remote), &remote)) {
     return absl::UnavailableError("Sending TLV value failed");
   }
 
@@ -115,7 +416,7 @@ absl::Status RPCChannel::Free(void* addr) {
 
 absl::Status RPCChannel::Symbol(const char* symname, void** addr) {
   absl::MutexLock lock(&mutex_);
-  if (!comms_->SendTLV(comms::kMsgSymbol, strlen(symname) + 1, symname)) {
+  if (!SendRequest(comms::kMsgSymbol, strlen(symname) + 1, symname)) {
     return absl::UnavailableError("Sending TLV value failed");
   }
 
@@ -133,7 +434,7 @@ absl::Status RPCChannel::Exit() {
 
   // Try the RPC exit sequence. But, the only thing that matters as a success
   // indicator is whether the Comms channel had been closed
-  comms_->SendTLV(comms::kMsgExit, 0, nullptr);
+  SendRequest(comms::kMsgExit, 0, nullptr);
   bool unused;
   comms_->RecvBool(&unused);
 
@@ -147,9 +448,31 @@ absl::Status RPCChannel::Exit() {
   return absl::OkStatus();
 }
 
+absl::Status RPCChannel::SnapshotReset() {
+  absl::MutexLock lock(&mutex_);
+  if (!SendRequest(comms::kMsgSnapshotReset, 0, nullptr)) {
+    return absl::UnavailableError("Sending TLV value failed");
+  }
+  return Return(v::Type::kVoid).status();
+}
+
+absl::StatusOr<pid_t> RPCChannel::SnapshotFork() {
+  absl::MutexLock lock(&mutex_);
+  if (!SendRequest(comms::kMsgSnapshotFork, 0, nullptr)) {
+    return absl::UnavailableError("Sending TLV value failed");
+  }
+  pid_t pid;
+  uid_t uid;
+  gid_t gid;
+  if (!comms_->RecvSenderCreds(&pid, &uid, &gid)) {
+    return absl::UnavailableError("Receiving snapshot worker PID failed");
+  }
+  return pid;
+}
+
 absl::Status RPCChannel::SendFD(int local_fd, int* remote_fd) {
   absl::MutexLock lock(&mutex_);
-  if (!comms_->SendTLV(comms::kMsgSendFd, 0, nullptr)) {
+  if (!SendRequest(comms::kMsgSendFd, 0, nullptr)) {
     return absl::UnavailableError("Sending TLV value failed");
   }
   if (!comms_->SendFD(local_fd)) {
@@ -166,7 +489,7 @@ absl::Status RPCChannel::SendFD(int local_fd, int* remote_fd) {
 
 absl::Status RPCChannel::RecvFD(int remote_fd, int* local_fd) {
   absl::MutexLock lock(&mutex_);
-  if (!comms_->SendTLV(comms::kMsgRecvFd, sizeof(remote_fd), &remote_fd)) {
+  if (!SendRequest(comms::kMsgRecvFd, sizeof(remote_fd), &remote_fd)) {
     return absl::UnavailableError("Sending TLV value failed");
   }
 
@@ -183,7 +506,7 @@ absl::Status RPCChannel::RecvFD(int remote_fd, int* local_fd) {
 
 absl::Status RPCChannel::Close(int remote_fd) {
   absl::MutexLock lock(&mutex_);
-  if (!comms_->SendTLV(comms::kMsgClose, sizeof(remote_fd), &remote_fd)) {
+  if (!SendRequest(comms::kMsgClose, sizeof(remote_fd), &remote_fd)) {
     return absl::UnavailableError("Sending TLV value failed");
   }
 
@@ -194,9 +517,40 @@ absl::Status RPCChannel::Close(int remote_fd) {
   return absl::OkStatus();
 }
 
+absl::Status RPCChannel::MapFd(int local_fd, size_t size, void** addr) {
+  absl::MutexLock lock(&mutex_);
+  if (!SendRequest(comms::kMsgMapFd, sizeof(size), &size)) {
+    return absl::UnavailableError("Sending TLV value failed");
+  }
+  if (!comms_->SendFD(local_fd)) {
+    return absl::UnavailableError("Sending FD failed");
+  }
+
+  SAPI_ASSIGN_OR_RETURN(auto fret, Return(v::Type::kPointer));
+  *addr = reinterpret_cast<void*>(fret.int_val);
+  return absl::OkStatus();
+}
+
+absl::Status RPCChannel::Unmap(void* addr, size_t size) {
+  absl::MutexLock lock(&mutex_);
+  comms::UnmapRequest req = {
+      .addr = reinterpret_cast<uintptr_t>(addr),
+      .size = size,
+  };
+  if (!SendRequest(comms::kMsgUnmap, sizeof(req), &req)) {
+    return absl::UnavailableError("Sending TLV value failed");
+  }
+
+  SAPI_ASSIGN_OR_RETURN(auto fret, Return(v::Type::kVoid));
+  if (!fret.success) {
+    return absl::UnavailableError("Unmap() failed on the remote side");
+  }
+  return absl::OkStatus();
+}
+
 absl::StatusOr<size_t> RPCChannel::Strlen(void* str) {
   absl::MutexLock lock(&mutex_);
-  if (!comms_->SendTLV(comms::kMsgStrlen, sizeof(str), &str)) {
+  if (!SendRequest(comms::kMsgStrlen, sizeof(str), &str)) {
     return absl::UnavailableError("Sending TLV value failed");
   }
 
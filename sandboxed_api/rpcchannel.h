@@ -15,13 +15,24 @@
 #ifndef SANDBOXED_API_RPCCHANNEL_H_
 #define SANDBOXED_API_RPCCHANNEL_H_
 
+#include <sys/types.h>
+
 #include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/types/span.h"
 #include "sandboxed_api/call.h"
+#include "sandboxed_api/sandbox2/buffer.h"
 #include "sandboxed_api/sandbox2/comms.h"
+#include "sandboxed_api/shm_ring.h"
 #include "sandboxed_api/var_type.h"
 
 namespace sapi {
@@ -36,6 +47,32 @@ class RPCChannel {
   absl::Status Call(const FuncCall& call, uint32_t tag, FuncRet* ret,
                     v::Type exp_type);
 
+  // Starts a function call without waiting for its result and returns an
+  // identifier for AwaitCall()/IsCallDone(). Up to kMaxPendingCalls calls are
+  // kept in flight, so that the sandboxee can start on the next one right after
+  // it has finished the previous one. Other requests wait for all outstanding
+  // calls to complete first.
+  absl::StatusOr<uint64_t> CallAsync(const FuncCall& call, v::Type exp_type);
+
+  // Waits for the result of a call started with CallAsync(). Every result can
+  // only be retrieved once.
+  absl::StatusOr<FuncRet> AwaitCall(uint64_t call_id);
+
+  // Returns whether the result of a call started with CallAsync() is
+  // available, i.e. whether AwaitCall() will not block. Never blocks itself.
+  bool IsCallDone(uint64_t call_id);
+
+  // Makes a sequence of function calls with a single round-trip. The sandboxee
+  // stops at the first failing call. The results of the calls made before are
+  // stored in 'rets' in any case.
+  absl::Status CallBatch(absl::Span<const BatchedFuncCall> calls,
+                         std::vector<FuncRet>* rets);
+
+  // Looks up the functions 'names' in the sandboxee, so that they can be called
+  // by index. Stores one entry per name in 'funcs'.
+  absl::Status Resolve(absl::Span<const std::string> names,
+                       std::vector<ResolvedFunc>* funcs);
+
   // Allocates memory.
   absl::Status Allocate(size_t size, void** addr);
 
@@ -51,6 +88,12 @@ class RPCChannel {
   // Makes the remote part exit.
   absl::Status Exit();
 
+  // Makes the current snapshot worker exit, see Sandbox::Reset().
+  absl::Status SnapshotReset();
+
+  // Makes the snapshot template fork a new worker, and returns its PID.
+  absl::StatusOr<pid_t> SnapshotFork();
+
   // Transfers fd to sandboxee.
   absl::Status SendFD(int local_fd, int* remote_fd);
 
@@ -60,17 +103,93 @@ class RPCChannel {
   // Closes fd in sandboxee.
   absl::Status Close(int remote_fd);
 
+  // Maps 'size' bytes of the memory file local_fd into the sandboxee, shared
+  // with all other mappings of it.
+  absl::Status MapFd(int local_fd, size_t size, void** addr);
+
+  // Unmaps memory mapped with MapFd().
+  absl::Status Unmap(void* addr, size_t size);
+
   // Returns length of a null-terminated c-style string (invokes strlen).
   absl::StatusOr<size_t> Strlen(void* str);
 
+  // Switches function calls to the shared-memory ring backed by 'buffer'
+  // (which must already be mapped by the sandboxee, see ShmRing). All other
+  // requests, in particular the ones transferring file descriptors, keep
+  // using the Comms channel.
+  absl::Status EnableShmTransport(std::unique_ptr<sandbox2::Buffer> buffer);
+
+  // Returns whether function calls are sent over the shared-memory ring.
+  bool shm_transport_enabled() const { return ring_ != nullptr; }
+
   sandbox2::Comms* comms() const { return comms_; }
 
+  // Maximum number of asynchronous calls in flight.
+  static constexpr size_t kMaxPendingCalls = ShmRing::kSlots;
+
  private:
+  struct PendingCall {
+    uint64_t id;
+    v::Type exp_type;
+    // Ring sequence number of the call, if the shared-memory ring is enabled.
+    uint32_t seq = 0;
+  };
+
+  // Receives the result of the oldest outstanding asynchronous call and stores
+  // it in completed_.
+  void CollectOldestPendingCall() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Receives the results of all outstanding asynchronous calls.
+  void DrainPendingCalls() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Sends a request over the Comms channel. If the shared-memory ring is
+  // enabled, the sandboxee is notified through it first.
+  bool SendRequest(uint32_t tag, size_t length, const void* value)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Makes the slot at next_seq_ visible to the sandboxee.
+  void Publish() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Writes a function call to the next slot of the shared-memory ring and
+  // returns its sequence number.
+  uint32_t PublishCall(const FuncCall& call)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Returns whether the sandboxee has completed the request at 'seq'.
+  bool IsShmRequestDone(uint32_t seq) const
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Waits until the sandboxee has completed the request at 'seq'.
+  absl::Status WaitForShmRequest(uint32_t seq)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Calls a function through the shared-memory ring.
+  absl::StatusOr<FuncRet> CallShm(const FuncCall& call, v::Type exp_type)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   // Receives the result after a call.
   absl::StatusOr<FuncRet> Return(v::Type exp_type);
 
+  // Receives the next result from the Comms channel without validating it.
+  absl::StatusOr<FuncRet> RecvReturn();
+
+  // Checks the type and success indicator of a result.
+  static absl::Status ValidateReturn(const FuncRet& ret, v::Type exp_type);
+
   sandbox2::Comms* comms_;  // Owned by sandbox2;
   absl::Mutex mutex_;
+
+  // Shared-memory transport, only set if enabled with EnableShmTransport().
+  std::unique_ptr<sandbox2::Buffer> shm_buffer_ ABSL_GUARDED_BY(mutex_);
+  ShmRing* ring_ ABSL_GUARDED_BY(mutex_) = nullptr;
+  // Sequence number of the next request to publish.
+  uint32_t next_seq_ ABSL_GUARDED_BY(mutex_) = 0;
+
+  // Asynchronous calls whose results have not been received yet, oldest first.
+  std::deque<PendingCall> pending_ ABSL_GUARDED_BY(mutex_);
+  // Received results of asynchronous calls, not yet retrieved by AwaitCall().
+  absl::flat_hash_map<uint64_t, absl::StatusOr<FuncRet>> completed_
+      ABSL_GUARDED_BY(mutex_);
 };
 
 }  // namespace sapi
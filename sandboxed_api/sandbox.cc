@@ -15,12 +15,15 @@
 #include "sandboxed_api/sandbox.h"
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/uio.h>
 
 #include <algorithm>
 #include <cstdarg>
+#include <cstddef>
 #include <cstdio>
+#include <typeinfo>
 
 #include <glog/logging.h>
 #include "absl/base/casts.h"
@@ -32,14 +35,17 @@
 #include "absl/time/time.h"
 #include "sandboxed_api/embed_file.h"
 #include "sandboxed_api/rpcchannel.h"
+#include "sandboxed_api/sandbox2/buffer.h"
 #include "sandboxed_api/sandbox2/executor.h"
 #include "sandboxed_api/sandbox2/policy.h"
+#include "sandboxed_api/sandbox2/policy_cache.h"
 #include "sandboxed_api/sandbox2/policybuilder.h"
 #include "sandboxed_api/sandbox2/sandbox2.h"
 #include "sandboxed_api/sandbox2/util/bpf_helper.h"
 #include "sandboxed_api/sandbox2/util/fileops.h"
 #include "sandboxed_api/sandbox2/util/path.h"
 #include "sandboxed_api/sandbox2/util/runfiles.h"
+#include "sandboxed_api/shm_ring.h"
 #include "sandboxed_api/util/status_macros.h"
 
 namespace file = ::sandbox2::file;
@@ -101,6 +107,24 @@ void InitDefaultPolicyBuilder(sandbox2::PolicyBuilder* builder) {
 #endif
 }
 
+namespace {
+
+// Allows the mappings of v::SharedArray variables, see
+// Sandbox::UseSharedArrays().
+void AllowSharedArrayMappings(sandbox2::PolicyBuilder* builder) {
+  builder->AddPolicyOnMmap([](bpf_labels& labels) -> std::vector<sock_filter> {
+    return {
+        ARG_32(2),  // prot
+        JNE32(PROT_READ | PROT_WRITE, JUMP(&labels, shared_mmap_end)),
+        ARG_32(3),  // flags
+        JEQ32(MAP_SHARED, ALLOW),
+        LABEL(&labels, shared_mmap_end),
+    };
+  });
+}
+
+}  // namespace
+
 void Sandbox::Terminate(bool attempt_graceful_exit) {
   if (!is_active()) {
     return;
@@ -134,6 +158,10 @@ absl::Status Sandbox::Init() {
   if (is_active()) {
     return absl::OkStatus();
   }
+  if (UseSnapshotTemplate() && UseSharedMemoryTransport()) {
+    return absl::InvalidArgumentError(
+        "Snapshot templates do not support the shared-memory transport");
+  }
 
   // Initialize the forkserver if it is not already running.
   if (!fork_client_) {
@@ -161,6 +189,12 @@ absl::Status Sandbox::Init() {
     std::vector<std::string> args = {lib_path};
     // Additional arguments, if needed.
     GetArgs(&args);
+    if (UseSharedMemoryTransport()) {
+      args.push_back("--sapi_shm_transport=true");
+    }
+    if (UseSnapshotTemplate()) {
+      args.push_back("--sapi_snapshot_template=true");
+    }
     std::vector<std::string> envs{};
     // Additional envvars, if needed.
     GetEnvs(&envs);
@@ -178,9 +212,31 @@ absl::Status Sandbox::Init() {
     }
   }
 
+  auto build_policy = [this] {
     sandbox2::PolicyBuilder policy_builder;
     InitDefaultPolicyBuilder(&policy_builder);
-  auto s2p = ModifyPolicy(&policy_builder);
+    if (UseSnapshotTemplate()) {
+      policy_builder.AllowFork().AllowWait();
+    }
+    if (UseSharedArrays()) {
+      AllowSharedArrayMappings(&policy_builder);
+    }
+    return ModifyPolicy(&policy_builder);
+  };
+  std::unique_ptr<sandbox2::Policy> s2p;
+  if (UsePolicyCache()) {
+    // Everything the policy depends on: the default policy builder, the
+    // sandbox type, the library being sandboxed, and the state of the instance
+    // which ModifyPolicy() uses.
+    s2p = sandbox2::PolicyCache::Global()->GetOrBuild(
+        absl::StrCat(typeid(*this).name(), "|",
+                     embed_lib_toc_ ? embed_lib_toc_->name : GetLibPath(), "|",
+                     UseSnapshotTemplate(), "|", UseSharedArrays(), "|",
+                     GetPolicyCacheKey()),
+        build_policy);
+  } else {
+    s2p = build_policy();
+  }
 
   // Spawn new process from the forkserver.
   auto executor = absl::make_unique<sandbox2::Executor>(fork_client_.get());
@@ -208,14 +264,98 @@ absl::Status Sandbox::Init() {
   pid_ = s2_->GetPid();
 
   rpc_channel_ = absl::make_unique<RPCChannel>(comms_);
+  call_arena_ = nullptr;
+  call_arena_used_ = 0;
 
   if (!res) {
     Terminate();
     return absl::UnavailableError("Could not start the sandbox");
   }
+  if (UseSharedMemoryTransport()) {
+    if (auto status = InitShmTransport(); !status.ok()) {
+      Terminate();
+      return status;
+    }
+  }
+  if (UseSnapshotTemplate()) {
+    // Calls are served by a copy of the template from now on.
+    auto pid_or = rpc_channel_->SnapshotFork();
+    if (!pid_or.ok()) {
+      Terminate();
+      return pid_or.status();
+    }
+    pid_ = *pid_or;
+  }
+  if (auto status = ResolveKnownFunctions(); !status.ok()) {
+    Terminate();
+    return status;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Sandbox::Reset() {
+  if (!UseSnapshotTemplate()) {
+    return absl::FailedPreconditionError(
+        "Sandbox was not started with a snapshot template");
+  }
+  if (!is_active()) {
+    return absl::UnavailableError("Sandbox not active");
+  }
+  SAPI_RETURN_IF_ERROR(rpc_channel_->SnapshotReset());
+  // The call arena was reserved by the worker which just exited.
+  call_arena_ = nullptr;
+  call_arena_used_ = 0;
+  SAPI_ASSIGN_OR_RETURN(pid_, rpc_channel_->SnapshotFork());
+  // The new worker is forked from the template, which has not resolved any
+  // functions.
+  return ResolveKnownFunctions();
+}
+
+absl::Status Sandbox::ResolveKnownFunctions() {
+  std::vector<std::string> names = GetFunctionNames();
+  for (const auto& entry : func_indices_) {
+    names.push_back(entry.first);
+  }
+  func_indices_.clear();
+  symbols_.clear();
+  return ResolveFunctions(names);
+}
+
+absl::Status Sandbox::ResolveFunctions(absl::Span<const std::string> names) {
+  if (!is_active()) {
+    return absl::UnavailableError("Sandbox not active");
+  }
+  std::vector<std::string> unresolved;
+  for (const std::string& name : names) {
+    // Functions which are not found are called by name, as before.
+    if (func_indices_.emplace(name, -1).second) {
+      unresolved.push_back(name);
+    }
+  }
+  if (unresolved.empty()) {
+    return absl::OkStatus();
+  }
+  std::vector<ResolvedFunc> funcs;
+  SAPI_RETURN_IF_ERROR(rpc_channel_->Resolve(unresolved, &funcs));
+  for (size_t i = 0; i < unresolved.size(); ++i) {
+    if (funcs[i].index < 0) {
+      VLOG(1) << "Function '" << unresolved[i] << "' not found";
+      continue;
+    }
+    func_indices_[unresolved[i]] = funcs[i].index;
+    symbols_[unresolved[i]] = reinterpret_cast<void*>(funcs[i].addr);
+  }
   return absl::OkStatus();
 }
 
+absl::Status Sandbox::InitShmTransport() {
+  int local_fd;
+  SAPI_RETURN_IF_ERROR(
+      rpc_channel_->RecvFD(ShmRing::kSandboxeeFd, &local_fd));
+  SAPI_ASSIGN_OR_RETURN(auto buffer, sandbox2::Buffer::CreateFromFd(local_fd));
+  return rpc_channel_->EnableShmTransport(std::move(buffer));
+}
+
 bool Sandbox::is_active() const { return s2_ && !s2_->IsTerminated(); }
 
 absl::Status Sandbox::Allocate(v::Var* var, bool automatic_free) {
@@ -232,48 +372,99 @@ absl::Status Sandbox::Free(v::Var* var) {
   return var->Free(GetRpcChannel());
 }
 
-absl::Status Sandbox::SynchronizePtrBefore(v::Callable* ptr) {
-  if (!is_active()) {
-    return absl::UnavailableError("Sandbox not active");
-  }
+absl::StatusOr<v::Var*> Sandbox::PrepareSyncBefore(
+    v::Callable* ptr, std::vector<v::Var*>* arena_vars) {
   if (ptr->GetType() != v::Type::kPointer) {
-    return absl::OkStatus();
+    return nullptr;
   }
   // Cast is safe, since type is v::Type::kPointer
   auto* p = static_cast<v::Ptr*>(ptr);
   if (p->GetSyncType() == v::Pointable::kSyncNone) {
-    return absl::OkStatus();
+    return nullptr;
   }
 
-  if (p->GetPointedVar()->GetRemote() == nullptr) {
-    // Allocate the memory, and make it automatically free-able, upon this
-    // object's (p->GetPointedVar()) end of life-time.
-    SAPI_RETURN_IF_ERROR(Allocate(p->GetPointedVar(), /*automatic_free=*/true));
+  v::Var* var = p->GetPointedVar();
+  if (var->GetRemote() == nullptr) {
+    bool in_arena = false;
+    if (arena_vars != nullptr && var->SupportsCallArena()) {
+      SAPI_ASSIGN_OR_RETURN(in_arena, AllocateInCallArena(var));
+    }
+    if (in_arena) {
+      arena_vars->push_back(var);
+    } else {
+      // Allocate the memory, and make it automatically free-able, upon this
+      // object's (p->GetPointedVar()) end of life-time.
+      SAPI_RETURN_IF_ERROR(Allocate(var, /*automatic_free=*/true));
+    }
   }
 
   // Allocation occurs during both before/after synchronization modes. But the
   // memory is transferred to the sandboxee only if v::Pointable::kSyncBefore
   // was requested.
   if ((p->GetSyncType() & v::Pointable::kSyncBefore) == 0) {
-    return absl::OkStatus();
+    return nullptr;
+  }
+  // Unless the sandboxee already has the current data.
+  if (var->track_changes_ && var->in_sync_pid_ == pid_) {
+    VLOG(3) << "Skipping synchronization (TO) of unchanged var: "
+            << var->ToString();
+    return nullptr;
   }
 
   VLOG(3) << "Synchronization (TO), ptr " << p << ", Type: " << p->GetSyncType()
           << " for var: " << p->GetPointedVar()->ToString();
+  return p->GetPointedVar();
+}
 
-  return p->GetPointedVar()->TransferToSandboxee(GetRpcChannel(), pid());
+absl::StatusOr<bool> Sandbox::AllocateInCallArena(v::Var* var) {
+  // Keep every variable aligned like memory returned by malloc().
+  constexpr size_t kAlignment = alignof(std::max_align_t);
+  const size_t size = (var->GetSize() + kAlignment - 1) & ~(kAlignment - 1);
+  if (size > kCallArenaSize - call_arena_used_) {
+    return false;
+  }
+  if (call_arena_ == nullptr) {
+    SAPI_RETURN_IF_ERROR(rpc_channel_->Allocate(kCallArenaSize, &call_arena_));
+    if (call_arena_ == nullptr) {
+      return absl::UnavailableError("Allocating the call arena failed");
+    }
+  }
+  var->SetRemote(static_cast<char*>(call_arena_) + call_arena_used_);
+  call_arena_used_ += size;
+  return true;
 }
 
-absl::Status Sandbox::SynchronizePtrAfter(v::Callable* ptr) const {
+void Sandbox::ReleaseCallArena(absl::Span<v::Var* const> arena_vars) {
+  for (v::Var* var : arena_vars) {
+    var->SetRemote(nullptr);
+  }
+  call_arena_used_ = 0;
+}
+
+absl::Status Sandbox::SynchronizePtrBefore(v::Callable* ptr) {
   if (!is_active()) {
     return absl::UnavailableError("Sandbox not active");
   }
-  if (ptr->GetType() != v::Type::kPointer) {
+  SAPI_ASSIGN_OR_RETURN(v::Var* var, PrepareSyncBefore(ptr));
+  if (var == nullptr) {
     return absl::OkStatus();
   }
+  return TransferToSandboxee(var);
+}
+
+void Sandbox::MarkInSync(absl::Span<v::Var* const> vars) const {
+  for (v::Var* var : vars) {
+    var->in_sync_pid_ = pid_;
+  }
+}
+
+absl::StatusOr<v::Var*> Sandbox::PrepareSyncAfter(v::Callable* ptr) const {
+  if (ptr->GetType() != v::Type::kPointer) {
+    return nullptr;
+  }
   v::Ptr* p = reinterpret_cast<v::Ptr*>(ptr);
   if ((p->GetSyncType() & v::Pointable::kSyncAfter) == 0) {
-    return absl::OkStatus();
+    return nullptr;
   }
 
   VLOG(3) << "Synchronization (FROM), ptr " << p
@@ -288,8 +479,20 @@ absl::Status Sandbox::SynchronizePtrAfter(v::Callable* ptr) const {
         "sandboxee p=",
         p->ToString()));
   }
+  return p->GetPointedVar();
+}
 
-  return p->GetPointedVar()->TransferFromSandboxee(GetRpcChannel(), pid());
+absl::Status Sandbox::SynchronizePtrAfter(v::Callable* ptr) const {
+  if (!is_active()) {
+    return absl::UnavailableError("Sandbox not active");
+  }
+  SAPI_ASSIGN_OR_RETURN(v::Var* var, PrepareSyncAfter(ptr));
+  if (var == nullptr) {
+    return absl::OkStatus();
+  }
+  SAPI_RETURN_IF_ERROR(var->TransferFromSandboxee(GetRpcChannel(), pid()));
+  MarkInSync({var});
+  return absl::OkStatus();
 }
 
 absl::Status Sandbox::Call(const std::string& func, v::Callable* ret,
@@ -297,60 +500,188 @@ absl::Status Sandbox::Call(const std::string& func, v::Callable* ret,
   if (!is_active()) {
     return absl::UnavailableError("Sandbox not active");
   }
-  // Send data.
   FuncCall rfcall{};
-  rfcall.argc = args.size();
-  absl::SNPrintF(rfcall.func, ABSL_ARRAYSIZE(rfcall.func), "%s", func);
+  std::vector<v::Var*> arena_vars;
+  absl::Status status = PrepareCall(func, ret, args, &rfcall,
+                                    UseCallArena() ? &arena_vars : nullptr);
+
+  // Call & receive data.
+  FuncRet fret;
+  if (status.ok()) {
+    status =
+        GetRpcChannel()->Call(rfcall, comms::kMsgCall, &fret, rfcall.ret_type);
+  }
+  if (status.ok()) {
+    status = FinishCall(fret, ret, args);
+  }
+  // Variables in the call arena are only allocated for the duration of the
+  // call, even if it failed.
+  ReleaseCallArena(arena_vars);
+  return status;
+}
+
+absl::StatusOr<AsyncCall> Sandbox::CallAsync(
+    const std::string& func, v::Callable* ret,
+    std::initializer_list<v::Callable*> args) {
+  if (!is_active()) {
+    return absl::UnavailableError("Sandbox not active");
+  }
+  FuncCall rfcall{};
+  SAPI_RETURN_IF_ERROR(PrepareCall(func, ret, args, &rfcall));
+  SAPI_ASSIGN_OR_RETURN(uint64_t call_id,
+                        GetRpcChannel()->CallAsync(rfcall, rfcall.ret_type));
+  return AsyncCall(this, call_id, ret, args);
+}
+
+bool AsyncCall::IsDone() const {
+  if (!sandbox_->is_active()) {
+    return true;
+  }
+  return sandbox_->rpc_channel()->IsCallDone(call_id_);
+}
+
+absl::Status AsyncCall::Wait() {
+  if (!sandbox_->is_active()) {
+    return absl::UnavailableError("Sandbox not active");
+  }
+  SAPI_ASSIGN_OR_RETURN(FuncRet fret,
+                        sandbox_->rpc_channel()->AwaitCall(call_id_));
+  return sandbox_->FinishCall(fret, ret_, args_);
+}
+
+int CallBatch::Add(const std::string& func, v::Callable* ret,
+                   std::initializer_list<v::Callable*> args) {
+  Call& call = calls_.emplace_back();
+  call.func = func;
+  call.ret = ret;
+  call.args.assign(args.begin(), args.end());
+  std::fill(std::begin(call.arg_from_call), std::end(call.arg_from_call), -1);
+  return calls_.size() - 1;
+}
+
+absl::Status CallBatch::PassReturnValue(int from, int to, int arg) {
+  if (from < 0 || to <= from || to >= size()) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Cannot pass the return value of call ", from, " to call ", to));
+  }
+  Call& call = calls_[to];
+  if (arg < 0 || arg >= static_cast<int>(call.args.size())) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Call ", to, " ('", call.func, "') has no argument ", arg));
+  }
+  if (calls_[from].ret->GetType() == v::Type::kFloat ||
+      call.args[arg]->GetType() == v::Type::kFloat) {
+    return absl::InvalidArgumentError(
+        "Floating-point values cannot be passed between calls");
+  }
+  call.arg_from_call[arg] = from;
+  return absl::OkStatus();
+}
+
+absl::Status CallBatch::Run() {
+  completed_ = 0;
+  if (!sandbox_->is_active()) {
+    return absl::UnavailableError("Sandbox not active");
+  }
+  if (calls_.empty()) {
+    return absl::OkStatus();
+  }
+
+  std::vector<BatchedFuncCall> batched(calls_.size());
+  std::vector<v::Var*> arena_vars;
+  absl::Status status;
+  for (size_t i = 0; i < calls_.size() && status.ok(); ++i) {
+    const Call& call = calls_[i];
+    status = sandbox_->PrepareCall(
+        call.func, call.ret, call.args, &batched[i].call,
+        sandbox_->UseCallArena() ? &arena_vars : nullptr);
+    std::copy(std::begin(call.arg_from_call), std::end(call.arg_from_call),
+              batched[i].arg_from_call);
+  }
+
+  std::vector<FuncRet> rets;
+  if (status.ok()) {
+    status = sandbox_->rpc_channel()->CallBatch(batched, &rets);
+  }
+  for (size_t i = 0; i < rets.size(); ++i) {
+    if (absl::Status finished =
+            sandbox_->FinishCall(rets[i], calls_[i].ret, calls_[i].args);
+        !finished.ok()) {
+      status.Update(finished);
+      break;
+    }
+    ++completed_;
+  }
+  sandbox_->ReleaseCallArena(arena_vars);
+  return status;
+}
+
+absl::Status Sandbox::PrepareCall(const std::string& func, v::Callable* ret,
+                                  absl::Span<v::Callable* const> args,
+                                  FuncCall* rfcall,
+                                  std::vector<v::Var*>* arena_vars) {
+  rfcall->argc = args.size();
+  absl::SNPrintF(rfcall->func, ABSL_ARRAYSIZE(rfcall->func), "%s", func);
+  auto func_index = func_indices_.find(func);
+  rfcall->func_index =
+      func_index != func_indices_.end() ? func_index->second : -1;
 
   VLOG(1) << "CALL ENTRY: '" << func << "' with " << args.size()
           << " argument(s)";
 
   // Copy all arguments into rfcall.
   int i = 0;
+  std::vector<v::Var*> sync_before;
   for (auto* arg : args) {
-    rfcall.arg_size[i] = arg->GetSize();
-    rfcall.arg_type[i] = arg->GetType();
+    rfcall->arg_size[i] = arg->GetSize();
+    rfcall->arg_type[i] = arg->GetType();
 
     // For pointers, set the auxiliary type and size.
-    if (rfcall.arg_type[i] == v::Type::kPointer) {
+    if (rfcall->arg_type[i] == v::Type::kPointer) {
       // Cast is safe, since type is v::Type::kPointer
       auto* p = static_cast<v::Ptr*>(arg);
-      rfcall.aux_type[i] = p->GetPointedVar()->GetType();
-      rfcall.aux_size[i] = p->GetPointedVar()->GetSize();
+      rfcall->aux_type[i] = p->GetPointedVar()->GetType();
+      rfcall->aux_size[i] = p->GetPointedVar()->GetSize();
     }
 
-    // Synchronize all pointers before the call if it's needed.
-    SAPI_RETURN_IF_ERROR(SynchronizePtrBefore(arg));
+    // Allocate the memory pointed to, it is synchronized below, if needed.
+    SAPI_ASSIGN_OR_RETURN(v::Var* sync_var,
+                          PrepareSyncBefore(arg, arena_vars));
+    if (sync_var != nullptr) {
+      sync_before.push_back(sync_var);
+    }
 
     if (arg->GetType() == v::Type::kFloat) {
-      arg->GetDataFromPtr(&rfcall.args[i].arg_float,
-                          sizeof(rfcall.args[0].arg_float));
+      arg->GetDataFromPtr(&rfcall->args[i].arg_float,
+                          sizeof(rfcall->args[0].arg_float));
     } else {
-      arg->GetDataFromPtr(&rfcall.args[i].arg_int,
-                          sizeof(rfcall.args[0].arg_int));
+      arg->GetDataFromPtr(&rfcall->args[i].arg_int,
+                          sizeof(rfcall->args[0].arg_int));
     }
 
-    if (rfcall.arg_type[i] == v::Type::kFd) {
+    if (rfcall->arg_type[i] == v::Type::kFd) {
       // Cast is safe, since type is v::Type::kFd
       auto* fd = static_cast<v::Fd*>(arg);
       if (fd->GetRemoteFd() < 0) {
         SAPI_RETURN_IF_ERROR(TransferToSandboxee(fd));
       }
-      rfcall.args[i].arg_int = fd->GetRemoteFd();
+      rfcall->args[i].arg_int = fd->GetRemoteFd();
     }
 
     VLOG(1) << "CALL ARG: (" << i << "), Type: " << arg->GetTypeString()
             << ", Size: " << arg->GetSize() << ", Val: " << arg->ToString();
     ++i;
   }
-  rfcall.ret_type = ret->GetType();
-  rfcall.ret_size = ret->GetSize();
+  rfcall->ret_type = ret->GetType();
+  rfcall->ret_size = ret->GetSize();
 
-  // Call & receive data.
-  FuncRet fret;
-  SAPI_RETURN_IF_ERROR(
-      GetRpcChannel()->Call(rfcall, comms::kMsgCall, &fret, rfcall.ret_type));
+  // Synchronize all pointers before the call, using as few transfers as
+  // possible.
+  return TransferToSandboxee(absl::MakeConstSpan(sync_before));
+}
 
+absl::Status Sandbox::FinishCall(const FuncRet& fret, v::Callable* ret,
+                                 absl::Span<v::Callable* const> args) {
   if (fret.ret_type == v::Type::kFloat) {
     ret->SetDataFromPtr(&fret.float_val, sizeof(fret.float_val));
   } else {
@@ -362,9 +693,14 @@ absl::Status Sandbox::Call(const std::string& func, v::Callable* ret,
   }
 
   // Synchronize all pointers after the call if it's needed.
+  std::vector<v::Var*> sync_after;
   for (auto* arg : args) {
-    SAPI_RETURN_IF_ERROR(SynchronizePtrAfter(arg));
+    SAPI_ASSIGN_OR_RETURN(v::Var* sync_var, PrepareSyncAfter(arg));
+    if (sync_var != nullptr) {
+      sync_after.push_back(sync_var);
+    }
   }
+  SAPI_RETURN_IF_ERROR(TransferFromSandboxee(absl::MakeConstSpan(sync_after)));
 
   VLOG(1) << "CALL EXIT: Type: " << ret->GetTypeString()
           << ", Size: " << ret->GetSize() << ", Val: " << ret->ToString();
@@ -376,21 +712,53 @@ absl::Status Sandbox::Symbol(const char* symname, void** addr) {
   if (!is_active()) {
     return absl::UnavailableError("Sandbox not active");
   }
-  return rpc_channel_->Symbol(symname, addr);
+  if (auto it = symbols_.find(symname); it != symbols_.end()) {
+    *addr = it->second;
+    return absl::OkStatus();
+  }
+  SAPI_RETURN_IF_ERROR(rpc_channel_->Symbol(symname, addr));
+  if (*addr != nullptr) {
+    symbols_.emplace(symname, *addr);
+  }
+  return absl::OkStatus();
 }
 
 absl::Status Sandbox::TransferToSandboxee(v::Var* var) {
   if (!is_active()) {
     return absl::UnavailableError("Sandbox not active");
   }
-  return var->TransferToSandboxee(GetRpcChannel(), pid());
+  SAPI_RETURN_IF_ERROR(var->TransferToSandboxee(GetRpcChannel(), pid()));
+  MarkInSync({var});
+  return absl::OkStatus();
 }
 
 absl::Status Sandbox::TransferFromSandboxee(v::Var* var) {
   if (!is_active()) {
     return absl::UnavailableError("Sandbox not active");
   }
-  return var->TransferFromSandboxee(GetRpcChannel(), pid());
+  SAPI_RETURN_IF_ERROR(var->TransferFromSandboxee(GetRpcChannel(), pid()));
+  MarkInSync({var});
+  return absl::OkStatus();
+}
+
+absl::Status Sandbox::TransferToSandboxee(absl::Span<v::Var* const> vars) {
+  if (!is_active()) {
+    return absl::UnavailableError("Sandbox not active");
+  }
+  SAPI_RETURN_IF_ERROR(
+      v::Var::BatchTransferToSandboxee(vars, GetRpcChannel(), pid()));
+  MarkInSync(vars);
+  return absl::OkStatus();
+}
+
+absl::Status Sandbox::TransferFromSandboxee(absl::Span<v::Var* const> vars) {
+  if (!is_active()) {
+    return absl::UnavailableError("Sandbox not active");
+  }
+  SAPI_RETURN_IF_ERROR(
+      v::Var::BatchTransferFromSandboxee(vars, GetRpcChannel(), pid()));
+  MarkInSync(vars);
+  return absl::OkStatus();
 }
 
 absl::StatusOr<std::string> Sandbox::GetCString(const v::RemotePtr& str,
@@ -21,6 +21,8 @@
 
 #include "sandboxed_api/file_toc.h"
 #include "absl/base/macros.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/types/span.h"
 #include "sandboxed_api/rpcchannel.h"
 #include "sandboxed_api/sandbox2/client.h"
 #include "sandboxed_api/sandbox2/comms.h"
@@ -31,6 +33,102 @@
 
 namespace sapi {
 
+class Sandbox;
+
+// Completion handle for a function call started with Sandbox::CallAsync(). The
+// return value and all arguments passed to CallAsync() must stay alive, and
+// memory they point to must not be modified, until Wait() has returned.
+class AsyncCall {
+ public:
+  AsyncCall(AsyncCall&&) = default;
+  AsyncCall& operator=(AsyncCall&&) = default;
+
+  // Returns whether the call has completed, i.e. whether Wait() will not block.
+  bool IsDone() const;
+
+  // Waits for the call to complete, stores the return value and synchronizes
+  // pointer arguments like Sandbox::Call() does. Must be called exactly once.
+  absl::Status Wait();
+
+ private:
+  friend class Sandbox;
+
+  AsyncCall(Sandbox* sandbox, uint64_t call_id, v::Callable* ret,
+            absl::Span<v::Callable* const> args)
+      : sandbox_(sandbox),
+        call_id_(call_id),
+        ret_(ret),
+        args_(args.begin(), args.end()) {}
+
+  Sandbox* sandbox_;
+  uint64_t call_id_;
+  v::Callable* ret_;
+  std::vector<v::Callable*> args_;
+};
+
+// A sequence of function calls which are sent to the sandboxee in a single
+// message and made one after the other, saving a round-trip per call:
+//
+//   sapi::v::GenericPtr stream;
+//   sapi::v::Int ret;
+//   sapi::CallBatch batch(&sandbox);
+//   int open = batch.Add("stream_open", &stream, path.PtrBefore());
+//   int read = batch.Add("stream_read", &ret, &stream, buffer.PtrAfter());
+//   // Passes the stream returned by the first call to the second one.
+//   SAPI_RETURN_IF_ERROR(batch.PassReturnValue(open, read, /*arg=*/0));
+//   SAPI_RETURN_IF_ERROR(batch.Run());
+//
+// All pointer arguments are synchronized before the first call, and after the
+// last one. The return values and arguments must stay alive until Run() has
+// returned.
+class CallBatch {
+ public:
+  explicit CallBatch(Sandbox* sandbox) : sandbox_(sandbox) {}
+
+  CallBatch(const CallBatch&) = delete;
+  CallBatch& operator=(const CallBatch&) = delete;
+
+  // Records a call, like Sandbox::Call() makes it. Returns the index of the
+  // call in the batch.
+  template <typename... Args>
+  int Add(const std::string& func, v::Callable* ret, Args&&... args) {
+    static_assert(sizeof...(Args) <= FuncCall::kArgsMax,
+                  "Too many arguments to sapi::CallBatch::Add()");
+    return Add(func, ret, {std::forward<Args>(args)...});
+  }
+  int Add(const std::string& func, v::Callable* ret,
+          std::initializer_list<v::Callable*> args);
+
+  // Passes the return value of the call at index 'from' as argument 'arg' of
+  // the later call at index 'to', instead of the value of the argument passed
+  // to Add(). Only integer and pointer values can be passed this way.
+  absl::Status PassReturnValue(int from, int to, int arg);
+
+  // Makes all recorded calls. The sandboxee stops at the first failing call,
+  // the return values and pointer arguments of the calls made before are
+  // stored nevertheless, see completed().
+  absl::Status Run();
+
+  // Returns the number of calls recorded.
+  int size() const { return calls_.size(); }
+
+  // Returns the number of calls completed by the last Run().
+  int completed() const { return completed_; }
+
+ private:
+  struct Call {
+    std::string func;
+    v::Callable* ret;
+    std::vector<v::Callable*> args;
+    // See BatchedFuncCall::arg_from_call.
+    int32_t arg_from_call[FuncCall::kArgsMax];
+  };
+
+  Sandbox* sandbox_;
+  std::vector<Call> calls_;
+  int completed_ = 0;
+};
+
 // The Sandbox class represents the sandboxed library. It provides users with
 // means to communicate with it (make function calls, transfer memory).
 class Sandbox {
@@ -60,6 +158,13 @@ class Sandbox {
     return Init();
   }
 
+  // Discards the state of the sandboxee by replacing it with a fresh fork of
+  // the snapshot template (see UseSnapshotTemplate()). This is much cheaper
+  // than Restart(), but it does not recover from policy violations, which
+  // terminate the whole sandbox. As with Restart(), all remote memory and file
+  // descriptors are invalidated, and pid() changes.
+  absl::Status Reset();
+
   // Getters for common fields.
   sandbox2::Comms* comms() const { return comms_; }
 
@@ -87,6 +192,21 @@ class Sandbox {
   absl::Status Call(const std::string& func, v::Callable* ret,
                     std::initializer_list<v::Callable*> args);
 
+  // Starts a call to the sandboxee and returns without waiting for its result.
+  // Several calls can be queued this way, the sandboxee processes them in
+  // order. Any other request to the sandboxee (including synchronous calls)
+  // waits for all outstanding calls to complete first.
+  template <typename... Args>
+  absl::StatusOr<AsyncCall> CallAsync(const std::string& func, v::Callable* ret,
+                                      Args&&... args) {
+    static_assert(sizeof...(Args) <= FuncCall::kArgsMax,
+                  "Too many arguments to sapi::Sandbox::CallAsync()");
+    return CallAsync(func, ret, {std::forward<Args>(args)...});
+  }
+  absl::StatusOr<AsyncCall> CallAsync(const std::string& func,
+                                      v::Callable* ret,
+                                      std::initializer_list<v::Callable*> args);
+
   // Allocates memory in the sandboxee, automatic_free indicates whether the
   // memory should be freed on the remote side when the 'var' goes out of scope.
   absl::Status Allocate(v::Var* var, bool automatic_free = false);
@@ -94,14 +214,26 @@ class Sandbox {
   // Frees memory in the sandboxee.
   absl::Status Free(v::Var* var);
 
-  // Finds the address of a symbol in the sandboxee.
+  // Finds the address of a symbol in the sandboxee. Addresses found are cached
+  // until the sandboxee is restarted or reset.
   absl::Status Symbol(const char* symname, void** addr);
 
+  // Looks up the functions 'names' in the sandboxee once, so that calls of them
+  // address the function by index instead of by name. The functions of
+  // GetFunctionNames() are resolved by Init() and Reset() already.
+  absl::Status ResolveFunctions(absl::Span<const std::string> names);
+
   // Transfers memory (both directions). Status is returned (memory transfer
   // succeeded/failed).
   absl::Status TransferToSandboxee(v::Var* var);
   absl::Status TransferFromSandboxee(v::Var* var);
 
+  // Transfers several variables at once (both directions). Variables backed by
+  // a single memory region are coalesced into one process_vm_writev()/readv()
+  // call per IOV_MAX variables.
+  absl::Status TransferToSandboxee(absl::Span<v::Var* const> vars);
+  absl::Status TransferFromSandboxee(absl::Span<v::Var* const> vars);
+
   absl::StatusOr<std::string> GetCString(const v::RemotePtr& str,
                                          size_t max_length = 10ULL
                                                              << 20 /* 10 MiB*/
@@ -124,6 +256,9 @@ class Sandbox {
   }
 
  private:
+  friend class AsyncCall;
+  friend class CallBatch;
+
   // Returns the sandbox policy. Subclasses can modify the default policy
   // builder, or return a completely new policy.
   virtual std::unique_ptr<sandbox2::Policy> ModifyPolicy(
@@ -141,9 +276,96 @@ class Sandbox {
   // Modifies the Executor object if needed.
   virtual void ModifyExecutor(sandbox2::Executor* executor) {}
 
+  // Functions to resolve when the sandboxee is started, see
+  // ResolveFunctions(). Generated sandboxes return all functions of their API.
+  virtual std::vector<std::string> GetFunctionNames() const { return {}; }
+
+  // Whether function calls should be exchanged over a shared-memory ring
+  // instead of the Comms channel. This avoids the socket round-trip for every
+  // call, at the cost of the sandboxee briefly spinning while idle.
+  virtual bool UseSharedMemoryTransport() const { return false; }
+
+  // Whether the sandboxee should be kept as a template in the state it had
+  // right after start-up, with function calls being served by a forked copy of
+  // it, so that Reset() can be used. The policy must allow fork() and wait4().
+  // Cannot be combined with UseSharedMemoryTransport().
+  virtual bool UseSnapshotTemplate() const { return false; }
+
+  // Whether v::SharedArray variables can be used with this sandbox. This
+  // allows the sandboxee to mmap() shared memory with PROT_READ | PROT_WRITE,
+  // so it is off by default. Without it, mapping a v::SharedArray is a policy
+  // violation.
+  virtual bool UseSharedArrays() const { return false; }
+
+  // Whether the policy is built once per process and shared by all sandboxes
+  // of this type, see sandbox2::PolicyCache. The time saved is reported by
+  // sandbox2::PolicyCache::Global()->stats().
+  // The policy is cached by the type of the sandbox, its library, and
+  // GetPolicyCacheKey(), not by what ModifyPolicy() does. If ModifyPolicy()
+  // depends on the state of the instance, e.g. on constructor arguments, that
+  // state must be part of GetPolicyCacheKey(). Otherwise all instances get the
+  // policy built for the first one. Debug builds rebuild the policy on every
+  // cache hit and crash if it differs from the cached one.
+  virtual bool UsePolicyCache() const { return false; }
+
+  // Identifies the state of the instance which ModifyPolicy() depends on, for
+  // UsePolicyCache().
+  virtual std::string GetPolicyCacheKey() const { return ""; }
+
+  // Whether pointer arguments of Call() which are not allocated in the
+  // sandboxee yet are placed in a region reserved once per sandboxee, instead
+  // of being allocated and freed with a round-trip each. Such variables are
+  // only allocated for the duration of the call, so the library must neither
+  // keep pointers to them, nor free or reallocate them. Variables which do not
+  // fit, or which the sandboxee may reallocate (v::LenVal, v::Proto), as well
+  // as the arguments of CallAsync() are allocated as usual.
+  virtual bool UseCallArena() const { return false; }
+
+  // Maps the shared-memory ring prepared by the sandboxee and switches the
+  // RPCChannel to it.
+  absl::Status InitShmTransport();
+
+  // Resolves the functions of GetFunctionNames(), as well as all functions
+  // resolved before, in a new sandboxee.
+  absl::Status ResolveKnownFunctions();
+
   // Exits the sandboxee.
   void Exit() const;
 
+  // Allocates the variable 'ptr' points to if needed, and returns it if it has
+  // to be transferred to the sandboxee before a call (nullptr otherwise). If
+  // 'arena_vars' is set, the variable is placed in the call arena if possible,
+  // and added to 'arena_vars'.
+  absl::StatusOr<v::Var*> PrepareSyncBefore(
+      v::Callable* ptr, std::vector<v::Var*>* arena_vars = nullptr);
+
+  // Places 'var' in the call arena, reserving the arena first if needed.
+  // Returns false if the variable does not fit.
+  absl::StatusOr<bool> AllocateInCallArena(v::Var* var);
+
+  // Detaches the variables placed in the call arena from their remote memory,
+  // and makes the whole arena available to the next call.
+  void ReleaseCallArena(absl::Span<v::Var* const> arena_vars);
+
+  // Records that the sandboxee's copies of 'vars' match their local data, see
+  // v::Var::SetTrackChanges().
+  void MarkInSync(absl::Span<v::Var* const> vars) const;
+
+  // Returns the variable 'ptr' points to if it has to be transferred from the
+  // sandboxee after a call (nullptr otherwise).
+  absl::StatusOr<v::Var*> PrepareSyncAfter(v::Callable* ptr) const;
+
+  // Fills in 'rfcall' and synchronizes the arguments before a call. See
+  // PrepareSyncBefore() for 'arena_vars'.
+  absl::Status PrepareCall(const std::string& func, v::Callable* ret,
+                           absl::Span<v::Callable* const> args,
+                           FuncCall* rfcall,
+                           std::vector<v::Var*>* arena_vars = nullptr);
+
+  // Stores the return value and synchronizes the arguments after a call.
+  absl::Status FinishCall(const FuncRet& fret, v::Callable* ret,
+                          absl::Span<v::Callable* const> args);
+
   // The client to the library forkserver.
   std::unique_ptr<sandbox2::ForkClient> fork_client_;
   std::unique_ptr<sandbox2::Executor> forkserver_executor_;
@@ -161,6 +383,19 @@ class Sandbox {
   // The main pid of the sandboxee.
   pid_t pid_ = 0;
 
+  // Size of the call arena, see UseCallArena().
+  static constexpr size_t kCallArenaSize = 1 << 20;
+  // Remote memory of the call arena, reserved on first use.
+  void* call_arena_ = nullptr;
+  // Number of bytes of the call arena used by the current call.
+  size_t call_arena_used_ = 0;
+
+  // Indices of the functions resolved in the sandboxee, or -1 for functions
+  // which were not found.
+  absl::flat_hash_map<std::string, int32_t> func_indices_;
+  // Addresses found by Symbol() and ResolveFunctions().
+  absl::flat_hash_map<std::string, void*> symbols_;
+
   // FileTOC with the embedded library, takes precedence over GetLibPath if
   // present (not nullptr).
   const FileToc* embed_lib_toc_;
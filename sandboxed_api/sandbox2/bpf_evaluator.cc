@@ -0,0 +1,172 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sandboxed_api/sandbox2/bpf_evaluator.h"
+
+// IWYU pragma: no_include <asm/int-ll64.h>
+#include <linux/filter.h>
+
+#include <cstring>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+
+namespace sandbox2 {
+namespace bpf {
+
+absl::StatusOr<EvaluationResult> Evaluate(const std::vector<sock_filter>& prog,
+                                          const seccomp_data& data) {
+  uint32_t a = 0;
+  uint32_t x = 0;
+  uint32_t mem[BPF_MEMWORDS] = {0};
+  int instructions = 0;
+
+  for (size_t pc = 0; pc < prog.size(); ++pc) {
+    const sock_filter& inst = prog[pc];
+    ++instructions;
+    switch (BPF_CLASS(inst.code)) {
+      case BPF_LD:
+      case BPF_LDX: {
+        uint32_t value;
+        switch (BPF_MODE(inst.code)) {
+          case BPF_ABS:
+            if (BPF_CLASS(inst.code) != BPF_LD ||
+                BPF_SIZE(inst.code) != BPF_W ||
+                inst.k % sizeof(uint32_t) != 0 ||
+                inst.k + sizeof(uint32_t) > sizeof(data)) {
+              return absl::InvalidArgumentError(
+                  absl::StrCat("Invalid load at ", pc));
+            }
+            memcpy(&value, reinterpret_cast<const char*>(&data) + inst.k,
+                   sizeof(value));
+            break;
+          case BPF_IMM:
+            value = inst.k;
+            break;
+          case BPF_MEM:
+            if (inst.k >= BPF_MEMWORDS) {
+              return absl::InvalidArgumentError(
+                  absl::StrCat("Invalid memory load at ", pc));
+            }
+            value = mem[inst.k];
+            break;
+          case BPF_LEN:
+            value = sizeof(data);
+            break;
+          default:
+            return absl::InvalidArgumentError(
+                absl::StrCat("Invalid load mode at ", pc));
+        }
+        (BPF_CLASS(inst.code) == BPF_LD ? a : x) = value;
+        break;
+      }
+      case BPF_ST:
+      case BPF_STX:
+        if (inst.k >= BPF_MEMWORDS) {
+          return absl::InvalidArgumentError(
+              absl::StrCat("Invalid memory store at ", pc));
+        }
+        mem[inst.k] = BPF_CLASS(inst.code) == BPF_ST ? a : x;
+        break;
+      case BPF_ALU: {
+        const uint32_t operand = BPF_SRC(inst.code) == BPF_X ? x : inst.k;
+        switch (BPF_OP(inst.code)) {
+          case BPF_ADD:
+            a += operand;
+            break;
+          case BPF_SUB:
+            a -= operand;
+            break;
+          case BPF_MUL:
+            a *= operand;
+            break;
+          case BPF_DIV:
+          case BPF_MOD:
+            if (operand == 0) {
+              // The kernel aborts the program, which kills the process.
+              return EvaluationResult{SECCOMP_RET_KILL, instructions};
+            }
+            a = BPF_OP(inst.code) == BPF_DIV ? a / operand : a % operand;
+            break;
+          case BPF_OR:
+            a |= operand;
+            break;
+          case BPF_AND:
+            a &= operand;
+            break;
+          case BPF_XOR:
+            a ^= operand;
+            break;
+          case BPF_LSH:
+            a = operand < 32 ? a << operand : 0;
+            break;
+          case BPF_RSH:
+            a = operand < 32 ? a >> operand : 0;
+            break;
+          case BPF_NEG:
+            a = -a;
+            break;
+          default:
+            return absl::InvalidArgumentError(
+                absl::StrCat("Invalid ALU operation at ", pc));
+        }
+        break;
+      }
+      case BPF_JMP: {
+        if (BPF_OP(inst.code) == BPF_JA) {
+          pc += inst.k;
+          break;
+        }
+        const uint32_t operand = BPF_SRC(inst.code) == BPF_X ? x : inst.k;
+        bool taken;
+        switch (BPF_OP(inst.code)) {
+          case BPF_JEQ:
+            taken = a == operand;
+            break;
+          case BPF_JGT:
+            taken = a > operand;
+            break;
+          case BPF_JGE:
+            taken = a >= operand;
+            break;
+          case BPF_JSET:
+            taken = (a & operand) != 0;
+            break;
+          default:
+            return absl::InvalidArgumentError(
+                absl::StrCat("Invalid jump at ", pc));
+        }
+        pc += taken ? inst.jt : inst.jf;
+        break;
+      }
+      case BPF_RET:
+        return EvaluationResult{
+            BPF_RVAL(inst.code) == BPF_A ? a : inst.k, instructions};
+      case BPF_MISC:
+        if (BPF_MISCOP(inst.code) == BPF_TAX) {
+          x = a;
+        } else {
+          a = x;
+        }
+        break;
+      default:
+        return absl::InvalidArgumentError(
+            absl::StrCat("Invalid instruction at ", pc));
+    }
+  }
+  return absl::InvalidArgumentError("Program ended without a return");
+}
+
+}  // namespace bpf
+}  // namespace sandbox2
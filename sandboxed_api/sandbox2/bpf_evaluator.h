@@ -0,0 +1,45 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SANDBOXED_API_SANDBOX2_BPF_EVALUATOR_H_
+#define SANDBOXED_API_SANDBOX2_BPF_EVALUATOR_H_
+
+#include <linux/seccomp.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/statusor.h"
+
+struct sock_filter;
+
+namespace sandbox2 {
+namespace bpf {
+
+struct EvaluationResult {
+  // Value returned by the program, i.e. the seccomp action and its data.
+  uint32_t action;
+  // Number of instructions executed, including the return instruction.
+  int instructions;
+};
+
+// Runs a seccomp-bpf program on 'data', the way the kernel does. Returns an
+// error if the program is malformed (out of bounds jump or load, no return).
+absl::StatusOr<EvaluationResult> Evaluate(const std::vector<sock_filter>& prog,
+                                          const seccomp_data& data);
+
+}  // namespace bpf
+}  // namespace sandbox2
+
+#endif  // SANDBOXED_API_SANDBOX2_BPF_EVALUATOR_H_
@@ -0,0 +1,291 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Implementation of the sandbox2::Cgroup class.
+
+#include "sandboxed_api/sandbox2/cgroup.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <functional>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
+#include "absl/time/clock.h"
+#include "sandboxed_api/sandbox2/util/file_helpers.h"
+#include "sandboxed_api/sandbox2/util/path.h"
+#include "sandboxed_api/sandbox2/util/strerror.h"
+
+namespace sandbox2 {
+namespace {
+
+constexpr char kCgroupRoot[] = "/sys/fs/cgroup";
+
+// Writes 'value' to the file 'name' of the cgroup directory 'dir_fd' with a
+// single write(), as the kernel takes every write as one setting, and reports
+// invalid ones as errors of the write.
+absl::Status WriteCgroupFile(int dir_fd, absl::string_view dir,
+                             const char* name, absl::string_view value) {
+  const int fd = openat(dir_fd, name, O_WRONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "opening ", file::JoinPath(dir, name), ": ", StrError(errno)));
+  }
+  const ssize_t written = write(fd, value.data(), value.size());
+  const int saved_errno = errno;
+  close(fd);
+  if (written != static_cast<ssize_t>(value.size())) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("writing '", value, "' to ", file::JoinPath(dir, name),
+                     ": ", StrError(saved_errno)));
+  }
+  return absl::OkStatus();
+}
+
+// Makes the controllers available to the children of the cgroup 'dir'.
+absl::Status EnableControllers(const std::string& dir,
+                               const std::vector<absl::string_view>& needed) {
+  std::string enabled;
+  absl::Status status = file::GetContents(
+      file::JoinPath(dir, "cgroup.subtree_control"), &enabled,
+      file::Defaults());
+  if (!status.ok()) {
+    return status;
+  }
+  const std::vector<absl::string_view> current =
+      absl::StrSplit(absl::StripAsciiWhitespace(enabled), ' ');
+  std::string missing;
+  for (absl::string_view controller : needed) {
+    if (std::find(current.begin(), current.end(), controller) ==
+        current.end()) {
+      absl::StrAppend(&missing, missing.empty() ? "+" : " +", controller);
+    }
+  }
+  if (missing.empty()) {
+    return absl::OkStatus();
+  }
+  const int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("opening ", dir, ": ", StrError(errno)));
+  }
+  status = WriteCgroupFile(dir_fd, dir, "cgroup.subtree_control", missing);
+  close(dir_fd);
+  if (!status.ok()) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        status.message(),
+        " (the parent cgroup must be delegated, and must not contain any "
+        "processes itself)"));
+  }
+  return absl::OkStatus();
+}
+
+// Parses the "key value" lines of a cgroup statistics file.
+void ForEachStat(const std::string& path,
+                 const std::function<void(absl::string_view key,
+                                          uint64_t value)>& callback) {
+  std::string contents;
+  if (!file::GetContents(path, &contents, file::Defaults()).ok()) {
+    return;
+  }
+  for (absl::string_view line :
+       absl::StrSplit(contents, '\n', absl::SkipEmpty())) {
+    std::pair<absl::string_view, absl::string_view> entry =
+        absl::StrSplit(line, ' ');
+    uint64_t value;
+    if (absl::SimpleAtoi(entry.second, &value)) {
+      callback(entry.first, value);
+    }
+  }
+}
+
+}  // namespace
+
+Cgroup::~Cgroup() {
+  close(fd_);
+  if (TryRemove()) {
+    return;
+  }
+  // Do not block the owner of the Executor until the kernel releases the last
+  // processes of the sandboxee.
+  std::thread([path = std::move(path_)] {
+    constexpr int kRetries = 100;
+    for (int i = 0;; ++i) {
+      absl::SleepFor(absl::Milliseconds(10));
+      if (rmdir(path.c_str()) == 0) {
+        return;
+      }
+      if (errno != EBUSY || i == kRetries) {
+        PLOG(WARNING) << "Could not remove cgroup " << path;
+        return;
+      }
+    }
+  }).detach();
+}
+
+bool Cgroup::TryRemove() {
+  if (removed_) {
+    return true;
+  }
+  if (rmdir(path_.c_str()) == -1) {
+    if (errno == EBUSY) {
+      return false;
+    }
+    PLOG(WARNING) << "Could not remove cgroup " << path_;
+  } else {
+    VLOG(1) << "Removed cgroup " << path_;
+  }
+  removed_ = true;
+  return true;
+}
+
+absl::StatusOr<std::string> Cgroup::GetCurrentCgroupPath() {
+  std::string contents;
+  absl::Status status =
+      file::GetContents("/proc/self/cgroup", &contents, file::Defaults());
+  if (!status.ok()) {
+    return status;
+  }
+  // The cgroup v2 hierarchy has the ID 0 and no controllers.
+  for (absl::string_view line :
+       absl::StrSplit(contents, '\n', absl::SkipEmpty())) {
+    if (absl::ConsumePrefix(&line, "0::")) {
+      return file::JoinPath(kCgroupRoot, line);
+    }
+  }
+  return absl::FailedPreconditionError(
+      "The current process is not in a cgroup v2 hierarchy");
+}
+
+absl::StatusOr<std::unique_ptr<Cgroup>> Cgroup::Create(const Limits& limits) {
+  const std::string& parent = limits.cgroup_parent();
+  if (parent.empty()) {
+    // The cgroup of the current process cannot be used, as it contains this
+    // process and so cannot enable controllers for its children.
+    return absl::FailedPreconditionError(
+        "cgroup limits require Limits::set_cgroup_parent()");
+  }
+
+  std::vector<absl::string_view> controllers;
+  if (limits.cgroup_memory_max()) {
+    controllers.push_back("memory");
+  }
+  if (limits.cgroup_cpu_max()) {
+    controllers.push_back("cpu");
+  }
+  if (limits.cgroup_pids_max()) {
+    controllers.push_back("pids");
+  }
+  if (!limits.cgroup_io_max().empty()) {
+    controllers.push_back("io");
+  }
+  absl::Status status = EnableControllers(parent, controllers);
+  if (!status.ok()) {
+    return status;
+  }
+
+  static std::atomic<int> counter{0};
+  std::string path = file::JoinPath(
+      parent, absl::StrCat("sandbox2-", getpid(), "-", counter++));
+  if (mkdir(path.c_str(), 0755) == -1) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("creating cgroup ", path, ": ", StrError(errno)));
+  }
+  const int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) {
+    const int saved_errno = errno;
+    rmdir(path.c_str());
+    return absl::FailedPreconditionError(
+        absl::StrCat("opening cgroup ", path, ": ", StrError(saved_errno)));
+  }
+  // Removes the cgroup again if a limit cannot be applied.
+  auto cgroup = absl::WrapUnique(new Cgroup(std::move(path), fd));
+
+  if (const auto& value = limits.cgroup_memory_max(); value) {
+    status = WriteCgroupFile(fd, cgroup->path(), "memory.max",
+                             absl::StrCat(*value));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  if (const auto& value = limits.cgroup_cpu_max(); value) {
+    status = WriteCgroupFile(
+        fd, cgroup->path(), "cpu.max",
+        absl::StrCat(absl::ToInt64Microseconds(value->first), " ",
+                     absl::ToInt64Microseconds(value->second)));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  if (const auto& value = limits.cgroup_pids_max(); value) {
+    status = WriteCgroupFile(fd, cgroup->path(), "pids.max",
+                             absl::StrCat(*value));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  for (const std::string& value : limits.cgroup_io_max()) {
+    status = WriteCgroupFile(fd, cgroup->path(), "io.max", value);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  VLOG(1) << "Created cgroup " << cgroup->path();
+  return cgroup;
+}
+
+CgroupStats Cgroup::GetStats() const {
+  CgroupStats stats;
+  std::string peak;
+  if (file::GetContents(file::JoinPath(path_, "memory.peak"), &peak,
+                        file::Defaults())
+          .ok()) {
+    absl::SimpleAtoi(absl::StripAsciiWhitespace(peak), &stats.memory_peak);
+  }
+  ForEachStat(file::JoinPath(path_, "cpu.stat"),
+              [&stats](absl::string_view key, uint64_t value) {
+                if (key == "usage_usec") {
+                  stats.cpu_usage = absl::Microseconds(value);
+                } else if (key == "nr_throttled") {
+                  stats.nr_throttled = value;
+                } else if (key == "throttled_usec") {
+                  stats.throttled_time = absl::Microseconds(value);
+                }
+              });
+  ForEachStat(file::JoinPath(path_, "memory.events"),
+              [&stats](absl::string_view key, uint64_t value) {
+                if (key == "oom") {
+                  stats.oom_events = value;
+                } else if (key == "oom_kill") {
+                  stats.oom_kill = value;
+                }
+              });
+  return stats;
+}
+
+}  // namespace sandbox2
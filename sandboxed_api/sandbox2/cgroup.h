@@ -0,0 +1,88 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The sandbox2::Cgroup class manages the cgroup v2 directory of a sandboxee,
+// which enforces the cgroup limits of sandbox2::Limits.
+
+#ifndef SANDBOXED_API_SANDBOX2_CGROUP_H_
+#define SANDBOXED_API_SANDBOX2_CGROUP_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "sandboxed_api/sandbox2/limits.h"
+
+namespace sandbox2 {
+
+// Resource usage of all the processes of a sandboxee, as accounted by its
+// cgroup.
+struct CgroupStats {
+  // Peak memory usage in bytes (memory.peak, requires Linux 5.19+).
+  uint64_t memory_peak = 0;
+  // CPU time used, both user and system.
+  absl::Duration cpu_usage;
+  // Number of periods in which the sandboxee was throttled by cpu.max, and the
+  // total time it was throttled for.
+  uint64_t nr_throttled = 0;
+  absl::Duration throttled_time;
+  // Number of times memory.max was hit and reclaim did not help, and the
+  // number of processes killed by the OOM killer as a result.
+  uint64_t oom_events = 0;
+  uint64_t oom_kill = 0;
+};
+
+class Cgroup final {
+ public:
+  Cgroup(const Cgroup&) = delete;
+  Cgroup& operator=(const Cgroup&) = delete;
+
+  ~Cgroup();
+
+  // Creates a new cgroup with the cgroup limits of 'limits', below
+  // limits.cgroup_parent(), which has to be set. Enables the required
+  // controllers in the parent cgroup, if they are not yet.
+  static absl::StatusOr<std::unique_ptr<Cgroup>> Create(const Limits& limits);
+
+  // Returns the cgroup of the current process, as a path below the cgroup v2
+  // mount point.
+  static absl::StatusOr<std::string> GetCurrentCgroupPath();
+
+  // Directory FD of the cgroup, for clone3(CLONE_INTO_CGROUP).
+  int fd() const { return fd_; }
+  const std::string& path() const { return path_; }
+
+  // Reads the statistics of the cgroup. Missing ones are left at zero.
+  CgroupStats GetStats() const;
+
+  // Removes the cgroup unless it still has processes, without waiting for
+  // them. Returns false if it has to be tried again. Otherwise the destructor
+  // retries in the background, as the last processes of a cgroup are only
+  // released some time after they were reaped.
+  bool TryRemove();
+
+ private:
+  Cgroup(std::string path, int fd) : path_(std::move(path)), fd_(fd) {}
+
+  std::string path_;
+  int fd_;
+  bool removed_ = false;
+};
+
+}  // namespace sandbox2
+
+#endif  // SANDBOXED_API_SANDBOX2_CGROUP_H_
@@ -0,0 +1,96 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sandboxed_api/sandbox2/cgroup.h"
+
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/strip.h"
+#include "sandboxed_api/sandbox2/limits.h"
+#include "sandboxed_api/sandbox2/testing.h"
+#include "sandboxed_api/sandbox2/util/file_helpers.h"
+#include "sandboxed_api/sandbox2/util/path.h"
+#include "sandboxed_api/util/status_matchers.h"
+
+using ::sapi::StatusIs;
+using ::testing::Eq;
+using ::testing::StartsWith;
+
+namespace sandbox2 {
+namespace {
+
+std::string ReadCgroupFile(const Cgroup& cgroup, const char* name) {
+  std::string contents;
+  EXPECT_TRUE(file::GetContents(file::JoinPath(cgroup.path(), name), &contents,
+                                file::Defaults())
+                  .ok());
+  return std::string(absl::StripAsciiWhitespace(contents));
+}
+
+TEST(CgroupTest, CurrentCgroupPath) {
+  absl::StatusOr<std::string> path = Cgroup::GetCurrentCgroupPath();
+  if (!path.ok()) {
+    GTEST_SKIP() << path.status();
+  }
+  EXPECT_THAT(*path, StartsWith("/sys/fs/cgroup"));
+  EXPECT_THAT(access(path->c_str(), F_OK), Eq(0));
+}
+
+TEST(CgroupTest, ParentIsRequired) {
+  Limits limits;
+  limits.set_cgroup_pids_max(16);
+  EXPECT_THAT(Cgroup::Create(limits),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+}
+
+TEST(CgroupTest, LimitsAreWritten) {
+  const std::string parent = GetTestCgroupParent();
+  if (parent.empty()) {
+    GTEST_SKIP() << "Requires a delegated cgroup v2 hierarchy";
+  }
+  Limits limits;
+  limits.set_cgroup_memory_max(64ULL << 20)
+      .set_cgroup_pids_max(16)
+      .set_cgroup_cpu_max(absl::Milliseconds(50), absl::Milliseconds(100))
+      .set_cgroup_parent(parent);
+  SAPI_ASSERT_OK_AND_ASSIGN(std::unique_ptr<Cgroup> cgroup,
+                            Cgroup::Create(limits));
+  const std::string path = cgroup->path();
+  EXPECT_THAT(ReadCgroupFile(*cgroup, "memory.max"), Eq("67108864"));
+  EXPECT_THAT(ReadCgroupFile(*cgroup, "pids.max"), Eq("16"));
+  EXPECT_THAT(ReadCgroupFile(*cgroup, "cpu.max"), Eq("50000 100000"));
+
+  CgroupStats stats = cgroup->GetStats();
+  EXPECT_THAT(stats.oom_kill, Eq(0));
+
+  // There are no processes in the cgroup, so it is removed right away.
+  EXPECT_TRUE(cgroup->TryRemove());
+  EXPECT_THAT(access(path.c_str(), F_OK), Eq(-1));
+}
+
+TEST(CgroupTest, InvalidLimitFails) {
+  Limits limits;
+  limits.add_cgroup_io_max("not a device")
+      .set_cgroup_parent(GetTestCgroupParent());
+  absl::StatusOr<std::unique_ptr<Cgroup>> cgroup = Cgroup::Create(limits);
+  EXPECT_FALSE(cgroup.ok());
+}
+
+}  // namespace
+}  // namespace sandbox2
@@ -35,6 +35,7 @@
 #include "absl/base/attributes.h"
 #include "absl/base/macros.h"
 #include "absl/memory/memory.h"
+#include "absl/status/status.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
@@ -177,6 +178,9 @@ void Client::ReceivePolicy() {
 
   policy_ = absl::make_unique<uint8_t[]>(policy_len_);
   memcpy(policy_.get(), bytes.data(), policy_len_);
+
+  SAPI_RAW_CHECK(comms_->RecvBytes(&user_notify_policy_),
+                 "receive user notify policy");
 }
 
 void Client::ApplyPolicyAndBecomeTracee() {
@@ -212,6 +216,33 @@ void Client::ApplyPolicyAndBecomeTracee() {
       1, "Applying policy in PID %d, sock_fprog.len: %hd entries (%d bytes)",
       syscall(__NR_gettid), prog.len, policy_len_);
 
+  if (!user_notify_policy_.empty()) {
+    // The listener fd is only returned when installing the filter. Send it to
+    // the monitor now, as the policy applied below may not allow it.
+    sock_fprog notify_prog;
+    notify_prog.len =
+        static_cast<uint16_t>(user_notify_policy_.size() / sizeof(sock_filter));
+    notify_prog.filter =
+        reinterpret_cast<sock_filter*>(user_notify_policy_.data());
+    int listener_fd = syscall(__NR_seccomp, SECCOMP_SET_MODE_FILTER,
+                              SECCOMP_FILTER_FLAG_NEW_LISTENER,
+                              reinterpret_cast<uintptr_t>(&notify_prog));
+    if (listener_fd == -1) {
+      // Not supported by older kernels, let the monitor report it.
+      SAPI_RAW_CHECK(
+          comms_->SendStatus(absl::FailedPreconditionError(absl::StrCat(
+              "setting SECCOMP_FILTER_FLAG_NEW_LISTENER flag: ",
+              StrError(errno)))),
+          "sending seccomp listener status");
+      _exit(EXIT_FAILURE);
+    }
+    SAPI_RAW_CHECK(comms_->SendStatus(absl::OkStatus()),
+                   "sending seccomp listener status");
+    SAPI_RAW_CHECK(comms_->SendFD(listener_fd), "sending seccomp listener fd");
+    // The sandboxee must not be able to answer its own notifications.
+    SAPI_RAW_PCHECK(close(listener_fd) == 0, "closing seccomp listener fd");
+  }
+
   // Signal executor we are ready to have limits applied on us and be ptraced.
   // We want limits at the last moment to avoid triggering them too early and we
   // want ptrace at the last moment to avoid synchronization deadlocks.
@@ -22,6 +22,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "sandboxed_api/sandbox2/comms.h"
 #include "sandboxed_api/sandbox2/logsink.h"
@@ -77,6 +78,10 @@ class Client {
   // Length of the policy received from the monitor.
   int policy_len_;
 
+  // Seccomp-bpf filter installed in front of the policy to trap syscalls with
+  // seccomp user notifications, empty if not used.
+  std::vector<uint8_t> user_notify_policy_;
+
   // LogSink that forwards all log messages to the supervisor.
   std::unique_ptr<LogSink> logsink_;
 
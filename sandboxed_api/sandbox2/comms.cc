@@ -327,6 +327,138 @@ bool Comms::RecvCreds(pid_t* pid, uid_t* uid, gid_t* gid) {
   return true;
 }
 
+bool Comms::SendSenderCreds() {
+  char cred_msg[CMSG_SPACE(sizeof(ucred))] = {0};
+  cmsghdr* cmsg = reinterpret_cast<cmsghdr*>(cred_msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_CREDENTIALS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(ucred));
+
+  ucred* uc = reinterpret_cast<ucred*>(CMSG_DATA(cmsg));
+  uc->pid = getpid();
+  uc->uid = getuid();
+  uc->gid = getgid();
+
+  InternalTLV tlv = {kTagCreds, 0};
+
+  iovec iov;
+  iov.iov_base = &tlv;
+  iov.iov_len = sizeof(tlv);
+
+  msghdr msg;
+  msg.msg_name = nullptr;
+  msg.msg_namelen = 0;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg;
+  msg.msg_controllen = sizeof(cred_msg);
+  msg.msg_flags = 0;
+
+  ssize_t len;
+  {
+    PotentiallyBlockingRegion region;
+    len = TEMP_FAILURE_RETRY(util::Syscall(
+        __NR_sendmsg, connection_fd_, reinterpret_cast<uintptr_t>(&msg), 0));
+  }
+  if (len == -1 && errno == EPIPE) {
+    Terminate();
+    SAPI_RAW_LOG(ERROR, "sendmsg(SCM_CREDENTIALS): Peer disconnected");
+    return false;
+  }
+  if (len < 0) {
+    if (IsFatalError(errno)) {
+      Terminate();
+    }
+    SAPI_RAW_PLOG(ERROR, "sendmsg(SCM_CREDENTIALS)");
+    return false;
+  }
+  if (len != sizeof(tlv)) {
+    SAPI_RAW_LOG(ERROR, "Expected to send %u bytes, sent %d", sizeof(tlv), len);
+    return false;
+  }
+  return true;
+}
+
+bool Comms::RecvSenderCreds(pid_t* pid, uid_t* uid, gid_t* gid) {
+  // Credentials are only passed on if enabled on the receiving socket.
+  int enable = 1;
+  if (setsockopt(connection_fd_, SOL_SOCKET, SO_PASSCRED, &enable,
+                 sizeof(enable)) == -1) {
+    SAPI_RAW_PLOG(ERROR, "setsockopt(SO_PASSCRED)");
+    return false;
+  }
+
+  char cred_msg[CMSG_SPACE(sizeof(ucred))];
+  cmsghdr* cmsg = reinterpret_cast<cmsghdr*>(cred_msg);
+
+  InternalTLV tlv;
+  iovec iov = {&tlv, sizeof(tlv)};
+
+  msghdr msg;
+  msg.msg_name = nullptr;
+  msg.msg_namelen = 0;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cmsg;
+  msg.msg_controllen = sizeof(cred_msg);
+  msg.msg_flags = 0;
+
+  ssize_t len;
+  {
+    PotentiallyBlockingRegion region;
+    len = TEMP_FAILURE_RETRY(util::Syscall(
+        __NR_recvmsg, connection_fd_, reinterpret_cast<uintptr_t>(&msg), 0));
+  }
+  if (len < 0) {
+    if (IsFatalError(errno)) {
+      Terminate();
+    }
+    SAPI_RAW_PLOG(ERROR, "recvmsg(SCM_CREDENTIALS)");
+    return false;
+  }
+  if (len == 0) {
+    Terminate();
+    SAPI_RAW_VLOG(1, "RecvSenderCreds: end-point terminated the connection.");
+    return false;
+  }
+  if (len != sizeof(tlv)) {
+    SAPI_RAW_LOG(ERROR, "Expected size: %u, got %d", sizeof(tlv), len);
+    return false;
+  }
+#ifdef MEMORY_SANITIZER
+  ABSL_ANNOTATE_MEMORY_IS_INITIALIZED(&tlv, sizeof(tlv));
+#endif
+  if (tlv.tag != kTagCreds) {
+    SAPI_RAW_LOG(ERROR, "Expected (kTagCreds: 0x%x), got: 0x%x", kTagCreds,
+                 tlv.tag);
+    return false;
+  }
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+#ifdef MEMORY_SANITIZER
+    ABSL_ANNOTATE_MEMORY_IS_INITIALIZED(cmsg, sizeof(cmsghdr));
+#endif
+    if (cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_CREDENTIALS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(ucred))) {
+      ucred uc;
+      memcpy(&uc, CMSG_DATA(cmsg), sizeof(uc));
+#ifdef MEMORY_SANITIZER
+      ABSL_ANNOTATE_MEMORY_IS_INITIALIZED(&uc, sizeof(uc));
+#endif
+      *pid = uc.pid;
+      *uid = uc.uid;
+      *gid = uc.gid;
+      SAPI_RAW_VLOG(2, "Received sender credentials PID/UID/GID: %d/%u/%u",
+                    *pid, *uid, *gid);
+      return true;
+    }
+  }
+  SAPI_RAW_LOG(ERROR, "Haven't received the SCM_CREDENTIALS message");
+  return false;
+}
+
 bool Comms::RecvFD(int* fd) {
   char fd_msg[8192];
   cmsghdr* cmsg = reinterpret_cast<cmsghdr*>(fd_msg);
@@ -58,6 +58,7 @@ class Comms {
   static constexpr uint32_t kTagBytes = 0x80000101;
   static constexpr uint32_t kTagProto2 = 0x80000102;
   static constexpr uint32_t kTagFd = 0X80000201;
+  static constexpr uint32_t kTagCreds = 0X80000202;
 
   // Any payload size above this limit will LOG(WARNING).
   static constexpr size_t kWarnMsgSize = (256ULL << 20);
@@ -144,6 +145,14 @@ class Comms {
   // Receives remote process credentials.
   bool RecvCreds(pid_t* pid, uid_t* uid, gid_t* gid);
 
+  // Sends/receives the credentials of the sending process. Unlike RecvCreds(),
+  // which reports the process which connected the socket, this identifies the
+  // process actually sending the message (e.g. a child forked after the
+  // connection was made). The PID is translated to the PID namespace of the
+  // receiver.
+  bool SendSenderCreds();
+  bool RecvSenderCreds(pid_t* pid, uid_t* uid, gid_t* gid);
+
   // Receives/sends file descriptors.
   bool RecvFD(int* fd);
   bool SendFD(int fd);
@@ -373,6 +373,22 @@ TEST_F(CommsTest, TestSendRecvCredentials) {
   HandleCommunication(sockname_, a, b);
 }
 
+TEST_F(CommsTest, TestSendRecvSenderCreds) {
+  auto a = [](Comms* comms) {
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+    ASSERT_THAT(comms->RecvSenderCreds(&pid, &uid, &gid), IsTrue());
+    EXPECT_THAT(pid, Eq(getpid()));
+    EXPECT_THAT(uid, Eq(getuid()));
+    EXPECT_THAT(gid, Eq(getgid()));
+  };
+  auto b = [](Comms* comms) {
+    ASSERT_THAT(comms->SendSenderCreds(), IsTrue());
+  };
+  HandleCommunication(sockname_, a, b);
+}
+
 TEST_F(CommsTest, TestSendTooMuchData) {
   auto a = [](Comms* comms) {
     // Nothing to do here.
@@ -0,0 +1,167 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Implementation of the sandbox2::CpuPlacement class.
+
+#include "sandboxed_api/sandbox2/cpu_placement.h"
+
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <string>
+#include <utility>
+
+#include <glog/logging.h>
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "sandboxed_api/sandbox2/util/file_helpers.h"
+
+namespace sandbox2 {
+namespace {
+
+constexpr char kNodeDir[] = "/sys/devices/system/node";
+
+// Returns the CPUs which the current thread may run on.
+std::vector<int> GetAllowedCpus() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  std::vector<int> cpus;
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    PLOG(WARNING) << "sched_getaffinity()";
+    return cpus;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+absl::StatusOr<std::vector<int>> ReadCpuList(const std::string& path) {
+  std::string contents;
+  absl::Status status = file::GetContents(path, &contents, file::Defaults());
+  if (!status.ok()) {
+    return status;
+  }
+  return CpuPlacement::ParseCpuList(absl::StripAsciiWhitespace(contents));
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<int>> CpuPlacement::ParseCpuList(
+    absl::string_view list) {
+  std::vector<int> cpus;
+  for (absl::string_view range : absl::StrSplit(list, ',', absl::SkipEmpty())) {
+    std::pair<absl::string_view, absl::string_view> bounds =
+        absl::StrSplit(range, absl::MaxSplits('-', 1));
+    int first;
+    int last;
+    if (!absl::SimpleAtoi(bounds.first, &first) ||
+        !absl::SimpleAtoi(bounds.second.empty() ? bounds.first : bounds.second,
+                          &last) ||
+        first < 0 || last < first) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid CPU list: '", list, "'"));
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::vector<std::vector<int>> CpuPlacement::GetNodes() {
+  const std::vector<int> allowed = GetAllowedCpus();
+  absl::StatusOr<std::vector<int>> online =
+      ReadCpuList(absl::StrCat(kNodeDir, "/online"));
+  if (!online.ok() || online->empty()) {
+    VLOG(1) << "NUMA topology not available, using a single node";
+    return {allowed};
+  }
+  std::vector<std::vector<int>> nodes(online->back() + 1);
+  for (int node : *online) {
+    absl::StatusOr<std::vector<int>> cpus =
+        ReadCpuList(absl::StrCat(kNodeDir, "/node", node, "/cpulist"));
+    if (!cpus.ok()) {
+      LOG(WARNING) << "Reading the CPUs of NUMA node " << node << ": "
+                   << cpus.status();
+      continue;
+    }
+    std::copy_if(cpus->begin(), cpus->end(), std::back_inserter(nodes[node]),
+                 [&allowed](int cpu) {
+                   return std::binary_search(allowed.begin(), allowed.end(),
+                                             cpu);
+                 });
+  }
+  return nodes;
+}
+
+std::vector<int> CpuPlacement::Resolve() const {
+  switch (policy_) {
+    case kAnywhere:
+      return {};
+    case kCpus: {
+      // The affinity of the sandboxee cannot include CPUs which the current
+      // thread may not run on.
+      const std::vector<int> allowed = GetAllowedCpus();
+      std::vector<int> cpus;
+      std::copy_if(cpus_.begin(), cpus_.end(), std::back_inserter(cpus),
+                   [&allowed](int cpu) {
+                     return std::binary_search(allowed.begin(), allowed.end(),
+                                               cpu);
+                   });
+      if (cpus.size() != cpus_.size()) {
+        LOG(WARNING) << "Ignoring the placement CPUs which are not allowed by "
+                        "the affinity of the current thread";
+      }
+      return cpus;
+    }
+    case kSameNodeAsCaller: {
+      const int cpu = sched_getcpu();
+      if (cpu == -1) {
+        PLOG(WARNING) << "sched_getcpu()";
+        return {};
+      }
+      for (std::vector<int>& node : GetNodes()) {
+        if (std::binary_search(node.begin(), node.end(), cpu)) {
+          return std::move(node);
+        }
+      }
+      // The CPU is on none of the known nodes.
+      return {};
+    }
+    case kRoundRobinNodes: {
+      std::vector<std::vector<int>> nodes = GetNodes();
+      nodes.erase(std::remove_if(nodes.begin(), nodes.end(),
+                                 [](const std::vector<int>& node) {
+                                   return node.empty();
+                                 }),
+                  nodes.end());
+      if (nodes.empty()) {
+        return {};
+      }
+      static std::atomic<size_t> next_node{0};
+      return std::move(nodes[next_node++ % nodes.size()]);
+    }
+  }
+  return {};
+}
+
+}  // namespace sandbox2
@@ -0,0 +1,99 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The sandbox2::CpuPlacement class decides on which CPUs a sandboxee runs.
+
+#ifndef SANDBOXED_API_SANDBOX2_CPU_PLACEMENT_H_
+#define SANDBOXED_API_SANDBOX2_CPU_PLACEMENT_H_
+
+#include <utility>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace sandbox2 {
+
+// Keeping a sandboxee on the NUMA node of the thread which talks to it keeps
+// the Comms traffic and the process_vm_readv()/process_vm_writev() transfers
+// of SAPI in local memory. Usage:
+//
+//   executor->set_cpu_placement(
+//       sandbox2::CpuPlacement::SameNodeAsCaller().set_pin_monitor(true));
+//
+// The CPUs are chosen when the sandbox is started, and set as the affinity of
+// the sandboxee before execve(), so that its memory is allocated on their node
+// from the start.
+class CpuPlacement final {
+ public:
+  enum Policy {
+    // Runs anywhere, as allowed by the affinity of the current process.
+    kAnywhere,
+    // Runs on an explicit set of CPUs.
+    kCpus,
+    // Runs on the NUMA node of the CPU of the thread starting the sandbox.
+    kSameNodeAsCaller,
+    // Runs on the next NUMA node, in turn, for every started sandbox.
+    kRoundRobinNodes,
+  };
+
+  CpuPlacement() = default;
+
+  static CpuPlacement Cpus(std::vector<int> cpus) {
+    CpuPlacement placement(kCpus);
+    placement.cpus_ = std::move(cpus);
+    return placement;
+  }
+  static CpuPlacement SameNodeAsCaller() {
+    return CpuPlacement(kSameNodeAsCaller);
+  }
+  static CpuPlacement RoundRobinNodes() {
+    return CpuPlacement(kRoundRobinNodes);
+  }
+
+  // Also pins the Monitor thread of the sandbox to the CPUs of the sandboxee.
+  // Monitors served by a MonitorReactor share their threads, and are not
+  // pinned.
+  CpuPlacement& set_pin_monitor(bool value) {
+    pin_monitor_ = value;
+    return *this;
+  }
+
+  Policy policy() const { return policy_; }
+  bool pin_monitor() const { return pin_monitor_; }
+
+  // Returns the CPUs for the next sandboxee, or an empty list if it can run
+  // anywhere. Must be called on the thread which starts the sandbox. If the
+  // NUMA topology is not available, all nodes are treated as one. Explicit CPUs
+  // which that thread may not run on are left out.
+  std::vector<int> Resolve() const;
+
+  // Returns the CPUs of each NUMA node which the calling thread may run on,
+  // indexed by node. Nodes without such CPUs are left empty.
+  static std::vector<std::vector<int>> GetNodes();
+
+  // Parses a list of CPUs in the format of the kernel, e.g. "0-3,8,10-11".
+  static absl::StatusOr<std::vector<int>> ParseCpuList(absl::string_view list);
+
+ private:
+  explicit CpuPlacement(Policy policy) : policy_(policy) {}
+
+  Policy policy_ = kAnywhere;
+  std::vector<int> cpus_;
+  bool pin_monitor_ = false;
+};
+
+}  // namespace sandbox2
+
+#endif  // SANDBOXED_API_SANDBOX2_CPU_PLACEMENT_H_
@@ -0,0 +1,135 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sandboxed_api/sandbox2/cpu_placement.h"
+
+#include <sched.h>
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "sandboxed_api/sandbox2/executor.h"
+#include "sandboxed_api/sandbox2/policybuilder.h"
+#include "sandboxed_api/sandbox2/result.h"
+#include "sandboxed_api/sandbox2/sandbox2.h"
+#include "sandboxed_api/sandbox2/testing.h"
+#include "sandboxed_api/sandbox2/util/file_helpers.h"
+#include "sandboxed_api/util/status_matchers.h"
+
+using ::sapi::IsOk;
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::IsEmpty;
+using ::testing::Not;
+
+namespace sandbox2 {
+namespace {
+
+TEST(CpuPlacementTest, ParseCpuList) {
+  SAPI_ASSERT_OK_AND_ASSIGN(std::vector<int> cpus,
+                            CpuPlacement::ParseCpuList("0-3,8,10-11"));
+  EXPECT_THAT(cpus, ElementsAre(0, 1, 2, 3, 8, 10, 11));
+  SAPI_ASSERT_OK_AND_ASSIGN(cpus, CpuPlacement::ParseCpuList(""));
+  EXPECT_THAT(cpus, IsEmpty());
+  EXPECT_THAT(CpuPlacement::ParseCpuList("3-1"), Not(IsOk()));
+  EXPECT_THAT(CpuPlacement::ParseCpuList("a"), Not(IsOk()));
+}
+
+TEST(CpuPlacementTest, Resolve) {
+  EXPECT_THAT(CpuPlacement().Resolve(), IsEmpty());
+  // CPUs which the caller may not run on are left out.
+  std::vector<std::vector<int>> nodes = CpuPlacement::GetNodes();
+  ASSERT_THAT(nodes, Not(IsEmpty()));
+  ASSERT_THAT(nodes.front(), Not(IsEmpty()));
+  const int cpu = nodes.front().front();
+  EXPECT_THAT(CpuPlacement::Cpus({cpu, CPU_SETSIZE}).Resolve(),
+              ElementsAre(cpu));
+  // The caller runs on some node.
+  EXPECT_THAT(CpuPlacement::SameNodeAsCaller().Resolve(), Not(IsEmpty()));
+
+  // Every node with allowed CPUs is used in turn.
+  std::set<std::vector<int>> expected;
+  for (std::vector<int>& node : nodes) {
+    if (!node.empty()) {
+      expected.insert(std::move(node));
+    }
+  }
+  ASSERT_THAT(expected, Not(IsEmpty()));
+  std::set<std::vector<int>> resolved;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    resolved.insert(CpuPlacement::RoundRobinNodes().Resolve());
+  }
+  EXPECT_THAT(resolved, Eq(expected));
+}
+
+TEST(CpuPlacementTest, SandboxeeRunsOnPlacedCpus) {
+  std::vector<std::vector<int>> nodes = CpuPlacement::GetNodes();
+  ASSERT_THAT(nodes, Not(IsEmpty()));
+  ASSERT_THAT(nodes.back(), Not(IsEmpty()));
+  const int cpu = nodes.back().back();
+
+  const std::string path = GetTestSourcePath("sandbox2/testcases/sleep");
+  std::vector<std::string> args = {path};
+  auto executor = absl::make_unique<Executor>(path, args);
+  executor->set_cpu_placement(CpuPlacement::Cpus({cpu}));
+  SAPI_ASSERT_OK_AND_ASSIGN(auto policy, PolicyBuilder()
+                                        // Don't restrict the syscalls at all.
+                                        .DangerDefaultAllowAll()
+                                        .TryBuild());
+  Sandbox2 sandbox(std::move(executor), std::move(policy));
+  ASSERT_TRUE(sandbox.RunAsync());
+
+  std::string status;
+  ASSERT_THAT(file::GetContents(absl::StrCat("/proc/", sandbox.GetPid(),
+                                             "/status"),
+                                &status, file::Defaults()),
+              IsOk());
+  bool found = false;
+  for (absl::string_view line : absl::StrSplit(status, '\n')) {
+    if (absl::ConsumePrefix(&line, "Cpus_allowed_list:")) {
+      EXPECT_THAT(absl::StripAsciiWhitespace(line), Eq(absl::StrCat(cpu)));
+      found = true;
+    }
+  }
+  EXPECT_TRUE(found);
+
+  sandbox.Kill();
+  EXPECT_THAT(sandbox.AwaitResult().final_status(), Eq(Result::EXTERNAL_KILL));
+}
+
+TEST(CpuPlacementTest, NoAllowedCpusFailsSetup) {
+  const std::string path = GetTestSourcePath("sandbox2/testcases/sleep");
+  std::vector<std::string> args = {path};
+  auto executor = absl::make_unique<Executor>(path, args);
+  executor->set_cpu_placement(CpuPlacement::Cpus({CPU_SETSIZE}));
+  SAPI_ASSERT_OK_AND_ASSIGN(auto policy, PolicyBuilder()
+                                        // Don't restrict the syscalls at all.
+                                        .DangerDefaultAllowAll()
+                                        .TryBuild());
+  Sandbox2 sandbox(std::move(executor), std::move(policy));
+  const Result result = sandbox.Run();
+  EXPECT_THAT(result.final_status(), Eq(Result::SETUP_ERROR));
+  EXPECT_THAT(result.reason_code(), Eq(Result::FAILED_SUBPROCESS));
+}
+
+}  // namespace
+}  // namespace sandbox2
@@ -16,6 +16,10 @@
 //
 // Usage:
 // sandbox2tool -v=1 -sandbox2_danger_danger_permit_all -logtostderr -- /bin/ls
+//
+// Recording the syscall profile of a command, for
+// PolicyBuilder::OrderSyscallsByProfile():
+// sandbox2tool -sandbox2tool_syscall_profile=/tmp/ls.profile -- /bin/ls
 
 #include <sys/resource.h>
 #include <sys/stat.h>
@@ -41,6 +45,7 @@
 #include "sandboxed_api/sandbox2/policybuilder.h"
 #include "sandboxed_api/sandbox2/result.h"
 #include "sandboxed_api/sandbox2/sandbox2.h"
+#include "sandboxed_api/sandbox2/syscall_profile.h"
 #include "sandboxed_api/sandbox2/util.h"
 #include "sandboxed_api/sandbox2/util/bpf_helper.h"
 
@@ -78,6 +83,9 @@ ABSL_FLAG(string, sandbox2tool_additional_bind_mounts, "",
           "bind mounts. Mounts are separated by comma and can optionally "
           "specify a target using \"=>\" "
           "(e.g. \"/usr,/bin,/lib,/tmp/foo=>/etc/passwd\")");
+ABSL_FLAG(string, sandbox2tool_syscall_profile, "",
+          "If not empty, count the syscalls made by the sandboxee and write "
+          "the profile to this file");
 
 namespace {
 
@@ -177,6 +185,12 @@ int main(int argc, char** argv) {
     builder.AddLibrariesForBinary(argv[1]);
   }
 
+  const std::string profile_path =
+      absl::GetFlag(FLAGS_sandbox2tool_syscall_profile);
+  if (!profile_path.empty()) {
+    builder.CollectSyscallProfile();
+  }
+
   auto policy = builder.BuildOrDie();
 
   // Current working directory.
@@ -218,6 +232,13 @@ int main(int argc, char** argv) {
 
   auto result = s2.AwaitResult();
 
+  if (!profile_path.empty()) {
+    auto status = result.syscall_profile().WriteToFile(profile_path);
+    if (!status.ok()) {
+      LOG(ERROR) << "Could not write the syscall profile: " << status;
+    }
+  }
+
   if (result.final_status() != sandbox2::Result::OK) {
     LOG(ERROR) << "Sandbox error: " << result.ToString();
     return 2;  // sandbox violation
@@ -23,9 +23,12 @@
 
 #include <climits>
 #include <cstddef>
+#include <utility>
 
 #include "absl/memory/memory.h"
+#include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
+#include "sandboxed_api/sandbox2/cgroup.h"
 #include "sandboxed_api/sandbox2/fork_client.h"
 #include "sandboxed_api/sandbox2/forkserver.pb.h"
 #include "sandboxed_api/sandbox2/global_forkclient.h"
@@ -133,11 +136,32 @@ pid_t Executor::StartSubProcess(int32_t clone_flags, const Namespace* ns,
 
   if (ns) {
     clone_flags |= ns->GetCloneFlags();
-    *request.mutable_mount_tree() = ns->mounts().GetMountTree();
+    *request.mutable_mount_tree() = ns->mounts().GetMountTreeForSandboxee();
     request.set_hostname(ns->hostname());
   }
 
   request.set_clone_flags(clone_flags);
+  request.set_prefork(prefork_);
+  request.set_namespace_pool(namespace_pool_);
+  if (cpu_placement_.policy() == CpuPlacement::kCpus && cpus_.empty()) {
+    LOG(ERROR) << "None of the CPUs of the placement are allowed for the "
+                  "sandboxee";
+    return -1;
+  }
+  for (int cpu : cpus_) {
+    request.add_cpus(cpu);
+  }
+
+  if (limits_.has_cgroup_limits()) {
+    absl::StatusOr<std::unique_ptr<Cgroup>> cgroup = Cgroup::Create(limits_);
+    if (!cgroup.ok()) {
+      LOG(ERROR) << "Could not create a cgroup for the sandboxee: "
+                 << cgroup.status();
+      return -1;
+    }
+    cgroup_ = std::move(cgroup).value();
+    request.set_join_cgroup(true);
+  }
 
   if (caps) {
     for (auto cap : *caps) {
@@ -156,7 +180,8 @@ pid_t Executor::StartSubProcess(int32_t clone_flags, const Namespace* ns,
   pid_t init_pid = -1;
 
   pid_t sandboxee_pid = fork_client_->SendRequest(
-      request, exec_fd_, client_comms_fd_, ns_fd, &init_pid);
+      request, exec_fd_, client_comms_fd_, ns_fd, &init_pid,
+      cgroup_ ? cgroup_->fd() : -1);
 
   if (init_pid < 0) {
     LOG(ERROR) << "Could not obtain init PID";
@@ -20,10 +20,13 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include <glog/logging.h>
 #include "absl/base/macros.h"
+#include "sandboxed_api/sandbox2/cgroup.h"
+#include "sandboxed_api/sandbox2/cpu_placement.h"
 #include "sandboxed_api/sandbox2/fork_client.h"
 #include "sandboxed_api/sandbox2/ipc.h"
 #include "sandboxed_api/sandbox2/limits.h"
@@ -84,6 +87,9 @@ class Executor final {
 
   Limits* limits() { return &limits_; }
 
+  // The cgroup of the sandboxee, if it has cgroup limits and was started.
+  const Cgroup* cgroup() const { return cgroup_.get(); }
+
   Executor& set_enable_sandbox_before_exec(bool value) {
     enable_sandboxing_pre_execve_ = value;
     return *this;
@@ -94,6 +100,32 @@ class Executor final {
     return *this;
   }
 
+  // Asks the ForkServer to keep up to 'value' children forked ahead of time
+  // for sandboxees with the same namespaces and mount tree as this one, which
+  // cuts the latency of starting the next ones. Only applies to sandboxees
+  // which are executed (not forked).
+  Executor& set_prefork(int value) {
+    prefork_ = value;
+    return *this;
+  }
+
+  // Asks the ForkServer to keep up to 'value' sets of network, IPC and UTS
+  // namespaces created ahead of time, as creating a network namespace may take
+  // long on a busy kernel. Each sandboxee joins a new set. Only applies to
+  // sandboxees with user and mount namespaces.
+  Executor& set_namespace_pool(int value) {
+    namespace_pool_ = value;
+    return *this;
+  }
+
+  // Sets the CPUs the sandboxee runs on, see sandbox2::CpuPlacement. They are
+  // chosen on the thread which starts the sandbox.
+  Executor& set_cpu_placement(CpuPlacement value) {
+    cpu_placement_ = std::move(value);
+    return *this;
+  }
+  const CpuPlacement& cpu_placement() const { return cpu_placement_; }
+
  private:
   friend class Monitor;
   friend class StackTracePeer;
@@ -160,6 +192,17 @@ class Executor final {
   // chdir to cwd_, if set.
   std::string cwd_;
 
+  // Number of children the ForkServer keeps prepared, see set_prefork().
+  int prefork_ = 0;
+
+  // Number of pooled namespaces in the ForkServer, see set_namespace_pool().
+  int namespace_pool_ = 0;
+
+  // Placement policy, see set_cpu_placement(), and the CPUs chosen by it for
+  // the sandboxee.
+  CpuPlacement cpu_placement_;
+  std::vector<int> cpus_;
+
   // Server (sandbox) end-point of a socket-pair used to create Comms channel
   int server_comms_fd_ = -1;
   // Client (sandboxee) end-point of a socket-pair used to create Comms channel
@@ -170,6 +213,11 @@ class Executor final {
 
   IPC ipc_;        // Used for communication with the sandboxee
   Limits limits_;  // Defines server- and client-side limits
+
+  // cgroup of the sandboxee, created when it is started if limits_ has any
+  // cgroup limits. Removed by the Monitor once the sandboxee is done, or with
+  // the Executor.
+  std::unique_ptr<Cgroup> cgroup_;
 };
 
 }  // namespace sandbox2
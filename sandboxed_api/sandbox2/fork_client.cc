@@ -14,6 +14,12 @@
 
 #include "sandboxed_api/sandbox2/fork_client.h"
 
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "absl/memory/memory.h"
 #include "sandboxed_api/sandbox2/comms.h"
 #include "sandboxed_api/sandbox2/forkserver.pb.h"
 #include "sandboxed_api/util/raw_logging.h"
@@ -23,16 +29,116 @@ namespace sandbox2 {
 const char kForkServerDisableEnv[] = "SANDBOX2_NOFORKSERVER";
 
 pid_t ForkClient::SendRequest(const ForkRequest& request, int exec_fd,
-                              int comms_fd, int user_ns_fd, pid_t* init_pid) {
-  // Acquire the channel ownership for this request (transaction).
-  absl::MutexLock l(&comms_mutex_);
+                              int comms_fd, int user_ns_fd, pid_t* init_pid,
+                              int cgroup_fd) {
+  bool use_workers;
+  {
+    absl::MutexLock lock(&workers_mutex_);
+    use_workers = max_workers_ > 1;
+  }
+  if (!use_workers) {
+    // Acquire the channel ownership for this request (transaction).
+    absl::MutexLock l(&comms_mutex_);
+    return SendRequestTo(comms_, request, exec_fd, comms_fd, user_ns_fd,
+                         init_pid, cgroup_fd);
+  }
+
+  Comms* worker = AcquireWorker();
+  if (worker == nullptr) {
+    return -1;
+  }
+  // A failed fork leaves the worker usable, only transfer errors do not.
+  bool comms_failed = false;
+  const pid_t pid = SendRequestTo(worker, request, exec_fd, comms_fd,
+                                  user_ns_fd, init_pid, cgroup_fd,
+                                  &comms_failed);
+  ReleaseWorker(worker, comms_failed);
+  return pid;
+}
+
+void ForkClient::SetMaxWorkers(int max_workers) {
+  absl::MutexLock lock(&workers_mutex_);
+  max_workers_ = std::max(max_workers, 1);
+}
+
+bool ForkClient::CanAcquireWorker() const {
+  return !idle_workers_.empty() || num_workers_ < max_workers_;
+}
+
+Comms* ForkClient::AcquireWorker() {
+  {
+    absl::MutexLock lock(&workers_mutex_);
+    workers_mutex_.Await(
+        absl::Condition(this, &ForkClient::CanAcquireWorker));
+    if (!idle_workers_.empty()) {
+      Comms* worker = idle_workers_.back();
+      idle_workers_.pop_back();
+      return worker;
+    }
+    ++num_workers_;
+  }
+
+  // Fork the worker without holding the lock, so that other requests can use
+  // the idle workers in the meantime.
+  std::unique_ptr<Comms> worker = SpawnWorker();
+  absl::MutexLock lock(&workers_mutex_);
+  if (worker == nullptr) {
+    --num_workers_;
+    return nullptr;
+  }
+  workers_.push_back(std::move(worker));
+  return workers_.back().get();
+}
+
+void ForkClient::ReleaseWorker(Comms* worker, bool failed) {
+  absl::MutexLock lock(&workers_mutex_);
+  if (!failed) {
+    idle_workers_.push_back(worker);
+    return;
+  }
+  // The channel may be out of sync, start over with a new worker.
+  --num_workers_;
+  workers_.erase(std::find_if(
+      workers_.begin(), workers_.end(),
+      [worker](const std::unique_ptr<Comms>& w) { return w.get() == worker; }));
+}
+
+std::unique_ptr<Comms> ForkClient::SpawnWorker() {
+  int sv[2];
+  if (socketpair(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+    SAPI_RAW_PLOG(ERROR, "creating socket pair for a ForkServer worker");
+    return nullptr;
+  }
+  ForkRequest request;
+  request.set_mode(FORKSERVER_SPAWN_WORKER);
+  pid_t pid;
+  {
+    absl::MutexLock l(&comms_mutex_);
+    pid = SendRequestTo(comms_, request, -1, sv[0], -1, nullptr, -1);
+  }
+  close(sv[0]);
+  if (pid == -1) {
+    close(sv[1]);
+    return nullptr;
+  }
+  SAPI_RAW_VLOG(1, "Started ForkServer worker %d", pid);
+  return absl::make_unique<Comms>(sv[1]);
+}
 
-  if (!comms_->SendProtoBuf(request)) {
+pid_t ForkClient::SendRequestTo(Comms* comms, const ForkRequest& request,
+                                int exec_fd, int comms_fd, int user_ns_fd,
+                                pid_t* init_pid, int cgroup_fd,
+                                bool* comms_failed) {
+  // Any early return below is a transfer error.
+  if (comms_failed) {
+    *comms_failed = true;
+  }
+  if (!comms->SendProtoBuf(request)) {
     SAPI_RAW_LOG(ERROR, "Sending PB to the ForkServer failed");
     return -1;
   }
   SAPI_RAW_CHECK(comms_fd != -1, "comms_fd was not properly set up");
-  if (!comms_->SendFD(comms_fd)) {
+  if (!comms->SendFD(comms_fd)) {
     SAPI_RAW_LOG(ERROR, "Sending Comms FD (%d) to the ForkServer failed",
                  comms_fd);
     return -1;
@@ -40,7 +146,7 @@ pid_t ForkClient::SendRequest(const ForkRequest& request, int exec_fd,
   if (request.mode() == FORKSERVER_FORK_EXECVE ||
       request.mode() == FORKSERVER_FORK_EXECVE_SANDBOX) {
     SAPI_RAW_CHECK(exec_fd != -1, "exec_fd cannot be -1 in execve mode");
-    if (!comms_->SendFD(exec_fd)) {
+    if (!comms->SendFD(exec_fd)) {
       SAPI_RAW_LOG(ERROR, "Sending Exec FD (%d) to the ForkServer failed",
                    exec_fd);
       return -1;
@@ -49,16 +155,25 @@ pid_t ForkClient::SendRequest(const ForkRequest& request, int exec_fd,
 
   if (request.mode() == FORKSERVER_FORK_JOIN_SANDBOX_UNWIND) {
     SAPI_RAW_CHECK(user_ns_fd != -1, "user_ns_fd cannot be -1 in unwind mode");
-    if (!comms_->SendFD(user_ns_fd)) {
+    if (!comms->SendFD(user_ns_fd)) {
       SAPI_RAW_LOG(ERROR, "Sending user ns FD (%d) to the ForkServer failed",
                    user_ns_fd);
       return -1;
     }
   }
 
+  if (request.join_cgroup()) {
+    SAPI_RAW_CHECK(cgroup_fd != -1, "cgroup_fd cannot be -1 with join_cgroup");
+    if (!comms->SendFD(cgroup_fd)) {
+      SAPI_RAW_LOG(ERROR, "Sending cgroup FD (%d) to the ForkServer failed",
+                   cgroup_fd);
+      return -1;
+    }
+  }
+
   int32_t pid;
   // Receive init process ID.
-  if (!comms_->RecvInt32(&pid)) {
+  if (!comms->RecvInt32(&pid)) {
     SAPI_RAW_LOG(ERROR, "Receiving init PID from the ForkServer failed");
     return -1;
   }
@@ -67,10 +182,13 @@ pid_t ForkClient::SendRequest(const ForkRequest& request, int exec_fd,
   }
 
   // Receive sandboxee process ID.
-  if (!comms_->RecvInt32(&pid)) {
+  if (!comms->RecvInt32(&pid)) {
     SAPI_RAW_LOG(ERROR, "Receiving sandboxee PID from the ForkServer failed");
     return -1;
   }
+  if (comms_failed) {
+    *comms_failed = false;
+  }
   return static_cast<pid_t>(pid);
 }
 
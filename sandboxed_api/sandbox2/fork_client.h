@@ -17,7 +17,11 @@
 
 #include <sys/types.h>
 
+#include <memory>
+#include <vector>
+
 #include "absl/base/attributes.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/synchronization/mutex.h"
 
 namespace sandbox2 {
@@ -35,15 +39,51 @@ class ForkClient {
 
   explicit ForkClient(Comms* comms) : comms_(comms) {}
 
-  // Sends the fork request over the supplied Comms channel.
+  // Sends the fork request over the supplied Comms channel. If the request
+  // sets join_cgroup, 'cgroup_fd' is the cgroup v2 directory for the sandboxee.
   pid_t SendRequest(const ForkRequest& request, int exec_fd, int comms_fd,
-                    int user_ns_fd = -1, pid_t* init_pid = nullptr);
+                    int user_ns_fd = -1, pid_t* init_pid = nullptr,
+                    int cgroup_fd = -1);
+
+  // Lets the ForkServer serve up to 'max_workers' requests concurrently. By
+  // default, requests are served one at a time. Otherwise, the ForkServer forks
+  // workers with channels of their own whenever all existing workers are busy,
+  // and only serves requests for new workers itself. Workers are kept when the
+  // limit is lowered again.
+  void SetMaxWorkers(int max_workers);
 
  private:
+  // Sends the fork request over 'comms', which the caller must hold. Sets
+  // '*comms_failed', if not null, when -1 is returned because the request or
+  // the reply could not be transferred, as opposed to the ForkServer failing
+  // to fork.
+  static pid_t SendRequestTo(Comms* comms, const ForkRequest& request,
+                             int exec_fd, int comms_fd, int user_ns_fd,
+                             pid_t* init_pid, int cgroup_fd,
+                             bool* comms_failed = nullptr);
+
+  // Returns the channel of an idle worker, forking a new worker if the limit
+  // allows it. Returns nullptr if forking a worker failed.
+  Comms* AcquireWorker();
+  // Makes the worker available to other requests again, or drops it if its
+  // channel is out of sync after a failed transfer.
+  void ReleaseWorker(Comms* worker, bool failed);
+  // Asks the ForkServer to fork a new worker.
+  std::unique_ptr<Comms> SpawnWorker();
+
+  bool CanAcquireWorker() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(workers_mutex_);
+
   // Comms channel connecting with the ForkServer. Not owned by the object.
   Comms* comms_;
   // Mutex locking transactions (requests) over the Comms channel.
   absl::Mutex comms_mutex_;
+
+  absl::Mutex workers_mutex_;
+  int max_workers_ ABSL_GUARDED_BY(workers_mutex_) = 1;
+  // Number of workers, including the ones being forked.
+  int num_workers_ ABSL_GUARDED_BY(workers_mutex_) = 0;
+  std::vector<std::unique_ptr<Comms>> workers_ ABSL_GUARDED_BY(workers_mutex_);
+  std::vector<Comms*> idle_workers_ ABSL_GUARDED_BY(workers_mutex_);
 };
 }  // namespace sandbox2
 
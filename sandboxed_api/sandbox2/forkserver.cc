@@ -18,6 +18,8 @@
 
 #include <asm/types.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sched.h>
 #include <sys/prctl.h>
 #include <sys/socket.h>
@@ -27,12 +29,16 @@
 #include <syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <csignal>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
@@ -41,6 +47,8 @@
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/strings/str_join.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "libcap/include/sys/capability.h"
 #include "sandboxed_api/sandbox2/client.h"
 #include "sandboxed_api/sandbox2/comms.h"
@@ -58,6 +66,11 @@
 #include "sandboxed_api/util/raw_logging.h"
 
 namespace {
+
+// Keep the low FD numbers clean so that client FD mappings don't interfer
+// with us.
+constexpr int kTargetExecFd = 1022;
+
 // "Moves" the old FD to the new FD number.
 // The old FD will be closed, the new one is marked as CLOEXEC.
 void MoveToFdNumber(int* old_fd, int new_fd) {
@@ -172,6 +185,41 @@ absl::StatusOr<pid_t> ReceivePid(int signaling_fd) {
   struct ucred* ucredp = reinterpret_cast<struct ucred*>(CMSG_DATA(cmsgp));
   return ucredp->pid;
 }
+
+// Creates the socketpair over which the sandboxee sends its PID.
+void CreateSignalingSocketPair(int fds[2]) {
+  SAPI_RAW_PCHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == 0,
+                  "creating signaling socketpair");
+  for (int i = 0; i < 2; i++) {
+    int val = 1;
+    SAPI_RAW_PCHECK(
+        setsockopt(fds[i], SOL_SOCKET, SO_PASSCRED, &val, sizeof(val)) == 0,
+        "setsockopt failed");
+  }
+}
+
+// Blocks SIGPIPE in its scope, so that writing to a prepared child which is
+// gone fails with EPIPE instead of killing the ForkServer.
+class SigPipeBlocker {
+ public:
+  SigPipeBlocker() {
+    sigemptyset(&sigpipe_);
+    sigaddset(&sigpipe_, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe_, &old_mask_);
+  }
+
+  ~SigPipeBlocker() {
+    // Discard a SIGPIPE raised in the scope before unblocking it.
+    const timespec no_wait{};
+    while (sigtimedwait(&sigpipe_, nullptr, &no_wait) == SIGPIPE) {
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask_, nullptr);
+  }
+
+ private:
+  sigset_t sigpipe_;
+  sigset_t old_mask_;
+};
 }  // namespace
 
 namespace sandbox2 {
@@ -219,8 +267,6 @@ void ForkServer::LaunchChild(const ForkRequest& request, int execve_fd,
   // sandoxing can cause syscall violations (e.g. related to memory management).
   std::vector<std::string> args;
   std::vector<std::string> envs;
-  const char** argv = nullptr;
-  const char** envp = nullptr;
   if (will_execve) {
     PrepareExecveArgs(request, &args, &envs);
   }
@@ -232,6 +278,28 @@ void ForkServer::LaunchChild(const ForkRequest& request, int execve_fd,
     SAPI_RAW_LOG(WARNING, "Could not get list of current open FDs");
   }
   InitializeNamespaces(request, uid, gid, avoid_pivot_root);
+  LaunchChildInNamespaces(request, execve_fd, signaling_fd, open_fds, &args,
+                          &envs);
+}
+
+void ForkServer::LaunchChildInNamespaces(const ForkRequest& request,
+                                         int execve_fd, int signaling_fd,
+                                         const std::set<int>& open_fds,
+                                         std::vector<std::string>* args,
+                                         std::vector<std::string>* envs) {
+  bool will_execve = (request.mode() == FORKSERVER_FORK_EXECVE ||
+                      request.mode() == FORKSERVER_FORK_EXECVE_SANDBOX);
+  const char** argv = nullptr;
+  const char** envp = nullptr;
+
+  // Before anything is allocated, so that the memory of the sandboxee is on
+  // the NUMA node of its CPUs. The Executor only sends CPUs it may run on, but
+  // the ForkServer may be restricted further. The placement is not required
+  // for the sandboxee to work, so it is started anyway.
+  if (!request.cpus().empty() &&
+      !util::SetCpuAffinity({request.cpus().begin(), request.cpus().end()})) {
+    SAPI_RAW_LOG(ERROR, "Could not set the CPU affinity of the sandboxee");
+  }
 
   auto caps = cap_init();
   for (auto cap : request.capabilities()) {
@@ -283,11 +351,11 @@ void ForkServer::LaunchChild(const ForkRequest& request, int execve_fd,
     // before we enable the syscall filter.
     c.PrepareEnvironment();
 
-    envs.push_back(c.GetFdMapEnvVar());
+    envs->push_back(c.GetFdMapEnvVar());
     // Convert argv and envs to const char **. No need to free it, as the
     // code will either execve() or exit().
-    argv = util::VecStringToCharPtrArr(args);
-    envp = util::VecStringToCharPtrArr(envs);
+    argv = util::VecStringToCharPtrArr(*args);
+    envp = util::VecStringToCharPtrArr(*envs);
 
     c.EnableSandbox();
     if (request.mode() == FORKSERVER_FORK_JOIN_SANDBOX_UNWIND) {
@@ -300,78 +368,24 @@ void ForkServer::LaunchChild(const ForkRequest& request, int execve_fd,
   }
 
   if (will_execve) {
-    argv = util::VecStringToCharPtrArr(args);
-    envp = util::VecStringToCharPtrArr(envs);
+    argv = util::VecStringToCharPtrArr(*args);
+    envp = util::VecStringToCharPtrArr(*envs);
     ExecuteProcess(execve_fd, argv, envp);
     abort();
   }
 }
 
-pid_t ForkServer::ServeRequest() {
-  // Keep the low FD numbers clean so that client FD mappings don't interfer
-  // with us.
-  constexpr int kTargetExecFd = 1022;
-
-  ForkRequest fork_request;
-  if (!comms_->RecvProtoBuf(&fork_request)) {
-    if (comms_->IsTerminated()) {
-      SAPI_RAW_VLOG(1, "ForkServer Comms closed. Exiting");
-      exit(0);
-    } else {
-      SAPI_RAW_LOG(FATAL, "Failed to receive ForkServer request");
-    }
-  }
-  int comms_fd;
-  SAPI_RAW_CHECK(comms_->RecvFD(&comms_fd), "Failed to receive Comms FD");
-
-  int exec_fd = -1;
-  if (fork_request.mode() == FORKSERVER_FORK_EXECVE ||
-      fork_request.mode() == FORKSERVER_FORK_EXECVE_SANDBOX) {
-    SAPI_RAW_CHECK(comms_->RecvFD(&exec_fd), "Failed to receive Exec FD");
-    // We're duping to a high number here to avoid colliding with the IPC FDs.
-    MoveToFdNumber(&exec_fd, kTargetExecFd);
-  }
-
-  // Make the kernel notify us with SIGCHLD when the process terminates.
-  // We use sigaction(SIGCHLD, flags=SA_NOCLDWAIT) in combination with
-  // this to make sure the zombie process is reaped immediately.
-  int clone_flags = fork_request.clone_flags() | SIGCHLD;
-
-  int user_ns_fd = -1;
-  if (fork_request.mode() == FORKSERVER_FORK_JOIN_SANDBOX_UNWIND) {
-    SAPI_RAW_CHECK(comms_->RecvFD(&user_ns_fd),
-                   "Failed to receive user namespace fd");
-  }
-
-  // Store uid and gid since they will change if CLONE_NEWUSER is set.
-  uid_t uid = getuid();
-  uid_t gid = getgid();
-
-  int socketpair_fds[2];
-  SAPI_RAW_PCHECK(
-      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socketpair_fds) == 0,
-      "creating signaling socketpair");
-  for (int i = 0; i < 2; i++) {
-    int val = 1;
-    SAPI_RAW_PCHECK(setsockopt(socketpair_fds[i], SOL_SOCKET, SO_PASSCRED, &val,
-                               sizeof(val)) == 0,
-                    "setsockopt failed");
-  }
-
-  file_util::fileops::FDCloser fd_closer0{socketpair_fds[0]};
-  file_util::fileops::FDCloser fd_closer1{socketpair_fds[1]};
-
-  // Note: init_pid will be overwritten with the actual init pid if the init
-  //       process was started or stays at 0 if that is not needed - no pidns.
-  pid_t init_pid = 0;
+pid_t ForkServer::ForkChild(int clone_flags, bool avoid_pivot_root,
+                            int parent_signaling_fd, int child_signaling_fd,
+                            int cgroup_fd) {
   pid_t sandboxee_pid = -1;
-  bool avoid_pivot_root = clone_flags & (CLONE_NEWUSER | CLONE_NEWNS);
   if (avoid_pivot_root) {
     // Create initial namespaces only when they're first needed.
     // This allows sandbox2 to be still used without any namespaces support
     if (initial_mntns_fd_ == -1) {
       CreateInitialNamespaces();
     }
+    PooledNamespaces pooled = TakePooledNamespaces();
     // We first just fork a child, which will join the initial namespaces
     // Note: Not a regular fork() as one really needs to be single-threaded to
     //       setns and this is not the case with TSAN.
@@ -384,9 +398,32 @@ pid_t ForkServer::ServeRequest() {
                       "joining initial mnt namespace");
       close(initial_userns_fd_);
       close(initial_mntns_fd_);
+      // Join the pooled namespaces instead of creating new ones. They are
+      // owned by the initial user namespace, like the ones created below.
+      if (pooled.net_fd != -1) {
+        constexpr struct {
+          int PooledNamespaces::*fd;
+          int flag;
+        } kPooled[] = {
+            {&PooledNamespaces::net_fd, CLONE_NEWNET},
+            {&PooledNamespaces::ipc_fd, CLONE_NEWIPC},
+            {&PooledNamespaces::uts_fd, CLONE_NEWUTS},
+        };
+        for (const auto& ns : kPooled) {
+          if (clone_flags & ns.flag) {
+            SAPI_RAW_PCHECK(setns(pooled.*ns.fd, ns.flag) != -1,
+                            "joining pooled namespace %x", ns.flag);
+            clone_flags &= ~ns.flag;
+          }
+        }
+        ClosePooledNamespaces(&pooled);
+      }
+      DropNamespacePool();
       // Do not create new userns it will be unshared later
-      sandboxee_pid =
-          util::ForkWithFlags((clone_flags & ~CLONE_NEWUSER) | CLONE_PARENT);
+      const int flags = (clone_flags & ~CLONE_NEWUSER) | CLONE_PARENT;
+      sandboxee_pid = cgroup_fd != -1
+                          ? util::ForkWithFlagsIntoCgroup(flags, cgroup_fd)
+                          : util::ForkWithFlags(flags);
       if (sandboxee_pid == -1) {
         SAPI_RAW_LOG(ERROR, "util::ForkWithFlags(%x)", clone_flags);
       }
@@ -394,46 +431,434 @@ pid_t ForkServer::ServeRequest() {
         _exit(0);
       }
       // Send sandboxee pid
-      absl::Status status = SendPid(fd_closer1.get());
+      absl::Status status = SendPid(child_signaling_fd);
       SAPI_RAW_CHECK(status.ok(), "sending pid: %s", status.message());
-    } else if (auto pid_or = ReceivePid(fd_closer0.get()); !pid_or.ok()) {
+    } else if (auto pid_or = ReceivePid(parent_signaling_fd); !pid_or.ok()) {
       SAPI_RAW_LOG(ERROR, "receiving pid: %s", pid_or.status().message());
     } else {
       sandboxee_pid = pid_or.value();
     }
+    // Pooled namespaces are used once.
+    ClosePooledNamespaces(&pooled);
   } else {
-    sandboxee_pid = util::ForkWithFlags(clone_flags);
+    sandboxee_pid = cgroup_fd != -1
+                        ? util::ForkWithFlagsIntoCgroup(clone_flags, cgroup_fd)
+                        : util::ForkWithFlags(clone_flags);
     if (sandboxee_pid == -1) {
       SAPI_RAW_LOG(ERROR, "util::ForkWithFlags(%x)", clone_flags);
     }
     if (sandboxee_pid == 0) {
       close(initial_userns_fd_);
       close(initial_mntns_fd_);
+      DropNamespacePool();
     }
   }
+  return sandboxee_pid;
+}
 
-  // Child.
-  if (sandboxee_pid == 0) {
-    LaunchChild(fork_request, exec_fd, comms_fd, uid, gid, user_ns_fd,
-                fd_closer1.get(), avoid_pivot_root);
-    return sandboxee_pid;
+void ForkServer::StartNamespacePool() {
+  if (initial_userns_fd_ == -1) {
+    CreateInitialNamespaces();
+  }
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+    SAPI_RAW_PLOG(ERROR, "creating socketpair for the namespace pool");
+    namespace_pool_failed_ = true;
+    return;
+  }
+  const pid_t pid = util::ForkWithFlags(SIGCHLD);
+  if (pid == 0) {
+    RunNamespacePool(fds[1]);
   }
+  close(fds[1]);
+  if (pid == -1) {
+    SAPI_RAW_PLOG(ERROR, "forking the namespace pool");
+    close(fds[0]);
+    namespace_pool_failed_ = true;
+    return;
+  }
+  namespace_pool_comms_ = absl::make_unique<Comms>(fds[0]);
+}
 
-  fd_closer1.Close();
+void ForkServer::RunNamespacePool(int comms_fd) const {
+  if (prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) != 0) {
+    SAPI_RAW_PLOG(ERROR, "prctl(PR_SET_PDEATHSIG, SIGKILL)");
+    _exit(EXIT_FAILURE);
+  }
+  if (prctl(PR_SET_NAME, "S2-NS-POOL", 0, 0, 0) != 0) {
+    SAPI_RAW_PLOG(WARNING, "prctl(PR_SET_NAME, 'S2-NS-POOL')");
+  }
+  // Namespaces created by sandboxees are owned by the initial user namespace,
+  // so must be the pooled ones.
+  SAPI_RAW_PCHECK(setns(initial_userns_fd_, CLONE_NEWUSER) != -1,
+                  "joining initial user namespace");
+  SAPI_RAW_CHECK(sanitizer::CloseAllFDsExcept(
+                     {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, comms_fd}),
+                 "closing FDs of the namespace pool");
+
+  Comms comms(comms_fd);
+  bool more;
+  while (comms.RecvBool(&more) && more) {
+    if (unshare(CLONE_NEWNET | CLONE_NEWIPC | CLONE_NEWUTS) != 0) {
+      SAPI_RAW_PLOG(ERROR, "creating namespaces for the pool");
+      _exit(EXIT_FAILURE);
+    }
+    for (const char* ns : {"net", "ipc", "uts"}) {
+      const std::string path = absl::StrCat("/proc/self/ns/", ns);
+      file_util::fileops::FDCloser fd(
+          open(path.c_str(), O_RDONLY | O_CLOEXEC));
+      if (fd.get() == -1 || !comms.SendFD(fd.get())) {
+        SAPI_RAW_PLOG(ERROR, "sending %s", path);
+        _exit(EXIT_FAILURE);
+      }
+    }
+  }
+  _exit(EXIT_SUCCESS);
+}
 
-  if (fork_request.clone_flags() & CLONE_NEWPID) {
-    // The pid of the init process is equal to the child process that we've
-    // previously forked.
-    init_pid = sandboxee_pid;
-    sandboxee_pid = -1;
-    // And the actual sandboxee is forked from the init process, so we need to
-    // receive the actual PID.
-    if (auto pid_or = ReceivePid(fd_closer0.get()); !pid_or.ok()) {
-      SAPI_RAW_LOG(ERROR, "%s", pid_or.status().message());
-      kill(init_pid, SIGKILL);
-      init_pid = -1;
+void ForkServer::FillNamespacePool() {
+  if (namespace_pool_size_ == 0 || namespace_pool_failed_) {
+    return;
+  }
+  if (!namespace_pool_comms_) {
+    StartNamespacePool();
+    if (!namespace_pool_comms_) {
+      return;
+    }
+  }
+  // Collect the namespaces which are ready without waiting for the others.
+  const int fd = namespace_pool_comms_->GetConnectionFD();
+  bool ok = true;
+  while (ok && namespace_pool_pending_ > 0) {
+    pollfd pfd = {fd, POLLIN, 0};
+    if (TEMP_FAILURE_RETRY(poll(&pfd, 1, 0)) != 1) {
+      break;
+    }
+    PooledNamespaces pooled;
+    ok = namespace_pool_comms_->RecvFD(&pooled.net_fd) &&
+         namespace_pool_comms_->RecvFD(&pooled.ipc_fd) &&
+         namespace_pool_comms_->RecvFD(&pooled.uts_fd);
+    if (ok) {
+      namespace_pool_.push_back(pooled);
+      --namespace_pool_pending_;
     } else {
-      sandboxee_pid = pid_or.value();
+      ClosePooledNamespaces(&pooled);
+    }
+  }
+  {
+    SigPipeBlocker block_sigpipe;
+    while (ok && namespace_pool_.size() + namespace_pool_pending_ <
+                     namespace_pool_size_) {
+      ok = namespace_pool_comms_->SendBool(true);
+      ++namespace_pool_pending_;
+    }
+  }
+  if (!ok) {
+    SAPI_RAW_LOG(ERROR, "The namespace pool is gone, creating namespaces for "
+                        "every sandboxee");
+    namespace_pool_comms_.reset();
+    namespace_pool_pending_ = 0;
+    namespace_pool_failed_ = true;
+  }
+}
+
+ForkServer::PooledNamespaces ForkServer::TakePooledNamespaces() {
+  PooledNamespaces pooled;
+  if (namespace_pool_size_ == 0) {
+    return pooled;
+  }
+  FillNamespacePool();
+  if (namespace_pool_.empty()) {
+    SAPI_RAW_VLOG(1, "The namespace pool is empty");
+    return pooled;
+  }
+  pooled = namespace_pool_.back();
+  namespace_pool_.pop_back();
+  return pooled;
+}
+
+void ForkServer::ClosePooledNamespaces(PooledNamespaces* pooled) {
+  for (int* fd : {&pooled->net_fd, &pooled->ipc_fd, &pooled->uts_fd}) {
+    if (*fd != -1) {
+      close(*fd);
+      *fd = -1;
+    }
+  }
+}
+
+void ForkServer::DropNamespacePool() {
+  for (PooledNamespaces& pooled : namespace_pool_) {
+    ClosePooledNamespaces(&pooled);
+  }
+  namespace_pool_.clear();
+  namespace_pool_comms_.reset();
+  namespace_pool_pending_ = 0;
+}
+
+std::string ForkServer::GetPreforkKey(const ForkRequest& request) {
+  if (request.prefork() <= 0 ||
+      (request.mode() != FORKSERVER_FORK_EXECVE &&
+       request.mode() != FORKSERVER_FORK_EXECVE_SANDBOX)) {
+    return "";
+  }
+  // Prepared children differ only in what is set up before the request.
+  ForkRequest shape;
+  shape.set_mode(request.mode());
+  shape.set_clone_flags(request.clone_flags());
+  if (request.has_mount_tree()) {
+    *shape.mutable_mount_tree() = request.mount_tree();
+  }
+  if (request.has_hostname()) {
+    shape.set_hostname(request.hostname());
+  }
+  std::string key;
+  {
+    google::protobuf::io::StringOutputStream stream(&key);
+    google::protobuf::io::CodedOutputStream output(&stream);
+    // The mount tree is a map, which is serialized in any order otherwise.
+    output.SetSerializationDeterministic(true);
+    shape.SerializePartialToCodedStream(&output);
+  }
+  return key;
+}
+
+bool ForkServer::StartPreparedChild(const std::string& key,
+                                    const ForkRequest& request, int exec_fd,
+                                    int comms_fd, int cgroup_fd,
+                                    pid_t* init_pid, pid_t* sandboxee_pid) {
+  auto it = prepared_.find(key);
+  if (it == prepared_.end() || it->second.children.empty()) {
+    return false;
+  }
+  it->second.last_used = ++prepared_uses_;
+  const PreparedChild child = it->second.children.back();
+  it->second.children.pop_back();
+
+  file_util::fileops::FDCloser signaling_fd{child.signaling_fd};
+  // The prepared child waits for the request, so it does not run any code of
+  // the sandboxee before it is in the cgroup. With a PID namespace, it is the
+  // init process, and the sandboxee inherits its cgroup.
+  if (cgroup_fd != -1 && !util::JoinCgroup(cgroup_fd, child.pid)) {
+    kill(child.pid, SIGKILL);
+    close(child.control_fd);
+    return false;
+  }
+  bool sent;
+  {
+    SigPipeBlocker block_sigpipe;
+    Comms control(child.control_fd);
+    sent = control.SendProtoBuf(request) && control.SendFD(comms_fd) &&
+           control.SendFD(exec_fd);
+  }
+  if (!sent) {
+    SAPI_RAW_LOG(WARNING, "Prepared child %d is gone, forking a new one",
+                 child.pid);
+    kill(child.pid, SIGKILL);
+    return false;
+  }
+
+  if (!(request.clone_flags() & CLONE_NEWPID)) {
+    *init_pid = 0;
+    *sandboxee_pid = child.pid;
+    return true;
+  }
+  // The prepared child is the init process, which forks the sandboxee.
+  *init_pid = child.pid;
+  if (auto pid_or = ReceivePid(signaling_fd.get()); !pid_or.ok()) {
+    SAPI_RAW_LOG(ERROR, "%s", pid_or.status().message());
+    kill(child.pid, SIGKILL);
+    *init_pid = -1;
+    *sandboxee_pid = -1;
+  } else {
+    *sandboxee_pid = pid_or.value();
+  }
+  return true;
+}
+
+void ForkServer::PrepareChildren(const std::string& key,
+                                 const ForkRequest& request, uid_t uid,
+                                 gid_t gid) {
+  prepared_[key].last_used = ++prepared_uses_;
+  if (prepared_.size() > kMaxPreparedShapes) {
+    // Drop the children of the shape which was used least recently.
+    auto lru = prepared_.begin();
+    for (auto it = prepared_.begin(); it != prepared_.end(); ++it) {
+      if (it->second.last_used < lru->second.last_used) {
+        lru = it;
+      }
+    }
+    for (const PreparedChild& child : lru->second.children) {
+      kill(child.pid, SIGKILL);
+      close(child.control_fd);
+      close(child.signaling_fd);
+    }
+    prepared_.erase(lru);
+  }
+
+  const size_t num_children =
+      std::min<size_t>(request.prefork(), kMaxPreparedChildren);
+  std::vector<PreparedChild>& children = prepared_[key].children;
+  while (children.size() < num_children) {
+    int control_fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, control_fds) != 0) {
+      SAPI_RAW_PLOG(ERROR, "creating socketpair for a prepared child");
+      return;
+    }
+    int signaling_fds[2];
+    CreateSignalingSocketPair(signaling_fds);
+
+    const int clone_flags = request.clone_flags() | SIGCHLD;
+    const bool avoid_pivot_root = clone_flags & (CLONE_NEWUSER | CLONE_NEWNS);
+    // Prepared children are moved into the cgroup of the request later.
+    const pid_t pid = ForkChild(clone_flags, avoid_pivot_root,
+                                signaling_fds[0], signaling_fds[1],
+                                /*cgroup_fd=*/-1);
+    if (pid == 0) {
+      RunPreparedChild(request, uid, gid, control_fds[1], signaling_fds[1],
+                       avoid_pivot_root);
+    }
+    close(control_fds[1]);
+    close(signaling_fds[1]);
+    if (pid == -1) {
+      close(control_fds[0]);
+      close(signaling_fds[0]);
+      return;
+    }
+    SAPI_RAW_VLOG(1, "Prepared child %d", pid);
+    children.push_back({pid, control_fds[0], signaling_fds[0]});
+  }
+}
+
+void ForkServer::RunPreparedChild(const ForkRequest& shape, uid_t uid,
+                                  gid_t gid, int control_fd, int signaling_fd,
+                                  bool avoid_pivot_root) const {
+  // Keep the channels of other prepared children and of the ForkServer closed,
+  // so that they are noticed when they go down.
+  SAPI_RAW_CHECK(sanitizer::CloseAllFDsExcept({STDIN_FILENO, STDOUT_FILENO,
+                                               STDERR_FILENO, control_fd,
+                                               signaling_fd}),
+                 "closing FDs of a prepared child");
+  std::set<int> open_fds;
+  if (!sanitizer::GetListOfFDs(&open_fds)) {
+    SAPI_RAW_LOG(WARNING, "Could not get list of current open FDs");
+  }
+  InitializeNamespaces(shape, uid, gid, avoid_pivot_root);
+
+  // Wait for the request, which also brings the FDs which are not known in
+  // advance.
+  Comms control(control_fd);
+  ForkRequest request;
+  int comms_fd;
+  int exec_fd;
+  if (!control.RecvProtoBuf(&request) || !control.RecvFD(&comms_fd) ||
+      !control.RecvFD(&exec_fd)) {
+    _exit(EXIT_FAILURE);
+  }
+  MoveToFdNumber(&exec_fd, kTargetExecFd);
+
+  std::vector<std::string> args;
+  std::vector<std::string> envs;
+  PrepareExecveArgs(request, &args, &envs);
+  SanitizeEnvironment(comms_fd);
+  open_fds.insert({Comms::kSandbox2ClientCommsFD, kTargetExecFd});
+  LaunchChildInNamespaces(request, exec_fd, signaling_fd, open_fds, &args,
+                          &envs);
+  _exit(EXIT_FAILURE);
+}
+
+pid_t ForkServer::ServeRequest() {
+  ForkRequest fork_request;
+  if (!comms_->RecvProtoBuf(&fork_request)) {
+    if (comms_->IsTerminated()) {
+      SAPI_RAW_VLOG(1, "ForkServer Comms closed. Exiting");
+      exit(0);
+    } else {
+      SAPI_RAW_LOG(FATAL, "Failed to receive ForkServer request");
+    }
+  }
+  int comms_fd;
+  SAPI_RAW_CHECK(comms_->RecvFD(&comms_fd), "Failed to receive Comms FD");
+
+  if (fork_request.mode() == FORKSERVER_SPAWN_WORKER) {
+    return SpawnWorker(comms_fd);
+  }
+
+  int exec_fd = -1;
+  if (fork_request.mode() == FORKSERVER_FORK_EXECVE ||
+      fork_request.mode() == FORKSERVER_FORK_EXECVE_SANDBOX) {
+    SAPI_RAW_CHECK(comms_->RecvFD(&exec_fd), "Failed to receive Exec FD");
+    // We're duping to a high number here to avoid colliding with the IPC FDs.
+    MoveToFdNumber(&exec_fd, kTargetExecFd);
+  }
+
+  // Make the kernel notify us with SIGCHLD when the process terminates.
+  // We use sigaction(SIGCHLD, flags=SA_NOCLDWAIT) in combination with
+  // this to make sure the zombie process is reaped immediately.
+  int clone_flags = fork_request.clone_flags() | SIGCHLD;
+
+  int user_ns_fd = -1;
+  if (fork_request.mode() == FORKSERVER_FORK_JOIN_SANDBOX_UNWIND) {
+    SAPI_RAW_CHECK(comms_->RecvFD(&user_ns_fd),
+                   "Failed to receive user namespace fd");
+  }
+
+  int cgroup_fd = -1;
+  if (fork_request.join_cgroup()) {
+    SAPI_RAW_CHECK(comms_->RecvFD(&cgroup_fd), "Failed to receive cgroup fd");
+  }
+
+  // Store uid and gid since they will change if CLONE_NEWUSER is set.
+  uid_t uid = getuid();
+  uid_t gid = getgid();
+
+  if (fork_request.namespace_pool() > namespace_pool_size_) {
+    namespace_pool_size_ =
+        std::min<size_t>(fork_request.namespace_pool(), kMaxNamespacePool);
+  }
+
+  // Note: init_pid will be overwritten with the actual init pid if the init
+  //       process was started or stays at 0 if that is not needed - no pidns.
+  pid_t init_pid = 0;
+  pid_t sandboxee_pid = -1;
+  const std::string prefork_key = GetPreforkKey(fork_request);
+  if (prefork_key.empty() ||
+      !StartPreparedChild(prefork_key, fork_request, exec_fd, comms_fd,
+                          cgroup_fd, &init_pid, &sandboxee_pid)) {
+    int socketpair_fds[2];
+    CreateSignalingSocketPair(socketpair_fds);
+    file_util::fileops::FDCloser fd_closer0{socketpair_fds[0]};
+    file_util::fileops::FDCloser fd_closer1{socketpair_fds[1]};
+
+    bool avoid_pivot_root = clone_flags & (CLONE_NEWUSER | CLONE_NEWNS);
+    sandboxee_pid = ForkChild(clone_flags, avoid_pivot_root, fd_closer0.get(),
+                              fd_closer1.get(), cgroup_fd);
+
+    // Child.
+    if (sandboxee_pid == 0) {
+      if (cgroup_fd >= 0) {
+        close(cgroup_fd);
+      }
+      LaunchChild(fork_request, exec_fd, comms_fd, uid, gid, user_ns_fd,
+                  fd_closer1.get(), avoid_pivot_root);
+      return sandboxee_pid;
+    }
+
+    fd_closer1.Close();
+
+    if (fork_request.clone_flags() & CLONE_NEWPID) {
+      // The pid of the init process is equal to the child process that we've
+      // previously forked.
+      init_pid = sandboxee_pid;
+      sandboxee_pid = -1;
+      // And the actual sandboxee is forked from the init process, so we need
+      // to receive the actual PID.
+      if (auto pid_or = ReceivePid(fd_closer0.get()); !pid_or.ok()) {
+        SAPI_RAW_LOG(ERROR, "%s", pid_or.status().message());
+        kill(init_pid, SIGKILL);
+        init_pid = -1;
+      } else {
+        sandboxee_pid = pid_or.value();
+      }
     }
   }
 
@@ -445,13 +870,54 @@ pid_t ForkServer::ServeRequest() {
   if (user_ns_fd >= 0) {
     close(user_ns_fd);
   }
+  if (cgroup_fd >= 0) {
+    close(cgroup_fd);
+  }
   SAPI_RAW_CHECK(comms_->SendInt32(init_pid), "Failed to send init PID: %d",
                  init_pid);
   SAPI_RAW_CHECK(comms_->SendInt32(sandboxee_pid),
                  "Failed to send sandboxee PID: %d", sandboxee_pid);
+
+  // Replace the prepared child only now, so that the requester does not wait
+  // for it.
+  if (!prefork_key.empty()) {
+    PrepareChildren(prefork_key, fork_request, uid, gid);
+  }
+  FillNamespacePool();
   return sandboxee_pid;
 }
 
+pid_t ForkServer::SpawnWorker(int worker_comms_fd) {
+  // The ForkServer is single-threaded, so a plain fork() is enough.
+  const pid_t pid = util::ForkWithFlags(SIGCHLD);
+  if (pid == 0) {
+    // Take over the FD number of the current channel, and let the parent serve
+    // requests over it.
+    SAPI_RAW_PCHECK(dup2(worker_comms_fd, comms_->GetConnectionFD()) != -1,
+                    "duping the worker Comms FD");
+    close(worker_comms_fd);
+    // Prepared children belong to the parent, workers keep their own.
+    for (const auto& [key, shape] : prepared_) {
+      for (const PreparedChild& child : shape.children) {
+        close(child.control_fd);
+        close(child.signaling_fd);
+      }
+    }
+    prepared_.clear();
+    DropNamespacePool();
+    // Neither the parent death signal nor the subreaper flag are inherited.
+    SAPI_RAW_CHECK(Initialize(), "initializing the ForkServer worker");
+    return getpid();
+  }
+  if (pid == -1) {
+    SAPI_RAW_PLOG(ERROR, "forking a ForkServer worker");
+  }
+  close(worker_comms_fd);
+  SAPI_RAW_CHECK(comms_->SendInt32(0), "Failed to send init PID");
+  SAPI_RAW_CHECK(comms_->SendInt32(pid), "Failed to send worker PID");
+  return pid;
+}
+
 bool ForkServer::Initialize() {
   // If the parent goes down, so should we.
   if (prctl(PR_SET_PDEATHSIG, SIGKILL, 0, 0, 0) != 0) {
@@ -20,10 +20,14 @@
 
 #include <sys/types.h>
 
+#include <cstdint>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
 #include <glog/logging.h>
+#include "absl/container/flat_hash_map.h"
 
 namespace sandbox2 {
 
@@ -44,15 +48,106 @@ class ForkServer {
   // Receives a fork request from the master process. The started process does
   // not need to be waited for (with waitid/waitpid/wait3/wait4) as the current
   // process will have the SIGCHLD set to sa_flags=SA_NOCLDWAIT.
-  // Returns values defined as with fork() (-1 means error).
+  // Returns values defined as with fork() (-1 means error). A worker forked by
+  // FORKSERVER_SPAWN_WORKER returns its own PID, and keeps serving requests
+  // over its own channel.
   pid_t ServeRequest();
 
  private:
+  // Forks a new ForkServer which serves requests over 'worker_comms_fd'.
+  pid_t SpawnWorker(int worker_comms_fd);
+
+  // A child forked ahead of time for requests of some shape (see
+  // ForkRequest.prefork). It has its namespaces set up, and waits for the
+  // request on 'control_fd'.
+  struct PreparedChild {
+    pid_t pid;
+    int control_fd;
+    int signaling_fd;
+  };
+
+  struct PreparedShape {
+    std::vector<PreparedChild> children;
+    int64_t last_used = 0;
+  };
+
+  // Limits of the number of prepared children.
+  static constexpr size_t kMaxPreparedChildren = 16;
+  static constexpr size_t kMaxPreparedShapes = 4;
+
+  // Network, IPC and UTS namespaces created ahead of time (see
+  // ForkRequest.namespace_pool), each used by a single sandboxee.
+  struct PooledNamespaces {
+    int net_fd = -1;
+    int ipc_fd = -1;
+    int uts_fd = -1;
+  };
+
+  static constexpr size_t kMaxNamespacePool = 64;
+
+  // Forks the process which becomes the sandboxee (or its init process), in
+  // the initial namespaces if 'avoid_pivot_root' is set, and in the cgroup
+  // 'cgroup_fd' unless it is -1.
+  pid_t ForkChild(int clone_flags, bool avoid_pivot_root,
+                  int parent_signaling_fd, int child_signaling_fd,
+                  int cgroup_fd);
+
   // Creates and launched the child process.
   void LaunchChild(const ForkRequest& request, int execve_fd, int client_fd,
                    uid_t uid, gid_t gid, int user_ns_fd, int signaling_fd,
                    bool avoid_pivot_root) const;
 
+  // Finishes launching the child process once it is in its namespaces: drops
+  // capabilities, starts the init process, enables the sandbox, and executes
+  // the sandboxee.
+  static void LaunchChildInNamespaces(const ForkRequest& request,
+                                      int execve_fd, int signaling_fd,
+                                      const std::set<int>& open_fds,
+                                      std::vector<std::string>* args,
+                                      std::vector<std::string>* envs);
+
+  // Returns the key under which children for 'request' are prepared, or an
+  // empty string if it should not use prepared children.
+  static std::string GetPreforkKey(const ForkRequest& request);
+
+  // Hands the request over to a prepared child, after moving it into the
+  // cgroup 'cgroup_fd' unless it is -1. Returns false if there is none which
+  // could take it.
+  bool StartPreparedChild(const std::string& key, const ForkRequest& request,
+                          int exec_fd, int comms_fd, int cgroup_fd,
+                          pid_t* init_pid, pid_t* sandboxee_pid);
+
+  // Forks prepared children for requests of the same shape as 'request', up to
+  // the number it asks for.
+  void PrepareChildren(const std::string& key, const ForkRequest& request,
+                       uid_t uid, gid_t gid);
+
+  // Starts the process which creates the pooled namespaces.
+  void StartNamespacePool();
+
+  // Runs in the process which creates the pooled namespaces. Creates one set of
+  // namespaces per request received over 'comms_fd'.
+  void RunNamespacePool(int comms_fd) const;
+
+  // Collects the pooled namespaces which are ready, and asks for more up to
+  // the size of the pool. Does not wait for any.
+  void FillNamespacePool();
+
+  // Returns pooled namespaces, or a set of -1 FDs if there are none.
+  PooledNamespaces TakePooledNamespaces();
+
+  static void ClosePooledNamespaces(PooledNamespaces* pooled);
+
+  // Closes the pool in a child, which must not use the namespaces of the
+  // parent.
+  void DropNamespacePool();
+
+  // Runs in a prepared child. Sets up the namespaces for 'shape', then waits
+  // for the request to launch.
+  void RunPreparedChild(const ForkRequest& shape, uid_t uid, gid_t gid,
+                        int control_fd, int signaling_fd,
+                        bool avoid_pivot_root) const;
+
   // Prepares the Fork-Server (worker side, not the requester side) for work by
   // sanitizing the environment:
   // - go down if the parent goes down,
@@ -84,6 +179,15 @@ class ForkServer {
   Comms* comms_;
   int initial_mntns_fd_ = -1;
   int initial_userns_fd_ = -1;
+  // Prepared children, by the key of their requests.
+  absl::flat_hash_map<std::string, PreparedShape> prepared_;
+  int64_t prepared_uses_ = 0;
+  // Pooled namespaces, and the channel to the process which creates them.
+  std::vector<PooledNamespaces> namespace_pool_;
+  std::unique_ptr<Comms> namespace_pool_comms_;
+  size_t namespace_pool_size_ = 0;
+  size_t namespace_pool_pending_ = 0;
+  bool namespace_pool_failed_ = false;
 };
 
 }  // namespace sandbox2
@@ -18,7 +18,10 @@
 #include <sys/socket.h>
 #include <syscall.h>
 #include <unistd.h>
+
+#include <thread>  // NOLINT(build/c++11)
 #include <utility>
+#include <vector>
 
 #include <glog/logging.h>
 #include "gtest/gtest.h"
@@ -93,6 +96,26 @@ TEST(ForkserverTest, SimpleForkNoZombie) {
   EXPECT_TRUE(process_reaped);
 }
 
+TEST(ForkserverTest, ConcurrentForksWithWorkers) {
+  // Serve the requests of several threads by ForkServer workers.
+  GetGlobalForkClient()->SetMaxWorkers(4);
+  std::vector<pid_t> children(8, -1);
+  std::vector<std::thread> threads;
+  for (pid_t& child : children) {
+    threads.emplace_back(
+        [&child] { child = TestSingleRequest(FORKSERVER_FORK, -1, -1); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  GetGlobalForkClient()->SetMaxWorkers(1);
+  for (pid_t child : children) {
+    EXPECT_NE(child, -1);
+  }
+  // The ForkServer itself still serves requests.
+  ASSERT_NE(TestSingleRequest(FORKSERVER_FORK, -1, -1), -1);
+}
+
 TEST(ForkserverTest, ForkExecveWorks) {
   // Run a test binary through the FORK_EXECVE request.
   int exec_fd = GetMinimalTestcaseFd();
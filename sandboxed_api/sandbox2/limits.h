@@ -21,9 +21,13 @@
 #include <sys/resource.h>
 #include <cstdint>
 #include <ctime>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/base/macros.h"
 #include "absl/time/time.h"
+#include "absl/types/optional.h"
 
 namespace sandbox2 {
 
@@ -112,6 +116,67 @@ class Limits final {
   }
   absl::Duration wall_time_limit() const { return wall_time_limit_; }
 
+  // cgroup v2 limits. If any of them is set, the sandboxee starts in a new
+  // cgroup of its own, which also provides the cgroup statistics in
+  // sandbox2::Result. Unlike rlimits, they apply to all the processes of the
+  // sandboxee together, and also account for the page cache.
+  //
+  // Upper limit of the memory usage in bytes (memory.max).
+  Limits& set_cgroup_memory_max(uint64_t value) {
+    cgroup_memory_max_ = value;
+    return *this;
+  }
+  const absl::optional<uint64_t>& cgroup_memory_max() const {
+    return cgroup_memory_max_;
+  }
+
+  // Lets the sandboxee use up to 'quota' of CPU time in each 'period' of wall
+  // time (cpu.max), e.g. a quota of 2 periods allows for 2 full CPUs.
+  Limits& set_cgroup_cpu_max(absl::Duration quota,
+                             absl::Duration period = absl::Milliseconds(100)) {
+    cgroup_cpu_max_ = std::make_pair(quota, period);
+    return *this;
+  }
+  const absl::optional<std::pair<absl::Duration, absl::Duration>>&
+  cgroup_cpu_max() const {
+    return cgroup_cpu_max_;
+  }
+
+  // Upper limit of the number of processes and threads (pids.max).
+  Limits& set_cgroup_pids_max(uint64_t value) {
+    cgroup_pids_max_ = value;
+    return *this;
+  }
+  const absl::optional<uint64_t>& cgroup_pids_max() const {
+    return cgroup_pids_max_;
+  }
+
+  // Adds an I/O limit for a block device (io.max), in the format of the
+  // kernel, e.g. "8:16 rbps=2097152 wiops=120".
+  Limits& add_cgroup_io_max(std::string value) {
+    cgroup_io_max_.push_back(std::move(value));
+    return *this;
+  }
+  const std::vector<std::string>& cgroup_io_max() const {
+    return cgroup_io_max_;
+  }
+
+  // Sets the cgroup v2 directory under which the cgroups of sandboxees are
+  // created, e.g. "/sys/fs/cgroup/sandboxes". The controllers for the limits
+  // must be available in it, and it must not contain processes itself (the
+  // "no internal processes" rule of cgroup v2), so it cannot be the cgroup of
+  // the current process. Required for the cgroup limits above.
+  Limits& set_cgroup_parent(std::string value) {
+    cgroup_parent_ = std::move(value);
+    return *this;
+  }
+  const std::string& cgroup_parent() const { return cgroup_parent_; }
+
+  bool has_cgroup_limits() const {
+    return cgroup_memory_max_ || cgroup_cpu_max_ || cgroup_pids_max_ ||
+           !cgroup_io_max_.empty();
+  }
+
  private:
   // Initial values for limits. Fields of rlimit64 are defined as __u64,
   // so we use uint64_t here.
@@ -149,6 +214,13 @@ class Limits final {
 
   // Wall-time limit (local to Monitor).
   absl::Duration wall_time_limit_;
+
+  // cgroup v2 limits, see set_cgroup_memory_max() and others.
+  absl::optional<uint64_t> cgroup_memory_max_;
+  absl::optional<std::pair<absl::Duration, absl::Duration>> cgroup_cpu_max_;
+  absl::optional<uint64_t> cgroup_pids_max_;
+  std::vector<std::string> cgroup_io_max_;
+  std::string cgroup_parent_;
 };
 
 }  // namespace sandbox2
@@ -126,5 +126,43 @@ TEST(LimitsTest, RLimitASAllocaBigAboveLimit) {
   EXPECT_EQ(result.reason_code(), SIGSEGV);
 }
 
+// Sets cgroup limits which the testcase stays well below.
+void SetCgroupLimits(Limits* limits) {
+  limits->set_cgroup_memory_max(256ULL << 20)  // 256 MiB
+      .set_cgroup_pids_max(16)
+      .set_cgroup_cpu_max(absl::Milliseconds(500))
+      .set_cgroup_parent(GetTestCgroupParent());
+}
+
+TEST(LimitsTest, CgroupLimitsAndStats) {
+  if (GetTestCgroupParent().empty()) {
+    GTEST_SKIP() << "Requires a delegated cgroup v2 hierarchy";
+  }
+  const std::string path = GetTestSourcePath("sandbox2/testcases/limits");
+  // The last run starts from a prepared child, which is only moved into the
+  // cgroup when it takes the request.
+  for (int prefork : {0, 1, 1}) {
+    std::vector<std::string> args = {path, "1"};  // mmap(1 MiB)
+    auto executor = absl::make_unique<sandbox2::Executor>(path, args);
+    executor->set_prefork(prefork);
+    SetCgroupLimits(executor->limits());
+
+    SAPI_ASSERT_OK_AND_ASSIGN(auto policy,
+                              sandbox2::PolicyBuilder()
+                                  .DisableNamespaces()
+                                  // Don't restrict the syscalls at all.
+                                  .DangerDefaultAllowAll()
+                                  .TryBuild());
+    sandbox2::Sandbox2 s2(std::move(executor), std::move(policy));
+    auto result = s2.Run();
+
+    ASSERT_EQ(result.final_status(), sandbox2::Result::OK);
+    EXPECT_EQ(result.reason_code(), 0);
+    ASSERT_TRUE(result.cgroup_stats().has_value());
+    EXPECT_GT(result.cgroup_stats()->cpu_usage, absl::ZeroDuration());
+    EXPECT_EQ(result.cgroup_stats()->oom_kill, 0);
+  }
+}
+
 }  // namespace
 }  // namespace sandbox2
@@ -20,6 +20,7 @@
 #include <linux/posix_types.h>  // NOLINT: Needs to come before linux/ipc.h
 #include <linux/ipc.h>
 // clang-format on
+#include <linux/seccomp.h>
 #include <sched.h>
 #include <sys/mman.h>
 #include <sys/ptrace.h>
@@ -44,9 +45,14 @@
 #include <glog/logging.h>
 #include "sandboxed_api/util/flag.h"
 #include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
 #include "absl/time/time.h"
+#include "absl/types/optional.h"
+#include "sandboxed_api/sandbox2/bpf_evaluator.h"
+#include "sandboxed_api/sandbox2/cgroup.h"
 #include "sandboxed_api/sandbox2/client.h"
 #include "sandboxed_api/sandbox2/comms.h"
 #include "sandboxed_api/sandbox2/config.h"
@@ -61,6 +67,7 @@
 #include "sandboxed_api/sandbox2/sanitizer.h"
 #include "sandboxed_api/sandbox2/stack_trace.h"
 #include "sandboxed_api/sandbox2/syscall.h"
+#include "sandboxed_api/sandbox2/user_notify.h"
 #include "sandboxed_api/sandbox2/util.h"
 #include "sandboxed_api/util/raw_logging.h"
 
@@ -138,6 +145,12 @@ Monitor::Monitor(Executor* executor, Policy* policy, Notify* notify)
     log_file_ = std::fopen(path.c_str(), "a+");
     PCHECK(log_file_ != nullptr) << "Failed to open log file '" << path << "'";
   }
+  if (policy_->collect_syscall_profile_) {
+    profiled_policy_ = policy_->GetEnforcedPolicy();
+  }
+  // The Monitor is created on the thread which starts the sandbox, which
+  // CpuPlacement::SameNodeAsCaller() refers to.
+  executor_->cpus_ = executor_->cpu_placement_.Resolve();
 }
 
 Monitor::~Monitor() {
@@ -168,17 +181,19 @@ void Monitor::Run() {
   struct MonitorCleanup {
     ~MonitorCleanup() {
       getrusage(RUSAGE_THREAD, capture->result_.GetRUsageMonitor());
-      capture->notify_->EventFinished(capture->result_);
-      capture->ipc_->InternalCleanupFdMap();
-      capture->done_notification_.Notify();
+      capture->FinishCgroup();
+      capture->NotifyFinished();
     }
     Monitor* capture;
   } monitor_cleanup{this};
 
-  if (executor_->limits()->wall_time_limit() != absl::ZeroDuration()) {
-    auto deadline = absl::Now() + executor_->limits()->wall_time_limit();
-    deadline_millis_.store(absl::ToUnixMillis(deadline),
-                           std::memory_order_relaxed);
+  tracer_thread_ = pthread_self();
+
+  // Pin the Monitor before the sandboxee is started, so that the memory it
+  // allocates for the sandboxee is on the same node.
+  if (executor_->cpu_placement_.pin_monitor() && !executor_->cpus_.empty() &&
+      !util::SetCpuAffinity(executor_->cpus_)) {
+    LOG(WARNING) << "Could not pin the Monitor to the CPUs of the sandboxee";
   }
 
   // It'd be costly to initialize the sigset_t for each sigtimedwait()
@@ -189,6 +204,24 @@ void Monitor::Run() {
     return;
   }
 
+  if (!InitSetup() || !InitAttach()) {
+    return;
+  }
+
+  // Tell the parent thread (Sandbox2 object) that we're done with the initial
+  // set-up process of the sandboxee.
+  setup_notify.reset();
+
+  MainLoop(&sigtimedwait_sset);
+}
+
+bool Monitor::InitSetup() {
+  if (executor_->limits()->wall_time_limit() != absl::ZeroDuration()) {
+    auto deadline = absl::Now() + executor_->limits()->wall_time_limit();
+    deadline_millis_.store(absl::ToUnixMillis(deadline),
+                           std::memory_order_relaxed);
+  }
+
   if (SAPI_VLOG_IS_ON(1) && policy_->GetNamespace() != nullptr) {
     std::vector<std::string> outside_entries;
     std::vector<std::string> inside_entries;
@@ -210,64 +243,79 @@ void Monitor::Run() {
   }
 
   // Get PID of the sandboxee.
-  pid_t init_pid = 0;
   Namespace* ns = policy_->GetNamespace();
   bool should_have_init = ns && (ns->GetCloneFlags() & CLONE_NEWPID);
   pid_ = executor_->StartSubProcess(clone_flags, ns, policy_->GetCapabilities(),
-                                    &init_pid);
-
-  if (init_pid > 0) {
-    if (ptrace(PTRACE_SEIZE, init_pid, 0, PTRACE_O_EXITKILL) != 0) {
-      if (errno == ESRCH) {
-        SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_PTRACE);
-        return;
-      }
-      PLOG(FATAL) << "attaching to init process failed";
-    }
-  }
+                                    &init_pid_);
 
-  if (pid_ <= 0 || (should_have_init && init_pid <= 0)) {
+  if (pid_ <= 0 || (should_have_init && init_pid_ <= 0)) {
     SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_SUBPROCESS);
-    return;
+    return false;
   }
 
   if (!notify_->EventStarted(pid_, comms_)) {
     SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_NOTIFY);
-    return;
+    return false;
   }
   if (!InitSendIPC()) {
     SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_IPC);
-    return;
+    return false;
   }
   if (!InitSendCwd()) {
     SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_CWD);
-    return;
+    return false;
   }
   if (!InitSendPolicy()) {
     SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_POLICY);
-    return;
+    return false;
   }
   if (!WaitForSandboxReady()) {
     SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_WAIT);
-    return;
+    return false;
   }
   if (!InitApplyLimits()) {
     SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_LIMITS);
-    return;
+    return false;
   }
+  return true;
+}
+
+bool Monitor::InitAttach() {
+  if (init_pid_ > 0) {
+    if (ptrace(PTRACE_SEIZE, init_pid_, 0, PTRACE_O_EXITKILL) != 0) {
+      if (errno == ESRCH) {
+        SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_PTRACE);
+        return false;
+      }
+      PLOG(FATAL) << "attaching to init process failed";
+    }
+  }
+
   // This call should be the last in the init sequence, because it can cause the
   // sandboxee to enter ptrace-stopped state, in which it will not be able to
   // send any messages over the Comms channel.
   if (!InitPtraceAttach()) {
     SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_PTRACE);
-    return;
+    return false;
   }
+  return true;
+}
 
-  // Tell the parent thread (Sandbox2 object) that we're done with the initial
-  // set-up process of the sandboxee.
-  setup_notify.reset();
+void Monitor::FinishCgroup() {
+  Cgroup* cgroup = executor_->cgroup_.get();
+  if (!cgroup) {
+    return;
+  }
+  result_.set_cgroup_stats(cgroup->GetStats());
+  // Otherwise it is removed with the Executor.
+  cgroup->TryRemove();
+}
 
-  MainLoop(&sigtimedwait_sset);
+void Monitor::NotifyFinished() {
+  StopUserNotifyServer();
+  notify_->EventFinished(result_);
+  ipc_->InternalCleanupFdMap();
+  done_notification_.Notify();
 }
 
 bool Monitor::IsActivelyMonitoring() {
@@ -342,36 +390,61 @@ void Monitor::KillSandboxee() {
 // Not defined in glibc.
 #define __WPTRACEEVENT(x) ((x & 0xff0000) >> 16)
 
+void Monitor::CheckRequests() {
+  int64_t deadline = deadline_millis_.load(std::memory_order_relaxed);
+  if (deadline != 0 && absl::Now() >= absl::FromUnixMillis(deadline)) {
+    VLOG(1) << "Sandbox process hit timeout due to the walltime timer";
+    timed_out_ = true;
+    KillSandboxee();
+  }
+
+  if (!dump_stack_request_flag_.test_and_set(std::memory_order_relaxed)) {
+    should_dump_stack_ = true;
+    InterruptProcess(pid_);
+  }
+
+  if (!external_kill_request_flag_.test_and_set(std::memory_order_relaxed)) {
+    external_kill_ = true;
+    KillSandboxee();
+  }
+
+  if (network_proxy_server_ &&
+      network_proxy_server_->violation_occurred_.load(
+          std::memory_order_acquire) &&
+      !network_violation_) {
+    network_violation_ = true;
+    KillSandboxee();
+  }
+
+  // The sandboxee is killed once the result is set.
+  if (user_notify_server_ && result_.final_status() == Result::UNSET) {
+    absl::StatusOr<absl::optional<Syscall>> violation =
+        user_notify_server_->HandleNotifications();
+    if (!violation.ok()) {
+      LOG(ERROR) << "Handling seccomp user notifications failed: "
+                 << violation.status();
+      SetExitStatusCode(Result::INTERNAL_ERROR, Result::FAILED_NOTIFY);
+    } else if (violation->has_value()) {
+      ActionProcessUserNotifyViolation(**violation);
+    }
+  }
+}
+
+absl::Duration Monitor::TimeToDeadline() const {
+  int64_t deadline = deadline_millis_.load(std::memory_order_relaxed);
+  if (deadline == 0 || timed_out_) {
+    return absl::InfiniteDuration();
+  }
+  return std::max(absl::FromUnixMillis(deadline) - absl::Now(),
+                  absl::ZeroDuration());
+}
+
 void Monitor::MainLoop(sigset_t* sset) {
-  bool sandboxee_exited = false;
   int status;
   // All possible still running children of main process, will be killed due to
   // PTRACE_O_EXITKILL ptrace() flag.
   while (result_.final_status() == Result::UNSET) {
-    int64_t deadline = deadline_millis_.load(std::memory_order_relaxed);
-    if (deadline != 0 && absl::Now() >= absl::FromUnixMillis(deadline)) {
-      VLOG(1) << "Sandbox process hit timeout due to the walltime timer";
-      timed_out_ = true;
-      KillSandboxee();
-    }
-
-    if (!dump_stack_request_flag_.test_and_set(std::memory_order_relaxed)) {
-      should_dump_stack_ = true;
-      InterruptProcess(pid_);
-    }
-
-    if (!external_kill_request_flag_.test_and_set(std::memory_order_relaxed)) {
-      external_kill_ = true;
-      KillSandboxee();
-    }
-
-    if (network_proxy_server_ &&
-        network_proxy_server_->violation_occurred_.load(
-            std::memory_order_acquire) &&
-        !network_violation_) {
-      network_violation_ = true;
-      KillSandboxee();
-    }
+    CheckRequests();
 
     // It should be a non-blocking operation (hence WNOHANG), so this function
     // returns quickly if there are no events to be processed.
@@ -383,7 +456,13 @@ void Monitor::MainLoop(sigset_t* sset) {
     }
 
     if (ret == 0) {
-      constexpr timespec ts = {kWakeUpPeriodSec, kWakeUpPeriodNSec};
+      // Sleep until the next event, or until the walltime deadline expires.
+      // Ptrace stops are reported with a SIGCHLD to the whole process, which
+      // any host thread with SIGCHLD unblocked may consume, and a pidfd only
+      // reports the exit of the sandboxee. Neither a signalfd nor a pidfd can
+      // therefore replace the periodic wake-up, which catches such events.
+      const absl::Duration timeout = std::min(kWakeUpPeriod, TimeToDeadline());
+      const timespec ts = absl::ToTimespec(timeout);
       int signo = sigtimedwait(sset, nullptr, &ts);
       LOG_IF(ERROR, signo != -1 && signo != SIGCHLD)
           << "Unknown signal received: " << signo;
@@ -402,52 +481,10 @@ void Monitor::MainLoop(sigset_t* sset) {
     }
 
     VLOG(3) << "waitpid() returned with PID: " << ret << ", status: " << status;
-
-    if (WIFEXITED(status)) {
-      VLOG(1) << "PID: " << ret
-              << " finished with code: " << WEXITSTATUS(status);
-      // That's the main process, set the exit code, and exit. It will kill
-      // all remaining processes (if there are any) because of the
-      // PTRACE_O_EXITKILL ptrace() flag.
-      if (ret == pid_) {
-        if (IsActivelyMonitoring()) {
-          SetExitStatusCode(Result::OK, WEXITSTATUS(status));
-        } else {
-          SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_MONITOR);
-        }
-        sandboxee_exited = true;
-      }
-    } else if (WIFSIGNALED(status)) {
-      //  This usually does not happen, but might.
-      //  Quote from the manual:
-      //   A SIGKILL signal may still cause a PTRACE_EVENT_EXIT stop before
-      //   actual signal death.  This may be changed in the future;
-      VLOG(1) << "PID: " << ret << " terminated with signal: "
-              << util::GetSignalName(WTERMSIG(status));
-      if (ret == pid_) {
-        if (network_violation_) {
-          SetExitStatusCode(Result::VIOLATION, Result::VIOLATION_NETWORK);
-          result_.SetNetworkViolation(network_proxy_server_->violation_msg_);
-        } else if (external_kill_) {
-          SetExitStatusCode(Result::EXTERNAL_KILL, 0);
-        } else if (timed_out_) {
-          SetExitStatusCode(Result::TIMEOUT, 0);
-        } else {
-          SetExitStatusCode(Result::SIGNALED, WTERMSIG(status));
-        }
-        sandboxee_exited = true;
-      }
-    } else if (WIFSTOPPED(status)) {
-      VLOG(2) << "PID: " << ret
-              << " received signal: " << util::GetSignalName(WSTOPSIG(status))
-              << " with event: " << __WPTRACEEVENT(status);
-      StateProcessStopped(ret, status);
-    } else if (WIFCONTINUED(status)) {
-      VLOG(2) << "PID: " << ret << " is being continued";
-    }
+    HandleWaitStatus(ret, status);
   }
   // Try to make sure main pid is killed and reaped
-  if (!sandboxee_exited) {
+  if (!sandboxee_exited_) {
     kill(pid_, SIGKILL);
     constexpr auto kGracefullExitTimeout = absl::Milliseconds(200);
     auto deadline = absl::Now() + kGracefullExitTimeout;
@@ -468,23 +505,73 @@ void Monitor::MainLoop(sigset_t* sset) {
         PLOG(ERROR) << "waitpid() failed";
         break;
       }
-      if (ret == pid_ && (WIFSIGNALED(status) || WIFEXITED(status))) {
-        break;
-      }
       if (ret == 0) {
         auto ts = absl::ToTimespec(left);
         sigtimedwait(sset, nullptr, &ts);
-      } else if (WIFSTOPPED(status) &&
-                 __WPTRACEEVENT(status) == PTRACE_EVENT_EXIT) {
-        VLOG(2) << "PID: " << ret << " PTRACE_EVENT_EXIT ";
-        ContinueProcess(ret, 0);
+      } else if (HandleReapStatus(ret, status)) {
+        break;
+      }
+    }
+  }
+}
+
+void Monitor::HandleWaitStatus(pid_t pid, int status) {
+  if (WIFEXITED(status)) {
+    VLOG(1) << "PID: " << pid << " finished with code: " << WEXITSTATUS(status);
+    // That's the main process, set the exit code, and exit. It will kill
+    // all remaining processes (if there are any) because of the
+    // PTRACE_O_EXITKILL ptrace() flag.
+    if (pid == pid_) {
+      if (IsActivelyMonitoring()) {
+        SetExitStatusCode(Result::OK, WEXITSTATUS(status));
+      } else {
+        SetExitStatusCode(Result::SETUP_ERROR, Result::FAILED_MONITOR);
+      }
+      sandboxee_exited_ = true;
+    }
+  } else if (WIFSIGNALED(status)) {
+    //  This usually does not happen, but might.
+    //  Quote from the manual:
+    //   A SIGKILL signal may still cause a PTRACE_EVENT_EXIT stop before
+    //   actual signal death.  This may be changed in the future;
+    VLOG(1) << "PID: " << pid << " terminated with signal: "
+            << util::GetSignalName(WTERMSIG(status));
+    if (pid == pid_) {
+      if (network_violation_) {
+        SetExitStatusCode(Result::VIOLATION, Result::VIOLATION_NETWORK);
+        result_.SetNetworkViolation(network_proxy_server_->violation_msg_);
+      } else if (external_kill_) {
+        SetExitStatusCode(Result::EXTERNAL_KILL, 0);
+      } else if (timed_out_) {
+        SetExitStatusCode(Result::TIMEOUT, 0);
       } else {
-        kill(pid_, SIGKILL);
+        SetExitStatusCode(Result::SIGNALED, WTERMSIG(status));
       }
+      sandboxee_exited_ = true;
     }
+  } else if (WIFSTOPPED(status)) {
+    VLOG(2) << "PID: " << pid
+            << " received signal: " << util::GetSignalName(WSTOPSIG(status))
+            << " with event: " << __WPTRACEEVENT(status);
+    StateProcessStopped(pid, status);
+  } else if (WIFCONTINUED(status)) {
+    VLOG(2) << "PID: " << pid << " is being continued";
   }
 }
 
+bool Monitor::HandleReapStatus(pid_t pid, int status) {
+  if (pid == pid_ && (WIFSIGNALED(status) || WIFEXITED(status))) {
+    return true;
+  }
+  if (WIFSTOPPED(status) && __WPTRACEEVENT(status) == PTRACE_EVENT_EXIT) {
+    VLOG(2) << "PID: " << pid << " PTRACE_EVENT_EXIT ";
+    ContinueProcess(pid, 0);
+  } else {
+    kill(pid_, SIGKILL);
+  }
+  return false;
+}
+
 bool Monitor::InitSetupSignals(sigset_t* sset) {
   if (sigemptyset(sset) == -1) {
     PLOG(ERROR) << "sigemptyset()";
@@ -559,6 +646,9 @@ bool Monitor::InitApplyLimits() {
 bool Monitor::InitSendIPC() { return ipc_->SendFdsOverComms(); }
 
 bool Monitor::WaitForSandboxReady() {
+  if (policy_->UsesUserNotify() && !EnableUserNotifyServer()) {
+    return false;
+  }
   uint32_t tmp;
   if (!comms_->RecvUint32(&tmp)) {
     LOG(ERROR) << "Couldn't receive 'Client::kClient2SandboxReady' message";
@@ -696,6 +786,11 @@ void Monitor::ActionProcessSyscall(Regs* regs, const Syscall& syscall) {
     return;
   }
 
+  if (policy_->collect_syscall_profile_ &&
+      ActionProcessProfiledSyscall(regs, syscall)) {
+    return;
+  }
+
   // Notify can decide whether we want to allow this syscall. It could be useful
   // for sandbox setups in which some syscalls might still need some logging,
   // but nonetheless be allowed ('permissible syscalls' in sandbox v1).
@@ -727,6 +822,48 @@ void Monitor::ActionProcessSyscall(Regs* regs, const Syscall& syscall) {
   ActionProcessSyscallViolation(regs, syscall, kSyscallViolation);
 }
 
+bool Monitor::ActionProcessProfiledSyscall(Regs* regs,
+                                           const Syscall& syscall) {
+  result_.mutable_syscall_profile()->Add(syscall.nr());
+
+  seccomp_data data;
+  memset(&data, 0, sizeof(data));
+  data.nr = syscall.nr();
+  data.arch = Syscall::GetHostAuditArch();
+  data.instruction_pointer = syscall.instruction_pointer();
+  for (int i = 0; i < syscall.args().size(); ++i) {
+    data.args[i] = syscall.args()[i];
+  }
+  auto result = bpf::Evaluate(profiled_policy_, data);
+  if (!result.ok()) {
+    LOG(ERROR) << "Cannot evaluate the policy: " << result.status();
+    ActionProcessSyscallViolation(regs, syscall, kSyscallViolation);
+    return true;
+  }
+
+  switch (result->action & SECCOMP_RET_ACTION_FULL) {
+    case SECCOMP_RET_ALLOW:
+    case SECCOMP_RET_LOG:
+      ContinueProcess(regs->pid(), 0);
+      return true;
+    case SECCOMP_RET_ERRNO: {
+      const int error = result->action & SECCOMP_RET_DATA;
+      auto status = regs->SkipSyscallReturnValue(-error);
+      if (!status.ok()) {
+        LOG(ERROR) << status;
+      }
+      ContinueProcess(regs->pid(), 0);
+      return true;
+    }
+    case SECCOMP_RET_TRACE:
+      return false;
+    default:
+      // SECCOMP_RET_KILL_* and SECCOMP_RET_TRAP.
+      ActionProcessSyscallViolation(regs, syscall, kSyscallViolation);
+      return true;
+  }
+}
+
 void Monitor::ActionProcessSyscallViolation(Regs* regs, const Syscall& syscall,
                                             ViolationType violation_type) {
   LogSyscallViolation(syscall);
@@ -742,6 +879,15 @@ void Monitor::ActionProcessSyscallViolation(Regs* regs, const Syscall& syscall,
   }
 }
 
+void Monitor::ActionProcessUserNotifyViolation(const Syscall& syscall) {
+  LogSyscallViolation(syscall);
+  notify_->EventSyscallViolation(syscall, kSyscallViolation);
+  SetExitStatusCode(Result::VIOLATION, syscall.nr());
+  result_.SetSyscall(absl::make_unique<Syscall>(syscall));
+  result_.SetProgName(util::GetProgName(syscall.pid()));
+  result_.SetProcMaps(ReadProcMaps(pid_));
+}
+
 void Monitor::LogSyscallViolation(const Syscall& syscall) const {
   // Do not unwind libunwind.
   if (executor_->libunwind_sbox_for_pid_ != 0) {
@@ -963,10 +1109,43 @@ void Monitor::EnableNetworkProxyServer() {
   int fd = ipc_->ReceiveFd(NetworkProxyClient::kFDName);
 
   network_proxy_server_ = absl::make_unique<NetworkProxyServer>(
-      fd, &policy_->allowed_hosts_.value(), pthread_self());
+      fd, &policy_->allowed_hosts_.value(), tracer_thread_);
 
   network_proxy_thread_ = std::thread(&NetworkProxyServer::Run,
   network_proxy_server_.get());
 }
 
+bool Monitor::EnableUserNotifyServer() {
+  absl::Status status;
+  if (!comms_->RecvStatus(&status)) {
+    LOG(ERROR) << "Couldn't receive the status of the seccomp listener";
+    return false;
+  }
+  if (!status.ok()) {
+    LOG(ERROR) << "Sandboxee could not create a seccomp listener, seccomp user "
+                  "notifications require Linux 5.5 or newer: "
+               << status;
+    return false;
+  }
+  int fd;
+  if (!comms_->RecvFD(&fd)) {
+    LOG(ERROR) << "Couldn't receive the seccomp listener fd";
+    return false;
+  }
+
+  user_notify_server_ =
+      absl::make_unique<UserNotifyServer>(fd, notify_, tracer_thread_);
+  user_notify_thread_ =
+      std::thread(&UserNotifyServer::Run, user_notify_server_.get());
+  return true;
+}
+
+void Monitor::StopUserNotifyServer() {
+  if (user_notify_server_) {
+    user_notify_server_->Stop();
+    user_notify_thread_.join();
+    user_notify_server_.reset();
+  }
+}
+
 }  // namespace sandbox2
@@ -18,6 +18,7 @@
 #ifndef SANDBOXED_API_SANDBOX2_MONITOR_H_
 #define SANDBOXED_API_SANDBOX2_MONITOR_H_
 
+#include <pthread.h>
 #include <sys/resource.h>
 
 #include <atomic>
@@ -27,8 +28,10 @@
 #include <ctime>
 #include <memory>
 #include <thread>
+#include <vector>
 
 #include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
 #include "sandboxed_api/sandbox2/comms.h"
 #include "sandboxed_api/sandbox2/executor.h"
 #include "sandboxed_api/sandbox2/ipc.h"
@@ -38,6 +41,7 @@
 #include "sandboxed_api/sandbox2/regs.h"
 #include "sandboxed_api/sandbox2/result.h"
 #include "sandboxed_api/sandbox2/syscall.h"
+#include "sandboxed_api/sandbox2/user_notify.h"
 
 namespace sandbox2 {
 
@@ -52,15 +56,34 @@ class Monitor final {
   ~Monitor();
 
  private:
+  friend class MonitorReactor;
   friend class Sandbox2;
 
-  // Timeout used with sigtimedwait (0.5s).
-  static const int kWakeUpPeriodSec = 0L;
-  static const int kWakeUpPeriodNSec = (500L * 1000L * 1000L);
+  // Longest time spent in sigtimedwait(). The monitor is woken up by SIGCHLD
+  // for ptrace events, and by Sandbox2::NotifyMonitor() for requests from the
+  // host, so this only bounds the latency of a SIGCHLD which was picked up by
+  // another thread. It is not increased while the sandboxee is idle, as that
+  // would delay the handling of such a lost SIGCHLD just as much.
+  static constexpr absl::Duration kWakeUpPeriod = absl::Milliseconds(500);
 
   // Starts the Monitor.
   void Run();
 
+  // Starts the sandboxee and exchanges the initial messages with it. Sets the
+  // exit status and returns false on failure.
+  bool InitSetup();
+
+  // Attaches to the sandboxee (and its init process), which makes the calling
+  // thread its tracer. Sets the exit status and returns false on failure.
+  bool InitAttach();
+
+  // Stores the statistics of the cgroup of the sandboxee, if it has one, in the
+  // result, and removes the cgroup if its processes were released already.
+  void FinishCgroup();
+
+  // Reports the final result to Notify and to the waiters of the Monitor.
+  void NotifyFinished();
+
   // Getters for private fields.
   bool IsDone() const { return done_notification_.HasBeenNotified(); }
 
@@ -102,6 +125,20 @@ class Monitor final {
   // Waits for events from monitored clients and signals from the main process.
   void MainLoop(sigset_t* sset);
 
+  // Handles the walltime deadline and the requests from the host (kill, stack
+  // dump, network violation).
+  void CheckRequests();
+
+  // Time left until the walltime deadline, infinite if there is none.
+  absl::Duration TimeToDeadline() const;
+
+  // Handles a status change of a traced process reported by waitpid().
+  void HandleWaitStatus(pid_t pid, int status);
+
+  // Handles a status change reported by waitpid() after the result has been
+  // set, but before the main process was reaped. Returns true once it has been.
+  bool HandleReapStatus(pid_t pid, int status);
+
   // Process with given PID changed state to a stopped state.
   void StateProcessStopped(pid_t pid, int status);
 
@@ -112,6 +149,15 @@ class Monitor final {
   // PID called a traced syscall, or was killed due to syscall.
   void ActionProcessSyscall(Regs* regs, const Syscall& syscall);
 
+  // Records the syscall in the profile of the Result, and applies the action
+  // of the enforced policy to it. Returns false if the policy traces it, and it
+  // must be processed by ActionProcessSyscall().
+  bool ActionProcessProfiledSyscall(Regs* regs, const Syscall& syscall);
+
+  // Logs the syscall disallowed by the UserNotifyServer. The sandboxee is not
+  // ptrace-stopped, so no registers are collected.
+  void ActionProcessUserNotifyViolation(const Syscall& syscall);
+
   // Sets basic info status and reason code in the result object.
   void SetExitStatusCode(Result::StatusEnum final_status,
                          uintptr_t reason_code);
@@ -145,6 +191,13 @@ class Monitor final {
   // that waits for connection requests from the sandboxee.
   void EnableNetworkProxyServer();
 
+  // Receives the seccomp listener fd from the sandboxee and starts a thread
+  // handling its notifications.
+  bool EnableUserNotifyServer();
+
+  // Stops the thread started by EnableUserNotifyServer().
+  void StopUserNotifyServer();
+
   // Internal objects, owned by the Sandbox2 object.
   Executor* executor_;
   Notify* notify_;
@@ -165,6 +218,12 @@ class Monitor final {
 
   // The main tracked PID.
   pid_t pid_ = -1;
+  // PID of the init process of the sandboxee's PID namespace, if any.
+  pid_t init_pid_ = 0;
+  // Has the main tracked PID been reaped?
+  bool sandboxee_exited_ = false;
+  // Thread doing the ptrace() calls, and the waitpid() for the sandboxee.
+  pthread_t tracer_thread_;
 
   // False iff external kill is requested
   std::atomic_flag external_kill_request_flag_ = ATOMIC_FLAG_INIT;
@@ -186,12 +245,20 @@ class Monitor final {
   // Log file specified by
   // --sandbox_danger_danger_permit_all_and_log flag.
   FILE* log_file_ = nullptr;
+  // The policy enforced by the Monitor while the tracking policy collects the
+  // syscall profile, see Policy::collect_syscall_profile_.
+  std::vector<sock_filter> profiled_policy_;
 
   // Handle to the class responsible for proxying and validating connect()
   // requests.
   std::unique_ptr<NetworkProxyServer> network_proxy_server_;
 
   std::thread network_proxy_thread_;
+
+  // Handles the syscalls trapped with seccomp user notifications, if the policy
+  // uses them.
+  std::unique_ptr<UserNotifyServer> user_notify_server_;
+  std::thread user_notify_thread_;
 };
 
 }  // namespace sandbox2
@@ -0,0 +1,327 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Implementation file for the sandbox2::MonitorReactor class.
+
+#include "sandboxed_api/sandbox2/monitor_reactor.h"
+
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <string>
+#include <utility>
+
+#include <glog/logging.h>
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/notification.h"
+#include "sandboxed_api/sandbox2/monitor.h"
+#include "sandboxed_api/sandbox2/result.h"
+#include "sandboxed_api/sandbox2/util/file_helpers.h"
+
+namespace sandbox2 {
+namespace {
+
+// Maximum number of waitpid() events handled before checking for requests
+// from the host again, so that a busy sandboxee cannot starve the others.
+constexpr int kMaxEventsPerRound = 64;
+
+// Maximum number of ancestors inspected when looking for the sandboxee a new
+// process belongs to.
+constexpr int kMaxAncestors = 16;
+
+// Time given to the main process to exit after it has been killed.
+constexpr absl::Duration kGracefullExitTimeout = absl::Milliseconds(200);
+
+// Returns a PID-valued field ("Tgid", "PPid") from /proc/<pid>/status, or -1.
+pid_t GetProcStatusPid(pid_t pid, absl::string_view key) {
+  std::string contents;
+  if (!file::GetContents(absl::StrCat("/proc/", pid, "/status"), &contents,
+                         file::Defaults())
+           .ok()) {
+    return -1;
+  }
+  for (absl::string_view line : absl::StrSplit(contents, '\n')) {
+    std::pair<absl::string_view, absl::string_view> kv =
+        absl::StrSplit(line, absl::MaxSplits(':', 1));
+    pid_t value;
+    if (kv.first == key &&
+        absl::SimpleAtoi(absl::StripAsciiWhitespace(kv.second), &value)) {
+      return value;
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+MonitorReactor::MonitorReactor(int num_threads) {
+  CHECK_GT(num_threads, 0);
+
+  // Reactor threads wait for SIGCHLD with sigtimedwait(), start them with the
+  // signal already blocked.
+  sigset_t sset;
+  sigset_t old_sset;
+  sigemptyset(&sset);
+  sigaddset(&sset, SIGCHLD);
+  PCHECK(pthread_sigmask(SIG_BLOCK, &sset, &old_sset) == 0);
+  for (int i = 0; i < num_threads; ++i) {
+    auto worker = absl::make_unique<Worker>();
+    worker->thread = std::thread(&MonitorReactor::Run, this, worker.get());
+    workers_.push_back(std::move(worker));
+  }
+  PCHECK(pthread_sigmask(SIG_SETMASK, &old_sset, nullptr) == 0);
+}
+
+MonitorReactor::~MonitorReactor() {
+  {
+    absl::MutexLock lock(&mutex_);
+    CHECK(monitors_.empty())
+        << "MonitorReactor destroyed while driving " << monitors_.size()
+        << " sandboxes";
+    for (auto& worker : workers_) {
+      worker->shutdown = true;
+      pthread_kill(worker->thread.native_handle(), SIGCHLD);
+    }
+  }
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+int MonitorReactor::num_monitors() const {
+  absl::MutexLock lock(&mutex_);
+  return monitors_.size();
+}
+
+void MonitorReactor::Launch(Monitor* monitor) {
+  Worker* worker;
+  {
+    // Pick the thread driving the fewest sandboxees.
+    absl::MutexLock lock(&mutex_);
+    absl::flat_hash_map<Worker*, int> load;
+    for (const auto& entry : monitors_) {
+      ++load[entry.second];
+    }
+    worker = std::min_element(workers_.begin(), workers_.end(),
+                              [&load](const std::unique_ptr<Worker>& a,
+                                      const std::unique_ptr<Worker>& b) {
+                                return load[a.get()] < load[b.get()];
+                              })
+                 ->get();
+  }
+
+  monitor->tracer_thread_ = worker->thread.native_handle();
+  bool attached = false;
+  if (monitor->InitSetup()) {
+    RunOnWorker(worker, [this, worker, monitor, &attached] {
+      attached = monitor->InitAttach();
+      if (!attached) {
+        // Do not leave a half-attached sandboxee behind.
+        kill(monitor->pid_, SIGKILL);
+        return;
+      }
+      worker->monitors.push_back(monitor);
+      worker->pids[monitor->pid_] = monitor;
+      if (monitor->init_pid_ > 0) {
+        worker->pids[monitor->init_pid_] = monitor;
+      }
+      absl::MutexLock lock(&mutex_);
+      monitors_[monitor] = worker;
+    });
+  }
+  monitor->setup_notification_.Notify();
+  if (!attached) {
+    monitor->NotifyFinished();
+  }
+}
+
+void MonitorReactor::Notify(Monitor* monitor) {
+  absl::MutexLock lock(&mutex_);
+  auto it = monitors_.find(monitor);
+  if (it != monitors_.end()) {
+    pthread_kill(it->second->thread.native_handle(), SIGCHLD);
+  }
+}
+
+void MonitorReactor::RunOnWorker(Worker* worker, std::function<void()> task) {
+  absl::Notification done;
+  {
+    absl::MutexLock lock(&mutex_);
+    worker->tasks.push_back([&task, &done] {
+      task();
+      done.Notify();
+    });
+    pthread_kill(worker->thread.native_handle(), SIGCHLD);
+  }
+  done.WaitForNotification();
+}
+
+void MonitorReactor::Run(Worker* worker) {
+  sigset_t sset;
+  sigemptyset(&sset);
+  sigaddset(&sset, SIGCHLD);
+
+  for (;;) {
+    std::vector<std::function<void()>> tasks;
+    {
+      absl::MutexLock lock(&mutex_);
+      if (worker->shutdown) {
+        return;
+      }
+      tasks.swap(worker->tasks);
+    }
+    for (auto& task : tasks) {
+      task();
+    }
+
+    for (Monitor* monitor : worker->monitors) {
+      if (monitor->result_.final_status() == Result::UNSET) {
+        monitor->CheckRequests();
+      }
+    }
+
+    int events = 0;
+    int status;
+    pid_t pid = 0;
+    while (events < kMaxEventsPerRound &&
+           (pid = waitpid(-1, &status,
+                          __WNOTHREAD | __WALL | WUNTRACED | WNOHANG)) > 0) {
+      VLOG(3) << "waitpid() returned with PID: " << pid
+              << ", status: " << status;
+      HandleWaitStatus(worker, pid, status);
+      ++events;
+    }
+    if (pid == -1 && errno != ECHILD) {
+      PLOG(ERROR) << "waitpid() failed";
+    }
+
+    // Retire the sandboxees which have a result, after making sure that their
+    // main process is killed and reaped.
+    const absl::Time now = absl::Now();
+    absl::Duration timeout = Monitor::kWakeUpPeriod;
+    std::vector<Monitor*> finished;
+    for (Monitor* monitor : worker->monitors) {
+      if (monitor->result_.final_status() == Result::UNSET) {
+        timeout = std::min(timeout, monitor->TimeToDeadline());
+        continue;
+      }
+      if (monitor->sandboxee_exited_) {
+        finished.push_back(monitor);
+        continue;
+      }
+      auto it = worker->reap_deadlines.find(monitor);
+      if (it == worker->reap_deadlines.end()) {
+        kill(monitor->pid_, SIGKILL);
+        it = worker->reap_deadlines
+                 .emplace(monitor, now + kGracefullExitTimeout)
+                 .first;
+      } else if (now >= it->second) {
+        LOG(INFO) << "Waiting for sandboxee exit timed out";
+        finished.push_back(monitor);
+        continue;
+      }
+      timeout = std::min(timeout, it->second - now);
+    }
+    for (Monitor* monitor : finished) {
+      FinishMonitor(worker, monitor);
+    }
+
+    if (events > 0 || !finished.empty()) {
+      continue;
+    }
+    const timespec ts = absl::ToTimespec(timeout);
+    sigtimedwait(&sset, nullptr, &ts);
+  }
+}
+
+void MonitorReactor::HandleWaitStatus(Worker* worker, pid_t pid, int status) {
+  auto it = worker->pids.find(pid);
+  if (it == worker->pids.end() && !FindMonitorForNewPid(worker, pid)) {
+    LOG(ERROR) << "waitpid() returned PID " << pid
+               << " which does not belong to any sandboxee";
+    if (WIFSTOPPED(status)) {
+      kill(pid, SIGKILL);
+    }
+    return;
+  }
+  it = worker->pids.find(pid);
+  Monitor* monitor = it->second;
+  if (WIFEXITED(status) || WIFSIGNALED(status)) {
+    worker->pids.erase(it);
+  }
+  if (monitor == nullptr) {
+    // Left behind by a sandboxee which finished before all of its processes
+    // were reaped, this thread is still their tracer.
+    if (WIFSTOPPED(status)) {
+      kill(pid, SIGKILL);
+    }
+    return;
+  }
+
+  if (monitor->result_.final_status() != Result::UNSET) {
+    if (monitor->HandleReapStatus(pid, status)) {
+      monitor->sandboxee_exited_ = true;
+    }
+    return;
+  }
+  monitor->HandleWaitStatus(pid, status);
+}
+
+bool MonitorReactor::FindMonitorForNewPid(Worker* worker, pid_t pid) {
+  // New threads are in the thread group of a traced process, new processes are
+  // children of one.
+  pid_t current = pid;
+  for (int i = 0; i < kMaxAncestors && current > 0; ++i) {
+    for (pid_t candidate : {current, GetProcStatusPid(current, "Tgid")}) {
+      auto it = worker->pids.find(candidate);
+      if (it != worker->pids.end()) {
+        worker->pids[pid] = it->second;
+        return true;
+      }
+    }
+    current = GetProcStatusPid(current, "PPid");
+  }
+  return false;
+}
+
+void MonitorReactor::FinishMonitor(Worker* worker, Monitor* monitor) {
+  worker->monitors.erase(
+      std::remove(worker->monitors.begin(), worker->monitors.end(), monitor),
+      worker->monitors.end());
+  worker->reap_deadlines.erase(monitor);
+  // The remaining PIDs are still traced by this thread, keep them until they
+  // are reaped.
+  for (auto& entry : worker->pids) {
+    if (entry.second == monitor) {
+      entry.second = nullptr;
+    }
+  }
+  {
+    absl::MutexLock lock(&mutex_);
+    monitors_.erase(monitor);
+  }
+  monitor->FinishCgroup();
+  monitor->NotifyFinished();
+}
+
+}  // namespace sandbox2
@@ -0,0 +1,122 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The sandbox2::MonitorReactor class drives the monitors of many sandboxes
+// from a small, fixed set of threads.
+
+#ifndef SANDBOXED_API_SANDBOX2_MONITOR_REACTOR_H_
+#define SANDBOXED_API_SANDBOX2_MONITOR_REACTOR_H_
+
+#include <sys/types.h>
+
+#include <functional>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace sandbox2 {
+
+class Monitor;
+
+// By default, every Sandbox2 object starts its own monitor thread. Hosts
+// running many sandboxes at once can instead share a MonitorReactor between
+// them, which handles the ptrace events, walltime limits and results of all
+// its sandboxees with a fixed number of threads:
+//
+//   sandbox2::MonitorReactor reactor(/*num_threads=*/4);
+//   ...
+//   sandbox2::Sandbox2 s2(std::move(executor), std::move(policy));
+//   s2.set_monitor_reactor(&reactor);
+//   s2.RunAsync();
+//
+// Notify callbacks are invoked from the reactor threads, so a slow callback
+// delays all sandboxees handled by the same thread. The set-up of a sandboxee
+// runs on the thread calling Sandbox2::RunAsync(), only attaching to it is done
+// by a reactor thread.
+// The threads are shared, so Result::GetRUsageMonitor() is not collected for
+// sandboxes driven by a MonitorReactor, and is left zeroed.
+class MonitorReactor {
+ public:
+  explicit MonitorReactor(int num_threads);
+
+  MonitorReactor(const MonitorReactor&) = delete;
+  MonitorReactor& operator=(const MonitorReactor&) = delete;
+
+  // All sandboxes using the reactor must have finished before destroying it.
+  ~MonitorReactor();
+
+  int num_threads() const { return workers_.size(); }
+
+  // Number of sandboxees currently driven by the reactor.
+  int num_monitors() const;
+
+ private:
+  friend class Sandbox2;
+
+  // State of a single reactor thread. Everything but 'tasks' and 'shutdown'
+  // is only accessed by the thread itself.
+  struct Worker {
+    std::thread thread;
+    std::vector<std::function<void()>> tasks;
+    bool shutdown = false;
+
+    std::vector<Monitor*> monitors;
+    // Traced PIDs, and the monitor they belong to. PIDs of finished monitors
+    // map to nullptr until they are reaped.
+    absl::flat_hash_map<pid_t, Monitor*> pids;
+    // Monitors which have a result, but whose main PID was not reaped yet.
+    absl::flat_hash_map<Monitor*, absl::Time> reap_deadlines;
+  };
+
+  // Sets up the sandboxee of 'monitor' and hands it over to a reactor thread.
+  // Returns after the set-up is finished, successfully or not.
+  void Launch(Monitor* monitor);
+
+  // Wakes up the thread driving 'monitor', so that it handles requests from
+  // the host (Kill(), DumpStackTrace(), new walltime limit). No-op if the
+  // monitor is not driven by the reactor (anymore).
+  void Notify(Monitor* monitor);
+
+  // Runs 'task' on the worker thread and waits for it to finish.
+  void RunOnWorker(Worker* worker, std::function<void()> task);
+
+  // Main loop of a reactor thread.
+  void Run(Worker* worker);
+
+  // Handles a status change of a traced process reported by waitpid().
+  void HandleWaitStatus(Worker* worker, pid_t pid, int status);
+
+  // Finds the monitor of a PID which the worker has not seen before, e.g. a
+  // new thread or child process of a sandboxee, and adds it to Worker::pids.
+  // Returns false if it belongs to none of them.
+  bool FindMonitorForNewPid(Worker* worker, pid_t pid);
+
+  // Removes the monitor from the worker and reports its result.
+  void FinishMonitor(Worker* worker, Monitor* monitor);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  mutable absl::Mutex mutex_;
+  // Worker driving each monitor.
+  absl::flat_hash_map<Monitor*, Worker*> monitors_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace sandbox2
+
+#endif  // SANDBOXED_API_SANDBOX2_MONITOR_REACTOR_H_
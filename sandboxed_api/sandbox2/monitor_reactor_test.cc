@@ -0,0 +1,213 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sandboxed_api/sandbox2/monitor_reactor.h"
+
+#include <syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include "benchmark/benchmark.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "sandboxed_api/sandbox2/comms.h"
+#include "sandboxed_api/sandbox2/executor.h"
+#include "sandboxed_api/sandbox2/notify.h"
+#include "sandboxed_api/sandbox2/policy.h"
+#include "sandboxed_api/sandbox2/policybuilder.h"
+#include "sandboxed_api/sandbox2/result.h"
+#include "sandboxed_api/sandbox2/sandbox2.h"
+#include "sandboxed_api/sandbox2/sanitizer.h"
+#include "sandboxed_api/sandbox2/testing.h"
+#include "sandboxed_api/sandbox2/util/bpf_helper.h"
+#include "sandboxed_api/sandbox2/util/file_helpers.h"
+
+using ::testing::Eq;
+using ::testing::Lt;
+
+namespace sandbox2 {
+namespace {
+
+// Allows all traced syscalls, and counts them.
+class CountingNotify : public Notify {
+ public:
+  explicit CountingNotify(std::atomic<int>* traps) : traps_(traps) {}
+
+  bool EventSyscallTrap(const Syscall& syscall) override {
+    ++*traps_;
+    return true;
+  }
+
+ private:
+  std::atomic<int>* traps_;
+};
+
+// Creates a sandbox for the trap_loop testcase, with the personality syscall
+// traced.
+std::unique_ptr<Sandbox2> CreateTrapLoopSandbox(std::atomic<int>* traps) {
+  const std::string path = GetTestSourcePath("sandbox2/testcases/trap_loop");
+  std::vector<std::string> args = {path};
+  auto executor = absl::make_unique<Executor>(path, args);
+  auto policy = PolicyBuilder()
+                    .DisableNamespaces()
+                    .AddPolicyOnSyscall(__NR_personality, {SANDBOX2_TRACE})
+                    .DangerDefaultAllowAll()
+                    .BuildOrDie();
+  return absl::make_unique<Sandbox2>(std::move(executor), std::move(policy),
+                                     absl::make_unique<CountingNotify>(traps));
+}
+
+TEST(MonitorReactorTest, DrivesManySandboxes) {
+  SKIP_SANITIZERS_AND_COVERAGE;
+  constexpr int kSandboxes = 8;
+  constexpr int kTraps = 10;
+  MonitorReactor reactor(/*num_threads=*/2);
+  std::atomic<int> traps{0};
+
+  std::vector<std::unique_ptr<Sandbox2>> sandboxes;
+  for (int i = 0; i < kSandboxes; ++i) {
+    sandboxes.push_back(CreateTrapLoopSandbox(&traps));
+    sandboxes.back()->set_monitor_reactor(&reactor);
+    ASSERT_TRUE(sandboxes.back()->RunAsync());
+  }
+  EXPECT_THAT(reactor.num_monitors(), Eq(kSandboxes));
+
+  for (auto& sandbox : sandboxes) {
+    bool done = false;
+    ASSERT_TRUE(sandbox->comms()->SendInt32(kTraps));
+    ASSERT_TRUE(sandbox->comms()->RecvBool(&done));
+    EXPECT_TRUE(done);
+  }
+  for (auto& sandbox : sandboxes) {
+    sandbox->Kill();
+    auto result = sandbox->AwaitResult();
+    EXPECT_THAT(result.final_status(), Eq(Result::EXTERNAL_KILL));
+  }
+  EXPECT_THAT(traps, Eq(kSandboxes * kTraps));
+  EXPECT_THAT(reactor.num_monitors(), Eq(0));
+}
+
+TEST(MonitorReactorTest, ReportsExitCode) {
+  const std::string path = GetTestSourcePath("sandbox2/testcases/minimal");
+  std::vector<std::string> args = {path, "1"};
+  MonitorReactor reactor(/*num_threads=*/1);
+
+  Sandbox2 sandbox(absl::make_unique<Executor>(path, args),
+                   PolicyBuilder()
+                       .DisableNamespaces()
+                       .DangerDefaultAllowAll()
+                       .BuildOrDie());
+  sandbox.set_monitor_reactor(&reactor);
+  auto result = sandbox.Run();
+  EXPECT_THAT(result.final_status(), Eq(Result::OK));
+  EXPECT_THAT(result.reason_code(), Eq(1));
+}
+
+TEST(MonitorReactorTest, SandboxeeTimeout) {
+  const std::string path = GetTestSourcePath("sandbox2/testcases/sleep");
+  std::vector<std::string> args = {path};
+  MonitorReactor reactor(/*num_threads=*/1);
+
+  Sandbox2 sandbox(absl::make_unique<Executor>(path, args),
+                   PolicyBuilder()
+                       .DangerDefaultAllowAll()
+                       .CollectStacktracesOnTimeout(false)
+                       .BuildOrDie());
+  sandbox.set_monitor_reactor(&reactor);
+  ASSERT_TRUE(sandbox.RunAsync());
+  auto start = absl::Now();
+  sandbox.set_walltime_limit(absl::Milliseconds(100));
+  auto result = sandbox.AwaitResult();
+  EXPECT_THAT(result.final_status(), Eq(Result::TIMEOUT));
+  EXPECT_THAT(absl::Now() - start, Lt(absl::Seconds(1)));
+}
+
+// Returns a "<value> kB" field from /proc/self/status.
+int64_t GetSelfStatusKb(absl::string_view key) {
+  std::string contents;
+  CHECK(file::GetContents("/proc/self/status", &contents, file::Defaults())
+            .ok());
+  for (absl::string_view line : absl::StrSplit(contents, '\n')) {
+    std::vector<absl::string_view> fields =
+        absl::StrSplit(line, absl::ByAnyChar(": \t"), absl::SkipEmpty());
+    int64_t value;
+    if (fields.size() >= 2 && fields[0] == key &&
+        absl::SimpleAtoi(fields[1], &value)) {
+      return value;
+    }
+  }
+  return 0;
+}
+
+// Starts state.range(0) idle sandboxes, either with their own monitor thread
+// (state.range(1) == 0), or driven by a MonitorReactor with state.range(1)
+// threads, and reports the per-sandbox thread and memory overhead of the host.
+void BenchmarkMonitorScaling(benchmark::State& state) {
+  const int num_sandboxes = state.range(0);
+  const int num_threads = state.range(1);
+  std::atomic<int> traps{0};
+  for (auto _ : state) {
+    std::unique_ptr<MonitorReactor> reactor;
+    if (num_threads > 0) {
+      reactor = absl::make_unique<MonitorReactor>(num_threads);
+    }
+    const int threads_before = sanitizer::GetNumberOfThreads(getpid());
+    const int64_t vm_before = GetSelfStatusKb("VmSize");
+    const int64_t rss_before = GetSelfStatusKb("VmRSS");
+
+    std::vector<std::unique_ptr<Sandbox2>> sandboxes;
+    for (int i = 0; i < num_sandboxes; ++i) {
+      sandboxes.push_back(CreateTrapLoopSandbox(&traps));
+      sandboxes.back()->set_monitor_reactor(reactor.get());
+      CHECK(sandboxes.back()->RunAsync());
+    }
+
+    state.counters["threads_per_sandbox"] =
+        static_cast<double>(sanitizer::GetNumberOfThreads(getpid()) -
+                            threads_before) /
+        num_sandboxes;
+    state.counters["vm_kb_per_sandbox"] =
+        static_cast<double>(GetSelfStatusKb("VmSize") - vm_before) /
+        num_sandboxes;
+    state.counters["rss_kb_per_sandbox"] =
+        static_cast<double>(GetSelfStatusKb("VmRSS") - rss_before) /
+        num_sandboxes;
+
+    for (auto& sandbox : sandboxes) {
+      sandbox->Kill();
+      sandbox->AwaitResult().IgnoreResult();
+    }
+  }
+}
+BENCHMARK(BenchmarkMonitorScaling)
+    ->Args({64, 0})
+    ->Args({64, 4})
+    ->Args({512, 0})
+    ->Args({512, 4})
+    ->Iterations(1);
+
+}  // namespace
+}  // namespace sandbox2
@@ -21,11 +21,19 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <cerrno>
 #include <climits>
+#include <cstdint>
 #include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
 #include "google/protobuf/util/message_differencer.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/ascii.h"
@@ -34,11 +42,13 @@
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "sandboxed_api/sandbox2/config.h"
 #include "sandboxed_api/sandbox2/util/fileops.h"
 #include "sandboxed_api/sandbox2/util/minielf.h"
 #include "sandboxed_api/sandbox2/util/path.h"
 #include "sandboxed_api/sandbox2/util/strerror.h"
+#include "sandboxed_api/sandbox2/util/temp_file.h"
 #include "sandboxed_api/util/raw_logging.h"
 #include "sandboxed_api/util/status_macros.h"
 
@@ -240,6 +250,8 @@ absl::Status Mounts::Insert(absl::string_view path,
   }
 
   *curtree->mutable_node() = new_node;
+  // The image no longer matches the tree.
+  image_.reset();
   return absl::OkStatus();
 }
 
@@ -295,10 +307,50 @@ void LogContainer(const std::vector<std::string>& container) {
   }
 }
 
-}  // namespace
+// Identifies a version of a file. A missing file has all the fields zeroed.
+struct FileStamp {
+  dev_t dev = 0;
+  ino_t ino = 0;
+  off_t size = 0;
+  int64_t mtime_ns = 0;
+  int64_t ctime_ns = 0;
+
+  bool operator==(const FileStamp& other) const {
+    return dev == other.dev && ino == other.ino && size == other.size &&
+           mtime_ns == other.mtime_ns && ctime_ns == other.ctime_ns;
+  }
+  bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+FileStamp GetFileStamp(const std::string& path) {
+  FileStamp stamp;
+  struct stat sb;
+  if (stat(path.c_str(), &sb) == -1) {
+    return stamp;
+  }
+  stamp.dev = sb.st_dev;
+  stamp.ino = sb.st_ino;
+  stamp.size = sb.st_size;
+  stamp.mtime_ns = sb.st_mtim.tv_sec * 1000000000LL + sb.st_mtim.tv_nsec;
+  stamp.ctime_ns = sb.st_ctim.tv_sec * 1000000000LL + sb.st_ctim.tv_nsec;
+  return stamp;
+}
 
-absl::Status Mounts::AddMappingsForBinary(const std::string& path,
-                                          absl::string_view ld_library_path) {
+struct BinaryDependencies {
+  // Empty for static binaries.
+  std::string interpreter;
+  std::vector<std::string> libraries;
+  // The files and directories the resolution depends on: the binary, the
+  // library search paths, and the resolved files.
+  std::vector<std::string> watched_paths;
+  std::vector<FileStamp> stamps;
+};
+
+// Resolves the interpreter and the shared libraries 'path' depends on.
+absl::StatusOr<BinaryDependencies> ResolveBinaryDependencies(
+    const std::string& path, absl::string_view ld_library_path) {
+  BinaryDependencies deps;
+  deps.watched_paths.push_back(path);
   SAPI_ASSIGN_OR_RETURN(auto elf, ElfFile::ParseFromFile(
                                  path, ElfFile::kGetInterpreter |
                                            ElfFile::kLoadImportedLibraries));
@@ -306,7 +358,7 @@ absl::Status Mounts::AddMappingsForBinary(const std::string& path,
 
   if (interpreter.empty()) {
     SAPI_RAW_VLOG(1, "The file %s is not a dynamic executable", path);
-    return absl::OkStatus();
+    return deps;
   }
 
   SAPI_RAW_VLOG(1, "The file %s is using interpreter %s", path, interpreter);
@@ -341,6 +393,9 @@ absl::Status Mounts::AddMappingsForBinary(const std::string& path,
           path = file::JoinPath(path, hw_cap_paths[hw_cap]);
         }
       }
+      // Libraries may be added to any of the directories, or the directories
+      // may come into existence.
+      deps.watched_paths.push_back(path);
       if (file_util::fileops::Exists(path, /*fully_resolve=*/false)) {
         full_search_paths.push_back(path);
       }
@@ -436,14 +491,102 @@ absl::Status Mounts::AddMappingsForBinary(const std::string& path,
     }
   }
 
-  SAPI_RETURN_IF_ERROR(AddFile(interpreter));
-  for (const auto& lib : imported_libraries) {
-    SAPI_RETURN_IF_ERROR(AddFile(lib));
+  deps.interpreter = interpreter;
+  deps.libraries.assign(imported_libraries.begin(), imported_libraries.end());
+  deps.watched_paths.push_back(interpreter);
+  deps.watched_paths.insert(deps.watched_paths.end(), deps.libraries.begin(),
+                            deps.libraries.end());
+  return deps;
+}
+
+// Dependencies of binaries are resolved once per process, and reused as long
+// as none of the files and directories they were resolved from changed.
+class BinaryDependenciesCache {
+ public:
+  static BinaryDependenciesCache* Global() {
+    static auto* cache = new BinaryDependenciesCache();
+    return cache;
+  }
+
+  absl::StatusOr<BinaryDependencies> Get(const std::string& path,
+                                         absl::string_view ld_library_path) {
+    const std::string key = absl::StrCat(ld_library_path, ":", path);
+    {
+      absl::MutexLock lock(&mutex_);
+      auto it = entries_.find(key);
+      if (it != entries_.end() && IsCurrent(it->second)) {
+        ++stats_.hits;
+        return it->second;
+      }
+    }
+
+    // Resolve without holding the lock, as it reads a lot of files.
+    SAPI_ASSIGN_OR_RETURN(BinaryDependencies deps,
+                          ResolveBinaryDependencies(path, ld_library_path));
+    deps.stamps.reserve(deps.watched_paths.size());
+    for (const std::string& watched_path : deps.watched_paths) {
+      deps.stamps.push_back(GetFileStamp(watched_path));
+    }
+
+    absl::MutexLock lock(&mutex_);
+    ++stats_.misses;
+    entries_.insert_or_assign(key, deps);
+    return deps;
+  }
+
+  void Clear() {
+    absl::MutexLock lock(&mutex_);
+    entries_.clear();
+  }
+
+  Mounts::BinaryMappingsCacheStats stats() {
+    absl::MutexLock lock(&mutex_);
+    return stats_;
+  }
+
+ private:
+  static bool IsCurrent(const BinaryDependencies& deps) {
+    for (size_t i = 0; i < deps.watched_paths.size(); ++i) {
+      if (GetFileStamp(deps.watched_paths[i]) != deps.stamps[i]) {
+        SAPI_RAW_VLOG(1, "%s changed, resolving the dependencies again",
+                      deps.watched_paths[i]);
+        return false;
+      }
+    }
+    return true;
   }
 
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, BinaryDependencies> entries_
+      ABSL_GUARDED_BY(mutex_);
+  Mounts::BinaryMappingsCacheStats stats_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace
+
+absl::Status Mounts::AddMappingsForBinary(const std::string& path,
+                                          absl::string_view ld_library_path) {
+  SAPI_ASSIGN_OR_RETURN(
+      BinaryDependencies deps,
+      BinaryDependenciesCache::Global()->Get(path, ld_library_path));
+  if (deps.interpreter.empty()) {
+    return absl::OkStatus();
+  }
+  SAPI_RETURN_IF_ERROR(AddFile(deps.interpreter));
+  for (const auto& lib : deps.libraries) {
+    SAPI_RETURN_IF_ERROR(AddFile(lib));
+  }
   return absl::OkStatus();
 }
 
+Mounts::BinaryMappingsCacheStats Mounts::GetBinaryMappingsCacheStats() {
+  return BinaryDependenciesCache::Global()->stats();
+}
+
+void Mounts::ClearBinaryMappingsCache() {
+  BinaryDependenciesCache::Global()->Clear();
+}
+
 absl::Status Mounts::AddTmpfs(absl::string_view inside, size_t sz) {
   MountTree::Node node;
   auto tmpfs_node = node.mutable_tmpfs_node();
@@ -453,6 +596,209 @@ absl::Status Mounts::AddTmpfs(absl::string_view inside, size_t sz) {
 
 namespace {
 
+// Hard links the file 'outside' to 'path'. Returns false if it has to be bind
+// mounted instead: only regular files on the device 'dev' of the image can be
+// linked, and copying others would make the image as expensive to create as the
+// mounts it replaces, or never finish for devices like /dev/urandom.
+bool TryLinkFile(const std::string& outside, const std::string& path,
+                 dev_t dev) {
+  struct stat sb;
+  if (stat(outside.c_str(), &sb) == -1 || !S_ISREG(sb.st_mode) ||
+      sb.st_dev != dev) {
+    return false;
+  }
+  // Files of other users usually cannot be linked (see protected_hardlinks in
+  // man 5 proc).
+  return linkat(AT_FDCWD, outside.c_str(), AT_FDCWD, path.c_str(),
+                AT_SYMLINK_FOLLOW) == 0;
+}
+
+// Creates the files and directories of 'tree' at 'path', on the device 'dev',
+// and removes the read-only files which could be linked into the image from
+// the tree. Nodes which stay in the tree get a backing file or directory. Sets
+// 'empty' if nothing is left to mount in the tree.
+absl::Status MaterializeImage(MountTree* tree, const std::string& path,
+                              dev_t dev, bool* empty) {
+  *empty = false;
+  switch (tree->node().node_case()) {
+    case MountTree::Node::kFileNode: {
+      if (tree->node().file_node().is_ro() &&
+          TryLinkFile(tree->node().file_node().outside(), path, dev)) {
+        *empty = true;
+        return absl::OkStatus();
+      }
+      int fd = open(path.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0600);
+      if (fd == -1) {
+        return absl::UnknownError(
+            absl::StrCat("open(", path, "): ", StrError(errno)));
+      }
+      close(fd);
+      // A file node has to be a leaf.
+      return absl::OkStatus();
+    }
+    case MountTree::Node::kDirNode:
+    case MountTree::Node::kTmpfsNode:
+    case MountTree::Node::kRootNode:
+    case MountTree::Node::NODE_NOT_SET:
+      // Intermediate directories are only accessible to the user of this
+      // process, which sandboxees are mapped to. The image itself stays
+      // writable, sandboxees only get a read-only view of it because their
+      // root is remounted read-only after all the mounts are in place.
+      if (mkdir(path.c_str(), 0700) == -1 && errno != EEXIST) {
+        return absl::UnknownError(
+            absl::StrCat("mkdir(", path, "): ", StrError(errno)));
+      }
+      break;
+  }
+  if (tree->node().has_dir_node() || tree->node().has_tmpfs_node()) {
+    // Anything below is mounted on top of this node, not on the image.
+    return absl::OkStatus();
+  }
+
+  auto* entries = tree->mutable_entries();
+  for (auto it = entries->begin(); it != entries->end();) {
+    bool entry_empty;
+    SAPI_RETURN_IF_ERROR(MaterializeImage(
+        &it->second, file::JoinPath(path, it->first), dev, &entry_empty));
+    if (entry_empty) {
+      it = entries->erase(it);
+    } else {
+      ++it;
+    }
+  }
+  *empty = !tree->has_node() && entries->empty();
+  return absl::OkStatus();
+}
+
+// Images which were created already, by their mount tree.
+class MountImageCache {
+ public:
+  static MountImageCache* Global() {
+    static auto* cache = new MountImageCache();
+    return cache;
+  }
+
+  absl::StatusOr<std::shared_ptr<MountImage>> GetOrCreate(
+      const MountTree& tree);
+
+  // Called by the image once it is no longer used.
+  void Remove(const std::string& key) {
+    absl::MutexLock lock(&mutex_);
+    auto it = images_.find(key);
+    // The image may have been created again in the meantime.
+    if (it != images_.end() && it->second.expired()) {
+      images_.erase(it);
+    }
+  }
+
+ private:
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, std::weak_ptr<MountImage>> images_
+      ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace
+
+// A materialized image, with the tree of the nodes which are not part of it.
+// The directory is removed with the last reference to the image.
+class MountImage {
+ public:
+  MountImage(std::string key, MountTree tree)
+      : key_(std::move(key)), tree_(std::move(tree)) {}
+
+  MountImage(const MountImage&) = delete;
+  MountImage& operator=(const MountImage&) = delete;
+
+  ~MountImage() {
+    MountImageCache::Global()->Remove(key_);
+    const std::string& path = tree_.node().root_node().image();
+    if (!file_util::fileops::DeleteRecursively(path)) {
+      SAPI_RAW_LOG(WARNING, "Could not remove the mount image %s", path);
+      return;
+    }
+    SAPI_RAW_VLOG(1, "Removed the mount image %s", path);
+  }
+
+  const MountTree& tree() const { return tree_; }
+
+ private:
+  std::string key_;
+  MountTree tree_;
+};
+
+namespace {
+
+absl::StatusOr<std::shared_ptr<MountImage>> MountImageCache::GetOrCreate(
+    const MountTree& tree) {
+  std::string key;
+  {
+    google::protobuf::io::StringOutputStream stream(&key);
+    google::protobuf::io::CodedOutputStream output(&stream);
+    // The entries are a map, which is serialized in any order otherwise.
+    output.SetSerializationDeterministic(true);
+    tree.SerializePartialToCodedStream(&output);
+  }
+  // Creating an image is rare, there is no need to do it unlocked.
+  absl::MutexLock lock(&mutex_);
+  auto it = images_.find(key);
+  if (it != images_.end()) {
+    if (std::shared_ptr<MountImage> image = it->second.lock()) {
+      return image;
+    }
+  }
+
+  SAPI_ASSIGN_OR_RETURN(std::string path,
+                        CreateTempDir("/tmp/.sandbox2image_"));
+  // Sandboxees see the directory as their root, so let them traverse it
+  // like the tmpfs it replaces.
+  if (chmod(path.c_str(), 0755) == -1) {
+    const int saved_errno = errno;
+    file_util::fileops::DeleteRecursively(path);
+    return absl::UnknownError(
+        absl::StrCat("chmod(", path, "): ", StrError(saved_errno)));
+  }
+  // Files are only linked into the image if they are on its device.
+  struct stat sb;
+  if (stat(path.c_str(), &sb) == -1) {
+    const int saved_errno = errno;
+    file_util::fileops::DeleteRecursively(path);
+    return absl::UnknownError(
+        absl::StrCat("stat(", path, "): ", StrError(saved_errno)));
+  }
+  MountTree image_tree = tree;
+  bool empty;
+  if (auto status = MaterializeImage(&image_tree, path, sb.st_dev, &empty);
+      !status.ok()) {
+    file_util::fileops::DeleteRecursively(path);
+    return status;
+  }
+  image_tree.mutable_node()->mutable_root_node()->set_image(path);
+  SAPI_RAW_VLOG(1, "Created the mount image %s", path);
+  auto image = std::make_shared<MountImage>(key, std::move(image_tree));
+  images_.insert_or_assign(std::move(key), image);
+  return image;
+}
+
+}  // namespace
+
+MountTree Mounts::GetMountTreeForSandboxee() const {
+  if (!use_image_ || !mount_tree_.node().has_root_node()) {
+    return mount_tree_;
+  }
+  if (!image_) {
+    auto image = MountImageCache::Global()->GetOrCreate(mount_tree_);
+    if (!image.ok()) {
+      SAPI_RAW_LOG(WARNING, "Mounting the files one by one, no image: %s",
+                   image.status().message());
+      return mount_tree_;
+    }
+    image_ = *std::move(image);
+  }
+  return image_->tree();
+}
+
+namespace {
+
 uint64_t GetMountFlagsFor(const std::string& path) {
   struct statvfs vfs;
   if (TEMP_FAILURE_RETRY(statvfs(path.c_str(), &vfs)) == -1) {
@@ -627,6 +973,11 @@ void CreateMounts(const MountTree& tree, const std::string& path,
       return;
     }
     case MountTree::Node::kRootNode:
+      // An image has all the backing files in place already.
+      if (!tree.node().root_node().image().empty()) {
+        create_backing_files = false;
+      }
+      break;
     case MountTree::Node::NODE_NOT_SET:
       // Nothing to do, we already created the directory above.
       break;
@@ -15,6 +15,8 @@
 #ifndef SANDBOXED_API_SANDBOX2_MOUNTTREE_H_
 #define SANDBOXED_API_SANDBOX2_MOUNTTREE_H_
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -25,6 +27,8 @@
 
 namespace sandbox2 {
 
+class MountImage;
+
 class Mounts {
  public:
   Mounts() {
@@ -48,17 +52,52 @@ class Mounts {
   absl::Status AddDirectoryAt(absl::string_view outside,
                               absl::string_view inside, bool is_ro = true);
 
+  // Adds the interpreter and the shared libraries of the binary at 'path'.
+  // The dependencies are resolved once per process, and resolved again only if
+  // the binary, one of its dependencies, or one of the library search paths
+  // changed.
   absl::Status AddMappingsForBinary(const std::string& path,
                                     absl::string_view ld_library_path = {});
 
+  struct BinaryMappingsCacheStats {
+    int64_t hits = 0;
+    int64_t misses = 0;
+  };
+
+  static BinaryMappingsCacheStats GetBinaryMappingsCacheStats();
+
+  // Drops the cached dependencies, see AddMappingsForBinary().
+  static void ClearBinaryMappingsCache();
+
   absl::Status AddTmpfs(absl::string_view inside, size_t sz);
 
   void CreateMounts(const std::string& root_path) const;
 
   MountTree GetMountTree() const { return mount_tree_; }
 
+  // Makes sandboxees mount a directory holding the read-only files of the tree
+  // as their root, instead of bind mounting every file on its own. Files are
+  // hard linked into the image, so this only applies to regular files on the
+  // file system of the image, others are still mounted one by one. The image is
+  // created once per process and mount tree, and does not reflect files which
+  // are replaced afterwards. A writable root is an overlay on top of the image,
+  // which needs overlayfs in user namespaces (Linux 5.11). The image is removed
+  // when the last Mounts object which used it is destroyed.
+  void SetUseImage() { use_image_ = true; }
+
+  // Returns the tree to initialize the namespaces of a sandboxee with. With
+  // SetUseImage(), it only contains the nodes which are not part of the image,
+  // and this object keeps the image alive. Not thread-safe.
+  MountTree GetMountTreeForSandboxee() const;
+
+  // Returns the image directory the tree is based on, or an empty string.
+  const std::string& GetImage() const {
+    return mount_tree_.node().root_node().image();
+  }
+
   void SetRootWritable() {
     mount_tree_.mutable_node()->mutable_root_node()->set_is_ro(false);
+    image_.reset();
   }
 
   bool IsRootReadOnly() const {
@@ -82,6 +121,9 @@ class Mounts {
   friend class MountTreeTest;
   absl::Status Insert(absl::string_view path, const MountTree::Node& node);
   MountTree mount_tree_;
+  bool use_image_ = false;
+  // Shared by the copies of this object, see GetMountTreeForSandboxee().
+  mutable std::shared_ptr<MountImage> image_;
 };
 
 }  // namespace sandbox2
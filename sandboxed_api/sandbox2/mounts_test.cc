@@ -14,16 +14,24 @@
 
 #include "sandboxed_api/sandbox2/mounts.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <cstdint>
+#include <string>
 #include <utility>
+#include <vector>
 
+#include <glog/logging.h>
+#include "benchmark/benchmark.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "sandboxed_api/sandbox2/testing.h"
 #include "sandboxed_api/sandbox2/util/file_helpers.h"
+#include "sandboxed_api/sandbox2/util/fileops.h"
 #include "sandboxed_api/sandbox2/util/path.h"
 #include "sandboxed_api/sandbox2/util/temp_file.h"
 #include "sandboxed_api/util/status_matchers.h"
@@ -31,6 +39,10 @@
 using sapi::IsOk;
 using sapi::StatusIs;
 using ::testing::Eq;
+using ::testing::IsEmpty;
+using ::testing::IsNull;
+using ::testing::Not;
+using ::testing::NotNull;
 using ::testing::UnorderedElementsAreArray;
 
 namespace sandbox2 {
@@ -169,6 +181,145 @@ TEST(MountTreeTest, TestMinimalDynamicBinary) {
   EXPECT_THAT(mounts.AddFile("/lib/x86_64-linux-gnu/libc.so.6"), IsOk());
 }
 
+TEST(MountTreeTest, TestBinaryMappingsAreCached) {
+  const std::string path =
+      GetTestSourcePath("sandbox2/testcases/minimal_dynamic");
+  Mounts::ClearBinaryMappingsCache();
+  const Mounts::BinaryMappingsCacheStats before =
+      Mounts::GetBinaryMappingsCacheStats();
+
+  Mounts cold;
+  ASSERT_THAT(cold.AddMappingsForBinary(path), IsOk());
+  Mounts warm;
+  ASSERT_THAT(warm.AddMappingsForBinary(path), IsOk());
+
+  const Mounts::BinaryMappingsCacheStats after =
+      Mounts::GetBinaryMappingsCacheStats();
+  EXPECT_THAT(after.misses - before.misses, Eq(1));
+  EXPECT_THAT(after.hits - before.hits, Eq(1));
+
+  std::vector<std::string> cold_outside;
+  std::vector<std::string> cold_inside;
+  cold.RecursivelyListMounts(&cold_outside, &cold_inside);
+  std::vector<std::string> warm_outside;
+  std::vector<std::string> warm_inside;
+  warm.RecursivelyListMounts(&warm_outside, &warm_inside);
+  EXPECT_THAT(warm_outside, UnorderedElementsAreArray(cold_outside));
+  EXPECT_THAT(warm_inside, UnorderedElementsAreArray(cold_inside));
+}
+
+TEST(MountTreeTest, TestChangedBinaryIsResolvedAgain) {
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      std::string path,
+      CreateNamedTempFileAndClose(
+          file::JoinPath(GetTestTempPath(), "minimal_dynamic_")));
+  ASSERT_TRUE(file_util::fileops::CopyFile(
+      GetTestSourcePath("sandbox2/testcases/minimal_dynamic"), path, 0755));
+
+  Mounts mounts;
+  ASSERT_THAT(mounts.AddMappingsForBinary(path), IsOk());
+  const int64_t misses = Mounts::GetBinaryMappingsCacheStats().misses;
+
+  // Changes both the modification and the status change time.
+  const struct timespec times[2] = {{0, 0}, {0, 0}};
+  ASSERT_THAT(utimensat(AT_FDCWD, path.c_str(), times, 0), Eq(0));
+  ASSERT_THAT(mounts.AddMappingsForBinary(path), IsOk());
+  EXPECT_THAT(Mounts::GetBinaryMappingsCacheStats().misses, Eq(misses + 1));
+}
+
+TEST(MountTreeTest, TestImageMountTree) {
+  // Only files on the file system of the image are linked into it.
+  SAPI_ASSERT_OK_AND_ASSIGN(std::string ro_file,
+                            CreateNamedTempFileAndClose("/tmp/ro_"));
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      std::string rw_file,
+      CreateNamedTempFileAndClose(file::JoinPath(GetTestTempPath(), "rw_")));
+  ASSERT_THAT(file::SetContents(ro_file, "image", file::Defaults()), IsOk());
+
+  Mounts mounts;
+  mounts.SetUseImage();
+  ASSERT_THAT(mounts.AddFileAt(ro_file, "/a/ro"), IsOk());
+  ASSERT_THAT(mounts.AddFileAt(rw_file, "/b/rw", /*is_ro=*/false), IsOk());
+  ASSERT_THAT(mounts.AddTmpfs("/c", kTmpfsSize), IsOk());
+
+  const Mounts sandboxee(mounts.GetMountTreeForSandboxee());
+  const std::string& image = sandboxee.GetImage();
+  ASSERT_THAT(image, Not(IsEmpty()));
+  // The read-only file is part of the image, the others are still mounted.
+  EXPECT_THAT(sandboxee.GetNode("/a/ro"), IsNull());
+  EXPECT_THAT(sandboxee.GetNode("/b/rw"), NotNull());
+  EXPECT_THAT(sandboxee.GetNode("/c"), NotNull());
+  std::string contents;
+  ASSERT_THAT(file::GetContents(file::JoinPath(image, "a/ro"), &contents,
+                                file::Defaults()),
+              IsOk());
+  EXPECT_THAT(contents, Eq("image"));
+  EXPECT_TRUE(file_util::fileops::Exists(file::JoinPath(image, "b/rw"),
+                                         /*fully_resolve=*/false));
+  EXPECT_TRUE(file_util::fileops::Exists(file::JoinPath(image, "c"),
+                                         /*fully_resolve=*/false));
+
+  // The image is created once.
+  EXPECT_THAT(Mounts(mounts.GetMountTreeForSandboxee()).GetImage(), Eq(image));
+}
+
+TEST(MountTreeTest, TestImageMountsDevices) {
+  Mounts mounts;
+  mounts.SetUseImage();
+  ASSERT_THAT(mounts.AddFile("/dev/null"), IsOk());
+  ASSERT_THAT(mounts.AddFile("/dev/urandom"), IsOk());
+
+  // Devices are not part of the image, they are mounted on empty files in it.
+  const Mounts sandboxee(mounts.GetMountTreeForSandboxee());
+  const std::string& image = sandboxee.GetImage();
+  ASSERT_THAT(image, Not(IsEmpty()));
+  for (const char* device : {"/dev/null", "/dev/urandom"}) {
+    EXPECT_THAT(sandboxee.GetNode(device), NotNull());
+    struct stat sb;
+    ASSERT_THAT(stat(file::JoinPath(image, device).c_str(), &sb), Eq(0));
+    EXPECT_TRUE(S_ISREG(sb.st_mode));
+    EXPECT_THAT(sb.st_size, Eq(0));
+  }
+}
+
+TEST(MountTreeTest, TestImageIsRemovedWithLastMounts) {
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      std::string ro_file,
+      CreateNamedTempFileAndClose(file::JoinPath(GetTestTempPath(), "ro_")));
+
+  std::string image;
+  {
+    Mounts copy;
+    {
+      Mounts mounts;
+      mounts.SetUseImage();
+      ASSERT_THAT(mounts.AddFileAt(ro_file, "/ro"), IsOk());
+      image = Mounts(mounts.GetMountTreeForSandboxee()).GetImage();
+      ASSERT_THAT(image, Not(IsEmpty()));
+      // Copies share the image.
+      copy = mounts;
+    }
+    EXPECT_TRUE(file_util::fileops::Exists(image, /*fully_resolve=*/false));
+  }
+  EXPECT_FALSE(file_util::fileops::Exists(image, /*fully_resolve=*/false));
+}
+
+// Measures resolving the dependencies of the test binary, with the cache
+// cleared before every iteration (state.range(0) == 0) or kept (1).
+void BenchmarkAddMappingsForBinary(benchmark::State& state) {
+  const std::string path = file_util::fileops::ReadLink("/proc/self/exe");
+  const bool warm = state.range(0);
+  Mounts::ClearBinaryMappingsCache();
+  for (auto _ : state) {
+    if (!warm) {
+      Mounts::ClearBinaryMappingsCache();
+    }
+    Mounts mounts;
+    CHECK(mounts.AddMappingsForBinary(path).ok());
+  }
+}
+BENCHMARK(BenchmarkAddMappingsForBinary)->Arg(0)->Arg(1);
+
 TEST(MountTreeTest, TestList) {
   struct TestCase {
     const char *path;
@@ -29,6 +29,7 @@
 
 #include <cstdio>
 #include <cstring>
+#include <string>
 #include <utility>
 
 #include "absl/memory/memory.h"
@@ -44,6 +45,7 @@
 namespace sandbox2 {
 
 static constexpr char kSandbox2ChrootPath[] = "/tmp/.sandbox2chroot";
+static constexpr char kSandbox2OverlayPath[] = "/tmp/.sandbox2overlay";
 
 namespace {
 int MountFallbackToReadOnly(const char* source, const char* target,
@@ -63,12 +65,41 @@ int MountFallbackToReadOnly(const char* source, const char* target,
   return rv;
 }
 
+// Mounts a writable overlay of the image at the rootfs, with the changes kept
+// in a tmpfs.
+void MountImageOverlay(const std::string& image) {
+  SAPI_RAW_CHECK(util::CreateDirRecursive(kSandbox2OverlayPath, 0700),
+                 "could not create directory for the rootfs overlay");
+  SAPI_RAW_PCHECK(mount("none", kSandbox2OverlayPath, "tmpfs", 0, nullptr) == 0,
+                  "mounting tmpfs for the rootfs overlay failed");
+  const std::string upper = file::JoinPath(kSandbox2OverlayPath, "upper");
+  const std::string work = file::JoinPath(kSandbox2OverlayPath, "work");
+  SAPI_RAW_PCHECK(mkdir(upper.c_str(), 0755) == 0, "mkdir %s", upper);
+  SAPI_RAW_PCHECK(mkdir(work.c_str(), 0700) == 0, "mkdir %s", work);
+  const std::string options =
+      absl::StrCat("lowerdir=", image, ",upperdir=", upper, ",workdir=", work);
+  SAPI_RAW_PCHECK(mount("overlay", kSandbox2ChrootPath, "overlay", 0,
+                        options.c_str()) == 0,
+                  "mounting overlay of image %s failed", image);
+}
+
 void PrepareChroot(const Mounts& mounts) {
-  // Create a tmpfs mount for the new rootfs.
   SAPI_RAW_CHECK(util::CreateDirRecursive(kSandbox2ChrootPath, 0700),
                  "could not create directory for rootfs");
-  SAPI_RAW_PCHECK(mount("none", kSandbox2ChrootPath, "tmpfs", 0, nullptr) == 0,
-                  "mounting rootfs failed");
+  const std::string& image = mounts.GetImage();
+  if (image.empty()) {
+    // Create a tmpfs mount for the new rootfs.
+    SAPI_RAW_PCHECK(
+        mount("none", kSandbox2ChrootPath, "tmpfs", 0, nullptr) == 0,
+        "mounting rootfs failed");
+  } else if (mounts.IsRootReadOnly()) {
+    // The image is shared, it is made read-only below.
+    SAPI_RAW_PCHECK(mount(image.c_str(), kSandbox2ChrootPath, "",
+                          MS_BIND | MS_NOSUID, nullptr) == 0,
+                    "mounting rootfs image %s failed", image);
+  } else {
+    MountImageOverlay(image);
+  }
 
   // Walk the tree and perform all the mount operations.
   mounts.CreateMounts(kSandbox2ChrootPath);
@@ -40,7 +40,6 @@ class Namespace final {
   static void InitializeInitialNamespaces(uid_t uid, gid_t gid);
 
   Namespace() = delete;
-  Namespace(const Namespace&) = delete;
   Namespace& operator=(const Namespace&) = delete;
 
   Namespace(bool allow_unrestricted_networking, Mounts mounts,
@@ -60,8 +59,11 @@ class Namespace final {
   const std::string& hostname() const { return hostname_; }
 
  private:
+  friend class Policy;  // For Policy::Clone()
   friend class StackTracePeer;
 
+  Namespace(const Namespace&) = default;
+
   int32_t clone_flags_;
   Mounts mounts_;
   std::string hostname_;
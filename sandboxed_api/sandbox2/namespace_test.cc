@@ -212,6 +212,84 @@ TEST(NamespaceTest, RootWritable) {
   EXPECT_EQ(result.reason_code(), 0);
 }
 
+TEST(NamespaceTest, ImageFileNamespaceWorks) {
+  // Same as FileNamespaceWorks, with the file in the mount image.
+  const std::string path = GetTestSourcePath("sandbox2/testcases/namespace");
+  std::vector<std::string> args = {path, "0", "/binary_path", "/etc/passwd"};
+  auto executor = absl::make_unique<Executor>(path, args);
+  SAPI_ASSERT_OK_AND_ASSIGN(auto policy, PolicyBuilder()
+                                        // Don't restrict the syscalls at all
+                                        .DangerDefaultAllowAll()
+                                        .AddFileAt(path, "/binary_path")
+                                        .UseMountImage()
+                                        .TryBuild());
+
+  Sandbox2 sandbox(std::move(executor), std::move(policy));
+  auto result = sandbox.Run();
+
+  ASSERT_EQ(result.final_status(), Result::OK);
+  EXPECT_EQ(result.reason_code(), 2);
+}
+
+TEST(NamespaceTest, ImageDevicesAreMounted) {
+  // Devices are mounted on top of the image, /etc/passwd should not exist.
+  const std::string path = GetTestSourcePath("sandbox2/testcases/namespace");
+  std::vector<std::string> args = {path, "0", "/dev/null", "/dev/urandom",
+                                   "/etc/passwd"};
+  auto executor = absl::make_unique<Executor>(path, args);
+  SAPI_ASSERT_OK_AND_ASSIGN(auto policy, PolicyBuilder()
+                                        // Don't restrict the syscalls at all
+                                        .DangerDefaultAllowAll()
+                                        .AddFile("/dev/null")
+                                        .AddFile("/dev/urandom")
+                                        .UseMountImage()
+                                        .TryBuild());
+
+  Sandbox2 sandbox(std::move(executor), std::move(policy));
+  auto result = sandbox.Run();
+
+  ASSERT_EQ(result.final_status(), Result::OK);
+  EXPECT_EQ(result.reason_code(), 3);
+}
+
+TEST(NamespaceTest, ImageRootReadOnly) {
+  // Same as RootReadOnly, with the tmpfs mounted on top of the image.
+  const std::string path = GetTestSourcePath("sandbox2/testcases/namespace");
+  std::vector<std::string> args = {path, "4", "/tmp/testfile", "/testfile"};
+  auto executor = absl::make_unique<Executor>(path, args);
+  SAPI_ASSERT_OK_AND_ASSIGN(auto policy, PolicyBuilder()
+                                        // Don't restrict the syscalls at all
+                                        .DangerDefaultAllowAll()
+                                        .AddTmpfs("/tmp")
+                                        .UseMountImage()
+                                        .TryBuild());
+
+  Sandbox2 sandbox(std::move(executor), std::move(policy));
+  auto result = sandbox.Run();
+
+  ASSERT_EQ(result.final_status(), Result::OK);
+  EXPECT_EQ(result.reason_code(), 2);
+}
+
+TEST(NamespaceTest, ImageRootWritable) {
+  // Same as RootWritable, with an overlay on top of the image.
+  const std::string path = GetTestSourcePath("sandbox2/testcases/namespace");
+  std::vector<std::string> args = {path, "4", "/testfile"};
+  auto executor = absl::make_unique<Executor>(path, args);
+  SAPI_ASSERT_OK_AND_ASSIGN(auto policy, PolicyBuilder()
+                                        // Don't restrict the syscalls at all
+                                        .DangerDefaultAllowAll()
+                                        .SetRootWritable()
+                                        .UseMountImage()
+                                        .TryBuild());
+
+  Sandbox2 sandbox(std::move(executor), std::move(policy));
+  auto result = sandbox.Run();
+
+  ASSERT_EQ(result.final_status(), Result::OK);
+  EXPECT_EQ(result.reason_code(), 0);
+}
+
 class HostnameTest : public testing::Test {
  protected:
   void Try(std::string arg, std::unique_ptr<Policy> policy) {
@@ -256,5 +334,26 @@ TEST_F(HostnameTest, Configured) {
   EXPECT_EQ(code_, 0);
 }
 
+TEST(NamespaceTest, PooledNamespacesWork) {
+  // Run more sandboxees than there are pooled namespaces, so that some of them
+  // use pooled ones. Each must get its own hostname.
+  const std::string path = GetTestSourcePath("sandbox2/testcases/hostname");
+  for (int i = 0; i < 4; ++i) {
+    const std::string hostname = absl::StrCat("pooled", i);
+    std::vector<std::string> args = {path, hostname};
+    auto executor = absl::make_unique<Executor>(path, args);
+    executor->set_namespace_pool(2);
+    SAPI_ASSERT_OK_AND_ASSIGN(auto policy, PolicyBuilder()
+                                          // Don't restrict the syscalls at all
+                                          .DangerDefaultAllowAll()
+                                          .SetHostname(hostname)
+                                          .TryBuild());
+    Sandbox2 sandbox(std::move(executor), std::move(policy));
+    auto result = sandbox.Run();
+    ASSERT_EQ(result.final_status(), Result::OK);
+    EXPECT_EQ(result.reason_code(), 0);
+  }
+}
+
 }  // namespace
 }  // namespace sandbox2
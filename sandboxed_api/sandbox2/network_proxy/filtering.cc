@@ -16,6 +16,9 @@
 
 #include <arpa/inet.h>
 
+#include <algorithm>
+#include <cstring>
+
 #include <glog/logging.h>
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -232,6 +235,22 @@ absl::Status AllowedHosts::AllowIPv6(const std::string& ip, uint32_t cidr,
   return absl::OkStatus();
 }
 
+bool AllowedHosts::operator==(const AllowedHosts& other) const {
+  return std::equal(allowed_IPv4_.begin(), allowed_IPv4_.end(),
+                    other.allowed_IPv4_.begin(), other.allowed_IPv4_.end(),
+                    [](const IPv4& a, const IPv4& b) {
+                      return a.ip == b.ip && a.mask == b.mask &&
+                             a.port == b.port;
+                    }) &&
+         std::equal(allowed_IPv6_.begin(), allowed_IPv6_.end(),
+                    other.allowed_IPv6_.begin(), other.allowed_IPv6_.end(),
+                    [](const IPv6& a, const IPv6& b) {
+                      return memcmp(&a.ip, &b.ip, sizeof(a.ip)) == 0 &&
+                             memcmp(&a.mask, &b.mask, sizeof(a.mask)) == 0 &&
+                             a.port == b.port;
+                    });
+}
+
 bool AllowedHosts::IsHostAllowed(const struct sockaddr* saddr) const {
   switch (saddr->sa_family) {
     case AF_INET:
@@ -55,6 +55,9 @@ class AllowedHosts {
   // Checks if this host is allowed.
   bool IsHostAllowed(const struct sockaddr* saddr) const;
 
+  // Returns whether both allow the same hosts, in the same order.
+  bool operator==(const AllowedHosts& other) const;
+
  private:
   absl::Status AllowIPv4(const std::string& ip, const std::string& mask,
                          uint32_t cidr, uint32_t port);
@@ -14,6 +14,7 @@
 
 #include "sandboxed_api/sandbox2/notify.h"
 
+#include <pthread.h>
 #include <syscall.h>
 
 #include <memory>
@@ -40,9 +41,12 @@ namespace {
 
 // Allow typical syscalls and call SECCOMP_RET_TRACE for personality syscall,
 // chosen because unlikely to be called by a regular program.
-std::unique_ptr<Policy> NotifyTestcasePolicy() {
-  return PolicyBuilder()
-      .DisableNamespaces()
+std::unique_ptr<Policy> NotifyTestcasePolicy(bool user_notify = false) {
+  PolicyBuilder builder;
+  if (user_notify) {
+    builder.EnableUserNotify();
+  }
+  return builder.DisableNamespaces()
       .AllowStaticStartup()
       .AllowExit()
       .AllowRead()
@@ -85,6 +89,28 @@ class PersonalityNotify : public Notify {
   bool allow_;
 };
 
+// Records whether EventSyscallTrap() was called on the thread which called
+// EventStarted(), i.e. the monitor thread.
+class SameThreadPersonalityNotify : public PersonalityNotify {
+ public:
+  explicit SameThreadPersonalityNotify(bool* same_thread)
+      : PersonalityNotify(true), same_thread_(same_thread) {}
+
+  bool EventStarted(pid_t pid, Comms* comms) override {
+    monitor_thread_ = pthread_self();
+    return true;
+  }
+
+  bool EventSyscallTrap(const Syscall& syscall) override {
+    *same_thread_ = pthread_equal(monitor_thread_, pthread_self());
+    return PersonalityNotify::EventSyscallTrap(syscall);
+  }
+
+ private:
+  bool* same_thread_;
+  pthread_t monitor_thread_;
+};
+
 // Print the newly created PID, and exchange data over Comms before sandboxing.
 class PidCommsNotify : public Notify {
  public:
@@ -129,6 +155,63 @@ TEST(NotifyTest, DisallowPersonality) {
   ASSERT_EQ(result.reason_code(), __NR_personality);
 }
 
+// Same as AllowPersonality, with the syscall trapped by a seccomp user
+// notification instead of ptrace.
+TEST(NotifyTest, AllowPersonalityWithUserNotify) {
+  SKIP_SANITIZERS_AND_COVERAGE;
+  const std::string path = GetTestSourcePath("sandbox2/testcases/personality");
+  std::vector<std::string> args = {path};
+  auto executor = absl::make_unique<Executor>(path, args);
+  auto policy = NotifyTestcasePolicy(/*user_notify=*/true);
+  ASSERT_THAT(policy, testing::Not(testing::IsNull()));
+  auto notify = absl::make_unique<PersonalityNotify>(true);
+
+  Sandbox2 s2(std::move(executor), std::move(policy), std::move(notify));
+  auto result = s2.Run();
+
+  ASSERT_EQ(result.final_status(), Result::OK);
+  ASSERT_EQ(result.reason_code(), 22);
+}
+
+// Same as DisallowPersonality, with the syscall trapped by a seccomp user
+// notification instead of ptrace.
+TEST(NotifyTest, DisallowPersonalityWithUserNotify) {
+  SKIP_SANITIZERS_AND_COVERAGE;
+  const std::string path = GetTestSourcePath("sandbox2/testcases/personality");
+  std::vector<std::string> args = {path};
+  auto executor = absl::make_unique<Executor>(path, args);
+  auto policy = NotifyTestcasePolicy(/*user_notify=*/true);
+  ASSERT_THAT(policy, testing::Not(testing::IsNull()));
+  auto notify = absl::make_unique<PersonalityNotify>(false);
+
+  Sandbox2 s2(std::move(executor), std::move(policy), std::move(notify));
+  auto result = s2.Run();
+
+  ASSERT_EQ(result.final_status(), Result::VIOLATION);
+  ASSERT_EQ(result.reason_code(), __NR_personality);
+  ASSERT_THAT(result.GetSyscall(), testing::Not(testing::IsNull()));
+  EXPECT_EQ(result.GetSyscall()->nr(), __NR_personality);
+}
+
+// Notify callbacks are not required to be thread-safe, so EventSyscallTrap()
+// must be called on the monitor thread as well.
+TEST(NotifyTest, UserNotifyTrapOnMonitorThread) {
+  SKIP_SANITIZERS_AND_COVERAGE;
+  const std::string path = GetTestSourcePath("sandbox2/testcases/personality");
+  std::vector<std::string> args = {path};
+  auto executor = absl::make_unique<Executor>(path, args);
+  auto policy = NotifyTestcasePolicy(/*user_notify=*/true);
+  ASSERT_THAT(policy, testing::Not(testing::IsNull()));
+  bool same_thread = false;
+  auto notify = absl::make_unique<SameThreadPersonalityNotify>(&same_thread);
+
+  Sandbox2 s2(std::move(executor), std::move(policy), std::move(notify));
+  auto result = s2.Run();
+
+  ASSERT_EQ(result.final_status(), Result::OK);
+  EXPECT_TRUE(same_thread);
+}
+
 // Test EventStarted by exchanging data after started but before sandboxed.
 TEST(NotifyTest, PrintPidAndComms) {
   SKIP_SANITIZERS_AND_COVERAGE;
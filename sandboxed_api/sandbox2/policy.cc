@@ -28,6 +28,8 @@
 
 #include <glog/logging.h>
 #include "sandboxed_api/util/flag.h"
+#include "absl/memory/memory.h"
+#include "sandboxed_api/sandbox2/bpf_evaluator.h"
 #include "sandboxed_api/sandbox2/bpfdisassembler.h"
 #include "sandboxed_api/sandbox2/comms.h"
 #include "sandboxed_api/sandbox2/regs.h"
@@ -49,10 +51,14 @@ namespace sandbox2 {
 //   3. default KILL action (avoid failing open if user policy did not do it).
 std::vector<sock_filter> Policy::GetPolicy() const {
   if (absl::GetFlag(FLAGS_sandbox2_danger_danger_permit_all) ||
-      !absl::GetFlag(FLAGS_sandbox2_danger_danger_permit_all_and_log).empty()) {
+      !absl::GetFlag(FLAGS_sandbox2_danger_danger_permit_all_and_log).empty() ||
+      collect_syscall_profile_) {
     return GetTrackingPolicy();
   }
+  return GetEnforcedPolicy();
+}
 
+std::vector<sock_filter> Policy::GetEnforcedPolicy() const {
   // Now we can start building the policy.
   // 1. Start with the default policy (e.g. syscall architecture checks).
   auto policy = GetDefaultPolicy();
@@ -142,6 +148,61 @@ std::vector<sock_filter> Policy::GetTrackingPolicy() const {
   };
 }
 
+bool Policy::UsesUserNotify() const {
+  return user_notify_ && !collect_syscall_profile_ &&
+         !absl::GetFlag(FLAGS_sandbox2_danger_danger_permit_all) &&
+         absl::GetFlag(FLAGS_sandbox2_danger_danger_permit_all_and_log).empty();
+}
+
+// Seccomp evaluates all installed filters and keeps the action with the highest
+// precedence. SECCOMP_RET_USER_NOTIF takes precedence over SECCOMP_RET_TRACE
+// and SECCOMP_RET_ALLOW, but not over SECCOMP_RET_KILL/TRAP/ERRNO, so stacking
+// this filter with GetPolicy() only turns the traced syscalls into
+// notifications.
+std::vector<sock_filter> Policy::GetUserNotifyPolicy() const {
+  if (!UsesUserNotify()) {
+    return {};
+  }
+  bpf_labels l = {0};
+
+  std::vector<sock_filter> policy = {
+    // Syscalls of other architectures are reported through ptrace.
+    LOAD_ARCH,
+    JNE32(Syscall::GetHostAuditArch(), ALLOW),
+
+    // The monitor allows the execveat() of the forkserver through ptrace.
+    LOAD_SYSCALL_NR,
+    JNE32(__NR_execveat, JUMP(&l, past_execveat_l)),
+    ARG_32(4),
+    JNE32(AT_EMPTY_PATH, JUMP(&l, past_execveat_l)),
+    ARG_32(5),
+    JEQ32(internal::kExecveMagic, ALLOW),
+    LABEL(&l, past_execveat_l),
+
+    LOAD_SYSCALL_NR,
+  };
+  if (bpf_resolve_jumps(&l, policy.data(), policy.size()) != 0) {
+    LOG(FATAL) << "Cannot resolve bpf jumps";
+  }
+
+  // The jumps of the user policy are already resolved and relative, so only the
+  // return instructions need to be rewritten.
+  const sock_filter trace = SANDBOX2_TRACE;
+  for (const sock_filter& filter : user_policy_) {
+    if (BPF_CLASS(filter.code) != BPF_RET) {
+      policy.push_back(filter);
+    } else if (BPF_RVAL(filter.code) == BPF_K && filter.k == trace.k) {
+      policy.push_back(BPF_STMT(BPF_RET + BPF_K, SECCOMP_RET_USER_NOTIF));
+    } else {
+      policy.push_back(ALLOW);
+    }
+  }
+  policy.push_back(ALLOW);
+
+  VLOG(2) << "User notify policy:\n" << bpf::Disasm(policy);
+  return policy;
+}
+
 bool Policy::SendPolicy(Comms* comms) const {
   auto policy = GetPolicy();
   if (!comms->SendBytes(
@@ -151,9 +212,59 @@ bool Policy::SendPolicy(Comms* comms) const {
     return false;
   }
 
+  // Empty if the syscalls are trapped through ptrace only.
+  auto user_notify_policy = GetUserNotifyPolicy();
+  if (!comms->SendBytes(reinterpret_cast<uint8_t*>(user_notify_policy.data()),
+                        static_cast<uint64_t>(user_notify_policy.size()) *
+                            sizeof(sock_filter))) {
+    LOG(ERROR) << "Couldn't send user notify policy";
+    return false;
+  }
+
   return true;
 }
 
+absl::StatusOr<std::vector<int>> Policy::GetInstructionCounts(
+    int num_syscalls) const {
+  const std::vector<sock_filter> policy = GetPolicy();
+  std::vector<int> counts(num_syscalls);
+  seccomp_data data = {};
+  data.arch = Syscall::GetHostAuditArch();
+  for (int nr = 0; nr < num_syscalls; ++nr) {
+    data.nr = nr;
+    auto result = bpf::Evaluate(policy, data);
+    if (!result.ok()) {
+      return result.status();
+    }
+    counts[nr] = result->instructions;
+  }
+  return counts;
+}
+
+std::unique_ptr<Policy> Policy::Clone() const {
+  auto copy = absl::WrapUnique(new Policy());
+  if (namespace_) {
+    copy->namespace_ = absl::WrapUnique(new Namespace(*namespace_));
+  }
+  copy->collect_stacktrace_on_violation_ = collect_stacktrace_on_violation_;
+  copy->collect_stacktrace_on_signal_ = collect_stacktrace_on_signal_;
+  copy->collect_stacktrace_on_timeout_ = collect_stacktrace_on_timeout_;
+  copy->collect_stacktrace_on_kill_ = collect_stacktrace_on_kill_;
+  copy->user_notify_ = user_notify_;
+  copy->collect_syscall_profile_ = collect_syscall_profile_;
+  if (capabilities_) {
+    copy->capabilities_ = absl::make_unique<std::vector<int>>(*capabilities_);
+  }
+  if (policy_builder_description_) {
+    copy->policy_builder_description_ =
+        absl::make_unique<PolicyBuilderDescription>(
+            *policy_builder_description_);
+  }
+  copy->user_policy_ = user_policy_;
+  copy->allowed_hosts_ = allowed_hosts_;
+  return copy;
+}
+
 void Policy::AllowUnsafeKeepCapabilities(
     std::unique_ptr<std::vector<int>> caps) {
   if (namespace_) {
@@ -28,6 +28,7 @@
 #include <vector>
 
 #include "absl/base/macros.h"
+#include "absl/status/statusor.h"
 #include "absl/types/optional.h"
 #include "sandboxed_api/sandbox2/namespace.h"
 #include "sandboxed_api/sandbox2/network_proxy/filtering.h"
@@ -58,10 +59,19 @@ class Policy final {
   // in the protobuf structure.
   void GetPolicyDescription(PolicyDescription* policy) const;
 
+  // Returns the number of BPF instructions the final policy executes for each
+  // syscall number of the host architecture below num_syscalls, with all
+  // syscall arguments set to zero. Useful to compare the cost of policies.
+  absl::StatusOr<std::vector<int>> GetInstructionCounts(
+      int num_syscalls = 512) const;
+
  private:
   // Private constructor only called by the PolicyBuilder.
   Policy() = default;
 
+  // Returns a deep copy of the policy.
+  std::unique_ptr<Policy> Clone() const;
+
   // Sends the policy over the IPC channel.
   bool SendPolicy(Comms* comms) const;
 
@@ -69,6 +79,21 @@ class Policy final {
   // requirements (message passing via Comms, Executor::WaitForExecve etc.).
   std::vector<sock_filter> GetPolicy() const;
 
+  // Returns the policy GetPolicy() installs when neither the FLAGS nor
+  // collect_syscall_profile_ ask for the tracking policy.
+  std::vector<sock_filter> GetEnforcedPolicy() const;
+
+  // Whether syscalls traced by the user policy are handled through a seccomp
+  // listener fd instead of ptrace.
+  bool UsesUserNotify() const;
+
+  // Returns the filter which is installed in front of GetPolicy() with
+  // SECCOMP_FILTER_FLAG_NEW_LISTENER, or an empty one if UsesUserNotify() is
+  // false. It returns SECCOMP_RET_USER_NOTIF where the user policy traces a
+  // syscall, and SECCOMP_RET_ALLOW everywhere else, leaving the decision to
+  // GetPolicy().
+  std::vector<sock_filter> GetUserNotifyPolicy() const;
+
   Namespace* GetNamespace() { return namespace_.get(); }
   void SetNamespace(std::unique_ptr<Namespace> ns) {
     namespace_ = std::move(ns);
@@ -88,6 +113,15 @@ class Policy final {
   bool collect_stacktrace_on_timeout_ = true;
   bool collect_stacktrace_on_kill_ = true;
 
+  // Handle SANDBOX2_TRACE actions of the user policy with seccomp user
+  // notifications. See policybuilder.h for more information.
+  bool user_notify_ = false;
+
+  // Trace all syscalls to record their frequencies in the Result, while the
+  // Monitor applies the decisions of GetEnforcedPolicy(). See policybuilder.h
+  // for more information.
+  bool collect_syscall_profile_ = false;
+
   // The capabilities to keep in the sandboxee.
   std::unique_ptr<std::vector<int>> capabilities_;
 
@@ -108,6 +142,7 @@ class Policy final {
 
   friend class Monitor;
   friend class PolicyBuilder;
+  friend class PolicyCache;
   friend class PolicyBuilderPeer;  // For testing
   friend class StackTracePeer;
 };
@@ -0,0 +1,118 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Implementation of the sandbox2::PolicyCache class.
+
+#include "sandboxed_api/sandbox2/policy_cache.h"
+
+#include <utility>
+
+#include <glog/logging.h>
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+#include "sandboxed_api/sandbox2/namespace.h"
+
+namespace sandbox2 {
+namespace {
+
+// Serializes the description of the policy, with the map entries of the mount
+// tree in a stable order.
+std::string SerializeDescription(const Policy& policy) {
+  PolicyDescription description;
+  policy.GetPolicyDescription(&description);
+  std::string serialized;
+  google::protobuf::io::StringOutputStream stream(&serialized);
+  google::protobuf::io::CodedOutputStream output(&stream);
+  output.SetSerializationDeterministic(true);
+  description.SerializeToCodedStream(&output);
+  output.Trim();
+  return serialized;
+}
+
+}  // namespace
+
+PolicyCache* PolicyCache::Global() {
+  static auto* cache = new PolicyCache();
+  return cache;
+}
+
+std::unique_ptr<Policy> PolicyCache::GetOrBuild(
+    absl::string_view key,
+    const std::function<std::unique_ptr<Policy>()>& build) {
+  std::unique_ptr<Policy> cached;
+  bool verify_hits;
+  {
+    absl::MutexLock lock(&mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      ++stats_.hits;
+      stats_.build_time_saved += it->second.build_time;
+      VLOG(1) << "Using the cached policy '" << key << "', saved "
+              << it->second.build_time;
+      cached = it->second.policy->Clone();
+    }
+    verify_hits = verify_hits_;
+  }
+  if (cached) {
+    CHECK(!verify_hits || IsSamePolicy(*cached, *build()))
+        << "The policy cached under '" << key << "' differs from the one "
+        << "built now, the key misses some of the inputs of the policy";
+    return cached;
+  }
+
+  // Build without holding the lock, as it may take a while.
+  const absl::Time start = absl::Now();
+  std::unique_ptr<Policy> policy = build();
+  const absl::Duration build_time = absl::Now() - start;
+  std::unique_ptr<Policy> copy = policy->Clone();
+
+  absl::MutexLock lock(&mutex_);
+  ++stats_.misses;
+  stats_.build_time += build_time;
+  entries_.emplace(key, Entry{std::move(policy), build_time});
+  return copy;
+}
+
+void PolicyCache::Clear() {
+  absl::MutexLock lock(&mutex_);
+  entries_.clear();
+}
+
+bool PolicyCache::IsSamePolicy(const Policy& a, const Policy& b) {
+  if (a.namespace_ && b.namespace_ &&
+      a.namespace_->hostname() != b.namespace_->hostname()) {
+    return false;
+  }
+  if (a.allowed_hosts_.has_value() != b.allowed_hosts_.has_value() ||
+      (a.allowed_hosts_ && !(*a.allowed_hosts_ == *b.allowed_hosts_))) {
+    return false;
+  }
+  // The description covers the user policy, the namespaces, the mount tree
+  // and the capabilities.
+  return a.collect_stacktrace_on_violation_ ==
+             b.collect_stacktrace_on_violation_ &&
+         a.collect_stacktrace_on_signal_ == b.collect_stacktrace_on_signal_ &&
+         a.collect_stacktrace_on_timeout_ == b.collect_stacktrace_on_timeout_ &&
+         a.collect_stacktrace_on_kill_ == b.collect_stacktrace_on_kill_ &&
+         a.user_notify_ == b.user_notify_ &&
+         a.collect_syscall_profile_ == b.collect_syscall_profile_ &&
+         SerializeDescription(a) == SerializeDescription(b);
+}
+
+PolicyCache::Stats PolicyCache::stats() const {
+  absl::MutexLock lock(&mutex_);
+  return stats_;
+}
+
+}  // namespace sandbox2
@@ -0,0 +1,112 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The sandbox2::PolicyCache class keeps compiled policies around, so that
+// sandboxes of the same kind do not rebuild them.
+
+#ifndef SANDBOXED_API_SANDBOX2_POLICY_CACHE_H_
+#define SANDBOXED_API_SANDBOX2_POLICY_CACHE_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "sandboxed_api/sandbox2/policy.h"
+
+namespace sandbox2 {
+
+// Building a policy resolves syscalls, generates the BPF program, and builds
+// the mount tree, which may involve resolving the shared libraries of a binary.
+// Policies which only depend on a few inputs can instead be built once per
+// process:
+//
+//   auto policy = sandbox2::PolicyCache::Global()->GetOrBuild(
+//       absl::StrCat("my_sandbox:", binary_path), [&binary_path] {
+//         return sandbox2::PolicyBuilder()
+//             .AddLibrariesForBinary(binary_path)
+//             ...
+//             .BuildOrDie();
+//       });
+//
+// The key must contain everything the policy depends on. Every call returns a
+// new copy of the cached policy, as sandboxes take ownership of theirs. As a
+// key which misses an input silently hands out the policy of another sandbox,
+// debug builds still build the policy on every hit, and crash if it differs
+// from the cached one, see set_verify_hits().
+class PolicyCache {
+ public:
+  struct Stats {
+    int64_t hits = 0;
+    int64_t misses = 0;
+    // Time spent building the policies which were not cached yet.
+    absl::Duration build_time;
+    // Time it would have taken to build the policies returned from the cache.
+    absl::Duration build_time_saved;
+  };
+
+  PolicyCache() = default;
+
+  PolicyCache(const PolicyCache&) = delete;
+  PolicyCache& operator=(const PolicyCache&) = delete;
+
+  // Returns the process-wide cache.
+  static PolicyCache* Global();
+
+  // Returns a copy of the policy cached under 'key'. If there is none, calls
+  // 'build' and caches its result first. Concurrent calls for a key which is
+  // not cached yet may build it more than once.
+  std::unique_ptr<Policy> GetOrBuild(
+      absl::string_view key,
+      const std::function<std::unique_ptr<Policy>()>& build);
+
+  // Removes all the policies from the cache. The stats are kept.
+  void Clear();
+
+  Stats stats() const;
+
+  // Whether GetOrBuild() also builds the policy on hits, and CHECK-fails if it
+  // differs from the cached one. Defaults to true in debug builds only.
+  void set_verify_hits(bool value) {
+    absl::MutexLock lock(&mutex_);
+    verify_hits_ = value;
+  }
+
+ private:
+  // Returns whether both policies enforce the same restrictions.
+  static bool IsSamePolicy(const Policy& a, const Policy& b);
+
+  struct Entry {
+    std::unique_ptr<const Policy> policy;
+    absl::Duration build_time;
+  };
+
+  mutable absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, Entry> entries_ ABSL_GUARDED_BY(mutex_);
+  Stats stats_ ABSL_GUARDED_BY(mutex_);
+#ifdef NDEBUG
+  bool verify_hits_ ABSL_GUARDED_BY(mutex_) = false;
+#else
+  bool verify_hits_ ABSL_GUARDED_BY(mutex_) = true;
+#endif
+};
+
+}  // namespace sandbox2
+
+#endif  // SANDBOXED_API_SANDBOX2_POLICY_CACHE_H_
@@ -0,0 +1,147 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sandboxed_api/sandbox2/policy_cache.h"
+
+#include <syscall.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/memory/memory.h"
+#include "sandboxed_api/sandbox2/executor.h"
+#include "sandboxed_api/sandbox2/policy.h"
+#include "sandboxed_api/sandbox2/policybuilder.h"
+#include "sandboxed_api/sandbox2/result.h"
+#include "sandboxed_api/sandbox2/sandbox2.h"
+#include "sandboxed_api/sandbox2/testing.h"
+#include "sandboxed_api/sandbox2/violation.pb.h"
+
+using ::testing::Eq;
+using ::testing::Ne;
+
+namespace sandbox2 {
+namespace {
+
+std::unique_ptr<Policy> BuildMinimalPolicy() {
+  return PolicyBuilder()
+      .AllowStaticStartup()
+      .AllowExit()
+      .BlockSyscallWithErrno(__NR_prlimit64, EPERM)
+#ifdef __NR_access
+      .BlockSyscallWithErrno(__NR_access, ENOENT)
+#endif
+      .BuildOrDie();
+}
+
+TEST(PolicyCacheTest, BuildsOnce) {
+  PolicyCache cache;
+  cache.set_verify_hits(false);
+  int builds = 0;
+  auto build = [&builds] {
+    ++builds;
+    return BuildMinimalPolicy();
+  };
+
+  std::unique_ptr<Policy> first = cache.GetOrBuild("minimal", build);
+  std::unique_ptr<Policy> second = cache.GetOrBuild("minimal", build);
+  EXPECT_THAT(builds, Eq(1));
+  EXPECT_THAT(first.get(), Ne(second.get()));
+
+  PolicyDescription first_description;
+  first->GetPolicyDescription(&first_description);
+  PolicyDescription second_description;
+  second->GetPolicyDescription(&second_description);
+  EXPECT_THAT(second_description.SerializeAsString(),
+              Eq(first_description.SerializeAsString()));
+
+  PolicyCache::Stats stats = cache.stats();
+  EXPECT_THAT(stats.hits, Eq(1));
+  EXPECT_THAT(stats.misses, Eq(1));
+  EXPECT_THAT(stats.build_time_saved, Eq(stats.build_time));
+}
+
+TEST(PolicyCacheTest, KeysAreSeparate) {
+  PolicyCache cache;
+  cache.set_verify_hits(false);
+  int builds = 0;
+  auto build = [&builds] {
+    ++builds;
+    return BuildMinimalPolicy();
+  };
+
+  cache.GetOrBuild("a", build);
+  cache.GetOrBuild("b", build);
+  EXPECT_THAT(builds, Eq(2));
+
+  cache.Clear();
+  cache.GetOrBuild("a", build);
+  EXPECT_THAT(builds, Eq(3));
+  EXPECT_THAT(cache.stats().misses, Eq(3));
+}
+
+TEST(PolicyCacheTest, VerifiedHitsReturnCachedPolicy) {
+  PolicyCache cache;
+  cache.set_verify_hits(true);
+  int builds = 0;
+  auto build = [&builds] {
+    ++builds;
+    return BuildMinimalPolicy();
+  };
+
+  cache.GetOrBuild("minimal", build);
+  cache.GetOrBuild("minimal", build);
+  EXPECT_THAT(builds, Eq(2));
+  EXPECT_THAT(cache.stats().hits, Eq(1));
+}
+
+TEST(PolicyCacheTest, VerifiedHitsCatchIncompleteKeys) {
+  PolicyCache cache;
+  cache.set_verify_hits(true);
+  cache.GetOrBuild("incomplete", BuildMinimalPolicy);
+  // The key does not cover the difference between the policies.
+  EXPECT_DEATH(cache.GetOrBuild("incomplete",
+                                [] {
+                                  return PolicyBuilder()
+                                      .AllowStaticStartup()
+                                      .AllowExit()
+                                      .BuildOrDie();
+                                }),
+               "key misses some of the inputs");
+}
+
+// Test that sandboxes can run with copies of the same cached policy.
+TEST(PolicyCacheTest, CachedPolicyWorks) {
+  SKIP_SANITIZERS_AND_COVERAGE;
+  const std::string path = GetTestSourcePath("sandbox2/testcases/minimal");
+  PolicyCache cache;
+  for (int i = 0; i < 2; ++i) {
+    std::vector<std::string> args = {path};
+    Sandbox2 s2(absl::make_unique<Executor>(path, args),
+                cache.GetOrBuild("minimal", BuildMinimalPolicy));
+    auto result = s2.Run();
+    ASSERT_THAT(result.final_status(), Eq(Result::OK));
+    EXPECT_THAT(result.reason_code(), Eq(EXIT_SUCCESS));
+  }
+  EXPECT_THAT(cache.stats().hits, Eq(1));
+}
+
+}  // namespace
+}  // namespace sandbox2
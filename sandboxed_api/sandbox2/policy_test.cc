@@ -164,15 +164,19 @@ TEST(PolicyTest, IsattyAllowed) {
   ASSERT_THAT(result.final_status(), Eq(Result::OK));
 }
 
-std::unique_ptr<Policy> MinimalTestcasePolicy() {
-  return PolicyBuilder()
-      .AllowStaticStartup()
+PolicyBuilder MinimalTestcasePolicyBuilder() {
+  PolicyBuilder builder;
+  builder.AllowStaticStartup()
       .AllowExit()
-      .BlockSyscallWithErrno(__NR_prlimit64, EPERM)
+      .BlockSyscallWithErrno(__NR_prlimit64, EPERM);
 #ifdef __NR_access
-      .BlockSyscallWithErrno(__NR_access, ENOENT)
+  builder.BlockSyscallWithErrno(__NR_access, ENOENT);
 #endif
-      .BuildOrDie();
+  return builder;
+}
+
+std::unique_ptr<Policy> MinimalTestcasePolicy() {
+  return MinimalTestcasePolicyBuilder().BuildOrDie();
 }
 
 // Test that we can sandbox a minimal static binary returning 0.
@@ -193,6 +197,39 @@ TEST(MinimalTest, MinimalBinaryWorks) {
   EXPECT_THAT(result.reason_code(), Eq(EXIT_SUCCESS));
 }
 
+// Test that the syscalls of a run are counted in learning mode.
+TEST(MinimalTest, CollectsSyscallProfile) {
+  SKIP_SANITIZERS_AND_COVERAGE;
+  const std::string path = GetTestSourcePath("sandbox2/testcases/minimal");
+  std::vector<std::string> args = {path};
+  auto executor = absl::make_unique<Executor>(path, args);
+
+  auto policy = MinimalTestcasePolicyBuilder().CollectSyscallProfile();
+
+  Sandbox2 s2(std::move(executor), policy.BuildOrDie());
+  auto result = s2.Run();
+
+  ASSERT_THAT(result.final_status(), Eq(Result::OK));
+  EXPECT_THAT(result.reason_code(), Eq(EXIT_SUCCESS));
+  EXPECT_THAT(result.syscall_profile().Count(__NR_exit_group), Eq(1));
+}
+
+// Test that the policy is still enforced in learning mode.
+TEST(MinimalTest, CollectSyscallProfileKeepsPolicy) {
+  SKIP_SANITIZERS_AND_COVERAGE;
+  const std::string path = GetTestSourcePath("sandbox2/testcases/minimal");
+  std::vector<std::string> args = {path};
+  auto executor = absl::make_unique<Executor>(path, args);
+
+  auto policy = PolicyBuilder().AllowExit().CollectSyscallProfile();
+
+  Sandbox2 s2(std::move(executor), policy.BuildOrDie());
+  auto result = s2.Run();
+
+  ASSERT_THAT(result.final_status(), Eq(Result::VIOLATION));
+  EXPECT_THAT(result.syscall_profile().empty(), Eq(false));
+}
+
 // Test that we can sandbox a minimal non-static binary returning 0.
 TEST(MinimalTest, MinimalSharedBinaryWorks) {
   SKIP_SANITIZERS_AND_COVERAGE;
@@ -16,6 +16,7 @@
 
 #include <asm/ioctls.h>  // For TCGETS
 #include <fcntl.h>       // For the fcntl flags
+#include <linux/filter.h>  // For BPF_MAXINSNS
 #include <linux/futex.h>
 #include <linux/net.h>     // For SYS_CONNECT
 #include <linux/random.h>  // For GRND_NONBLOCK
@@ -23,9 +24,14 @@
 #include <sys/socket.h>
 #include <syscall.h>
 
+#include <algorithm>
 #include <csignal>
 #include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
 #include <utility>
+#include <vector>
 
 #include "absl/memory/memory.h"
 #include "absl/status/statusor.h"
@@ -51,6 +57,7 @@ namespace {
 PolicyBuilder& PolicyBuilder::AllowSyscall(unsigned int num) {
   if (handled_syscalls_.insert(num).second) {
     user_policy_.insert(user_policy_.end(), {SYSCALL(num, ALLOW)});
+    rules_.push_back({{num}, false, {ALLOW}});
   }
   return *this;
 }
@@ -73,6 +80,7 @@ PolicyBuilder& PolicyBuilder::BlockSyscallWithErrno(unsigned int num,
                                                     int error) {
   if (handled_syscalls_.insert(num).second) {
     user_policy_.insert(user_policy_.end(), {SYSCALL(num, ERRNO(error))});
+    rules_.push_back({{num}, false, {ERRNO(error)}});
   }
   return *this;
 }
@@ -593,36 +601,43 @@ PolicyBuilder& PolicyBuilder::AddPolicyOnSyscall(unsigned int num, BpfFunc f) {
 
 PolicyBuilder& PolicyBuilder::AddPolicyOnSyscalls(
     SyscallInitializer nums, const std::vector<sock_filter>& policy) {
-  auto resolved_policy =
-      ResolveBpfFunc(
-          [nums, policy](bpf_labels& labels) -> std::vector<sock_filter> {
-            std::vector<sock_filter> out;
-            out.reserve(nums.size() + policy.size());
-            for (auto num : nums) {
-              out.insert(out.end(), {SYSCALL(num, JUMP(&labels, do_policy_l))});
-            }
-            out.insert(out.end(), {JUMP(&labels, dont_do_policy_l),
-                                   LABEL(&labels, do_policy_l)});
-            for (const auto& filter : policy) {
-              // Syscall arch is expected as TRACE value
-              if (filter.code == (BPF_RET | BPF_K) &&
-                  (filter.k & SECCOMP_RET_ACTION) == SECCOMP_RET_TRACE &&
-                  (filter.k & SECCOMP_RET_DATA) != Syscall::GetHostArch()) {
-                LOG(WARNING)
-                    << "SANDBOX2_TRACE should be used in policy instead of "
-                       "TRACE(value)";
-                out.push_back(SANDBOX2_TRACE);
-              } else {
-                out.push_back(filter);
-              }
-            }
-            out.push_back(LOAD_SYSCALL_NR);
-            out.insert(out.end(), {LABEL(&labels, dont_do_policy_l)});
-            return out;
-          });
+  std::vector<sock_filter> fixed_policy;
+  fixed_policy.reserve(policy.size());
+  for (const auto& filter : policy) {
+    // Syscall arch is expected as TRACE value
+    if (filter.code == (BPF_RET | BPF_K) &&
+        (filter.k & SECCOMP_RET_ACTION) == SECCOMP_RET_TRACE &&
+        (filter.k & SECCOMP_RET_DATA) != Syscall::GetHostArch()) {
+      LOG(WARNING) << "SANDBOX2_TRACE should be used in policy instead of "
+                      "TRACE(value)";
+      fixed_policy.push_back(SANDBOX2_TRACE);
+    } else {
+      fixed_policy.push_back(filter);
+    }
+  }
+  auto resolved_policy = ResolveBpfFunc(
+      [nums, &fixed_policy](bpf_labels& labels) -> std::vector<sock_filter> {
+        std::vector<sock_filter> out;
+        out.reserve(nums.size() + fixed_policy.size());
+        for (auto num : nums) {
+          out.insert(out.end(), {SYSCALL(num, JUMP(&labels, do_policy_l))});
+        }
+        out.insert(out.end(), {JUMP(&labels, dont_do_policy_l),
+                               LABEL(&labels, do_policy_l)});
+        out.insert(out.end(), fixed_policy.begin(), fixed_policy.end());
+        out.push_back(LOAD_SYSCALL_NR);
+        out.insert(out.end(), {LABEL(&labels, dont_do_policy_l)});
+        return out;
+      });
   // Pre-/Postcondition: Syscall number loaded into A register
   user_policy_.insert(user_policy_.end(), resolved_policy.begin(),
                       resolved_policy.end());
+
+  SyscallRule rule;
+  rule.nums.assign(nums.begin(), nums.end());
+  rule.body = std::move(fixed_policy);
+  rule.body.push_back(LOAD_SYSCALL_NR);
+  rules_.push_back(std::move(rule));
   return *this;
 }
 
@@ -664,6 +679,7 @@ PolicyBuilder& PolicyBuilder::AddPolicyOnMmap(BpfFunc f) {
 
 PolicyBuilder& PolicyBuilder::DangerDefaultAllowAll() {
   user_policy_.push_back(ALLOW);
+  rules_.push_back({{}, true, {ALLOW}});
   return *this;
 }
 
@@ -686,6 +702,256 @@ absl::StatusOr<std::string> PolicyBuilder::ValidatePath(
   return fixed_path;
 }
 
+std::vector<sock_filter> PolicyBuilder::CompileBinarySearchDispatch(
+    const std::vector<SyscallRule>& rules) {
+  // Rules which stop the evaluation, no matter the arguments.
+  auto is_terminal = [&rules](int rule) {
+    const std::vector<sock_filter>& body = rules[rule].body;
+    return !body.empty() && BPF_CLASS(body[0].code) == BPF_RET;
+  };
+  // Appends a rule to the rules evaluated for a syscall, unless one of them
+  // already returns unconditionally.
+  auto append_rule = [&is_terminal](std::vector<int>* list, int rule) {
+    if ((list->empty() || !is_terminal(list->back())) &&
+        std::find(list->begin(), list->end(), rule) == list->end()) {
+      list->push_back(rule);
+    }
+  };
+
+  // Rules evaluated for each syscall with a rule of its own, in the order they
+  // were added. The other syscalls only evaluate the rules for all syscalls.
+  std::map<uint32_t, std::vector<int>> syscall_rules;
+  std::vector<int> default_rules;
+  for (const auto& rule : rules) {
+    for (uint32_t nr : rule.nums) {
+      syscall_rules[nr];
+    }
+  }
+  for (int i = 0; i < rules.size(); ++i) {
+    if (rules[i].all_syscalls) {
+      append_rule(&default_rules, i);
+      for (auto& entry : syscall_rules) {
+        append_rule(&entry.second, i);
+      }
+      continue;
+    }
+    for (uint32_t nr : rules[i].nums) {
+      append_rule(&syscall_rules[nr], i);
+    }
+  }
+
+  // Syscalls evaluating the same rules share the same code.
+  std::map<std::vector<int>, int> code_ids;
+  std::vector<std::vector<int>> codes;
+  auto get_code = [&code_ids, &codes](const std::vector<int>& list) {
+    auto it = code_ids.emplace(list, codes.size()).first;
+    if (it->second == codes.size()) {
+      codes.push_back(list);
+    }
+    return it->second;
+  };
+
+  // Split the syscall numbers into ranges using the same code.
+  struct Range {
+    uint32_t first;
+    int code;
+  };
+  std::vector<Range> ranges;
+  auto add_range = [&ranges](uint32_t first, int code) {
+    if (ranges.empty() || ranges.back().code != code) {
+      ranges.push_back({first, code});
+    }
+  };
+  const int default_code = get_code(default_rules);
+  uint64_t next = 0;
+  for (const auto& entry : syscall_rules) {
+    if (entry.first > next) {
+      add_range(next, default_code);
+    }
+    add_range(entry.first, get_code(entry.second));
+    next = uint64_t{entry.first} + 1;
+  }
+  if (next <= UINT32_MAX) {
+    add_range(next, default_code);
+  }
+
+  // Jumps to the code of a range, or to the end of the user policy (kEnd).
+  // They are resolved once the position of the code is known.
+  constexpr int kEnd = -1;
+  struct Fixup {
+    size_t pos;
+    int code;
+  };
+  std::vector<sock_filter> out;
+  std::vector<Fixup> fixups;
+
+  // Emits the binary search over ranges[lo, hi). Conditional jumps can only
+  // skip 255 instructions, so larger subtrees are skipped with a BPF_JA.
+  std::function<void(size_t, size_t, std::vector<sock_filter>*,
+                     std::vector<Fixup>*)>
+      emit_tree = [&](size_t lo, size_t hi, std::vector<sock_filter>* tree,
+                      std::vector<Fixup>* tree_fixups) {
+        if (hi - lo == 1) {
+          const std::vector<int>& list = codes[ranges[lo].code];
+          if (!list.empty() && is_terminal(list.front())) {
+            tree->push_back(rules[list.front()].body.front());
+          } else {
+            tree_fixups->push_back(
+                {tree->size(), list.empty() ? kEnd : ranges[lo].code});
+            tree->push_back(BPF_STMT(BPF_JMP + BPF_JA, 0));
+          }
+          return;
+        }
+        const size_t mid = lo + (hi - lo) / 2;
+        std::vector<sock_filter> left;
+        std::vector<Fixup> left_fixups;
+        emit_tree(lo, mid, &left, &left_fixups);
+        if (left.size() <= 0xff) {
+          tree->push_back(BPF_JUMP(BPF_JMP + BPF_JGE + BPF_K,
+                                   ranges[mid].first, left.size(), 0));
+        } else {
+          tree->push_back(
+              BPF_JUMP(BPF_JMP + BPF_JGE + BPF_K, ranges[mid].first, 0, 1));
+          tree->push_back(BPF_STMT(BPF_JMP + BPF_JA, left.size()));
+        }
+        for (const Fixup& fixup : left_fixups) {
+          tree_fixups->push_back({tree->size() + fixup.pos, fixup.code});
+        }
+        tree->insert(tree->end(), left.begin(), left.end());
+        emit_tree(mid, hi, tree, tree_fixups);
+      };
+  emit_tree(0, ranges.size(), &out, &fixups);
+
+  // Append the code of the ranges which were not inlined into the tree.
+  std::map<int, size_t> code_starts;
+  for (size_t i = 0; i < fixups.size(); ++i) {
+    const int code = fixups[i].code;
+    if (code == kEnd || !code_starts.emplace(code, out.size()).second) {
+      continue;
+    }
+    for (int rule : codes[code]) {
+      out.insert(out.end(), rules[rule].body.begin(), rules[rule].body.end());
+    }
+    if (!is_terminal(codes[code].back())) {
+      fixups.push_back({out.size(), kEnd});
+      out.push_back(BPF_STMT(BPF_JMP + BPF_JA, 0));
+    }
+  }
+  for (const Fixup& fixup : fixups) {
+    const size_t target =
+        fixup.code == kEnd ? out.size() : code_starts[fixup.code];
+    out[fixup.pos].k = target - fixup.pos - 1;
+  }
+  return out;
+}
+
+std::vector<sock_filter> PolicyBuilder::CompileLinearDispatch(
+    const std::vector<SyscallRule>& rules) {
+  std::vector<sock_filter> out;
+  for (const SyscallRule& rule : rules) {
+    if (rule.all_syscalls) {
+      out.insert(out.end(), rule.body.begin(), rule.body.end());
+      continue;
+    }
+    // Same code as AllowSyscall() produces.
+    if (rule.nums.size() == 1 && rule.body.size() == 1) {
+      out.insert(out.end(), {SYSCALL(rule.nums[0], rule.body[0])});
+      continue;
+    }
+    // Like AddPolicyOnSyscalls(), with the jumps to the body folded into the
+    // syscall number checks. Conditional jumps can only skip 255 instructions,
+    // so longer lists are split into chunks, each of which jumps to the body
+    // through a BPF_JA trampoline at its end.
+    constexpr size_t kMaxChunkSize = 0xff;
+    const size_t num_syscalls = rule.nums.size();
+    std::vector<size_t> trampolines;
+    for (size_t start = 0; start < num_syscalls; start += kMaxChunkSize) {
+      const size_t end = std::min(start + kMaxChunkSize, num_syscalls);
+      for (size_t i = start; i < end; ++i) {
+        out.push_back(BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, rule.nums[i],
+                               end - i, 0));
+      }
+      if (num_syscalls <= kMaxChunkSize) {
+        break;
+      }
+      // Skip the trampoline if none of the chunk matched.
+      out.push_back(BPF_STMT(BPF_JMP + BPF_JA, 1));
+      trampolines.push_back(out.size());
+      out.push_back(BPF_STMT(BPF_JMP + BPF_JA, 0));
+    }
+    out.push_back(BPF_STMT(BPF_JMP + BPF_JA, rule.body.size()));
+    for (size_t pos : trampolines) {
+      out[pos].k = out.size() - pos - 1;
+    }
+    out.insert(out.end(), rule.body.begin(), rule.body.end());
+  }
+  return out;
+}
+
+std::vector<PolicyBuilder::SyscallRule> PolicyBuilder::OrderRulesByProfile(
+    const std::vector<SyscallRule>& rules, const SyscallProfile& profile) {
+  const size_t num_rules = rules.size();
+  std::vector<uint64_t> weights(num_rules);
+  std::vector<std::set<uint32_t>> nums(num_rules);
+  for (size_t i = 0; i < num_rules; ++i) {
+    nums[i].insert(rules[i].nums.begin(), rules[i].nums.end());
+    for (uint32_t nr : nums[i]) {
+      weights[i] += profile.Count(nr);
+    }
+  }
+
+  // A rule must stay after the rules added before it which apply to one of its
+  // syscalls, as the first of them returning decides.
+  auto overlap = [&rules, &nums](size_t a, size_t b) {
+    if (rules[a].all_syscalls || rules[b].all_syscalls) {
+      return true;
+    }
+    for (uint32_t nr : nums[a]) {
+      if (nums[b].count(nr) != 0) {
+        return true;
+      }
+    }
+    return false;
+  };
+  std::vector<std::vector<size_t>> successors(num_rules);
+  std::vector<int> predecessors(num_rules);
+  for (size_t b = 0; b < num_rules; ++b) {
+    for (size_t a = 0; a < b; ++a) {
+      if (overlap(a, b)) {
+        successors[a].push_back(b);
+        ++predecessors[b];
+      }
+    }
+  }
+
+  // Emit the heaviest rule whose predecessors were all emitted, preferring the
+  // original order for equal weights.
+  std::vector<SyscallRule> ordered;
+  ordered.reserve(num_rules);
+  std::vector<bool> emitted(num_rules);
+  while (ordered.size() < num_rules) {
+    size_t best = num_rules;
+    for (size_t i = 0; i < num_rules; ++i) {
+      if (!emitted[i] && predecessors[i] == 0 &&
+          (best == num_rules || weights[i] > weights[best])) {
+        best = i;
+      }
+    }
+    emitted[best] = true;
+    for (size_t successor : successors[best]) {
+      --predecessors[successor];
+    }
+    SyscallRule rule = rules[best];
+    // The order of the syscall numbers within a rule does not matter.
+    std::stable_sort(rule.nums.begin(), rule.nums.end(),
+                     [&profile](uint32_t a, uint32_t b) {
+                       return profile.Count(a) > profile.Count(b);
+                     });
+    ordered.push_back(std::move(rule));
+  }
+  return ordered;
+}
+
 std::vector<sock_filter> PolicyBuilder::ResolveBpfFunc(BpfFunc f) {
   bpf_labels l = {0};
 
@@ -726,7 +992,43 @@ absl::StatusOr<std::unique_ptr<Policy>> PolicyBuilder::TryBuild() {
   output->collect_stacktrace_on_violation_ = collect_stacktrace_on_violation_;
   output->collect_stacktrace_on_timeout_ = collect_stacktrace_on_timeout_;
   output->collect_stacktrace_on_kill_ = collect_stacktrace_on_kill_;
-  output->user_policy_ = std::move(user_policy_);
+  output->user_notify_ = user_notify_;
+  output->collect_syscall_profile_ = collect_syscall_profile_;
+  if (binary_search_dispatch_) {
+    output->user_policy_ = CompileBinarySearchDispatch(rules_);
+  } else if (syscall_profile_) {
+    output->user_policy_ =
+        CompileLinearDispatch(OrderRulesByProfile(rules_, *syscall_profile_));
+  } else {
+    output->user_policy_ = std::move(user_policy_);
+  }
+  // The kernel rejects filters with more instructions, which would otherwise
+  // only show when the sandboxee fails to start.
+  const size_t policy_size = std::max(output->GetEnforcedPolicy().size(),
+                                      output->GetUserNotifyPolicy().size());
+  if (policy_size > BPF_MAXINSNS) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("Policy has ", policy_size,
+                     " BPF instructions, more than the limit of ",
+                     BPF_MAXINSNS));
+  }
+  if (VLOG_IS_ON(1)) {
+    absl::StatusOr<std::vector<int>> counts = output->GetInstructionCounts();
+    if (counts.ok()) {
+      int total = 0;
+      int max = 0;
+      for (int count : *counts) {
+        total += count;
+        max = std::max(max, count);
+      }
+      VLOG(1) << "BPF instructions per syscall: "
+              << static_cast<double>(total) / counts->size() << " on average, "
+              << max << " at most";
+    } else {
+      VLOG(1) << "Could not count the BPF instructions per syscall: "
+              << counts.status();
+    }
+  }
 
   auto pb_description = absl::make_unique<PolicyBuilderDescription>();
 
@@ -876,6 +1178,27 @@ PolicyBuilder& PolicyBuilder::CollectStacktracesOnKill(bool enable) {
   return *this;
 }
 
+PolicyBuilder& PolicyBuilder::EnableUserNotify() {
+  user_notify_ = true;
+  return *this;
+}
+
+PolicyBuilder& PolicyBuilder::EnableBinarySearchDispatch() {
+  binary_search_dispatch_ = true;
+  return *this;
+}
+
+PolicyBuilder& PolicyBuilder::CollectSyscallProfile() {
+  collect_syscall_profile_ = true;
+  return *this;
+}
+
+PolicyBuilder& PolicyBuilder::OrderSyscallsByProfile(
+    const SyscallProfile& profile) {
+  syscall_profile_ = profile;
+  return *this;
+}
+
 PolicyBuilder& PolicyBuilder::AddNetworkProxyPolicy() {
   if (allowed_hosts_) {
     SetError(absl::FailedPreconditionError(
@@ -954,6 +1277,13 @@ PolicyBuilder& PolicyBuilder::SetRootWritable() {
   return *this;
 }
 
+PolicyBuilder& PolicyBuilder::UseMountImage() {
+  EnableNamespaces();
+  mounts_.SetUseImage();
+
+  return *this;
+}
+
 void PolicyBuilder::StoreDescription(PolicyBuilderDescription* pb_description) {
   for (const auto& handled_syscall : handled_syscalls_) {
     pb_description->add_handled_syscalls(handled_syscall);
@@ -14,13 +14,20 @@
 
 #include "sandboxed_api/sandbox2/policybuilder.h"
 
+#include <linux/seccomp.h>
 #include <syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <glog/logging.h>
+#include "benchmark/benchmark.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/memory/memory.h"
@@ -28,11 +35,13 @@
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_split.h"
+#include "sandboxed_api/sandbox2/bpf_evaluator.h"
 #include "sandboxed_api/sandbox2/comms.h"
 #include "sandboxed_api/sandbox2/executor.h"
 #include "sandboxed_api/sandbox2/ipc.h"
 #include "sandboxed_api/sandbox2/result.h"
 #include "sandboxed_api/sandbox2/sandbox2.h"
+#include "sandboxed_api/sandbox2/syscall_profile.h"
 #include "sandboxed_api/sandbox2/testing.h"
 #include "sandboxed_api/sandbox2/util/bpf_helper.h"
 #include "sandboxed_api/util/status_matchers.h"
@@ -58,11 +67,24 @@ class PolicyBuilderPeer {
 
   int policy_size() const { return builder_->user_policy_.size(); }
 
+  static std::vector<sock_filter> GetPolicy(const Policy& policy) {
+    return policy.GetPolicy();
+  }
+
   static absl::StatusOr<std::string> ValidateAbsolutePath(
       absl::string_view path) {
     return PolicyBuilder::ValidateAbsolutePath(path);
   }
 
+  // Compiles a rule for the given syscalls with the given body.
+  static std::vector<sock_filter> CompileLinearDispatch(
+      std::vector<uint32_t> nums, std::vector<sock_filter> body) {
+    PolicyBuilder::SyscallRule rule;
+    rule.nums = std::move(nums);
+    rule.body = std::move(body);
+    return PolicyBuilder::CompileLinearDispatch({rule});
+  }
+
  private:
   PolicyBuilder* builder_;
 };
@@ -155,6 +177,209 @@ TEST_F(PolicyBuilderTest, TestValidateAbsolutePath) {
   }
 }
 
+std::unique_ptr<Policy> BuildDispatchTestPolicy(
+    bool binary_search, const SyscallProfile* profile = nullptr) {
+  PolicyBuilder builder;
+  if (binary_search) {
+    builder.EnableBinarySearchDispatch();
+  }
+  if (profile) {
+    builder.OrderSyscallsByProfile(*profile);
+  }
+  return builder.DisableNamespaces()
+      .AllowStaticStartup()
+      .AllowExit()
+      .AllowRead()
+      .AllowWrite()
+      .AllowSystemMalloc()
+      .AllowTCGETS()
+      .BlockSyscallWithErrno(__NR_openat, ENOENT)
+      .AddPolicyOnSyscalls({__NR_fchmod, __NR_chdir},
+                           {ARG_32(0), JEQ32(1, ALLOW)})
+      .AllowSyscall(__NR_chdir)
+      .BuildOrDie();
+}
+
+TEST_F(PolicyBuilderTest, BinarySearchDispatchIsEquivalent) {
+  std::vector<sock_filter> linear =
+      PolicyBuilderPeer::GetPolicy(*BuildDispatchTestPolicy(false));
+  std::vector<sock_filter> binary_search =
+      PolicyBuilderPeer::GetPolicy(*BuildDispatchTestPolicy(true));
+
+  for (int nr = 0; nr < 512; ++nr) {
+    for (uint64_t arg : {0, 1, 2}) {
+      seccomp_data data = {};
+      data.arch = Syscall::GetHostAuditArch();
+      data.nr = nr;
+      data.args[0] = arg;
+      SAPI_ASSERT_OK_AND_ASSIGN(bpf::EvaluationResult expected,
+                                bpf::Evaluate(linear, data));
+      SAPI_ASSERT_OK_AND_ASSIGN(bpf::EvaluationResult actual,
+                                bpf::Evaluate(binary_search, data));
+      EXPECT_THAT(actual.action, Eq(expected.action))
+          << "syscall " << nr << ", arg " << arg;
+    }
+  }
+}
+
+TEST_F(PolicyBuilderTest, BinarySearchDispatchExecutesFewerInstructions) {
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      std::vector<int> linear,
+      BuildDispatchTestPolicy(false)->GetInstructionCounts());
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      std::vector<int> binary_search,
+      BuildDispatchTestPolicy(true)->GetInstructionCounts());
+  EXPECT_THAT(*std::max_element(binary_search.begin(), binary_search.end()),
+              Lt(*std::max_element(linear.begin(), linear.end())));
+}
+
+// Makes the syscalls of the last rules of BuildDispatchTestPolicy() the most
+// frequent ones.
+SyscallProfile DispatchTestProfile() {
+  SyscallProfile profile;
+  profile.Add(__NR_chdir, 1000);
+  profile.Add(__NR_openat, 500);
+  profile.Add(__NR_read, 10);
+  return profile;
+}
+
+TEST_F(PolicyBuilderTest, OrderSyscallsByProfileIsEquivalent) {
+  const SyscallProfile profile = DispatchTestProfile();
+  std::vector<sock_filter> linear =
+      PolicyBuilderPeer::GetPolicy(*BuildDispatchTestPolicy(false));
+  std::vector<sock_filter> ordered =
+      PolicyBuilderPeer::GetPolicy(*BuildDispatchTestPolicy(false, &profile));
+
+  for (int nr = 0; nr < 512; ++nr) {
+    for (uint64_t arg : {0, 1, 2}) {
+      seccomp_data data = {};
+      data.arch = Syscall::GetHostAuditArch();
+      data.nr = nr;
+      data.args[0] = arg;
+      SAPI_ASSERT_OK_AND_ASSIGN(bpf::EvaluationResult expected,
+                                bpf::Evaluate(linear, data));
+      SAPI_ASSERT_OK_AND_ASSIGN(bpf::EvaluationResult actual,
+                                bpf::Evaluate(ordered, data));
+      EXPECT_THAT(actual.action, Eq(expected.action))
+          << "syscall " << nr << ", arg " << arg;
+    }
+  }
+}
+
+// Conditional BPF jumps have an 8-bit offset, a rule for more syscalls than
+// that must still reach its body from every check.
+TEST_F(PolicyBuilderTest, LinearDispatchOfLargeRule) {
+  constexpr uint32_t kNumSyscalls = 300;
+  std::vector<uint32_t> nums;
+  for (uint32_t nr = 0; nr < kNumSyscalls; ++nr) {
+    nums.push_back(nr);
+  }
+  std::vector<sock_filter> policy = {LOAD_SYSCALL_NR};
+  std::vector<sock_filter> rule = PolicyBuilderPeer::CompileLinearDispatch(
+      std::move(nums), {ERRNO(EPERM)});
+  policy.insert(policy.end(), rule.begin(), rule.end());
+  policy.push_back(ALLOW);
+
+  for (uint32_t nr = 0; nr < kNumSyscalls + 10; ++nr) {
+    seccomp_data data = {};
+    data.arch = Syscall::GetHostAuditArch();
+    data.nr = nr;
+    SAPI_ASSERT_OK_AND_ASSIGN(bpf::EvaluationResult result,
+                              bpf::Evaluate(policy, data));
+    EXPECT_THAT(result.action, Eq(nr < kNumSyscalls
+                                      ? SECCOMP_RET_ERRNO | EPERM
+                                      : SECCOMP_RET_ALLOW))
+        << "syscall " << nr;
+  }
+}
+
+TEST_F(PolicyBuilderTest, OrderSyscallsByProfileChecksHotSyscallsFirst) {
+  const SyscallProfile profile = DispatchTestProfile();
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      std::vector<int> linear,
+      BuildDispatchTestPolicy(false)->GetInstructionCounts());
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      std::vector<int> ordered,
+      BuildDispatchTestPolicy(false, &profile)->GetInstructionCounts());
+  EXPECT_THAT(ordered[__NR_openat], Lt(linear[__NR_openat]));
+  EXPECT_THAT(ordered[__NR_read], Lt(linear[__NR_read]));
+  // The rules for chdir must stay in order, but still move up.
+  EXPECT_THAT(ordered[__NR_chdir], Lt(linear[__NR_chdir]));
+  EXPECT_THAT(ordered[__NR_chdir], Lt(ordered[__NR_read]));
+}
+
+TEST_F(PolicyBuilderTest, SyscallProfileRoundTrip) {
+  const SyscallProfile profile = DispatchTestProfile();
+  SAPI_ASSERT_OK_AND_ASSIGN(SyscallProfile parsed,
+                            SyscallProfile::FromString(profile.ToString()));
+  EXPECT_THAT(parsed.counts(), Eq(profile.counts()));
+  EXPECT_THAT(SyscallProfile::FromString("0 1 2").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST_F(PolicyBuilderTest, TooLargePolicyFailsToBuild) {
+  // Syscall numbers which do not exist on any architecture.
+  constexpr int kSyscalls = 4;
+  // The binary search copies the shared rule for each of the syscalls, as
+  // each of them also has a rule of its own.
+  auto build = [](bool binary_search) {
+    PolicyBuilder builder;
+    if (binary_search) {
+      builder.EnableBinarySearchDispatch();
+    }
+    builder.AddPolicyOnSyscalls(
+        {1000, 1001, 1002, 1003},
+        std::vector<sock_filter>(BPF_MAXINSNS / (kSyscalls - 1), ARG_32(0)));
+    for (int i = 0; i < kSyscalls; ++i) {
+      builder.BlockSyscallWithErrno(1000 + i, ENOSYS);
+    }
+    return builder.DisableNamespaces()
+        .AllowStaticStartup()
+        .AllowExit()
+        .TryBuild();
+  };
+  EXPECT_THAT(build(false).status(), IsOk());
+  EXPECT_THAT(build(true).status(),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+}
+
+// Measures the throughput of getpid() in a sandboxee whose policy has 150 rules
+// before the one allowing it, checked one by one (state.range(0) == 0) or with
+// a binary search (state.range(0) == 1).
+void BenchmarkGetpidThroughput(benchmark::State& state) {
+  // Rules for syscall numbers which do not exist on any architecture.
+  constexpr int kFirstUnusedSyscall = 1000;
+  constexpr int kRules = 150;
+  constexpr int32_t kCalls = 100000;
+
+  const std::string path = GetTestSourcePath("sandbox2/testcases/trap_loop");
+  std::vector<std::string> args = {path, absl::StrCat(__NR_getpid)};
+  PolicyBuilder builder;
+  if (state.range(0) != 0) {
+    builder.EnableBinarySearchDispatch();
+  }
+  for (int i = 0; i < kRules; ++i) {
+    builder.BlockSyscallWithErrno(kFirstUnusedSyscall + i, ENOSYS);
+  }
+  auto policy =
+      builder.DisableNamespaces().DangerDefaultAllowAll().BuildOrDie();
+  absl::StatusOr<std::vector<int>> counts = policy->GetInstructionCounts();
+  CHECK(counts.ok()) << counts.status();
+  state.counters["bpf_instructions_getpid"] = (*counts)[__NR_getpid];
+
+  Sandbox2 s2(absl::make_unique<Executor>(path, args), std::move(policy));
+  CHECK(s2.RunAsync());
+  for (auto _ : state) {
+    bool done = false;
+    CHECK(s2.comms()->SendInt32(kCalls));
+    CHECK(s2.comms()->RecvBool(&done));
+  }
+  state.SetItemsProcessed(state.iterations() * kCalls);
+  s2.Kill();
+  s2.AwaitResult().IgnoreResult();
+}
+BENCHMARK(BenchmarkGetpidThroughput)->Arg(0)->Arg(1);
+
 std::string PolicyBuilderTest::Run(std::vector<std::string> args,
                                    bool network) {
   PolicyBuilder builder;
@@ -39,7 +39,9 @@ Result& Result::operator=(const Result& other) {
   }
   prog_name_ = other.prog_name_;
   proc_maps_ = other.proc_maps_;
+  syscall_profile_ = other.syscall_profile_;
   rusage_monitor_ = other.rusage_monitor_;
+  cgroup_stats_ = other.cgroup_stats_;
   return *this;
 }
 
@@ -28,9 +28,12 @@
 
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
+#include "absl/types/optional.h"
+#include "sandboxed_api/sandbox2/cgroup.h"
 #include "sandboxed_api/sandbox2/config.h"
 #include "sandboxed_api/sandbox2/regs.h"
 #include "sandboxed_api/sandbox2/syscall.h"
+#include "sandboxed_api/sandbox2/syscall_profile.h"
 
 namespace sandbox2 {
 
@@ -153,8 +156,20 @@ class Result {
 
   const std::string& GetProcMaps() const { return proc_maps_; }
 
+  // Syscalls made by the sandboxee, only collected if the policy was built
+  // with PolicyBuilder::CollectSyscallProfile().
+  const SyscallProfile& syscall_profile() const { return syscall_profile_; }
+  SyscallProfile* mutable_syscall_profile() { return &syscall_profile_; }
+
   void SetProcMaps(const std::string& proc_maps) { proc_maps_ = proc_maps; }
 
+  // Resource usage of all the processes of the sandboxee, only collected if it
+  // ran in a cgroup of its own, see Limits::set_cgroup_memory_max() and others.
+  const absl::optional<CgroupStats>& cgroup_stats() const {
+    return cgroup_stats_;
+  }
+  void set_cgroup_stats(const CgroupStats& value) { cgroup_stats_ = value; }
+
   // Converts this result to a absl::Status object.  The status will only be
   // OK if the sandbox process exited normally with an exit code of 0.
   absl::Status ToStatus() const;
@@ -168,6 +183,8 @@ class Result {
   // Converts ReasonCodeEnum to a string.
   static std::string ReasonCodeEnumToString(ReasonCodeEnum value);
 
+  // Resource usage of the Monitor thread. Not collected, and left zeroed, if
+  // the sandbox was driven by a MonitorReactor.
   rusage* GetRUsageMonitor() { return &rusage_monitor_; }
 
  private:
@@ -193,9 +210,13 @@ class Result {
   std::string proc_maps_;
   // IP and port if network violation occurred
   std::string network_violation_;
+  // Syscall frequencies, see PolicyBuilder::CollectSyscallProfile().
+  SyscallProfile syscall_profile_;
   // Final resource usage as defined in <sys/resource.h> (man getrusage), for
   // the Monitor thread.
-  rusage rusage_monitor_;
+  rusage rusage_monitor_ = {};
+  // Final resource usage of the cgroup of the sandboxee, if it had one.
+  absl::optional<CgroupStats> cgroup_stats_;
 };
 
 }  // namespace sandbox2
@@ -32,19 +32,24 @@ Sandbox2::~Sandbox2() {
   if (monitor_thread_ && monitor_thread_->joinable()) {
     monitor_thread_->join();
   }
+  if (monitor_reactor_ != nullptr && monitor_ != nullptr) {
+    monitor_->done_notification_.WaitForNotification();
+  }
 }
 
 absl::StatusOr<Result> Sandbox2::AwaitResultWithTimeout(
     absl::Duration timeout) {
   CHECK(monitor_ != nullptr) << "Sandbox was not launched yet";
-  CHECK(monitor_thread_ != nullptr) << "Sandbox was already waited on";
+  CHECK(!awaited_) << "Sandbox was already waited on";
 
   auto done =
       monitor_->done_notification_.WaitForNotificationWithTimeout(timeout);
   if (!done) {
     return absl::DeadlineExceededError("Sandbox did not finish within timeout");
   }
-  monitor_thread_->join();
+  if (monitor_thread_ != nullptr) {
+    monitor_thread_->join();
+  }
 
   CHECK(IsTerminated()) << "Monitor did not terminate";
 
@@ -52,6 +57,7 @@ absl::StatusOr<Result> Sandbox2::AwaitResultWithTimeout(
   // object cannot be used anymore to control behavior of the sandboxee (e.g.
   // via signals).
   monitor_thread_.reset(nullptr);
+  awaited_ = true;
 
   VLOG(1) << "Final execution status: " << monitor_->result_.ToString();
   CHECK(monitor_->result_.final_status() != Result::UNSET);
@@ -73,9 +79,11 @@ bool Sandbox2::RunAsync() {
   return true;
 }
 
-void Sandbox2::NotifyMonitor() {
+void Sandbox2::NotifyMonitor() const {
   if (monitor_thread_ != nullptr) {
     pthread_kill(monitor_thread_->native_handle(), SIGCHLD);
+  } else if (monitor_reactor_ != nullptr && !awaited_) {
+    monitor_reactor_->Notify(monitor_.get());
   }
 }
 
@@ -113,11 +121,18 @@ void Sandbox2::set_walltime_limit(absl::Duration limit) const {
     monitor_->deadline_millis_.store(absl::ToUnixMillis(deadline),
                                      std::memory_order_relaxed);
   }
+  // The monitor sleeps until the previous deadline, wake it up to re-arm.
+  NotifyMonitor();
 }
 
 void Sandbox2::Launch() {
   monitor_ =
       absl::make_unique<Monitor>(executor_.get(), policy_.get(), notify_.get());
+  if (monitor_reactor_ != nullptr) {
+    // Returns once the set-up of the sandboxee is done.
+    monitor_reactor_->Launch(monitor_.get());
+    return;
+  }
   monitor_thread_ =
       absl::make_unique<std::thread>(&Monitor::Run, monitor_.get());
 
@@ -31,6 +31,7 @@
 #include "sandboxed_api/sandbox2/executor.h"
 #include "sandboxed_api/sandbox2/ipc.h"
 #include "sandboxed_api/sandbox2/monitor.h"
+#include "sandboxed_api/sandbox2/monitor_reactor.h"
 #include "sandboxed_api/sandbox2/notify.h"
 #include "sandboxed_api/sandbox2/policy.h"
 #include "sandboxed_api/sandbox2/result.h"
@@ -103,6 +104,14 @@ class Sandbox2 final {
   // between. Sandboxed API can be used to implement persistent sandboxes.
   void set_walltime_limit(absl::Duration limit) const;
 
+  // Lets 'reactor' drive this sandbox instead of a dedicated monitor thread.
+  // Must be called before Run()/RunAsync(), the reactor must outlive the
+  // sandboxee.
+  void set_monitor_reactor(MonitorReactor* reactor) {
+    CHECK(monitor_ == nullptr) << "Sandbox was already launched";
+    monitor_reactor_ = reactor;
+  }
+
   // Gets the pid inside the executor.
   pid_t GetPid() {
     if (monitor_ != nullptr) {
@@ -120,7 +129,7 @@ class Sandbox2 final {
   // Launches the Monitor.
   void Launch();
   // Notifies monitor about a state change
-  void NotifyMonitor();
+  void NotifyMonitor() const;
 
   // Executor set by user - owned by Sandbox2.
   std::unique_ptr<Executor> executor_;
@@ -134,6 +143,11 @@ class Sandbox2 final {
   // Monitor object - owned by Sandbox2.
   std::unique_ptr<Monitor> monitor_;
 
+  // Drives the Monitor instead of monitor_thread_ if set - not owned.
+  MonitorReactor* monitor_reactor_ = nullptr;
+  // Whether the result was already retrieved from the Monitor.
+  bool awaited_ = false;
+
   // Monitor thread object - owned by Sandbox2.
   std::unique_ptr<std::thread> monitor_thread_;
 };
@@ -15,24 +15,39 @@
 #include "sandboxed_api/sandbox2/sandbox2.h"
 
 #include <fcntl.h>
+#include <sys/resource.h>
 #include <syscall.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <csignal>
+#include <cerrno>
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <thread>  // NOLINT(build/c++11)
 #include <vector>
 
+#include <glog/logging.h>
+#include "benchmark/benchmark.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/memory/memory.h"
 #include "absl/strings/str_cat.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "sandboxed_api/sandbox2/comms.h"
 #include "sandboxed_api/sandbox2/config.h"
 #include "sandboxed_api/sandbox2/executor.h"
+#include "sandboxed_api/sandbox2/global_forkclient.h"
+#include "sandboxed_api/sandbox2/notify.h"
 #include "sandboxed_api/sandbox2/policy.h"
 #include "sandboxed_api/sandbox2/policybuilder.h"
 #include "sandboxed_api/sandbox2/result.h"
 #include "sandboxed_api/sandbox2/testing.h"
 #include "sandboxed_api/sandbox2/util/bpf_helper.h"
+#include "sandboxed_api/sandbox2/util/temp_file.h"
 #include "sandboxed_api/util/status_matchers.h"
 
 using ::testing::Eq;
@@ -198,6 +213,336 @@ TEST(RunAsyncTest, SandboxeeViolationDisabledStacktraces) {
   EXPECT_THAT(result.GetStackTrace(), IsEmpty());
 }
 
+// Tests that shortening the walltime limit takes effect right away, even if
+// the monitor is asleep in sigtimedwait().
+TEST(RunAsyncTest, SandboxeeTimeoutShortenedWhileIdle) {
+  const std::string path = GetTestSourcePath("sandbox2/testcases/sleep");
+
+  std::vector<std::string> args = {path};
+  std::vector<std::string> envs;
+  auto executor = absl::make_unique<Executor>(path, args, envs);
+
+  SAPI_ASSERT_OK_AND_ASSIGN(auto policy, PolicyBuilder()
+                                        // Don't restrict the syscalls at all.
+                                        .DangerDefaultAllowAll()
+                                        .CollectStacktracesOnTimeout(false)
+                                        .TryBuild());
+  Sandbox2 sandbox(std::move(executor), std::move(policy));
+  ASSERT_TRUE(sandbox.RunAsync());
+  absl::SleepFor(absl::Seconds(2));
+  auto start = absl::Now();
+  sandbox.set_walltime_limit(absl::Milliseconds(100));
+  auto result = sandbox.AwaitResult();
+  EXPECT_EQ(result.final_status(), Result::TIMEOUT);
+  EXPECT_THAT(absl::Now() - start, Lt(absl::Seconds(1)));
+}
+
+// Allows all traced syscalls, and counts them.
+class CountingNotify : public Notify {
+ public:
+  bool EventSyscallTrap(const Syscall& syscall) override {
+    ++traps_;
+    return true;
+  }
+
+  int64_t traps() const { return traps_; }
+
+ private:
+  int64_t traps_ = 0;
+};
+
+// Starts the trap_loop testcase, with the personality syscall traced through
+// ptrace, or through seccomp user notifications.
+std::unique_ptr<Sandbox2> StartTrapLoop(
+    std::unique_ptr<Notify> notify = absl::make_unique<CountingNotify>(),
+    bool user_notify = false) {
+  const std::string path = GetTestSourcePath("sandbox2/testcases/trap_loop");
+  std::vector<std::string> args = {path};
+  auto executor = absl::make_unique<Executor>(path, args);
+  PolicyBuilder builder;
+  if (user_notify) {
+    builder.EnableUserNotify();
+  }
+  auto policy = builder.DisableNamespaces()
+                    .AddPolicyOnSyscall(__NR_personality, {SANDBOX2_TRACE})
+                    .DangerDefaultAllowAll()
+                    .BuildOrDie();
+  auto sandbox = absl::make_unique<Sandbox2>(
+      std::move(executor), std::move(policy), std::move(notify));
+  CHECK(sandbox->RunAsync());
+  return sandbox;
+}
+
+// Runs with the personality syscall traced through ptrace (false), or through
+// seccomp user notifications (true).
+class TrapTest : public ::testing::TestWithParam<bool> {};
+
+TEST_P(TrapTest, TracedSyscallsAreAllowedByNotify) {
+  SKIP_SANITIZERS_AND_COVERAGE;
+  auto counting_notify = absl::make_unique<CountingNotify>();
+  CountingNotify* notify = counting_notify.get();
+  auto sandbox =
+      StartTrapLoop(std::move(counting_notify), /*user_notify=*/GetParam());
+  bool done = false;
+  ASSERT_TRUE(sandbox->comms()->SendInt32(100));
+  ASSERT_TRUE(sandbox->comms()->RecvBool(&done));
+  EXPECT_TRUE(done);
+  sandbox->Kill();
+  auto result = sandbox->AwaitResult();
+  EXPECT_EQ(result.final_status(), Result::EXTERNAL_KILL);
+  EXPECT_EQ(notify->traps(), 100);
+}
+
+INSTANTIATE_TEST_SUITE_P(Ptrace, TrapTest, ::testing::Values(false));
+INSTANTIATE_TEST_SUITE_P(UserNotify, TrapTest, ::testing::Values(true));
+
+// SKIP_SANITIZERS_AND_COVERAGE for benchmarks, which have to report why they
+// did not run the benchmark loop. Returns whether to skip.
+bool SkipSanitizersAndCoverage(benchmark::State& state) {
+  bool skip = true;
+  [&skip] {
+    SKIP_SANITIZERS_AND_COVERAGE;
+    skip = false;
+  }();
+  if (skip) {
+    state.SkipWithError("Not supported under sanitizers and coverage");
+  }
+  return skip;
+}
+
+// Measures the latency of a syscall trapped by the policy and allowed by
+// Notify::EventSyscallTrap(), i.e. the time until the monitor wakes up, handles
+// the ptrace stop (state.range(1) == 0) or the seccomp user notification
+// (state.range(1) == 1) and resumes the sandboxee.
+void BenchmarkSyscallTrapRoundTrip(benchmark::State& state) {
+  if (SkipSanitizersAndCoverage(state)) {
+    return;
+  }
+  auto sandbox = StartTrapLoop(absl::make_unique<CountingNotify>(),
+                               /*user_notify=*/state.range(1) != 0);
+  const int32_t traps = state.range(0);
+  for (auto _ : state) {
+    bool done = false;
+    CHECK(sandbox->comms()->SendInt32(traps));
+    CHECK(sandbox->comms()->RecvBool(&done));
+  }
+  state.SetItemsProcessed(state.iterations() * traps);
+  sandbox->Kill();
+  sandbox->AwaitResult();
+}
+BENCHMARK(BenchmarkSyscallTrapRoundTrip)
+    ->Args({1, 0})
+    ->Args({100, 0})
+    ->Args({1, 1})
+    ->Args({100, 1});
+
+// Measures the CPU time and the number of wake-ups of monitors whose
+// sandboxees are idle (blocked on the Comms channel). Idle monitors still wake
+// up every Monitor::kWakeUpPeriod, see Monitor::MainLoop().
+void BenchmarkIdleMonitorCpu(benchmark::State& state) {
+  if (SkipSanitizersAndCoverage(state)) {
+    return;
+  }
+  constexpr absl::Duration kIdleTime = absl::Seconds(10);
+  const int num_sandboxes = state.range(0);
+  absl::Duration cpu_time;
+  int64_t wakeups = 0;
+  for (auto _ : state) {
+    std::vector<std::unique_ptr<Sandbox2>> sandboxes;
+    for (int i = 0; i < num_sandboxes; ++i) {
+      sandboxes.push_back(StartTrapLoop());
+    }
+    absl::SleepFor(kIdleTime);
+    for (auto& sandbox : sandboxes) {
+      sandbox->Kill();
+      auto result = sandbox->AwaitResult();
+      const rusage* usage = result.GetRUsageMonitor();
+      cpu_time += absl::DurationFromTimeval(usage->ru_utime) +
+                  absl::DurationFromTimeval(usage->ru_stime);
+      wakeups += usage->ru_nvcsw;
+    }
+  }
+  const double monitor_seconds =
+      absl::ToDoubleSeconds(kIdleTime) * state.iterations() * num_sandboxes;
+  state.counters["cpu_us_per_monitor_s"] =
+      absl::ToDoubleMicroseconds(cpu_time) / monitor_seconds;
+  state.counters["wakeups_per_monitor_s"] = wakeups / monitor_seconds;
+}
+BENCHMARK(BenchmarkIdleMonitorCpu)->Arg(1)->Arg(64)->Iterations(1);
+
+std::unique_ptr<Policy> BuildMinimalPolicy() {
+  return PolicyBuilder()
+      .AllowStaticStartup()
+      .AllowExit()
+      .BlockSyscallWithErrno(__NR_prlimit64, EPERM)
+#ifdef __NR_access
+      .BlockSyscallWithErrno(__NR_access, ENOENT)
+#endif
+      .BuildOrDie();
+}
+
+// Measures the time to run state.range(0) sandboxes from as many threads, with
+// up to state.range(1) ForkServer workers.
+void BenchmarkConcurrentSandboxStart(benchmark::State& state) {
+  if (SkipSanitizersAndCoverage(state)) {
+    return;
+  }
+  const std::string path = GetTestSourcePath("sandbox2/testcases/minimal");
+  const int num_threads = state.range(0);
+  GetGlobalForkClient()->SetMaxWorkers(state.range(1));
+  for (auto _ : state) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([&path] {
+        std::vector<std::string> args = {path};
+        Sandbox2 sandbox(absl::make_unique<Executor>(path, args),
+                         BuildMinimalPolicy());
+        CHECK(sandbox.RunAsync());
+        CHECK_EQ(sandbox.AwaitResult().final_status(), Result::OK);
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+  GetGlobalForkClient()->SetMaxWorkers(1);
+  state.SetItemsProcessed(state.iterations() * num_threads);
+}
+BENCHMARK(BenchmarkConcurrentSandboxStart)
+    ->Args({16, 1})
+    ->Args({16, 16})
+    ->Args({64, 1})
+    ->Args({64, 16})
+    ->UseRealTime();
+
+// Test that sandboxees are started from prepared children, one after another.
+TEST(PreforkTest, SandboxeesRunFromPreparedChildren) {
+  SKIP_SANITIZERS_AND_COVERAGE;
+  const std::string path = GetTestSourcePath("sandbox2/testcases/minimal");
+  for (int i = 0; i < 3; ++i) {
+    std::vector<std::string> args = {path};
+    auto executor = absl::make_unique<Executor>(path, args);
+    executor->set_prefork(2);
+    Sandbox2 sandbox(std::move(executor), BuildMinimalPolicy());
+    auto result = sandbox.Run();
+    ASSERT_THAT(result.final_status(), Eq(Result::OK));
+    EXPECT_THAT(result.reason_code(), Eq(EXIT_SUCCESS));
+  }
+}
+
+// Measures the latency of starting a sandboxee, with state.range(0) children
+// prepared by the ForkServer.
+void BenchmarkSandboxStartLatency(benchmark::State& state) {
+  if (SkipSanitizersAndCoverage(state)) {
+    return;
+  }
+  const std::string path = GetTestSourcePath("sandbox2/testcases/minimal");
+  std::vector<double> latencies_us;
+  for (auto _ : state) {
+    std::vector<std::string> args = {path};
+    auto executor = absl::make_unique<Executor>(path, args);
+    executor->set_prefork(state.range(0));
+    Sandbox2 sandbox(std::move(executor), BuildMinimalPolicy());
+    const absl::Time start = absl::Now();
+    CHECK(sandbox.RunAsync());
+    latencies_us.push_back(absl::ToDoubleMicroseconds(absl::Now() - start));
+    CHECK_EQ(sandbox.AwaitResult().final_status(), Result::OK);
+  }
+  std::sort(latencies_us.begin(), latencies_us.end());
+  state.counters["start_p50_us"] = latencies_us[latencies_us.size() / 2];
+  state.counters["start_p99_us"] = latencies_us[latencies_us.size() * 99 / 100];
+}
+BENCHMARK(BenchmarkSandboxStartLatency)->Arg(0)->Arg(4);
+
+// Measures the latency of starting sandboxees from state.range(0) threads, with
+// up to state.range(1) pooled namespaces.
+void BenchmarkConcurrentSandboxStartLatency(benchmark::State& state) {
+  if (SkipSanitizersAndCoverage(state)) {
+    return;
+  }
+  const std::string path = GetTestSourcePath("sandbox2/testcases/minimal");
+  const int num_threads = state.range(0);
+  const int namespace_pool = state.range(1);
+  absl::Mutex mutex;
+  std::vector<double> latencies_us;
+  for (auto _ : state) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([&] {
+        std::vector<std::string> args = {path};
+        auto executor = absl::make_unique<Executor>(path, args);
+        executor->set_namespace_pool(namespace_pool);
+        Sandbox2 sandbox(std::move(executor), BuildMinimalPolicy());
+        const absl::Time start = absl::Now();
+        CHECK(sandbox.RunAsync());
+        const absl::Duration latency = absl::Now() - start;
+        {
+          absl::MutexLock lock(&mutex);
+          latencies_us.push_back(absl::ToDoubleMicroseconds(latency));
+        }
+        CHECK_EQ(sandbox.AwaitResult().final_status(), Result::OK);
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+  std::sort(latencies_us.begin(), latencies_us.end());
+  state.counters["start_p50_us"] = latencies_us[latencies_us.size() / 2];
+  state.counters["start_p99_us"] = latencies_us[latencies_us.size() * 99 / 100];
+  state.SetItemsProcessed(state.iterations() * num_threads);
+}
+BENCHMARK(BenchmarkConcurrentSandboxStartLatency)
+    ->Args({16, 0})
+    ->Args({16, 16})
+    ->UseRealTime();
+
+// Measures the time to run a sandboxee with state.range(0) files mounted, one
+// by one (state.range(1) == 0) or from a mount image (1).
+void BenchmarkSandboxStartByMountCount(benchmark::State& state) {
+  if (SkipSanitizersAndCoverage(state)) {
+    return;
+  }
+  const std::string path = GetTestSourcePath("sandbox2/testcases/minimal");
+  const int num_files = state.range(0);
+  const bool use_image = state.range(1);
+  std::vector<std::string> files;
+  for (int i = 0; i < num_files; ++i) {
+    files.push_back(
+        CreateNamedTempFileAndClose(GetTestTempPath("mounted_file_")).value());
+  }
+  for (auto _ : state) {
+    state.PauseTiming();
+    PolicyBuilder builder;
+    builder.AllowStaticStartup().AllowExit().BlockSyscallWithErrno(
+        __NR_prlimit64, EPERM);
+#ifdef __NR_access
+    builder.BlockSyscallWithErrno(__NR_access, ENOENT);
+#endif
+    for (int i = 0; i < num_files; ++i) {
+      builder.AddFileAt(files[i], absl::StrCat("/files/", i));
+    }
+    if (use_image) {
+      builder.UseMountImage();
+    }
+    std::vector<std::string> args = {path};
+    Sandbox2 sandbox(absl::make_unique<Executor>(path, args),
+                     builder.BuildOrDie());
+    state.ResumeTiming();
+    CHECK_EQ(sandbox.Run().final_status(), Result::OK);
+  }
+  for (const std::string& file : files) {
+    unlink(file.c_str());
+  }
+}
+BENCHMARK(BenchmarkSandboxStartByMountCount)
+    ->Args({0, 0})
+    ->Args({0, 1})
+    ->Args({100, 0})
+    ->Args({100, 1})
+    ->Args({1000, 0})
+    ->Args({1000, 1});
+
 TEST(StarvationTest, MonitorIsNotStarvedByTheSandboxee) {
   const std::string path = GetTestSourcePath("sandbox2/testcases/starve");
 
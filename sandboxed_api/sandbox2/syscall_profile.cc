@@ -0,0 +1,97 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Implementation of the sandbox2::SyscallProfile class.
+
+#include "sandboxed_api/sandbox2/syscall_profile.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/strip.h"
+#include "sandboxed_api/sandbox2/syscall.h"
+#include "sandboxed_api/sandbox2/util/file_helpers.h"
+
+namespace sandbox2 {
+
+void SyscallProfile::Add(uint32_t nr, uint64_t count) {
+  counts_[nr] += count;
+}
+
+uint64_t SyscallProfile::Count(uint32_t nr) const {
+  auto it = counts_.find(nr);
+  return it == counts_.end() ? 0 : it->second;
+}
+
+std::string SyscallProfile::ToString() const {
+  std::vector<std::pair<uint32_t, uint64_t>> entries(counts_.begin(),
+                                                     counts_.end());
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const auto& a, const auto& b) {
+                     return a.second > b.second;
+                   });
+  std::string out = "# Syscall profile: <nr> <count>\n";
+  for (const auto& entry : entries) {
+    absl::StrAppend(
+        &out, entry.first, " ", entry.second, "  # ",
+        Syscall(Syscall::GetHostArch(), entry.first).GetName(), "\n");
+  }
+  return out;
+}
+
+absl::StatusOr<SyscallProfile> SyscallProfile::FromString(
+    absl::string_view contents) {
+  SyscallProfile profile;
+  int line_number = 0;
+  for (absl::string_view line : absl::StrSplit(contents, '\n')) {
+    ++line_number;
+    line = line.substr(0, line.find('#'));
+    line = absl::StripAsciiWhitespace(line);
+    if (line.empty()) {
+      continue;
+    }
+    std::vector<absl::string_view> fields =
+        absl::StrSplit(line, ' ', absl::SkipWhitespace());
+    uint32_t nr;
+    uint64_t count;
+    if (fields.size() != 2 || !absl::SimpleAtoi(fields[0], &nr) ||
+        !absl::SimpleAtoi(fields[1], &count)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid syscall profile line ", line_number, ": '",
+                       line, "'"));
+    }
+    profile.Add(nr, count);
+  }
+  return profile;
+}
+
+absl::Status SyscallProfile::WriteToFile(absl::string_view path) const {
+  return file::SetContents(path, ToString(), file::Defaults());
+}
+
+absl::StatusOr<SyscallProfile> SyscallProfile::ReadFromFile(
+    absl::string_view path) {
+  std::string contents;
+  absl::Status status = file::GetContents(path, &contents, file::Defaults());
+  if (!status.ok()) {
+    return status;
+  }
+  return FromString(contents);
+}
+
+}  // namespace sandbox2
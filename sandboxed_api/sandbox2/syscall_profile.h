@@ -0,0 +1,61 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The sandbox2::SyscallProfile class holds the number of times each syscall was
+// made by a sandboxee, see PolicyBuilder::CollectSyscallProfile().
+
+#ifndef SANDBOXED_API_SANDBOX2_SYSCALL_PROFILE_H_
+#define SANDBOXED_API_SANDBOX2_SYSCALL_PROFILE_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace sandbox2 {
+
+// Syscall frequencies of the host architecture, keyed by syscall number.
+class SyscallProfile {
+ public:
+  SyscallProfile() = default;
+
+  // Adds count calls of syscall nr.
+  void Add(uint32_t nr, uint64_t count = 1);
+
+  // Returns the number of calls of syscall nr.
+  uint64_t Count(uint32_t nr) const;
+
+  const std::map<uint32_t, uint64_t>& counts() const { return counts_; }
+  bool empty() const { return counts_.empty(); }
+
+  // Serializes the profile, one "<nr> <count>" line per syscall, from the most
+  // to the least frequent one. Syscall names are added as '#' comments.
+  std::string ToString() const;
+
+  // Parses the output of ToString().
+  static absl::StatusOr<SyscallProfile> FromString(absl::string_view contents);
+
+  absl::Status WriteToFile(absl::string_view path) const;
+  static absl::StatusOr<SyscallProfile> ReadFromFile(absl::string_view path);
+
+ private:
+  std::map<uint32_t, uint64_t> counts_;
+};
+
+}  // namespace sandbox2
+
+#endif  // SANDBOXED_API_SANDBOX2_SYSCALL_PROFILE_H_
@@ -0,0 +1,47 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// A binary that calls the personality syscall as many times as requested over
+// the Comms channel. The syscall is traced by the policy of the test, so this
+// is used to measure the round-trip latency of syscall traps.
+// If a syscall number is given as the first argument, that syscall is called
+// instead, without any arguments.
+
+#include <syscall.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "sandboxed_api/sandbox2/comms.h"
+
+int main(int argc, char** argv) {
+  sandbox2::Comms comms(sandbox2::Comms::kSandbox2ClientCommsFD);
+  const long nr = argc > 1 ? std::atol(argv[1]) : -1;  // NOLINT
+  int32_t count;
+  while (comms.RecvInt32(&count)) {
+    for (int32_t i = 0; i < count; ++i) {
+      if (nr >= 0) {
+        syscall(nr);
+      } else {
+        // Only queries the current persona.
+        syscall(__NR_personality, 0xffffffff);
+      }
+    }
+    if (!comms.SendBool(true)) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -36,4 +36,9 @@ std::string GetTestSourcePath(absl::string_view name) {
                         "com_google_sandboxed_api/sandboxed_api", name);
 }
 
+std::string GetTestCgroupParent() {
+  const char* parent = getenv("SANDBOX2_TEST_CGROUP_PARENT");
+  return parent ? parent : "";
+}
+
 }  // namespace sandbox2
@@ -64,6 +64,12 @@ std::string GetTestTempPath(absl::string_view name = {});
 // source tree. Use this to access data files in tests.
 std::string GetTestSourcePath(absl::string_view name);
 
+// Returns the delegated cgroup v2 directory for the cgroups of sandboxees in
+// tests, from the environment variable SANDBOX2_TEST_CGROUP_PARENT. Returns an
+// empty string if it is not set, tests which need cgroups should be skipped
+// then.
+std::string GetTestCgroupParent();
+
 }  // namespace sandbox2
 
 #endif  // SANDBOXED_API_SANDBOX2_TESTING_H_
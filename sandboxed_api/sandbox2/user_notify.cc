@@ -0,0 +1,148 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Implementation file for the sandbox2::UserNotifyServer class.
+
+#include "sandboxed_api/sandbox2/user_notify.h"
+
+#include <linux/seccomp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+
+#include <glog/logging.h>
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "sandboxed_api/sandbox2/util.h"
+#include "sandboxed_api/sandbox2/util/strerror.h"
+
+// Not defined in older kernel headers (added in Linux 5.5).
+#ifndef SECCOMP_USER_NOTIF_FLAG_CONTINUE
+#define SECCOMP_USER_NOTIF_FLAG_CONTINUE (1UL << 0)
+#endif
+
+namespace sandbox2 {
+
+UserNotifyServer::UserNotifyServer(int listener_fd, Notify* notify,
+                                   pthread_t monitor_thread_id)
+    : listener_fd_(listener_fd),
+      stop_fd_(eventfd(0, EFD_CLOEXEC)),
+      notify_(notify),
+      monitor_thread_id_(monitor_thread_id) {
+  PCHECK(stop_fd_.get() != -1) << "eventfd()";
+}
+
+void UserNotifyServer::Run() {
+  pollfd fds[2];
+  fds[0].fd = listener_fd_.get();
+  fds[0].events = POLLIN;
+  fds[1].fd = stop_fd_.get();
+  fds[1].events = POLLIN;
+  for (;;) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "poll(seccomp listener)";
+      return;
+    }
+    if (fds[1].revents != 0) {
+      return;
+    }
+    // POLLHUP: no process uses the filter anymore.
+    if ((fds[0].revents & POLLIN) == 0) {
+      return;
+    }
+    if (!ReceiveNotification()) {
+      return;
+    }
+  }
+}
+
+void UserNotifyServer::Stop() {
+  uint64_t value = 1;
+  PCHECK(write(stop_fd_.get(), &value, sizeof(value)) == sizeof(value))
+      << "write(eventfd)";
+}
+
+bool UserNotifyServer::ReceiveNotification() {
+  // The kernel requires the structure to be zeroed.
+  seccomp_notif req;
+  memset(&req, 0, sizeof(req));
+  if (ioctl(listener_fd_.get(), SECCOMP_IOCTL_NOTIF_RECV, &req) == -1) {
+    // ENOENT: the notifying thread died before we could receive it.
+    if (errno == EINTR || errno == ENOENT) {
+      return true;
+    }
+    PLOG(ERROR) << "ioctl(SECCOMP_IOCTL_NOTIF_RECV)";
+    return false;
+  }
+
+  // Only syscalls of the host architecture are trapped this way, the others
+  // are still reported through ptrace.
+  Syscall::Args args;
+  for (int i = 0; i < args.size(); ++i) {
+    args[i] = req.data.args[i];
+  }
+  {
+    absl::MutexLock lock(&mutex_);
+    pending_.push_back({req.id, Syscall(Syscall::GetHostArch(), req.data.nr,
+                                        args, req.pid, /*sp=*/0,
+                                        req.data.instruction_pointer)});
+  }
+  pthread_kill(monitor_thread_id_, SIGCHLD);
+  return true;
+}
+
+absl::StatusOr<absl::optional<Syscall>>
+UserNotifyServer::HandleNotifications() {
+  std::deque<Notification> notifications;
+  {
+    absl::MutexLock lock(&mutex_);
+    notifications.swap(pending_);
+  }
+  for (const Notification& notification : notifications) {
+    const Syscall& syscall = notification.syscall;
+    if (!notify_->EventSyscallTrap(syscall)) {
+      // Leave the syscall pending, the monitor kills the sandboxee.
+      return syscall;
+    }
+
+    LOG(WARNING) << "[PERMITTED]: SYSCALL ::: PID: " << syscall.pid()
+                 << ", PROG: '" << util::GetProgName(syscall.pid())
+                 << "' : " << syscall.GetDescription();
+    seccomp_notif_resp resp;
+    memset(&resp, 0, sizeof(resp));
+    resp.id = notification.id;
+    resp.flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+    if (ioctl(listener_fd_.get(), SECCOMP_IOCTL_NOTIF_SEND, &resp) == -1 &&
+        errno != ENOENT) {
+      if (errno == EINVAL) {
+        return absl::FailedPreconditionError(
+            "Continuing a syscall from a seccomp user notification requires "
+            "Linux 5.5 or newer");
+      }
+      return absl::InternalError(absl::StrCat(
+          "ioctl(SECCOMP_IOCTL_NOTIF_SEND): ", StrError(errno)));
+    }
+  }
+  return absl::nullopt;
+}
+
+}  // namespace sandbox2
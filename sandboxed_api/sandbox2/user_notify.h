@@ -0,0 +1,86 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// The sandbox2::UserNotifyServer class handles the syscalls trapped with
+// SECCOMP_RET_USER_NOTIF, as an alternative to ptrace-based SECCOMP_RET_TRACE.
+
+#ifndef SANDBOXED_API_SANDBOX2_USER_NOTIFY_H_
+#define SANDBOXED_API_SANDBOX2_USER_NOTIFY_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <cstdint>
+#include <deque>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/types/optional.h"
+#include "sandboxed_api/sandbox2/notify.h"
+#include "sandboxed_api/sandbox2/syscall.h"
+#include "sandboxed_api/sandbox2/util/fileops.h"
+
+namespace sandbox2 {
+
+// Receives the notifications of a seccomp listener fd on a thread of its own,
+// and hands them to the monitor thread, which asks Notify::EventSyscallTrap()
+// whether the syscall is allowed. Allowed syscalls continue without the
+// monitor having to ptrace-stop the sandboxee. Disallowed syscalls are left
+// pending, and the monitor kills the sandboxee.
+class UserNotifyServer {
+ public:
+  // Takes ownership of listener_fd. notify is not owned.
+  UserNotifyServer(int listener_fd, Notify* notify,
+                   pthread_t monitor_thread_id);
+
+  UserNotifyServer(const UserNotifyServer&) = delete;
+  UserNotifyServer& operator=(const UserNotifyServer&) = delete;
+
+  // Receives notifications until Stop() is called, or the sandboxee is gone.
+  // The monitor thread is signalled with SIGCHLD for each of them.
+  void Run();
+
+  // Makes Run() return. Can be called from any thread.
+  void Stop();
+
+  // Handles the notifications received so far. Must be called on the monitor
+  // thread, so that Notify is only ever called from there. Returns the first
+  // disallowed syscall, if any, and leaves the remaining notifications pending.
+  // Returns an error if a syscall could not be continued.
+  absl::StatusOr<absl::optional<Syscall>> HandleNotifications();
+
+ private:
+  struct Notification {
+    uint64_t id;
+    Syscall syscall;
+  };
+
+  // Receives a single notification. Returns false if the server should stop.
+  bool ReceiveNotification();
+
+  file_util::fileops::FDCloser listener_fd_;
+  // Written to by Stop().
+  file_util::fileops::FDCloser stop_fd_;
+  Notify* notify_;
+  pthread_t monitor_thread_id_;
+
+  absl::Mutex mutex_;
+  // Received notifications, not yet handled by the monitor thread.
+  std::deque<Notification> pending_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace sandbox2
+
+#endif  // SANDBOXED_API_SANDBOX2_USER_NOTIFY_H_
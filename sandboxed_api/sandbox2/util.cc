@@ -16,6 +16,7 @@
 
 #include <asm/unistd.h>  // __NR_memdfd_create
 #include <bits/local_lim.h>
+#include <fcntl.h>
 #include <sched.h>
 #include <spawn.h>
 #include <sys/resource.h>
@@ -45,6 +46,10 @@
 #include "sandboxed_api/sandbox2/util/strerror.h"
 #include "sandboxed_api/util/raw_logging.h"
 
+#ifndef __NR_clone3
+#define __NR_clone3 435
+#endif
+
 namespace sandbox2::util {
 
 void CharPtrArrToVecString(char* const* arr, std::vector<std::string>* vec) {
@@ -160,6 +165,87 @@ pid_t ForkWithFlags(int flags) {
   return 0;
 }
 
+pid_t ForkWithFlagsIntoCgroup(int flags, int cgroup_fd) {
+  const int unsupported_flags = CLONE_CHILD_CLEARTID | CLONE_CHILD_SETTID |
+                                CLONE_PARENT_SETTID | CLONE_SETTLS | CLONE_VM;
+  if (flags & unsupported_flags) {
+    SAPI_RAW_LOG(ERROR, "ForkWithFlagsIntoCgroup used with unsupported flag");
+    return -1;
+  }
+
+  // Usually defined in linux/sched.h. Define them here to avoid dependency on
+  // UAPI headers.
+  constexpr uint64_t CLONE_INTO_CGROUP = 0x200000000ULL;
+  struct {
+    uint64_t flags;
+    uint64_t pidfd;
+    uint64_t child_tid;
+    uint64_t parent_tid;
+    uint64_t exit_signal;
+    uint64_t stack;
+    uint64_t stack_size;
+    uint64_t tls;
+    uint64_t set_tid;
+    uint64_t set_tid_size;
+    uint64_t cgroup;
+  } args = {};
+  args.flags = static_cast<uint32_t>(flags & ~CSIGNAL) | CLONE_INTO_CGROUP;
+  args.exit_signal = flags & CSIGNAL;
+  args.cgroup = cgroup_fd;
+  // Without a new stack, the child continues on a copy of this one, as after
+  // fork().
+  pid_t pid = Syscall(__NR_clone3, reinterpret_cast<uintptr_t>(&args),
+                      sizeof(args));
+  if (pid != -1 || (errno != ENOSYS && errno != E2BIG && errno != EINVAL)) {
+    if (pid == -1) {
+      SAPI_RAW_PLOG(ERROR, "clone3()");
+    }
+    return pid;
+  }
+
+  // On kernels without CLONE_INTO_CGROUP, the child moves itself before it
+  // runs any code of the caller.
+  pid = ForkWithFlags(flags);
+  if (pid == 0 && !JoinCgroup(cgroup_fd, 0)) {
+    _exit(EXIT_FAILURE);
+  }
+  return pid;
+}
+
+bool JoinCgroup(int cgroup_fd, pid_t pid) {
+  const int procs_fd =
+      openat(cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+  if (procs_fd == -1) {
+    SAPI_RAW_PLOG(ERROR, "opening cgroup.procs");
+    return false;
+  }
+  const std::string value = absl::StrCat(pid);
+  const bool ok = write(procs_fd, value.data(), value.size()) ==
+                  static_cast<ssize_t>(value.size());
+  if (!ok) {
+    SAPI_RAW_PLOG(ERROR, "moving process %d into the cgroup", pid);
+  }
+  close(procs_fd);
+  return ok;
+}
+
+bool SetCpuAffinity(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+      SAPI_RAW_LOG(ERROR, "CPU %d out of range", cpu);
+      return false;
+    }
+    CPU_SET(cpu, &set);
+  }
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    SAPI_RAW_PLOG(ERROR, "sched_setaffinity()");
+    return false;
+  }
+  return true;
+}
+
 bool CreateMemFd(int* fd, const char* name) {
   // Usually defined in linux/memfd.h. Define it here to avoid dependency on
   // UAPI headers.
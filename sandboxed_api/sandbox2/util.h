@@ -57,6 +57,19 @@ bool CreateDirRecursive(const std::string& path, mode_t mode);
 // Return values as for 'man 2 fork'.
 pid_t ForkWithFlags(int flags);
 
+// As ForkWithFlags(), but the child starts in the cgroup v2 directory referred
+// to by 'cgroup_fd', which is done with clone3(CLONE_INTO_CGROUP) if the kernel
+// supports it (5.7+). Otherwise, the child moves itself before returning.
+pid_t ForkWithFlagsIntoCgroup(int flags, int cgroup_fd);
+
+// Moves the process 'pid' (0 for the calling one) into the cgroup v2 directory
+// referred to by 'cgroup_fd'.
+bool JoinCgroup(int cgroup_fd, pid_t pid);
+
+// Restricts the calling thread to the given CPUs. Threads and processes it
+// creates afterwards inherit the restriction.
+bool SetCpuAffinity(const std::vector<int>& cpus);
+
 // Creates a new memfd.
 bool CreateMemFd(int* fd, const char* name = "buffer_file");
 
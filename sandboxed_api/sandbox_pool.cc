@@ -0,0 +1,178 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sandboxed_api/sandbox_pool.h"
+
+#include <algorithm>
+
+#include <glog/logging.h>
+#include "absl/strings/str_cat.h"
+
+namespace sapi {
+
+// Time to wait before retrying to start a sandbox which failed to start.
+constexpr absl::Duration kRestartBackoff = absl::Seconds(1);
+
+SandboxPoolBase::SandboxPoolBase(
+    std::function<std::unique_ptr<Sandbox>()> factory,
+    SandboxPoolOptions options)
+    : factory_(std::move(factory)), options_(options) {}
+
+SandboxPoolBase::~SandboxPoolBase() {
+  {
+    absl::MutexLock lock(&mutex_);
+    CHECK_EQ(checked_out_, 0)
+        << "SandboxPool destroyed with sandboxes still checked out";
+    shutdown_ = true;
+  }
+  if (restart_thread_.joinable()) {
+    restart_thread_.join();
+  }
+}
+
+absl::Status SandboxPoolBase::Init() {
+  if (options_.size <= 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid SandboxPool size: ", options_.size));
+  }
+  if (!entries_.empty()) {
+    return absl::FailedPreconditionError("SandboxPool already initialized");
+  }
+
+  for (int i = 0; i < options_.size; ++i) {
+    auto entry = absl::make_unique<Entry>();
+    entry->sandbox = factory_();
+    absl::Status status = RestartEntry(entry.get());
+    absl::MutexLock lock(&mutex_);
+    if (!status.ok()) {
+      ready_.clear();
+      entries_.clear();
+      return status;
+    }
+    ready_.push_back(entry.get());
+    entries_.push_back(std::move(entry));
+  }
+  restart_thread_ = std::thread(&SandboxPoolBase::RestartLoop, this);
+  absl::MutexLock lock(&mutex_);
+  initialized_ = true;
+  return absl::OkStatus();
+}
+
+SandboxPoolMetrics SandboxPoolBase::metrics() const {
+  absl::MutexLock lock(&mutex_);
+  return metrics_;
+}
+
+absl::StatusOr<SandboxPoolBase::Entry*> SandboxPoolBase::CheckoutEntry(
+    absl::Duration timeout) {
+  const absl::Time start = absl::Now();
+  const absl::Time deadline = start + timeout;
+  absl::MutexLock lock(&mutex_);
+  if (!initialized_) {
+    return absl::FailedPreconditionError("SandboxPool not initialized");
+  }
+
+  bool hit = true;
+  Entry* entry = nullptr;
+  while (entry == nullptr) {
+    if (!HasReadyEntry()) {
+      hit = false;
+      if (!mutex_.AwaitWithDeadline(
+              absl::Condition(this, &SandboxPoolBase::HasReadyEntry),
+              deadline)) {
+        return absl::DeadlineExceededError(
+            "Timed out waiting for a sandbox from the pool");
+      }
+    }
+    entry = ready_.front();
+    ready_.pop_front();
+    if (!entry->sandbox->is_active()) {
+      // Died while idling in the pool, e.g. because of a wall-time limit.
+      ++metrics_.dead;
+      to_restart_.push_back(entry);
+      entry = nullptr;
+    }
+  }
+  ++entry->uses;
+  ++checked_out_;
+
+  const absl::Duration wait = absl::Now() - start;
+  ++metrics_.checkouts;
+  if (hit) {
+    ++metrics_.hits;
+  }
+  metrics_.total_queue_wait += wait;
+  metrics_.max_queue_wait = std::max(metrics_.max_queue_wait, wait);
+  return entry;
+}
+
+void SandboxPoolBase::CheckinEntry(Entry* entry) {
+  absl::MutexLock lock(&mutex_);
+  --checked_out_;
+  if (!entry->sandbox->is_active()) {
+    ++metrics_.dead;
+    to_restart_.push_back(entry);
+  } else if (options_.restart_after_use ||
+             (options_.max_uses > 0 && entry->uses >= options_.max_uses)) {
+    to_restart_.push_back(entry);
+  } else {
+    ready_.push_back(entry);
+  }
+}
+
+void SandboxPoolBase::RestartLoop() {
+  for (;;) {
+    Entry* entry;
+    {
+      absl::MutexLock lock(&mutex_);
+      mutex_.Await(absl::Condition(this, &SandboxPoolBase::HasRestartWork));
+      if (shutdown_) {
+        return;
+      }
+      entry = to_restart_.front();
+      to_restart_.pop_front();
+    }
+
+    absl::Status status = RestartEntry(entry);
+
+    absl::MutexLock lock(&mutex_);
+    if (status.ok()) {
+      ready_.push_back(entry);
+      continue;
+    }
+    LOG(ERROR) << "Could not restart pooled sandbox: " << status;
+    to_restart_.push_back(entry);
+    mutex_.AwaitWithTimeout(absl::Condition(&shutdown_), kRestartBackoff);
+  }
+}
+
+absl::Status SandboxPoolBase::RestartEntry(Entry* entry) {
+  const absl::Time start = absl::Now();
+  absl::Status status = entry->sandbox->Restart(/*attempt_graceful_exit=*/true);
+  const absl::Duration latency = absl::Now() - start;
+
+  absl::MutexLock lock(&mutex_);
+  if (!status.ok()) {
+    ++metrics_.restart_failures;
+    return status;
+  }
+  entry->uses = 0;
+  ++metrics_.restarts;
+  metrics_.total_restart_latency += latency;
+  metrics_.max_restart_latency =
+      std::max(metrics_.max_restart_latency, latency);
+  return absl::OkStatus();
+}
+
+}  // namespace sapi
@@ -0,0 +1,213 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SANDBOXED_API_SANDBOX_POOL_H_
+#define SANDBOXED_API_SANDBOX_POOL_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>  // NOLINT(build/c++11)
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "sandboxed_api/sandbox.h"
+#include "sandboxed_api/util/status_macros.h"
+
+namespace sapi {
+
+struct SandboxPoolOptions {
+  // Number of sandboxes kept in the pool.
+  int size = 1;
+
+  // Restart a sandbox every time it is returned to the pool, so that no state
+  // is carried over from one user to the next.
+  bool restart_after_use = false;
+
+  // Restart a sandbox after it has been checked out that many times, 0 means
+  // no limit.
+  int max_uses = 0;
+};
+
+// Counters to help with sizing a SandboxPool.
+struct SandboxPoolMetrics {
+  // Number of sandboxes handed out.
+  uint64_t checkouts = 0;
+  // Number of checkouts which did not have to wait for a sandbox.
+  uint64_t hits = 0;
+  // Time spent waiting for a sandbox in Checkout().
+  absl::Duration total_queue_wait;
+  absl::Duration max_queue_wait;
+
+  // Number of sandboxes (re-)started, and the time it took.
+  uint64_t restarts = 0;
+  absl::Duration total_restart_latency;
+  absl::Duration max_restart_latency;
+  // Number of failed attempts to (re-)start a sandbox.
+  uint64_t restart_failures = 0;
+
+  // Number of sandboxes which were found to be dead and had to be replaced.
+  uint64_t dead = 0;
+
+  double hit_rate() const {
+    return checkouts == 0 ? 0.0 : static_cast<double>(hits) / checkouts;
+  }
+};
+
+// Type-independent part of SandboxPool<T>.
+class SandboxPoolBase {
+ public:
+  SandboxPoolBase(const SandboxPoolBase&) = delete;
+  SandboxPoolBase& operator=(const SandboxPoolBase&) = delete;
+
+  // All sandboxes must have been returned to the pool before destroying it.
+  virtual ~SandboxPoolBase();
+
+  // Starts all sandboxes of the pool, and the thread replacing them in the
+  // background.
+  absl::Status Init();
+
+  SandboxPoolMetrics metrics() const;
+
+ protected:
+  struct Entry {
+    std::unique_ptr<Sandbox> sandbox;
+    // Number of checkouts since the last restart.
+    int uses = 0;
+  };
+
+  SandboxPoolBase(std::function<std::unique_ptr<Sandbox>()> factory,
+                  SandboxPoolOptions options);
+
+  // Waits up to 'timeout' for a running sandbox and takes it out of the pool.
+  absl::StatusOr<Entry*> CheckoutEntry(absl::Duration timeout);
+
+  // Puts the sandbox back into the pool, or schedules a restart for it.
+  void CheckinEntry(Entry* entry);
+
+ private:
+  // Restarts the sandboxes handed to it by CheckinEntry()/CheckoutEntry().
+  void RestartLoop();
+
+  // (Re-)starts the sandbox in 'entry' and updates the metrics.
+  absl::Status RestartEntry(Entry* entry);
+
+  bool HasReadyEntry() const ABSL_SHARED_LOCKS_REQUIRED(mutex_) {
+    return !ready_.empty();
+  }
+  bool HasRestartWork() const ABSL_SHARED_LOCKS_REQUIRED(mutex_) {
+    return shutdown_ || !to_restart_.empty();
+  }
+
+  std::function<std::unique_ptr<Sandbox>()> factory_;
+  const SandboxPoolOptions options_;
+  std::vector<std::unique_ptr<Entry>> entries_;
+
+  mutable absl::Mutex mutex_;
+  // Running sandboxes, ready to be checked out.
+  std::deque<Entry*> ready_ ABSL_GUARDED_BY(mutex_);
+  // Sandboxes waiting to be restarted by the background thread.
+  std::deque<Entry*> to_restart_ ABSL_GUARDED_BY(mutex_);
+  int checked_out_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool initialized_ ABSL_GUARDED_BY(mutex_) = false;
+  bool shutdown_ ABSL_GUARDED_BY(mutex_) = false;
+  SandboxPoolMetrics metrics_ ABSL_GUARDED_BY(mutex_);
+
+  std::thread restart_thread_;
+};
+
+// Keeps a number of initialized sandboxes of type T around, so that requests
+// do not have to pay for the sandbox start-up. Example:
+//
+//   sapi::SandboxPool<SumSandbox> pool({.size = 4, .restart_after_use = true});
+//   SAPI_RETURN_IF_ERROR(pool.Init());
+//   ...
+//   SAPI_ASSIGN_OR_RETURN(auto lease, pool.Checkout());
+//   SumApi api(lease.sandbox());
+//   SAPI_ASSIGN_OR_RETURN(int result, api.sum(1, 2));
+//
+// Sandboxes which died while being used, or which are due for a restart, are
+// restarted by a background thread.
+template <typename T>
+class SandboxPool : public SandboxPoolBase {
+ public:
+  // A sandbox checked out from the pool. It goes back to the pool when the
+  // Lease is destroyed.
+  class Lease {
+   public:
+    Lease(Lease&& other) : pool_(other.pool_), entry_(other.entry_) {
+      other.entry_ = nullptr;
+    }
+    Lease& operator=(Lease&& other) {
+      if (this != &other) {
+        Return();
+        pool_ = other.pool_;
+        entry_ = other.entry_;
+        other.entry_ = nullptr;
+      }
+      return *this;
+    }
+
+    ~Lease() { Return(); }
+
+    T* sandbox() const { return static_cast<T*>(entry_->sandbox.get()); }
+    T* operator->() const { return sandbox(); }
+
+    // Returns the sandbox to the pool before the Lease is destroyed.
+    void Return() {
+      if (entry_ != nullptr) {
+        pool_->CheckinEntry(entry_);
+        entry_ = nullptr;
+      }
+    }
+
+   private:
+    friend class SandboxPool;
+
+    Lease(SandboxPool* pool, Entry* entry) : pool_(pool), entry_(entry) {}
+
+    SandboxPool* pool_;
+    Entry* entry_;
+  };
+
+  explicit SandboxPool(SandboxPoolOptions options = {})
+      : SandboxPool([] { return absl::make_unique<T>(); }, options) {}
+
+  SandboxPool(std::function<std::unique_ptr<T>()> factory,
+              SandboxPoolOptions options)
+      : SandboxPoolBase(
+            [factory = std::move(factory)]() -> std::unique_ptr<Sandbox> {
+              return factory();
+            },
+            options) {}
+
+  // Hands out a running sandbox, waiting up to 'timeout' for one to become
+  // available.
+  absl::StatusOr<Lease> Checkout(
+      absl::Duration timeout = absl::InfiniteDuration()) {
+    SAPI_ASSIGN_OR_RETURN(Entry * entry, CheckoutEntry(timeout));
+    return Lease(this, entry);
+  }
+};
+
+}  // namespace sapi
+
+#endif  // SANDBOXED_API_SANDBOX_POOL_H_
@@ -13,25 +13,46 @@
 // limitations under the License.
 
 #include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "benchmark/benchmark.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/memory/memory.h"
 #include "absl/status/status.h"
+#include "absl/time/time.h"
 #include "sandboxed_api/examples/stringop/lib/sandbox.h"
 #include "sandboxed_api/examples/stringop/lib/stringop-sapi.sapi.h"
 #include "sandboxed_api/examples/stringop/lib/stringop_params.pb.h"
 #include "sandboxed_api/examples/sum/lib/sandbox.h"
 #include "sandboxed_api/examples/sum/lib/sum-sapi.sapi.h"
+#include "sandboxed_api/examples/sum/lib/sum-sapi_direct.sapi.h"
 #include "sandboxed_api/examples/sum/lib/sum-sapi_embed.h"
+#include "sandboxed_api/proto_helper.h"
+#include "sandboxed_api/sandbox2/cpu_placement.h"
+#include "sandboxed_api/sandbox2/executor.h"
+#include "sandboxed_api/sandbox2/policy_cache.h"
+#include "sandboxed_api/sandbox2/util.h"
+#include "sandboxed_api/sandbox_pool.h"
 #include "sandboxed_api/transaction.h"
 #include "sandboxed_api/util/status_matchers.h"
 
 using ::sapi::IsOk;
 using ::sapi::StatusIs;
 using ::testing::Eq;
+using ::testing::Ge;
 using ::testing::HasSubstr;
+using ::testing::Le;
+using ::testing::Ne;
+using ::testing::Not;
 
 namespace sapi {
 namespace {
@@ -44,6 +65,72 @@ absl::Status InvokeNop(Sandbox* sandbox) {
   return api.nop();
 }
 
+// Function causing almost no load in the sandboxee, with a return value.
+absl::Status InvokeSum(Sandbox* sandbox) {
+  SumApi api(sandbox);
+  SAPI_ASSIGN_OR_RETURN(int result, api.sum(1, 2));
+  TRANSACTION_FAIL_IF_NOT(result == 3, "sum() returned incorrect result");
+  return absl::OkStatus();
+}
+
+// Same as InvokeSum(), but called through the generated direct-call dispatch
+// table of the sandboxee.
+absl::Status InvokeSumDirect(Sandbox* sandbox) {
+  SumDirectApi api(sandbox);
+  SAPI_ASSIGN_OR_RETURN(int result, api.sum(1, 2));
+  TRANSACTION_FAIL_IF_NOT(result == 3, "sum() returned incorrect result");
+  return absl::OkStatus();
+}
+
+// Sum sandbox which exchanges function calls over the shared-memory ring.
+class SumShmSandbox : public SumSandbox {
+ private:
+  bool UseSharedMemoryTransport() const override { return true; }
+};
+
+// Sum sandbox which serves calls from a fork of a snapshot template.
+class SumSnapshotSandbox : public SumSandbox {
+ private:
+  bool UseSnapshotTemplate() const override { return true; }
+};
+
+// Sum sandbox which allows v::SharedArray variables.
+class SumSharedArraySandbox : public SumSandbox {
+ private:
+  bool UseSharedArrays() const override { return true; }
+};
+
+// Sum sandbox whose policy is built once and shared by all its instances.
+class SumCachedPolicySandbox : public SumSandbox {
+ private:
+  bool UsePolicyCache() const override { return true; }
+};
+
+// Sum sandbox whose cached policy depends on per-instance state.
+class SumKeyedPolicySandbox : public SumSandbox {
+ public:
+  explicit SumKeyedPolicySandbox(std::string key) : key_(std::move(key)) {}
+
+ private:
+  bool UsePolicyCache() const override { return true; }
+  std::string GetPolicyCacheKey() const override { return key_; }
+
+  std::string key_;
+};
+
+// Sum sandbox which places pointer arguments in its call arena.
+class SumCallArenaSandbox : public SumSandbox {
+ private:
+  bool UseCallArena() const override { return true; }
+};
+
+// Sum sandbox which does not resolve its functions when started, so that calls
+// address them by name.
+class SumByNameSandbox : public SumSandbox {
+ private:
+  std::vector<std::string> GetFunctionNames() const override { return {}; }
+};
+
 // Function that makes use of our special protobuf (de)-serialization code
 // inside SAPI (including the back-synchronization of the structure).
 absl::Status InvokeStringReversal(Sandbox* sandbox) {
@@ -89,6 +176,37 @@ void BenchmarkSandboxRestartForkserverOverheadForced(benchmark::State& state) {
 }
 BENCHMARK(BenchmarkSandboxRestartForkserverOverheadForced);
 
+// Reset the sandboxee to a fresh fork of the snapshot template.
+void BenchmarkSandboxSnapshotResetOverhead(benchmark::State& state) {
+  sapi::BasicTransaction st{absl::make_unique<SumSnapshotSandbox>()};
+  for (auto _ : state) {
+    EXPECT_THAT(st.Run(InvokeSum), IsOk());
+    EXPECT_THAT(st.sandbox()->Reset(), IsOk());
+  }
+}
+BENCHMARK(BenchmarkSandboxSnapshotResetOverhead);
+
+// Start a new sandbox, with the policy rebuilt every time (state.range(0) ==
+// 0), or taken from the policy cache (state.range(0) == 1).
+void BenchmarkSandboxStartPolicyCache(benchmark::State& state) {
+  const auto stats_before = sandbox2::PolicyCache::Global()->stats();
+  for (auto _ : state) {
+    std::unique_ptr<Sandbox> sandbox;
+    if (state.range(0) == 0) {
+      sandbox = absl::make_unique<SumSandbox>();
+    } else {
+      sandbox = absl::make_unique<SumCachedPolicySandbox>();
+    }
+    EXPECT_THAT(sandbox->Init(), IsOk());
+    EXPECT_THAT(InvokeSum(sandbox.get()), IsOk());
+  }
+  const auto stats = sandbox2::PolicyCache::Global()->stats();
+  state.counters["policy_cache_hits"] = stats.hits - stats_before.hits;
+  state.counters["policy_build_us_saved"] = absl::ToDoubleMicroseconds(
+      stats.build_time_saved - stats_before.build_time_saved);
+}
+BENCHMARK(BenchmarkSandboxStartPolicyCache)->Arg(0)->Arg(1);
+
 // Reuse the sandbox. Used to measure the overhead of the call invocation.
 void BenchmarkCallOverhead(benchmark::State& state) {
   BasicTransaction st(absl::make_unique<StringopSandbox>());
@@ -98,6 +216,93 @@ void BenchmarkCallOverhead(benchmark::State& state) {
 }
 BENCHMARK(BenchmarkCallOverhead);
 
+// Measure the call overhead with the default (Comms channel) transport.
+void BenchmarkSumCallOverhead(benchmark::State& state) {
+  BasicTransaction st(absl::make_unique<SumSandbox>());
+  for (auto _ : state) {
+    EXPECT_THAT(st.Run(InvokeSum), IsOk());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BenchmarkSumCallOverhead);
+
+// Measure the call overhead when the sandboxee looks up the function by name.
+void BenchmarkSumCallOverheadByName(benchmark::State& state) {
+  BasicTransaction st(absl::make_unique<SumByNameSandbox>());
+  for (auto _ : state) {
+    EXPECT_THAT(st.Run(InvokeSum), IsOk());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BenchmarkSumCallOverheadByName);
+
+// Measure the call overhead with the shared-memory transport.
+void BenchmarkSumCallOverheadShm(benchmark::State& state) {
+  BasicTransaction st(absl::make_unique<SumShmSandbox>());
+  for (auto _ : state) {
+    EXPECT_THAT(st.Run(InvokeSum), IsOk());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BenchmarkSumCallOverheadShm);
+
+// Measure the call overhead without libffi in the sandboxee.
+void BenchmarkSumCallOverheadDirect(benchmark::State& state) {
+  BasicTransaction st(absl::make_unique<SumDirectSandbox>());
+  for (auto _ : state) {
+    EXPECT_THAT(st.Run(InvokeSumDirect), IsOk());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BenchmarkSumCallOverheadDirect);
+
+// Measure the call throughput when keeping state.range(0) calls in flight.
+template <typename SandboxT>
+void BenchmarkSumCallPipelined(benchmark::State& state) {
+  SandboxT sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  std::vector<v::Int> a(state.range(0));
+  std::vector<v::Int> b(state.range(0));
+  std::vector<v::Int> ret(state.range(0));
+  std::vector<AsyncCall> calls;
+  for (auto _ : state) {
+    calls.clear();
+    for (int i = 0; i < state.range(0); ++i) {
+      a[i].SetValue(i);
+      b[i].SetValue(1);
+      SAPI_ASSERT_OK_AND_ASSIGN(
+          AsyncCall call, sandbox.CallAsync("sum", &ret[i], &a[i], &b[i]));
+      calls.push_back(std::move(call));
+    }
+    for (auto& call : calls) {
+      ASSERT_THAT(call.Wait(), IsOk());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_TEMPLATE(BenchmarkSumCallPipelined, SumSandbox)->Arg(1)->Arg(16);
+BENCHMARK_TEMPLATE(BenchmarkSumCallPipelined, SumShmSandbox)->Arg(1)->Arg(16);
+
+// Measure the cost of a request served by a pre-warmed sandbox which gets
+// restarted in the background after each use.
+void BenchmarkSandboxPoolRestartAfterUse(benchmark::State& state) {
+  SandboxPool<SumSandbox> pool(
+      {.size = static_cast<int>(state.range(0)), .restart_after_use = true});
+  ASSERT_THAT(pool.Init(), IsOk());
+  for (auto _ : state) {
+    SAPI_ASSERT_OK_AND_ASSIGN(auto lease, pool.Checkout());
+    EXPECT_THAT(InvokeSum(lease.sandbox()), IsOk());
+  }
+  SandboxPoolMetrics metrics = pool.metrics();
+  state.counters["hit_rate"] = metrics.hit_rate();
+  state.counters["restart_ms"] =
+      metrics.restarts == 0
+          ? 0
+          : absl::ToDoubleMilliseconds(metrics.total_restart_latency) /
+                metrics.restarts;
+}
+BENCHMARK(BenchmarkSandboxPoolRestartAfterUse)->Arg(1)->Arg(4);
+
 // Make use of protobufs.
 void BenchmarkProtobufHandling(benchmark::State& state) {
   BasicTransaction st(absl::make_unique<StringopSandbox>());
@@ -107,6 +312,25 @@ void BenchmarkProtobufHandling(benchmark::State& state) {
 }
 BENCHMARK(BenchmarkProtobufHandling);
 
+// Measure the cost of passing protobufs of state.range(0) bytes in and out.
+void BenchmarkLargeProtobufHandling(benchmark::State& state) {
+  StringopSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  StringopApi api(&sandbox);
+  stringop::StringReverse proto;
+  proto.set_input(std::string(state.range(0), 'x'));
+  for (auto _ : state) {
+    v::Proto<stringop::StringReverse> pp(proto);
+    SAPI_ASSERT_OK_AND_ASSIGN(int return_code,
+                              api.pb_reverse_string(pp.PtrBoth()));
+    ASSERT_THAT(return_code, Ne(0));
+    SAPI_ASSERT_OK_AND_ASSIGN(auto pb_result, pp.GetMessage());
+    benchmark::DoNotOptimize(pb_result);
+  }
+  state.SetBytesProcessed(2 * state.iterations() * state.range(0));
+}
+BENCHMARK(BenchmarkLargeProtobufHandling)->Arg(1 << 10)->Arg(4 << 20);
+
 // Measure overhead of synchronizing data.
 void BenchmarkIntDataSynchronization(benchmark::State& state) {
   auto sandbox = absl::make_unique<StringopSandbox>();
@@ -133,6 +357,229 @@ void BenchmarkIntDataSynchronization(benchmark::State& state) {
 }
 BENCHMARK(BenchmarkIntDataSynchronization);
 
+// Measure the overhead of synchronizing many small arrays one by one.
+void BenchmarkArrayTransferIndividual(benchmark::State& state) {
+  auto sandbox = absl::make_unique<SumSandbox>();
+  ASSERT_THAT(sandbox->Init(), IsOk());
+
+  std::vector<std::unique_ptr<v::Array<int>>> arrays;
+  for (int i = 0; i < state.range(0); ++i) {
+    arrays.push_back(absl::make_unique<v::Array<int>>(16));
+    ASSERT_THAT(sandbox->Allocate(arrays.back().get(), true), IsOk());
+  }
+  for (auto _ : state) {
+    for (auto& array : arrays) {
+      EXPECT_THAT(sandbox->TransferToSandboxee(array.get()), IsOk());
+    }
+  }
+}
+BENCHMARK(BenchmarkArrayTransferIndividual)->Arg(1)->Arg(12)->Arg(2048);
+
+// Measure the overhead of synchronizing many small arrays in a single batch.
+void BenchmarkArrayTransferBatched(benchmark::State& state) {
+  auto sandbox = absl::make_unique<SumSandbox>();
+  ASSERT_THAT(sandbox->Init(), IsOk());
+
+  std::vector<std::unique_ptr<v::Array<int>>> arrays;
+  std::vector<v::Var*> vars;
+  for (int i = 0; i < state.range(0); ++i) {
+    arrays.push_back(absl::make_unique<v::Array<int>>(16));
+    ASSERT_THAT(sandbox->Allocate(arrays.back().get(), true), IsOk());
+    vars.push_back(arrays.back().get());
+  }
+  for (auto _ : state) {
+    EXPECT_THAT(sandbox->TransferToSandboxee(absl::MakeConstSpan(vars)),
+                IsOk());
+  }
+}
+BENCHMARK(BenchmarkArrayTransferBatched)->Arg(1)->Arg(12)->Arg(2048);
+
+// Measure the overhead of passing a new array to every call, which needs to be
+// allocated and freed in the sandboxee unless the call arena is used.
+template <typename T>
+void BenchmarkArrayArgument(benchmark::State& state) {
+  T sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+
+  std::vector<int> values(state.range(0), 1);
+  for (auto _ : state) {
+    v::Array<int> array(values.data(), values.size());
+    auto result = api.sumarr(array.PtrBefore(), array.GetNElem());
+    EXPECT_THAT(result, IsOk());
+  }
+}
+BENCHMARK_TEMPLATE(BenchmarkArrayArgument, SumSandbox)->Arg(16)->Arg(4096);
+BENCHMARK_TEMPLATE(BenchmarkArrayArgument, SumCallArenaSandbox)
+    ->Arg(16)
+    ->Arg(4096);
+
+// Measure the bandwidth of passing an array to a function which reads all of
+// it, copying it into the sandboxee on every call.
+void BenchmarkArrayBandwidth(benchmark::State& state) {
+  SumSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+
+  v::Array<int> array(state.range(0) / sizeof(int));
+  std::fill_n(array.GetData(), array.GetNElem(), 1);
+  ASSERT_THAT(sandbox.Allocate(&array, true), IsOk());
+  for (auto _ : state) {
+    auto result = api.sumarr(array.PtrBefore(), array.GetNElem());
+    EXPECT_THAT(result, IsOk());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BenchmarkArrayBandwidth)->RangeMultiplier(8)->Range(1 << 20, 1 << 30);
+
+// Same as above, but with an array shared with the sandboxee.
+void BenchmarkSharedArrayBandwidth(benchmark::State& state) {
+  SumSharedArraySandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      auto array, v::SharedArray<int>::Create(state.range(0) / sizeof(int)));
+  std::fill_n(array->GetData(), array->GetNElem(), 1);
+  for (auto _ : state) {
+    auto result = api.sumarr(array->PtrBefore(), array->GetNElem());
+    EXPECT_THAT(result, IsOk());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BenchmarkSharedArrayBandwidth)
+    ->RangeMultiplier(8)
+    ->Range(1 << 20, 1 << 30);
+
+// Sum sandbox whose sandboxee runs on the given CPUs.
+class SumPlacedSandbox : public SumSandbox {
+ public:
+  explicit SumPlacedSandbox(std::vector<int> cpus) : cpus_(std::move(cpus)) {}
+
+ private:
+  void ModifyExecutor(sandbox2::Executor* executor) override {
+    executor->set_cpu_placement(sandbox2::CpuPlacement::Cpus(cpus_));
+  }
+
+  std::vector<int> cpus_;
+};
+
+// Restores the CPU affinity of the calling thread when it goes out of scope,
+// also when an ASSERT returns early.
+class ScopedCpuAffinity {
+ public:
+  ScopedCpuAffinity() {
+    saved_ = sched_getaffinity(0, sizeof(affinity_), &affinity_) == 0;
+  }
+  ~ScopedCpuAffinity() {
+    if (saved_) {
+      sched_setaffinity(0, sizeof(affinity_), &affinity_);
+    }
+  }
+
+  ScopedCpuAffinity(const ScopedCpuAffinity&) = delete;
+  ScopedCpuAffinity& operator=(const ScopedCpuAffinity&) = delete;
+
+  bool saved() const { return saved_; }
+
+ private:
+  cpu_set_t affinity_;
+  bool saved_;
+};
+
+// Measure the bandwidth of transfers to and from a sandboxee on the NUMA node
+// of the calling thread (0), or on another node (1).
+void BenchmarkNodeTransferBandwidth(benchmark::State& state) {
+  std::vector<std::vector<int>> nodes = sandbox2::CpuPlacement::GetNodes();
+  nodes.erase(std::remove_if(nodes.begin(), nodes.end(),
+                             [](const std::vector<int>& node) {
+                               return node.empty();
+                             }),
+              nodes.end());
+  const bool remote = state.range(0);
+  if (remote && nodes.size() < 2) {
+    state.SkipWithError("Requires at least two NUMA nodes");
+    return;
+  }
+  const std::vector<int>& local_cpus = nodes.front();
+  const std::vector<int>& sandboxee_cpus =
+      remote ? nodes.back() : nodes.front();
+
+  ScopedCpuAffinity saved_affinity;
+  ASSERT_TRUE(saved_affinity.saved());
+  // The kernel allocates the pages of the first transfer on the node of the
+  // calling thread, so make it from the node of the sandboxee.
+  ASSERT_TRUE(sandbox2::util::SetCpuAffinity(sandboxee_cpus));
+  SumPlacedSandbox sandbox(sandboxee_cpus);
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  v::Array<uint8_t> array(state.range(1));
+  std::fill_n(array.GetData(), array.GetNElem(), 1);
+  ASSERT_THAT(sandbox.Allocate(&array, true), IsOk());
+  ASSERT_THAT(sandbox.TransferToSandboxee(&array), IsOk());
+  ASSERT_TRUE(sandbox2::util::SetCpuAffinity(local_cpus));
+
+  for (auto _ : state) {
+    EXPECT_THAT(sandbox.TransferToSandboxee(&array), IsOk());
+    EXPECT_THAT(sandbox.TransferFromSandboxee(&array), IsOk());
+  }
+  state.SetBytesProcessed(state.iterations() * 2 * state.range(1));
+}
+BENCHMARK(BenchmarkNodeTransferBandwidth)
+    ->Args({0, 1 << 20})
+    ->Args({1, 1 << 20})
+    ->Args({0, 64 << 20})
+    ->Args({1, 64 << 20});
+
+// Measure the overhead of passing the same large read-only array to every
+// call, with and without change tracking.
+void BenchmarkUnchangedArrayArgument(benchmark::State& state) {
+  SumSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+
+  v::Array<int> array(4 << 20);
+  std::fill_n(array.GetData(), array.GetNElem(), 1);
+  array.SetTrackChanges(state.range(0));
+  for (auto _ : state) {
+    auto result = api.sumarr(array.PtrBefore(), array.GetNElem());
+    EXPECT_THAT(result, IsOk());
+  }
+}
+BENCHMARK(BenchmarkUnchangedArrayArgument)->Arg(0)->Arg(1);
+
+// Measure the overhead of making many small calls, one by one or in a batch.
+void BenchmarkSumCallBatch(benchmark::State& state) {
+  SumSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  const bool batched = state.range(1);
+
+  v::Int a(1);
+  v::Int b(2);
+  std::vector<std::unique_ptr<v::Int>> rets;
+  CallBatch batch(&sandbox);
+  for (int i = 0; i < state.range(0); ++i) {
+    rets.push_back(absl::make_unique<v::Int>());
+    batch.Add("sum", rets.back().get(), &a, &b);
+  }
+  for (auto _ : state) {
+    if (batched) {
+      EXPECT_THAT(batch.Run(), IsOk());
+    } else {
+      for (auto& ret : rets) {
+        EXPECT_THAT(sandbox.Call("sum", ret.get(), &a, &b), IsOk());
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BenchmarkSumCallBatch)
+    ->Args({1, 0})
+    ->Args({1, 1})
+    ->Args({16, 0})
+    ->Args({16, 1})
+    ->Args({256, 0})
+    ->Args({256, 1});
+
 // Test whether stack trace generation works.
 TEST(SAPITest, HasStackTraces) {
   auto sandbox = absl::make_unique<StringopSandbox>();
@@ -146,6 +593,31 @@ TEST(SAPITest, HasStackTraces) {
 
 // Various tests:
 
+TEST(SAPITest, ProtoArgEnvelope) {
+  stringop::StringReverse proto;
+  proto.set_input("Hello");
+
+  // The envelope is written without a ProtoArg, but must be the same.
+  ProtoArg proto_arg;
+  proto_arg.set_full_name(proto.GetDescriptor()->full_name());
+  proto_arg.set_protobuf_data(proto.SerializeAsString());
+  SAPI_ASSERT_OK_AND_ASSIGN(std::vector<uint8_t> serialized,
+                            SerializeProto(proto));
+  EXPECT_THAT(std::string(serialized.begin(), serialized.end()),
+              Eq(proto_arg.SerializeAsString()));
+
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      auto deserialized,
+      DeserializeProto<stringop::StringReverse>(
+          reinterpret_cast<const char*>(serialized.data()), serialized.size()));
+  EXPECT_THAT(deserialized.input(), Eq("Hello"));
+
+  EXPECT_THAT(DeserializeProto<stringop::StringReverse>(
+                  reinterpret_cast<const char*>(serialized.data()),
+                  serialized.size() - 1),
+              Not(IsOk()));
+}
+
 // Leaks a file descriptor inside the sandboxee.
 int LeakFileDescriptor(sapi::Sandbox* sandbox, const char* path) {
   int raw_fd = open(path, O_RDONLY);
@@ -174,6 +646,60 @@ TEST(SandboxTest, RestartSandboxFD) {
   EXPECT_THAT(st.Run(test_body), IsOk());
 }
 
+// Make sure that resetting to the snapshot template gives a fresh set of FDs.
+TEST(SandboxTest, SnapshotResetFD) {
+  SumSnapshotSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+
+  EXPECT_THAT(LeakFileDescriptor(&sandbox, "/proc/self/exe"), Eq(3));
+  EXPECT_THAT(LeakFileDescriptor(&sandbox, "/proc/self/exe"), Eq(4));
+  const int pid = sandbox.pid();
+  ASSERT_THAT(sandbox.Reset(), IsOk());
+  EXPECT_THAT(sandbox.pid(), Ne(pid));
+  EXPECT_THAT(LeakFileDescriptor(&sandbox, "/proc/self/exe"), Eq(3));
+
+  SumApi api(&sandbox);
+  SAPI_ASSERT_OK_AND_ASSIGN(int result, api.sum(1, 2));
+  EXPECT_THAT(result, Eq(3));
+}
+
+TEST(SandboxTest, SnapshotResetAfterCrash) {
+  SumSnapshotSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+
+  // Only the worker crashes, the template keeps the sandbox alive.
+  EXPECT_THAT(api.crash(), StatusIs(absl::StatusCode::kUnavailable));
+  EXPECT_TRUE(sandbox.is_active());
+
+  ASSERT_THAT(sandbox.Reset(), IsOk());
+  SAPI_ASSERT_OK_AND_ASSIGN(int result, api.sum(1, 2));
+  EXPECT_THAT(result, Eq(3));
+}
+
+TEST(SandboxTest, SnapshotResetAfterWorkerDiedBetweenCalls) {
+  SumSnapshotSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+  SAPI_ASSERT_OK_AND_ASSIGN(int result, api.sum(1, 2));
+
+  // No call is outstanding, so the template must not reply for the worker,
+  // which would leave a stale reply for the next call.
+  ASSERT_THAT(kill(sandbox.pid(), SIGKILL), Eq(0));
+  EXPECT_THAT(api.sum(1, 2).status(), Not(IsOk()));
+
+  ASSERT_THAT(sandbox.Reset(), IsOk());
+  SAPI_ASSERT_OK_AND_ASSIGN(result, api.sum(3, 4));
+  EXPECT_THAT(result, Eq(7));
+}
+
+TEST(SandboxTest, SnapshotResetNotEnabled) {
+  SumSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  EXPECT_THAT(sandbox.Reset(),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+}
+
 TEST(SandboxTest, RestartTransactionSandboxFD) {
   sapi::BasicTransaction st{absl::make_unique<SumSandbox>()};
 
@@ -198,6 +724,31 @@ TEST(SandboxTest, RestartTransactionSandboxFD) {
               IsOk());
 }
 
+TEST(SandboxTest, PolicyCacheSharesPolicy) {
+  const auto stats_before = sandbox2::PolicyCache::Global()->stats();
+  for (int i = 0; i < 3; ++i) {
+    SumCachedPolicySandbox sandbox;
+    ASSERT_THAT(sandbox.Init(), IsOk());
+    EXPECT_THAT(InvokeSum(&sandbox), IsOk());
+  }
+  const auto stats = sandbox2::PolicyCache::Global()->stats();
+  EXPECT_THAT(stats.misses - stats_before.misses, Le(1));
+  EXPECT_THAT(stats.hits - stats_before.hits, Ge(2));
+}
+
+TEST(SandboxTest, PolicyCacheKeySeparatesPolicies) {
+  sandbox2::PolicyCache::Global()->Clear();
+  const auto stats_before = sandbox2::PolicyCache::Global()->stats();
+  for (const char* key : {"a", "b", "a"}) {
+    SumKeyedPolicySandbox sandbox(key);
+    ASSERT_THAT(sandbox.Init(), IsOk());
+    EXPECT_THAT(InvokeSum(&sandbox), IsOk());
+  }
+  const auto stats = sandbox2::PolicyCache::Global()->stats();
+  EXPECT_THAT(stats.misses - stats_before.misses, Eq(2));
+  EXPECT_THAT(stats.hits - stats_before.hits, Eq(1));
+}
+
 // Make sure we can recover from a dying sandbox.
 TEST(SandboxTest, RestartSandboxAfterCrash) {
   SumSandbox sandbox;
@@ -237,6 +788,367 @@ TEST(SandboxTest, RestartSandboxAfterViolation) {
   EXPECT_THAT(result, Eq(3));
 }
 
+// Transfer more variables than fit into a single process_vm_writev() call.
+TEST(SandboxTest, BatchTransfer) {
+  SumSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+
+  constexpr int kNumVars = IOV_MAX + 10;
+  std::vector<std::unique_ptr<v::Int>> ints;
+  std::vector<v::Var*> vars;
+  for (int i = 0; i < kNumVars; ++i) {
+    ints.push_back(absl::make_unique<v::Int>(i));
+    ASSERT_THAT(sandbox.Allocate(ints.back().get(), true), IsOk());
+    vars.push_back(ints.back().get());
+  }
+  // Variables not backed by plain memory are transferred individually.
+  sapi::v::Fd fd(open("/proc/self/exe", O_RDONLY));
+  vars.push_back(&fd);
+  ASSERT_THAT(sandbox.TransferToSandboxee(absl::MakeConstSpan(vars)), IsOk());
+  EXPECT_THAT(fd.GetRemoteFd(), Eq(3));
+
+  vars.pop_back();
+  for (auto& var : ints) {
+    var->SetValue(-1);
+  }
+  ASSERT_THAT(sandbox.TransferFromSandboxee(absl::MakeConstSpan(vars)), IsOk());
+  for (int i = 0; i < kNumVars; ++i) {
+    EXPECT_THAT(ints[i]->GetValue(), Eq(i));
+  }
+}
+
+TEST(SandboxTest, CallArena) {
+  SumCallArenaSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+
+  for (int i = 0; i < 3; ++i) {
+    int arr[] = {1, 2, 3, i};
+    v::Array<int> array(arr, ABSL_ARRAYSIZE(arr));
+    v::Struct<sum_params> params;
+    params.mutable_data()->a = i;
+    params.mutable_data()->b = 2;
+    ASSERT_THAT(api.sums(params.PtrBoth()), IsOk());
+    EXPECT_THAT(params.data().ret, Eq(i + 2));
+    SAPI_ASSERT_OK_AND_ASSIGN(
+        int result, api.sumarr(array.PtrBefore(), array.GetNElem()));
+    EXPECT_THAT(result, Eq(6 + i));
+    // The arena is reused by the next call.
+    EXPECT_THAT(params.GetRemote(), Eq(nullptr));
+    EXPECT_THAT(array.GetRemote(), Eq(nullptr));
+  }
+
+  // Arrays which do not fit are allocated as usual.
+  std::vector<int> values(1 << 20, 1);
+  v::Array<int> large(values.data(), values.size());
+  SAPI_ASSERT_OK_AND_ASSIGN(int result,
+                            api.sumarr(large.PtrBefore(), large.GetNElem()));
+  EXPECT_THAT(result, Eq(1 << 20));
+  EXPECT_THAT(large.GetRemote(), Ne(nullptr));
+
+  // So are explicitly allocated variables.
+  int arr[] = {4, 5};
+  v::Array<int> allocated(arr, ABSL_ARRAYSIZE(arr));
+  ASSERT_THAT(sandbox.Allocate(&allocated, true), IsOk());
+  void* remote = allocated.GetRemote();
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      result, api.sumarr(allocated.PtrBefore(), allocated.GetNElem()));
+  EXPECT_THAT(result, Eq(9));
+  EXPECT_THAT(allocated.GetRemote(), Eq(remote));
+}
+
+TEST(SandboxTest, SharedArray) {
+  SumSharedArraySandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+
+  SAPI_ASSERT_OK_AND_ASSIGN(auto array, v::SharedArray<int>::Create(4));
+  for (int i = 0; i < 4; ++i) {
+    (*array)[i] = i;
+  }
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      int result, api.sumarr(array->PtrBefore(), array->GetNElem()));
+  EXPECT_THAT(result, Eq(6));
+  void* remote = array->GetRemote();
+  ASSERT_THAT(remote, Ne(nullptr));
+
+  // Changes are visible without any transfer.
+  (*array)[0] = 10;
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      result, api.sumarr(array->PtrNone(), array->GetNElem()));
+  EXPECT_THAT(result, Eq(16));
+  EXPECT_THAT(array->GetRemote(), Eq(remote));
+
+  // So are changes made by the sandboxee.
+  SAPI_ASSERT_OK_AND_ASSIGN(auto params, v::SharedArray<sum_params>::Create(1));
+  (*params)[0].a = 1;
+  (*params)[0].b = 2;
+  ASSERT_THAT(api.sums(params->PtrBoth()), IsOk());
+  EXPECT_THAT((*params)[0].ret, Eq(3));
+
+  EXPECT_THAT(v::SharedArray<int>::Create(0),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+// The default policy does not allow shared read-write mappings.
+TEST(SandboxTest, SharedArrayRequiresOptIn) {
+  SumSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+
+  SAPI_ASSERT_OK_AND_ASSIGN(auto array, v::SharedArray<int>::Create(4));
+  EXPECT_THAT(sandbox.Allocate(array.get()), Not(IsOk()));
+  EXPECT_THAT(sandbox.AwaitResult().final_status(),
+              Eq(sandbox2::Result::VIOLATION));
+}
+
+TEST(SandboxTest, TrackChanges) {
+  SumSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+
+  int arr[] = {1, 2, 3};
+  v::Array<int> array(arr, ABSL_ARRAYSIZE(arr));
+  array.SetTrackChanges(true);
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      int result, api.sumarr(array.PtrBefore(), array.GetNElem()));
+  EXPECT_THAT(result, Eq(6));
+
+  // Unsignalled changes are not transferred.
+  arr[0] = 10;
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      result, api.sumarr(array.PtrBefore(), array.GetNElem()));
+  EXPECT_THAT(result, Eq(6));
+
+  array.MarkModified();
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      result, api.sumarr(array.PtrBefore(), array.GetNElem()));
+  EXPECT_THAT(result, Eq(15));
+
+  // Neither are they after a transfer back from the sandboxee.
+  {
+    v::Struct<sum_params> params;
+    params.SetTrackChanges(true);
+    params.mutable_data()->a = 1;
+    params.mutable_data()->b = 2;
+    ASSERT_THAT(api.sums(params.PtrBoth()), IsOk());
+    EXPECT_THAT(params.data().ret, Eq(3));
+    params.mutable_data()->a = 2;
+    ASSERT_THAT(api.sums(params.PtrBoth()), IsOk());
+    EXPECT_THAT(params.data().ret, Eq(3));
+  }
+
+  // A restarted sandboxee needs all variables again.
+  ASSERT_THAT(sandbox.Restart(false), IsOk());
+  ASSERT_THAT(sandbox.Allocate(&array, true), IsOk());
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      result, api.sumarr(array.PtrBefore(), array.GetNElem()));
+  EXPECT_THAT(result, Eq(15));
+}
+
+TEST(SandboxTest, CallBatch) {
+  SumSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+
+  v::Int a(1);
+  v::Int b(2);
+  v::Int sum_ab;
+  v::Int sum_abb;
+  v::Struct<sum_params> params;
+  params.mutable_data()->a = 3;
+  params.mutable_data()->b = 4;
+  v::Void ret_void;
+  CallBatch batch(&sandbox);
+  int first = batch.Add("sum", &sum_ab, &a, &b);
+  int second = batch.Add("sum", &sum_abb, &a, &b);
+  batch.Add("sums", &ret_void, params.PtrBoth());
+  ASSERT_THAT(batch.PassReturnValue(first, second, 0), IsOk());
+  EXPECT_THAT(batch.PassReturnValue(second, first, 0),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  EXPECT_THAT(batch.PassReturnValue(first, second, 2),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+
+  ASSERT_THAT(batch.Run(), IsOk());
+  EXPECT_THAT(batch.completed(), Eq(3));
+  EXPECT_THAT(sum_ab.GetValue(), Eq(3));
+  EXPECT_THAT(sum_abb.GetValue(), Eq(5));
+  EXPECT_THAT(params.data().ret, Eq(7));
+
+  // The batch stops at the first failing call.
+  v::Int unused;
+  batch.Add("no_such_function", &unused, &a, &b);
+  v::Int last;
+  batch.Add("sum", &last, &a, &b);
+  sum_ab.SetValue(0);
+  EXPECT_THAT(batch.Run(), StatusIs(absl::StatusCode::kUnavailable));
+  EXPECT_THAT(batch.completed(), Eq(3));
+  EXPECT_THAT(sum_ab.GetValue(), Eq(3));
+  EXPECT_THAT(last.GetValue(), Eq(0));
+
+  // The sandbox is still usable.
+  SumApi api(&sandbox);
+  SAPI_ASSERT_OK_AND_ASSIGN(int result, api.sum(1, 2));
+  EXPECT_THAT(result, Eq(3));
+}
+
+TEST(SandboxTest, ShmTransport) {
+  SumShmSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  ASSERT_TRUE(sandbox.rpc_channel()->shm_transport_enabled());
+  SumApi api(&sandbox);
+
+  for (int i = 0; i < 100; ++i) {
+    SAPI_ASSERT_OK_AND_ASSIGN(int result, api.sum(i, 2));
+    EXPECT_THAT(result, Eq(i + 2));
+  }
+  // Requests that are not function calls still go through the Comms channel.
+  int arr[] = {1, 2, 3, 4};
+  v::Array<int> array(arr, ABSL_ARRAYSIZE(arr));
+  SAPI_ASSERT_OK_AND_ASSIGN(int result,
+                            api.sumarr(array.PtrBefore(), array.GetNElem()));
+  EXPECT_THAT(result, Eq(10));
+  EXPECT_THAT(LeakFileDescriptor(&sandbox, "/proc/self/exe"), Eq(3));
+}
+
+TEST(SandboxTest, ShmTransportRestartAfterCrash) {
+  SumShmSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+
+  EXPECT_THAT(api.crash(), StatusIs(absl::StatusCode::kUnavailable));
+  EXPECT_THAT(sandbox.AwaitResult().final_status(),
+              Eq(sandbox2::Result::SIGNALED));
+
+  ASSERT_THAT(sandbox.Restart(false), IsOk());
+  SAPI_ASSERT_OK_AND_ASSIGN(int result, api.sum(1, 2));
+  EXPECT_THAT(result, Eq(3));
+}
+
+template <typename SandboxT>
+void TestCallAsync() {
+  SandboxT sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+
+  // More calls than can be in flight at once.
+  constexpr int kNumCalls = 3 * RPCChannel::kMaxPendingCalls;
+  std::vector<v::Int> a(kNumCalls);
+  v::Int b(2);
+  std::vector<v::Int> ret(kNumCalls);
+  std::vector<AsyncCall> calls;
+  for (int i = 0; i < kNumCalls; ++i) {
+    a[i].SetValue(i);
+    SAPI_ASSERT_OK_AND_ASSIGN(AsyncCall call,
+                              sandbox.CallAsync("sum", &ret[i], &a[i], &b));
+    calls.push_back(std::move(call));
+  }
+  // Synchronous requests are served after the outstanding calls.
+  SumApi api(&sandbox);
+  SAPI_ASSERT_OK_AND_ASSIGN(int result, api.sum(1, 2));
+  EXPECT_THAT(result, Eq(3));
+  EXPECT_TRUE(calls.back().IsDone());
+
+  // Results can be retrieved in any order.
+  for (int i = kNumCalls - 1; i >= 0; --i) {
+    ASSERT_THAT(calls[i].Wait(), IsOk());
+    EXPECT_THAT(ret[i].GetValue(), Eq(i + 2));
+  }
+
+  // Pointer arguments are synchronized once the call has completed.
+  int arr[] = {1, 2, 3, 4};
+  v::Array<int> array(arr, ABSL_ARRAYSIZE(arr));
+  v::ULong n(array.GetNElem());
+  v::Int sum;
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      AsyncCall call, sandbox.CallAsync("sumarr", &sum, array.PtrBefore(), &n));
+  ASSERT_THAT(call.Wait(), IsOk());
+  EXPECT_THAT(sum.GetValue(), Eq(10));
+}
+
+TEST(SandboxTest, CallAsync) { TestCallAsync<SumSandbox>(); }
+
+TEST(SandboxTest, CallAsyncShm) { TestCallAsync<SumShmSandbox>(); }
+
+TEST(SandboxTest, CallAsyncAfterCrash) {
+  SumSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+
+  v::Int a(1);
+  v::Int b(2);
+  v::Int ret;
+  v::Void crash_ret;
+  SAPI_ASSERT_OK_AND_ASSIGN(AsyncCall sum_call,
+                            sandbox.CallAsync("sum", &ret, &a, &b));
+  SAPI_ASSERT_OK_AND_ASSIGN(AsyncCall crash_call,
+                            sandbox.CallAsync("crash", &crash_ret));
+  ASSERT_THAT(sum_call.Wait(), IsOk());
+  EXPECT_THAT(ret.GetValue(), Eq(3));
+  EXPECT_THAT(crash_call.Wait(), StatusIs(absl::StatusCode::kUnavailable));
+}
+
+TEST(SandboxPoolTest, CheckoutCheckin) {
+  SandboxPool<SumSandbox> pool({.size = 2});
+  EXPECT_THAT(pool.Checkout().status(),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+  ASSERT_THAT(pool.Init(), IsOk());
+
+  SAPI_ASSERT_OK_AND_ASSIGN(auto lease1, pool.Checkout());
+  SAPI_ASSERT_OK_AND_ASSIGN(auto lease2, pool.Checkout());
+  EXPECT_THAT(lease1->pid(), Ne(lease2->pid()));
+  EXPECT_THAT(pool.Checkout(absl::Milliseconds(10)).status(),
+              StatusIs(absl::StatusCode::kDeadlineExceeded));
+
+  const int pid = lease1->pid();
+  lease1.Return();
+  SAPI_ASSERT_OK_AND_ASSIGN(auto lease3, pool.Checkout());
+  EXPECT_THAT(lease3->pid(), Eq(pid));
+  EXPECT_THAT(InvokeSum(lease3.sandbox()), IsOk());
+
+  SandboxPoolMetrics metrics = pool.metrics();
+  EXPECT_THAT(metrics.checkouts, Eq(3u));
+  EXPECT_THAT(metrics.hits, Eq(3u));
+  EXPECT_THAT(metrics.restarts, Eq(2u));
+}
+
+TEST(SandboxPoolTest, RestartAfterUse) {
+  SandboxPool<SumSandbox> pool({.size = 1, .restart_after_use = true});
+  ASSERT_THAT(pool.Init(), IsOk());
+
+  int pid;
+  {
+    SAPI_ASSERT_OK_AND_ASSIGN(auto lease, pool.Checkout());
+    pid = lease->pid();
+  }
+  SAPI_ASSERT_OK_AND_ASSIGN(auto lease, pool.Checkout());
+  EXPECT_THAT(lease->pid(), Ne(pid));
+  EXPECT_THAT(InvokeSum(lease.sandbox()), IsOk());
+}
+
+TEST(SandboxPoolTest, RestartAfterMaxUses) {
+  SandboxPool<SumSandbox> pool({.size = 1, .max_uses = 2});
+  ASSERT_THAT(pool.Init(), IsOk());
+
+  std::vector<int> pids;
+  for (int i = 0; i < 3; ++i) {
+    SAPI_ASSERT_OK_AND_ASSIGN(auto lease, pool.Checkout());
+    pids.push_back(lease->pid());
+  }
+  EXPECT_THAT(pids[1], Eq(pids[0]));
+  EXPECT_THAT(pids[2], Ne(pids[1]));
+}
+
+TEST(SandboxPoolTest, ReplacesDeadSandbox) {
+  SandboxPool<SumSandbox> pool({.size = 1});
+  ASSERT_THAT(pool.Init(), IsOk());
+  {
+    SAPI_ASSERT_OK_AND_ASSIGN(auto lease, pool.Checkout());
+    SumApi api(lease.sandbox());
+    EXPECT_THAT(api.crash(), StatusIs(absl::StatusCode::kUnavailable));
+    lease->AwaitResult();
+  }
+  SAPI_ASSERT_OK_AND_ASSIGN(auto lease, pool.Checkout());
+  EXPECT_THAT(InvokeSum(lease.sandbox()), IsOk());
+  EXPECT_THAT(pool.metrics().dead, Eq(1u));
+}
+
 TEST(SandboxTest, NoRaceInAwaitResult) {
   StringopSandbox sandbox;
   ASSERT_THAT(sandbox.Init(), IsOk());
@@ -248,5 +1160,63 @@ TEST(SandboxTest, NoRaceInAwaitResult) {
   EXPECT_THAT(result.final_status(), Eq(sandbox2::Result::VIOLATION));
 }
 
+TEST(SandboxTest, ResolvesFunctions) {
+  SumSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+
+  void* sum_addr = nullptr;
+  ASSERT_THAT(sandbox.Symbol("sum", &sum_addr), IsOk());
+  EXPECT_THAT(sum_addr, Ne(nullptr));
+  SAPI_ASSERT_OK_AND_ASSIGN(int result, api.sum(1, 2));
+  EXPECT_THAT(result, Eq(3));
+
+  // Unknown functions are still reported by the sandboxee.
+  ASSERT_THAT(sandbox.ResolveFunctions({"no_such_function"}), IsOk());
+  v::Int ret;
+  EXPECT_THAT(sandbox.Call("no_such_function", &ret), Not(IsOk()));
+
+  // Indices are resolved again in the new sandboxee.
+  ASSERT_THAT(sandbox.Restart(false), IsOk());
+  SAPI_ASSERT_OK_AND_ASSIGN(result, api.sum(3, 4));
+  EXPECT_THAT(result, Eq(7));
+}
+
+TEST(SandboxTest, ResolvesFunctionsByName) {
+  SumByNameSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumApi api(&sandbox);
+  SAPI_ASSERT_OK_AND_ASSIGN(int result, api.sum(1, 2));
+  EXPECT_THAT(result, Eq(3));
+
+  const std::vector<std::string> names = {"sum", "sub"};
+  ASSERT_THAT(sandbox.ResolveFunctions(names), IsOk());
+  SAPI_ASSERT_OK_AND_ASSIGN(result, api.sum(3, 4));
+  EXPECT_THAT(result, Eq(7));
+  SAPI_ASSERT_OK_AND_ASSIGN(result, api.sub(1, 2));
+  EXPECT_THAT(result, Eq(-1));
+}
+
+TEST(SandboxTest, DirectCalls) {
+  SumDirectSandbox sandbox;
+  ASSERT_THAT(sandbox.Init(), IsOk());
+  SumDirectApi api(&sandbox);
+
+  SAPI_ASSERT_OK_AND_ASSIGN(int sum, api.sum(1, 2));
+  EXPECT_THAT(sum, Eq(3));
+  SAPI_ASSERT_OK_AND_ASSIGN(int negative_sum, api.sum(-1, -2));
+  EXPECT_THAT(negative_sum, Eq(-3));
+  SAPI_ASSERT_OK_AND_ASSIGN(long double addf, api.addf(0.5f, 1.25, 2.0L));
+  EXPECT_THAT(addf, Eq(3.75L));
+  SAPI_ASSERT_OK_AND_ASSIGN(double muld, api.muld(1.5, 3.0f));
+  EXPECT_THAT(muld, Eq(4.5));
+
+  int input[] = {1, 2, 3, 4, 5};
+  v::Array<int> array(input, ABSL_ARRAYSIZE(input));
+  SAPI_ASSERT_OK_AND_ASSIGN(
+      int sumarr, api.sumarr(array.PtrBefore(), array.GetNElem()));
+  EXPECT_THAT(sumarr, Eq(15));
+}
+
 }  // namespace
 }  // namespace sapi
@@ -0,0 +1,105 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Layout of the shared-memory ring used as an optional fast-path transport for
+// FuncCall/FuncRet messages between the SAPI host and the sandboxee. The ring
+// lives in a memfd (sandbox2::Buffer) which is mapped into both processes.
+// Wake-ups are done with (process-shared) futexes on the sequence counters, and
+// only when the other side announced that it is about to sleep.
+
+#ifndef SANDBOXED_API_SHM_RING_H_
+#define SANDBOXED_API_SHM_RING_H_
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+#include "sandboxed_api/call.h"
+
+namespace sapi {
+
+struct ShmRing {
+  // Checked by both sides before enabling the transport.
+  static constexpr uint32_t kMagic = 0x53415049;  // 'SAPI'
+
+  // Number of request slots. Must be a power of two.
+  static constexpr uint32_t kSlots = 16;
+
+  // The sandboxee creates the memfd backing the ring before it enables
+  // sandboxing (mmap(MAP_SHARED) is usually not allowed by the policy) and
+  // keeps it on this FD until the host has fetched it.
+  static constexpr int kSandboxeeFd = 1022;
+
+  struct Slot {
+    // Either comms::kMsgCall (payload in 'call'/'ret'), or any other tag, which
+    // means that the request itself has to be read from the Comms channel.
+    uint32_t tag;
+    FuncCall call;
+    FuncRet ret;
+  };
+
+  uint32_t magic;
+  // Number of requests published by the host. Futex word for the sandboxee.
+  std::atomic<uint32_t> req_seq;
+  // Number of requests completed by the sandboxee. Futex word for the host.
+  std::atomic<uint32_t> ret_seq;
+  // Set by the respective side right before it goes to sleep in FUTEX_WAIT.
+  std::atomic<uint32_t> host_waiting;
+  std::atomic<uint32_t> sandboxee_waiting;
+
+  Slot slots[kSlots];
+
+  Slot& slot(uint32_t seq) { return slots[seq & (kSlots - 1)]; }
+};
+
+static_assert((ShmRing::kSlots & (ShmRing::kSlots - 1)) == 0,
+              "ShmRing::kSlots must be a power of two");
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "ShmRing requires lock-free 32-bit atomics");
+
+namespace shm_ring_internal {
+
+// Busy-waits for a short while before falling back to futexes. Small SAPI
+// functions complete well within this window.
+constexpr int kSpinIterations = 2000;
+
+inline void CpuRelax() {
+#if defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Waits until *word != val, or until the timeout (may be nullptr) expires.
+inline void FutexWait(std::atomic<uint32_t>* word, uint32_t val,
+                      const timespec* timeout) {
+  syscall(__NR_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, val,
+          timeout, nullptr, 0);
+}
+
+inline void FutexWake(std::atomic<uint32_t>* word) {
+  syscall(__NR_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, 1,
+          nullptr, nullptr, 0);
+}
+
+}  // namespace shm_ring_internal
+
+}  // namespace sapi
+
+#endif  // SANDBOXED_API_SHM_RING_H_
@@ -57,6 +57,27 @@ constexpr absl::string_view kHeaderEpilog =
     R"(
 #endif  // %1$s)";
 
+// Prolog of the direct-call dispatch table.
+constexpr absl::string_view kDispatchProlog =
+    R"(// AUTO-GENERATED by the Sandboxed API generator.
+// Edits will be discarded when regenerating this file.
+
+#include "sandboxed_api/direct_call.h"
+)";
+
+// Text template arguments:
+//   1. Table entries
+constexpr absl::string_view kDispatchTableTemplate = R"(
+namespace {
+
+const ::sapi::DirectCall kDirectCalls[] = {
+%1$s};
+
+const ::sapi::DirectCallRegistration kDirectCallRegistration(kDirectCalls);
+
+}  // namespace
+)";
+
 // Text template arguments:
 //   1. Include for embedded sandboxee objects
 constexpr absl::string_view kEmbedInclude = R"(#include "%1$s_embed.h"
@@ -78,11 +99,17 @@ constexpr absl::string_view kNamespaceEndTemplate =
 // Text template arguments:
 //   1. Class name
 //   2. Embedded object identifier
+//   3. Quoted names of the functions of the API
 constexpr absl::string_view kEmbedClassTemplate = R"(
 // Sandbox with embedded sandboxee and default policy
 class %1$s : public ::sapi::Sandbox {
  public:
   %1$s() : ::sapi::Sandbox(%2$s_embed_create()) {}
+
+ private:
+  std::vector<std::string> GetFunctionNames() const override {
+    return {%3$s};
+  }
 };
 
 )";
@@ -197,6 +224,32 @@ std::string PrintFunctionPrototype(const clang::FunctionDecl* decl) {
   return out;
 }
 
+// Maps a type to one that is passed the same way and can be spelled without
+// the headers of the library: pointers become void*, enums their underlying
+// type. Returns an empty string for types that cannot be passed directly.
+std::string MapQualTypeDirectCall(const clang::ASTContext& context,
+                                  clang::QualType qual) {
+  qual = qual.getCanonicalType().getUnqualifiedType();
+  if (qual->isPointerType() || qual->isArrayType()) {
+    return "void*";
+  }
+  if (const auto* enum_type = qual->getAs<clang::EnumType>()) {
+    qual = enum_type->getDecl()->getIntegerType();
+    if (qual.isNull()) {
+      return "";  // Incomplete enum
+    }
+    qual = qual.getCanonicalType();
+  }
+  if (!qual->isVoidType() && !qual->isIntegerType() &&
+      !qual->isRealFloatingType()) {
+    return "";
+  }
+  // Spell bool the C++ way, even when generating for C sources
+  clang::PrintingPolicy policy(context.getLangOpts());
+  policy.Bool = true;
+  return qual.getAsString(policy);
+}
+
 absl::StatusOr<std::string> EmitFunction(const clang::FunctionDecl* decl) {
   std::string out;
   absl::StrAppend(&out, "\n// ", PrintFunctionPrototype(decl), "\n");
@@ -322,7 +375,12 @@ absl::StatusOr<std::string> EmitHeader(
     // TODO(cblichmann): Make the "Sandbox" suffix configurable.
     absl::StrAppendFormat(
         &out, kEmbedClassTemplate, absl::StrCat(options.name, "Sandbox"),
-        absl::StrReplaceAll(options.embed_name, {{"-", "_"}}));
+        absl::StrReplaceAll(options.embed_name, {{"-", "_"}}),
+        absl::StrJoin(functions, ", ",
+                      [](std::string* out, const clang::FunctionDecl* decl) {
+                        absl::StrAppend(out, "\"", decl->getNameAsString(),
+                                        "\"");
+                      }));
   }
 
   // Emit the actual Sandboxed API
@@ -344,4 +402,41 @@ absl::StatusOr<std::string> EmitHeader(
   return out;
 }
 
+std::string EmitDispatchTable(
+    const std::vector<clang::FunctionDecl*>& functions) {
+  std::string out(kDispatchProlog);
+  std::string out_calls;
+  for (const clang::FunctionDecl* decl : functions) {
+    if (decl->isVariadic()) {
+      continue;
+    }
+    const clang::ASTContext& context = decl->getASTContext();
+    std::string signature =
+        MapQualTypeDirectCall(context, decl->getDeclaredReturnType());
+    if (signature.empty()) {
+      continue;
+    }
+    absl::StrAppend(&signature, "(");
+    bool supported = true;
+    for (int i = 0; i < decl->getNumParams(); ++i) {
+      const std::string param = MapQualTypeDirectCall(
+          context, decl->getParamDecl(i)->getType());
+      if (param.empty()) {
+        supported = false;
+        break;
+      }
+      absl::StrAppend(&signature, i > 0 ? ", " : "", param);
+    }
+    if (!supported) {
+      continue;
+    }
+    absl::StrAppend(&out_calls, "::sapi::MakeDirectCall<", signature, ")>(\"",
+                    decl->getNameAsString(), "\"),\n");
+  }
+  if (!out_calls.empty()) {
+    absl::StrAppendFormat(&out, kDispatchTableTemplate, out_calls);
+  }
+  return out;
+}
+
 }  // namespace sapi
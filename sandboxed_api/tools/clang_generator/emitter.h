@@ -16,6 +16,7 @@
 #define SANDBOXED_API_TOOLS_CLANG_GENERATOR_EMITTER_H_
 
 #include <string>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -40,6 +41,12 @@ absl::StatusOr<std::string> EmitHeader(
     std::vector<clang::FunctionDecl*> functions, const QualTypeSet& types,
     const GeneratorOptions& options);
 
+// Outputs a source file with the direct-call dispatch table of the sandboxee
+// for a list of functions. Functions which cannot be called directly are left
+// out, the sandboxee calls them through libffi.
+std::string EmitDispatchTable(
+    const std::vector<clang::FunctionDecl*>& functions);
+
 }  // namespace sapi
 
 #endif  // SANDBOXED_API_TOOLS_CLANG_GENERATOR_EMITTER_H_
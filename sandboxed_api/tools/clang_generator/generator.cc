@@ -43,6 +43,16 @@ std::string GetOutputFilename(absl::string_view source_file) {
   return ReplaceFileExtension(source_file, ".sapi.h");
 }
 
+absl::Status WriteFile(const std::string& filename,
+                       const std::string& contents) {
+  std::ofstream os(filename, std::ios::out | std::ios::trunc);
+  os << contents;
+  if (!os) {
+    return absl::UnknownError("I/O error");
+  }
+  return absl::OkStatus();
+}
+
 inline absl::string_view ToStringView(llvm::StringRef ref) {
   return absl::string_view(ref.data(), ref.size());
 }
@@ -100,12 +110,18 @@ absl::Status GeneratorASTConsumer::GenerateAndSaveHeader() {
   SAPI_ASSIGN_OR_RETURN(const std::string formatted_header,
                    internal::ReformatGoogleStyle(in_file_, header));
 
-  std::ofstream os(out_file, std::ios::out | std::ios::trunc);
-  os << formatted_header;
-  if (!os) {
-    return absl::UnknownError("I/O error");
+  SAPI_RETURN_IF_ERROR(WriteFile(out_file, formatted_header));
+
+  if (options_->dispatch_out_file.empty()) {
+    return absl::OkStatus();
   }
-  return absl::OkStatus();
+  SAPI_ASSIGN_OR_RETURN(
+      const std::string formatted_dispatch,
+      internal::ReformatGoogleStyle(in_file_,
+                                    EmitDispatchTable(visitor_.functions_)));
+  return WriteFile(sandbox2::file_util::fileops::MakeAbsolute(
+                       options_->dispatch_out_file, options_->work_dir),
+                   formatted_dispatch);
 }
 
 void GeneratorASTConsumer::HandleTranslationUnit(clang::ASTContext& context) {
@@ -44,11 +44,12 @@ struct GeneratorOptions {
 
   // Output options
   std::string work_dir;
-  std::string name;            // Name of the Sandboxed API
-  std::string namespace_name;  // Namespace to wrap the SAPI in
-  std::string out_file;        // Output path of the generated header
-  std::string embed_dir;       // Directory with embedded includes
-  std::string embed_name;      // Identifier of the embed object
+  std::string name;               // Name of the Sandboxed API
+  std::string namespace_name;     // Namespace to wrap the SAPI in
+  std::string out_file;           // Output path of the generated header
+  std::string dispatch_out_file;  // Output path of the dispatch table, if any
+  std::string embed_dir;          // Directory with embedded includes
+  std::string embed_name;         // Identifier of the embed object
 };
 
 class GeneratorASTVisitor
@@ -36,6 +36,11 @@ static auto* g_extra_help = new llvm::cl::extrahelp(
     "Report bugs to <https://github.com/google/sandboxed-api/issues>\n");
 
 // Command line options
+static auto* g_sapi_dispatch_out = new llvm::cl::opt<std::string>(
+    "sapi_dispatch_out",
+    llvm::cl::desc("Output path of the direct-call dispatch table of the "
+                   "sandboxee. If empty, no table is generated."),
+    llvm::cl::cat(*g_tool_category));
 static auto* g_sapi_embed_dir = new llvm::cl::opt<std::string>(
     "sapi_embed_dir", llvm::cl::desc("Directory with embedded includes"),
     llvm::cl::cat(*g_tool_category));
@@ -83,6 +88,7 @@ GeneratorOptions GeneratorOptionsFromFlags() {
   options.name = *g_sapi_name;
   options.namespace_name = *g_sapi_ns;
   options.out_file = *g_sapi_out;
+  options.dispatch_out_file = *g_sapi_dispatch_out;
   options.embed_dir = *g_sapi_embed_dir;
   options.embed_name = *g_sapi_embed_name;
   return options;
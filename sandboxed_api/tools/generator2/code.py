@@ -102,6 +102,27 @@ TYPE_MAPPING = {
     cindex.TypeKind.BOOL: '::sapi::v::Bool',
 }
 
+# C++ spelling of the types in TYPE_MAPPING, for the direct-call dispatch table.
+DIRECT_CALL_TYPE_MAPPING = {
+    cindex.TypeKind.VOID: 'void',
+    cindex.TypeKind.CHAR_S: 'char',
+    cindex.TypeKind.CHAR_U: 'char',
+    cindex.TypeKind.INT: 'int',
+    cindex.TypeKind.UINT: 'unsigned int',
+    cindex.TypeKind.LONG: 'long',
+    cindex.TypeKind.ULONG: 'unsigned long',
+    cindex.TypeKind.UCHAR: 'unsigned char',
+    cindex.TypeKind.USHORT: 'unsigned short',
+    cindex.TypeKind.SHORT: 'short',
+    cindex.TypeKind.LONGLONG: 'long long',
+    cindex.TypeKind.ULONGLONG: 'unsigned long long',
+    cindex.TypeKind.FLOAT: 'float',
+    cindex.TypeKind.DOUBLE: 'double',
+    cindex.TypeKind.LONGDOUBLE: 'long double',
+    cindex.TypeKind.SCHAR: 'signed char',
+    cindex.TypeKind.BOOL: 'bool',
+}
+
 
 class Type(object):
   """Class representing a type.
@@ -457,6 +478,30 @@ class ArgumentType(Type):
 
     return TYPE_MAPPING[type_.kind]
 
+  @property
+  def direct_call_type(self):
+    # type: () -> Optional[Text]
+    """Maps the type to one that is passed the same way, for direct calls.
+
+    The dispatch table is compiled without the headers of the library, so
+    pointers are spelled as void* and enums as their underlying type. The type
+    is built from its kind, qualifiers are dropped as they do not change how
+    the value is passed.
+
+    Returns:
+      type spelling, or None if the type cannot be passed directly, eg. a
+      structure passed by value
+    """
+    type_ = self._clang_type.get_canonical()
+    if type_.kind in [
+        cindex.TypeKind.POINTER, cindex.TypeKind.CONSTANTARRAY,
+        cindex.TypeKind.INCOMPLETEARRAY
+    ]:
+      return 'void*'
+    if type_.kind == cindex.TypeKind.ENUM:
+      type_ = type_.get_declaration().enum_type.get_canonical()
+    return DIRECT_CALL_TYPE_MAPPING.get(type_.kind)
+
 
 class ReturnType(ArgumentType):
   """Class representing function return type.
@@ -540,6 +585,20 @@ class Function(object):
 
     return result
 
+  def direct_call_signature(self):
+    # type: () -> Optional[Text]
+    """Returns the function type used in the direct-call dispatch table.
+
+    Returns:
+      function type, or None if the function cannot be called directly
+    """
+    if self.cursor.type.is_function_variadic():
+      return None
+    types = [a.direct_call_type for a in self.argument_types]
+    if self.result.direct_call_type is None or None in types:
+      return None
+    return '{}({})'.format(self.result.direct_call_type, ', '.join(types))
+
   def is_mangled(self):
     # type: () -> bool
     return self.name != self.mangled_name
@@ -691,6 +750,12 @@ class Generator(object):
   EMBED_CLASS = ('class {0}Sandbox : public ::sapi::Sandbox {{\n'
                  ' public:\n'
                  '  {0}Sandbox() : ::sapi::Sandbox({1}_embed_create()) {{}}\n'
+                 '\n'
+                 ' private:\n'
+                 '  std::vector<std::string> GetFunctionNames() const'
+                 ' override {{\n'
+                 '    return {{{2}}};\n'
+                 '  }}\n'
                  '}};')
 
   def __init__(self, translation_units):
@@ -747,6 +812,46 @@ class Generator(object):
     }
     return self.format_template(**api)
 
+  def generate_dispatch(self, function_names):
+    # type: (List[Text]) -> Text
+    """Generates the direct-call dispatch table of the sandboxee.
+
+    Functions which cannot be called directly are left out, the sandboxee
+    calls them through libffi.
+
+    Args:
+      function_names: list of function names to export to the interface
+
+    Returns:
+      generated source file, to be linked into the sandboxed binary
+    """
+    result = [Generator.AUTO_GENERATED]
+    result.append('#include "sandboxed_api/direct_call.h"')
+
+    calls = []
+    for f in self._get_functions(function_names):
+      signature = f.direct_call_signature()
+      if signature:
+        calls.append('    ::sapi::MakeDirectCall<{}>("{}"),'.format(
+            signature, f.name))
+
+    if calls:
+      result.append('')
+      result.append('namespace {')
+      result.append('')
+      result.append('const ::sapi::DirectCall kDirectCalls[] = {')
+      result += calls
+      result.append('};')
+      result.append('')
+      result.append('const ::sapi::DirectCallRegistration '
+                    'kDirectCallRegistration(kDirectCalls);')
+      result.append('')
+      result.append('}  // namespace')
+
+    result.append('')
+
+    return '\n'.join(result)
+
   def _get_functions(self, func_names=None):
     # type: (Optional[List[Text]]) -> List[Function]
     """Gets Function objects that will be used to generate interface."""
@@ -930,7 +1035,9 @@ class Generator(object):
 
     if (embed_dir is not None) and (embed_name is not None):
       result.append(
-          Generator.EMBED_CLASS.format(name, embed_name.replace('-', '_')))
+          Generator.EMBED_CLASS.format(
+              name, embed_name.replace('-', '_'),
+              ', '.join('"{}"'.format(f.name) for f in functions)))
 
     result.append('class {}Api {{'.format(name))
     result.append(' public:')
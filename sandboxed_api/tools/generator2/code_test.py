@@ -130,6 +130,36 @@ class CodeAnalysisTest(parameterized.TestCase):
     result = generator.generate('Test', functions, 'sapi::Tests', None, None)
     self.assertMultiLineEqual(code_test_util.CODE_GOLD, result)
 
+  def testDispatchTableOutput(self):
+    body = """
+      extern "C" {
+        typedef unsigned int uint;
+        enum e : long { A };
+        struct s { int a; };
+
+        int function_a(int x, int y) { return x + y; }
+        void* function_b(char* a, const uint* b, enum e c, double d);
+        void function_c();
+        int function_d(struct s* a, ...);
+        int function_e(struct s a);
+      }
+    """
+    generator = code.Generator([analyze_string(body)])
+    result = generator.generate_dispatch([])
+    self.assertMultiLineEqual(code_test_util.DISPATCH_GOLD, result)
+
+  def testDispatchTableTypes(self):
+    body = """
+      typedef int constraint_t;
+      typedef const unsigned char* const_buffer_t;
+      _Bool function_f(constraint_t a, const_buffer_t b, const long c);
+    """
+    generator = code.Generator([analyze_string(body, path='tmp.c')])
+    result = generator.generate_dispatch([])
+    self.assertIn(
+        '::sapi::MakeDirectCall<bool(int, void*, long)>("function_f")',
+        result)
+
   def testElaboratedArgument(self):
     body = """
       struct x { int a; };
@@ -188,3 +188,21 @@ class TestApi {
 }  // namespace Tests
 }  // namespace sapi
 """
+
+DISPATCH_GOLD = """// AUTO-GENERATED by the Sandboxed API generator.
+// Edits will be discarded when regenerating this file.
+
+#include "sandboxed_api/direct_call.h"
+
+namespace {
+
+const ::sapi::DirectCall kDirectCalls[] = {
+    ::sapi::MakeDirectCall<int(int, int)>("function_a"),
+    ::sapi::MakeDirectCall<void*(void*, void*, long, double)>("function_b"),
+    ::sapi::MakeDirectCall<void()>("function_c"),
+};
+
+const ::sapi::DirectCallRegistration kDirectCallRegistration(kDirectCalls);
+
+}  // namespace
+"""
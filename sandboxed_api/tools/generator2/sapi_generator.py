@@ -27,6 +27,8 @@ FLAGS = flags.FLAGS
 
 flags.DEFINE_string('sapi_name', None, 'library name')
 flags.DEFINE_string('sapi_out', '', 'output header file')
+flags.DEFINE_string('sapi_dispatch_out', '',
+                    'output source file with the direct-call dispatch table')
 flags.DEFINE_string('sapi_ns', '', 'namespace')
 flags.DEFINE_string('sapi_isystem', '', 'system includes')
 flags.DEFINE_list('sapi_functions', [], 'function list to analyze')
@@ -67,6 +69,10 @@ def main(c_flags):
   else:
     sys.stdout.write(result)
 
+  if FLAGS.sapi_dispatch_out:
+    with open(FLAGS.sapi_dispatch_out, 'w') as out_file:
+      out_file.write(generator.generate_dispatch(FLAGS.sapi_functions))
+
 
 if __name__ == '__main__':
   flags.mark_flags_as_required(['sapi_name', 'sapi_in'])
@@ -18,6 +18,10 @@
 
 #include <sys/uio.h>
 
+#include <algorithm>
+#include <climits>
+#include <vector>
+
 #include <glog/logging.h>
 #include "sandboxed_api/sandbox2/comms.h"
 #include "absl/strings/str_cat.h"
@@ -25,6 +29,41 @@
 #include "sandboxed_api/util/status_macros.h"
 
 namespace sapi::v {
+namespace {
+
+// Transfers the given memory regions with as few process_vm_writev() or
+// process_vm_readv() calls as possible. local[i] and remote[i] need to have the
+// same size.
+absl::Status TransferIovecs(pid_t pid, bool to_sandboxee,
+                            const std::vector<iovec>& local,
+                            const std::vector<iovec>& remote) {
+  for (size_t i = 0; i < local.size(); i += IOV_MAX) {
+    const size_t count = std::min<size_t>(IOV_MAX, local.size() - i);
+    size_t expected = 0;
+    for (size_t j = i; j < i + count; ++j) {
+      expected += local[j].iov_len;
+    }
+    ssize_t ret =
+        to_sandboxee
+            ? process_vm_writev(pid, &local[i], count, &remote[i], count, 0)
+            : process_vm_readv(pid, &local[i], count, &remote[i], count, 0);
+    const char* op = to_sandboxee ? "process_vm_writev" : "process_vm_readv";
+    if (ret == -1) {
+      PLOG(WARNING) << op << "(pid: " << pid << " iovecs: " << count
+                    << " size: " << expected << ")";
+      return absl::UnavailableError(absl::StrCat(op, " failed"));
+    }
+    if (ret != expected) {
+      LOG(WARNING) << op << "(pid: " << pid << " iovecs: " << count
+                   << " size: " << expected << ") transferred " << ret
+                   << " bytes";
+      return absl::UnavailableError(absl::StrCat(op, ": partial success"));
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
 
 Var::~Var() {
   if (free_rpc_channel_ && GetRemote()) {
@@ -128,4 +167,56 @@ absl::Status Var::TransferFromSandboxee(RPCChannel* rpc_channel, pid_t pid) {
   return absl::OkStatus();
 }
 
+absl::Status Var::BatchTransferToSandboxee(absl::Span<Var* const> vars,
+                                           RPCChannel* rpc_channel,
+                                           pid_t pid) {
+  std::vector<iovec> local;
+  std::vector<iovec> remote;
+  local.reserve(vars.size());
+  remote.reserve(vars.size());
+  for (Var* var : vars) {
+    if (!var->SupportsBatchTransfer()) {
+      SAPI_RETURN_IF_ERROR(var->TransferToSandboxee(rpc_channel, pid));
+      continue;
+    }
+    VLOG(3) << "BatchTransferToSandboxee for: " << var->ToString()
+            << ", local: " << var->GetLocal()
+            << ", remote: " << var->GetRemote() << ", size: " << var->GetSize();
+    if (var->GetRemote() == nullptr) {
+      LOG(WARNING) << "Object: " << var->GetType()
+                   << " has no remote object set";
+      return absl::FailedPreconditionError(absl::StrCat(
+          "Object: ", var->GetType(), " has no remote object set"));
+    }
+    local.push_back({var->GetLocal(), var->GetSize()});
+    remote.push_back({var->GetRemote(), var->GetSize()});
+  }
+  return TransferIovecs(pid, /*to_sandboxee=*/true, local, remote);
+}
+
+absl::Status Var::BatchTransferFromSandboxee(absl::Span<Var* const> vars,
+                                             RPCChannel* rpc_channel,
+                                             pid_t pid) {
+  std::vector<iovec> local;
+  std::vector<iovec> remote;
+  local.reserve(vars.size());
+  remote.reserve(vars.size());
+  for (Var* var : vars) {
+    if (!var->SupportsBatchTransfer()) {
+      SAPI_RETURN_IF_ERROR(var->TransferFromSandboxee(rpc_channel, pid));
+      continue;
+    }
+    VLOG(3) << "BatchTransferFromSandboxee for: " << var->ToString()
+            << ", local: " << var->GetLocal()
+            << ", remote: " << var->GetRemote() << ", size: " << var->GetSize();
+    if (var->GetLocal() == nullptr) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "Object: ", var->GetType(), " has no local storage set"));
+    }
+    local.push_back({var->GetLocal(), var->GetSize()});
+    remote.push_back({var->GetRemote(), var->GetSize()});
+  }
+  return TransferIovecs(pid, /*to_sandboxee=*/false, local, remote);
+}
+
 }  // namespace sapi::v
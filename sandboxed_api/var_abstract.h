@@ -21,6 +21,7 @@
 
 #include "absl/base/macros.h"
 #include "absl/status/status.h"
+#include "absl/types/span.h"
 #include "sandboxed_api/var_type.h"
 
 namespace sandbox2 {
@@ -46,7 +47,29 @@ class Var {
   virtual void* GetRemote() const { return remote_; }
 
   // Sets the address of the remote storage.
-  virtual void SetRemote(void* remote) { remote_ = remote; }
+  virtual void SetRemote(void* remote) {
+    remote_ = remote;
+    in_sync_pid_ = 0;
+  }
+
+  // Enables or disables tracking of changes to the local data. A variable
+  // tracking changes is only transferred to the sandboxee before a call
+  // (PtrBefore(), PtrBoth()) if it was modified since it was last transferred
+  // in either direction. As writes through GetLocal() and similar accessors
+  // cannot be observed, every modification has to be signalled with
+  // MarkModified(). The sandboxee must not modify variables which are not
+  // transferred back after a call (PtrAfter(), PtrBoth()) either.
+  //
+  // This is useful for large arguments which rarely change, like a dictionary
+  // passed to many calls.
+  void SetTrackChanges(bool track_changes) {
+    track_changes_ = track_changes;
+    in_sync_pid_ = 0;
+  }
+  bool GetTrackChanges() const { return track_changes_; }
+
+  // Marks the local data as modified, see SetTrackChanges().
+  void MarkModified() { in_sync_pid_ = 0; }
 
   // Returns the address of the storage (local side).
   virtual void* GetLocal() const { return local_; }
@@ -95,6 +118,31 @@ class Var {
   virtual absl::Status TransferFromSandboxee(RPCChannel* rpc_channel,
                                              pid_t pid);
 
+  // Returns whether the variable is transferred as a single memory region
+  // (GetLocal(), GetRemote(), GetSize()), so that it can be coalesced with
+  // other variables into a single process_vm_writev()/process_vm_readv() call.
+  // Classes overriding TransferToSandboxee()/TransferFromSandboxee() need to
+  // return false here.
+  virtual bool SupportsBatchTransfer() const { return true; }
+
+  // Returns whether the variable can be placed in the call arena of a sandbox
+  // (see Sandbox::UseCallArena()) by setting its remote address. Classes whose
+  // remote memory may be reallocated by the sandboxee need to return false.
+  virtual bool SupportsCallArena() const { return true; }
+
+  // Transfers several variables, using one process_vm_writev() call for up to
+  // IOV_MAX variables. Variables not supporting batch transfers are
+  // transferred individually.
+  static absl::Status BatchTransferToSandboxee(absl::Span<Var* const> vars,
+                                               RPCChannel* rpc_channel,
+                                               pid_t pid);
+
+  // Transfers several variables, using one process_vm_readv() call for up to
+  // IOV_MAX variables.
+  static absl::Status BatchTransferFromSandboxee(absl::Span<Var* const> vars,
+                                                 RPCChannel* rpc_channel,
+                                                 pid_t pid);
+
  private:
   // Invokes Allocate()/Free()/Transfer*Sandboxee().
   friend class ::sapi::Sandbox;
@@ -107,6 +155,12 @@ class Var {
   // Comms which can be used to free resources allocated in the sandboxer upon
   // this process' end of lifetime.
   RPCChannel* free_rpc_channel_ = nullptr;
+
+  // Whether to skip transfers of unchanged data, see SetTrackChanges().
+  bool track_changes_ = false;
+  // PID of the sandboxee whose copy of the variable is known to match the
+  // local data, 0 if none. Set by the Sandbox after every transfer.
+  pid_t in_sync_pid_ = 0;
 };
 
 }  // namespace sapi::v
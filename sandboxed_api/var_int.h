@@ -92,6 +92,9 @@ class Fd : public Int {
   // Retrieves remote file descriptor, does not own fd.
   absl::Status TransferToSandboxee(RPCChannel* rpc_channel, pid_t pid) override;
 
+  // File descriptors are transferred over the Comms channel.
+  bool SupportsBatchTransfer() const override { return false; }
+
  private:
   int remote_fd_ = -1;
   bool own_local_ = true;
@@ -70,6 +70,9 @@ class LenVal : public Var, public Pointable {
   absl::Status TransferToSandboxee(RPCChannel* rpc_channel, pid_t pid) override;
   absl::Status TransferFromSandboxee(RPCChannel* rpc_channel,
                                      pid_t pid) override;
+  bool SupportsBatchTransfer() const override { return false; }
+  // The sandboxee may reallocate the data.
+  bool SupportsCallArena() const override { return false; }
 
   Array<uint8_t> array_;
   Struct<LenValStruct> struct_;
@@ -19,7 +19,6 @@
 
 #include <cinttypes>
 #include <cstdint>
-#include <vector>
 
 #include "absl/base/macros.h"
 #include "absl/memory/memory.h"
@@ -39,11 +38,11 @@ class Proto : public Pointable, public Var {
 
   ABSL_DEPRECATED("Use Proto<>::FromMessage() instead")
   explicit Proto(const T& proto)
-      : wrapped_var_(SerializeProto(proto).value()) {}
+      : Proto(proto, GetSerializedProtoSize(proto).value()) {}
 
   static absl::StatusOr<Proto<T>> FromMessage(const T& proto) {
-    SAPI_ASSIGN_OR_RETURN(std::vector<uint8_t> len_val, SerializeProto(proto));
-    return Proto(len_val);
+    SAPI_ASSIGN_OR_RETURN(size_t size, GetSerializedProtoSize(proto));
+    return Proto(proto, size);
   }
 
   size_t GetSize() const final { return wrapped_var_.GetSize(); }
@@ -100,8 +99,14 @@ class Proto : public Pointable, public Var {
     return wrapped_var_.TransferFromSandboxee(rpc_channel, pid);
   }
 
+  bool SupportsBatchTransfer() const override { return false; }
+  bool SupportsCallArena() const override { return false; }
+
  private:
-  explicit Proto(std::vector<uint8_t> data) : wrapped_var_(data) {}
+  Proto(const T& proto, size_t size) : wrapped_var_(size) {
+    // Serialize directly into the buffer which is sent to the sandboxee.
+    SerializeProtoToArray(proto, wrapped_var_.GetData());
+  }
 
   // The management of reading/writing the data to the sandboxee is handled by
   // the LenVal class.
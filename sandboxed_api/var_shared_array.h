@@ -0,0 +1,129 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SANDBOXED_API_VAR_SHARED_ARRAY_H_
+#define SANDBOXED_API_VAR_SHARED_ARRAY_H_
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "sandboxed_api/rpcchannel.h"
+#include "sandboxed_api/sandbox2/buffer.h"
+#include "sandboxed_api/var_abstract.h"
+#include "sandboxed_api/var_pointable.h"
+#include "sandboxed_api/var_ptr.h"
+#include "sandboxed_api/util/status_macros.h"
+
+namespace sapi::v {
+
+// Class representing an array whose storage is a memory file mapped into both
+// the host and the sandboxee. Passing it to a function only passes a pointer,
+// its data is never copied: changes on either side are immediately visible on
+// the other one. This pays off for large arrays, small ones are cheaper to
+// copy than to map.
+//
+// The sandboxee maps the array on its first use (or on Sandbox::Allocate()),
+// which the sandbox must allow with Sandbox::UseSharedArrays().
+template <class T>
+class SharedArray : public Var, public Pointable {
+ public:
+  static_assert(std::is_trivially_copyable_v<T>,
+                "SharedArray elements must be trivially copyable");
+
+  // Creates an array with 'nelem' zero-initialized elements.
+  static absl::StatusOr<std::unique_ptr<SharedArray<T>>> Create(size_t nelem) {
+    if (nelem == 0) {
+      return absl::InvalidArgumentError("SharedArray cannot be empty");
+    }
+    SAPI_ASSIGN_OR_RETURN(std::unique_ptr<sandbox2::Buffer> buffer,
+                          sandbox2::Buffer::CreateWithSize(nelem * sizeof(T)));
+    return absl::WrapUnique(new SharedArray<T>(std::move(buffer), nelem));
+  }
+
+  ~SharedArray() override {
+    if (GetFreeRPCChannel() != nullptr && GetRemote() != nullptr) {
+      Free(GetFreeRPCChannel()).IgnoreError();
+    }
+    // Var::~Var() would free() the mapping, even if unmapping it failed.
+    SetRemote(nullptr);
+    SetFreeRPCChannel(nullptr);
+  }
+
+  T& operator[](size_t v) const { return GetData()[v]; }
+  T* GetData() const { return reinterpret_cast<T*>(buffer_->data()); }
+
+  size_t GetNElem() const { return nelem_; }
+  size_t GetSize() const final { return nelem_ * sizeof(T); }
+  Type GetType() const final { return Type::kArray; }
+  std::string GetTypeString() const final { return "SharedArray"; }
+  std::string ToString() const final {
+    return absl::StrCat("SharedArray, elem size: ", sizeof(T),
+                        " B., total size: ", GetSize(),
+                        " B., nelems: ", GetNElem());
+  }
+
+  Ptr* CreatePtr(Pointable::SyncType type) override {
+    return new Ptr(this, type);
+  }
+
+ protected:
+  absl::Status Allocate(RPCChannel* rpc_channel, bool automatic_free) override {
+    void* addr;
+    SAPI_RETURN_IF_ERROR(rpc_channel->MapFd(buffer_->fd(), GetSize(), &addr));
+    SetRemote(addr);
+    if (automatic_free) {
+      SetFreeRPCChannel(rpc_channel);
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status Free(RPCChannel* rpc_channel) override {
+    SAPI_RETURN_IF_ERROR(rpc_channel->Unmap(GetRemote(), GetSize()));
+    SetRemote(nullptr);
+    return absl::OkStatus();
+  }
+
+  // The memory is shared, there is nothing to transfer.
+  absl::Status TransferToSandboxee(RPCChannel* rpc_channel,
+                                   pid_t pid) override {
+    return absl::OkStatus();
+  }
+  absl::Status TransferFromSandboxee(RPCChannel* rpc_channel,
+                                     pid_t pid) override {
+    return absl::OkStatus();
+  }
+
+  bool SupportsBatchTransfer() const override { return false; }
+  bool SupportsCallArena() const override { return false; }
+
+ private:
+  SharedArray(std::unique_ptr<sandbox2::Buffer> buffer, size_t nelem)
+      : buffer_(std::move(buffer)), nelem_(nelem) {
+    SetLocal(buffer_->data());
+  }
+
+  // Host-side mapping of the array, owning the memory file.
+  std::unique_ptr<sandbox2::Buffer> buffer_;
+  // Number of elements.
+  size_t nelem_;
+};
+
+}  // namespace sapi::v
+
+#endif  // SANDBOXED_API_VAR_SHARED_ARRAY_H_
@@ -21,6 +21,7 @@
 #include "sandboxed_api/var_pointable.h"
 #include "sandboxed_api/var_proto.h"
 #include "sandboxed_api/var_ptr.h"
+#include "sandboxed_api/var_shared_array.h"
 #include "sandboxed_api/var_struct.h"
 #include "sandboxed_api/var_void.h"
 